@@ -89,6 +89,65 @@ extern "C" {
  *********************/
 #define PEGCTR                  0            /* Used for counter type definitions */
 #define ROLLERCTR               1
+#define CTR64BIT             0x10            /* To be OR-ed with counter type for 64 bit counters */
+
+#define CTRPLAINMODE            0            /* Used for counter update mode definitions */
+#define CTRATOMICMODE           1
+#define CTRSHARDEDMODE          2
+
+#define CTRRATE1MIN             0            /* Indexes of rate horizons within CtrRate (1, 5 and 15 minutes) */
+#define CTRRATE5MIN             1
+#define CTRRATE15MIN            2
+#define CTRRATEHORIZONS         3
+#define CTRTOPKINTKEY           0            /* Key types of Top-K Counters: 64 bit integers or strings */
+#define CTRTOPKSTRKEY           1
+#define CTRTOPKKEYLEN          32            /* Max length of string keys of Top-K Counters (longer keys are truncated) */
+#define CTRSCALAR               0            /* Used for counter class in bulk updates (see CtrUpdate) */
+#define CTRVECTOR               1
+#define CTRBULKSORT          0x01            /* Bulk update option: group records by counter before applying them */
+#define CTRALARMHIGH         0x00            /* Alarm types: raised above the high watermark, cleared below the low one */
+#define CTRALARMLOW          0x01            /* Raised below the low watermark, cleared above the high one */
+#define CTRALARMRATE         0x02            /* To be OR-ed with the alarm type: the increase per second of a Peg Counter is watched */
+
+#define CTRNOHANDLE             0            /* Never a valid counter handle (see register_scalar_ctr() and register_vector_ctr()) */
+#define CTRHANDLECLASS(h)  (((h) >> 16) & 0x01)        /* Class (CTRSCALAR or CTRVECTOR) of the counter of a handle */
+#define CTRHANDLEID(h)     ((uint16_t)((h) & 0xFFFF))  /* ID of the counter of a handle (e.g. for retrieve_xxx() functions) */
+
+#define CTRHEAPSTORAGE          0            /* Used for counter storage definitions */
+#define CTRSHMSTORAGE           1
+#define CTRFILESTORAGE          2
+
+#define CTRSHMMAGIC     "MIXFCTR"            /* Magic string at the beginning of the counters segment (shared memory or state file) */
+#define CTRSHMVERSION           1            /* Version of the layout of the counters segment */
+#define CTRSHMNAMELEN          40            /* Size of names within the counters segment */
+
+#define CTRCSVDUMP           0x00            /* Used for dump format definitions */
+#define CTRBINDUMP           0x01
+#define CTRCSVTAGGED         0x02
+#define CTRVARINTENC         0x10            /* Binary dump encodings, to be OR-ed with CTRBINDUMP */
+#define CTRDELTAENC          0x20
+
+#define CTRNOSYNC               0            /* Used for dump durability definitions: files are never synced */
+#define CTRSYNCEACHDUMP         1            /* Files are synced after each dump (any other value N: every N dumps) */
+
+#define CTRDIRECTWRITER         0            /* Used for dump writer definitions */
+#define CTRURINGWRITER          1
+#define CTRTHREADWRITER         2
+
+#define CTRDUMPMAGIC    "MIXFDMP"            /* Magic string within the schema block of binary dump files */
+#define CTRDUMPVERSION          1            /* Version of the format of binary dump files */
+#define CTRBLKSCHEMA            1            /* Types of blocks within binary dump files */
+#define CTRBLKROW               2
+#define CTRBLKGAP               3
+#define CTRBLKSPARSE            4
+#define CTRBLKHISTO             5
+#define CTRBLKSUMMARY           6
+#define CTRBLKRATE              7
+#define CTRBLKTOPK              8
+#define CTRBLKDISTINCT          9
+#define CTRSCHEMASECONDS   0x0001            /* Schema flag: row time stamps report seconds */
+#define CTRSPARSEOVFL      0x0001            /* Sparse block flag: the block ends with the value of the overflow cell */
+#define CTRDUMPWIDTH(t)  ((((t) & 0x10) && ((t) != 0xFF)) ? 8 : 4)  /* Bytes of a fixed width value of a counter of type t */
 
 
  /********************
@@ -96,6 +155,7 @@ extern "C" {
  ********************/
 typedef uint8_t         Error;               /* Type for Error Code returned by libmixf API routines (see Error Definitions above) */
 typedef uint8_t         EventCode;           /* Type for Event Codes handled by the libmixf library */
+typedef uint32_t        CtrHandle;           /* Type for handles of counters registered by name (see register_scalar_ctr()) */
 
 typedef struct Dir_Content                   /* Type used for elements of the list of files */
 {                                            /* given back by read_files_input_dir() */
@@ -110,6 +170,83 @@ typedef struct eventlist                     /* Type used for the list of events
     struct eventlist    *next;
 } EventList;
 
+typedef struct ctrupdate                     /* Type used for the records passed to update_ctr_bulk() */
+{
+    uint8_t             ctrClass;            /* CTRSCALAR or CTRVECTOR */
+    uint16_t            ctrId;               /* Scalar or Vector Counter ID */
+    uint16_t            instId;              /* Instance ID (Vector Counters only, ignored for Scalar Counters) */
+    int64_t             delta;               /* Amount to be added (Peg counters, shall not be negative) or signed delta (Roller counters) */
+} CtrUpdate;
+
+typedef struct ctrshmheader                  /* Header of the counters segment, either shared memory or state file (see define_ctr_storage()) */
+{
+    char                magic[8];            /* CTRSHMMAGIC, set once the segment is completely initialized */
+    uint32_t            version;             /* CTRSHMVERSION */
+    uint32_t            headerSize;          /* sizeof(CtrShmHeader) */
+    uint64_t            segmentSize;         /* Size of the whole segment in bytes */
+    uint16_t            numScalarCtr,        /* Number of Scalar Counters */
+                        numVectorCtr;        /* Number of Vector Counters */
+    uint32_t            descOffset;          /* Offset of numScalarCtr + numVectorCtr CtrShmDesc (Scalar Counters first) */
+    uint32_t            checksum;            /* FNV-1a of the fields from version to descOffset and of all CtrShmDesc */
+    uint32_t            baseEpoch,           /* Buffer (0 or 1) of Peg counters base values currently updated */
+                        aggrEpoch;           /* Buffer (0 or 1) of Peg counters aggr values currently updated */
+    uint32_t            reserved;
+    int64_t             baseLastDump,        /* Time of the last base dump slot */
+                        aggrLastDump;        /* Time of the last aggr dump slot */
+} CtrShmHeader;
+
+typedef struct ctrshmdesc                    /* Descriptor of a counter within the counters segment */
+{
+    char                name[CTRSHMNAMELEN];       /* Counter name */
+    char                instName[CTRSHMNAMELEN];   /* Instances name (Vector Counters only) */
+    uint8_t             ctrClass;            /* CTRSCALAR or CTRVECTOR */
+    uint8_t             ctrType;             /* PEGCTR or ROLLERCTR, possibly OR-ed with CTR64BIT (255 if not defined) */
+    uint16_t            numInstances;        /* Number of instances (1 for Scalar Counters) */
+    uint32_t            reserved;
+    uint64_t            baseOffset[2],       /* Offset of the uint64_t base values in each buffer (Roller counters use buffer 0) */
+                        aggrOffset[2];       /* Offset of the uint64_t aggr values in each buffer (Roller counters use buffer 0) */
+} CtrShmDesc;
+
+typedef struct ctrwriterstats                /* Type used for the statistics given back by query_ctr_dump_writer() */
+{
+    uint8_t             writer;              /* Writer in use: CTRDIRECTWRITER, CTRURINGWRITER or CTRTHREADWRITER */
+    uint64_t            inFlightBytes;       /* Bytes of dump files queued to the writer and not written yet */
+    uint64_t            inFlightOps;         /* Operations (writes, syncs, closes) queued to the writer and not completed yet */
+    uint64_t            writtenBytes;        /* Bytes written by the writer since start_counters() */
+    uint64_t            errors;              /* Operations completed with an error (or partial writes) since start_counters() */
+} CtrWriterStats;
+
+typedef struct ctrsummary                    /* Type used for the values given back by retrieve_summary_ctr() */
+{
+    uint64_t            count;               /* Number of values observed in the interval */
+    uint64_t            sum;                 /* Sum of values observed in the interval */
+    uint64_t            min;                 /* Min and max of values observed in the interval (0 if count is 0) */
+    uint64_t            max;
+} CtrSummary;
+
+typedef struct ctrrate                       /* Type used for the rates given back by retrieve_ctr_rate() */
+{
+    double              ewma[CTRRATEHORIZONS];   /* Exponentially weighted moving averages (per second) over 1, 5 and 15 minutes */
+    double              window[CTRRATEHORIZONS]; /* Averages (per second) over the last 1, 5 and 15 minutes (or since start) */
+} CtrRate;
+
+typedef struct ctrinterval                   /* Type used for the intervals given back by query_ctr_history() */
+{
+    time_t              slot;                /* Dump time of the interval, as stamped in dump files */
+    uint64_t            value;               /* Value dumped for the interval (0 if missed) */
+    bool                missed;              /* Set if the dump time has been missed (empty row in dump files) */
+} CtrInterval;
+
+typedef struct ctrtopkey                     /* Type used for the keys given back by retrieve_topk_ctr() */
+{
+    uint64_t            key;                 /* Integer key (CTRTOPKINTKEY), or hash of the string key (CTRTOPKSTRKEY) */
+    char                str[CTRTOPKKEYLEN+1];/* String key (CTRTOPKSTRKEY only, empty otherwise) */
+    uint64_t            count;               /* Estimated count, never below the actual one */
+    uint64_t            error;               /* Max overestimation: the actual count is between count - error and count */
+} CtrTopKey;
+
+typedef void (*CtrAlarmCallback)(uint16_t, bool, uint64_t);  /* Callback of threshold alarms: alarm ID, raised flag and value (see define_ctr_alarm_callback()) */
+
 
 
 
@@ -726,7 +863,8 @@ Error define_vector_ctr_num (uint16_t);
    The first parameter is the Scalar Counter ID and shall be defined
    in the interval (0,M-1), where M is the the maximum number of
    Scalar counters defined through define_scalar_ctr_num(). The second
-   parameter specifies the counter type (PEGCTR or ROLLERCTR).
+   parameter specifies the counter type (PEGCTR or ROLLERCTR), possibly
+   OR-ed with CTR64BIT for a 64 bit counter (default width is 32 bits).
    PEG Counters are counters that are characterized by the following
    properties: they have initial value set to 0, they can only increase
    and they are reset every time that counters are dumped to file
@@ -738,8 +876,10 @@ Error define_vector_ctr_num (uint16_t);
    in case that counter type is PEGCTR).
    The fourth parameter is a string that provides the counter name (up to 32
    characters, otherwise it is truncated).
+   The ID of a counter registered through register_scalar_ctr() cannot be redefined.
    This function provides MIXFKO either in case of wrong parameters (e.g. outside allowed
-   ranges) or in case of counters already started, MIXFOK if everything is ok */
+   ranges or ID of a registered counter) or in case of counters already started, MIXFOK
+   if everything is ok */
 Error define_scalar_ctr (uint16_t, uint8_t, uint32_t, char*);
 
 /* define_vector_ctr()
@@ -751,7 +891,8 @@ Error define_scalar_ctr (uint16_t, uint8_t, uint32_t, char*);
    Vector Counter ID specified by parameter 1. It shall be at least 1.
    The maximum value is limited by the fact that the maximum
    number of instances cannot exceed 65536. The third
-   parameter specifies the counter type (PEGCTR or ROLLERCTR).
+   parameter specifies the counter type (PEGCTR or ROLLERCTR), possibly
+   OR-ed with CTR64BIT for a 64 bit counter (default width is 32 bits).
    PEG Counters are counters that are characterized by the following
    properties: they have initial value set to 0, they can only increase
    and they are reset every time that counters are dumped to file
@@ -773,9 +914,11 @@ Error define_scalar_ctr (uint16_t, uint8_t, uint32_t, char*);
                  define_vector_ctr(12,512,ROLLERCTR,0,"Total Bytes Sent","TCP Conn. ID")
             In this case the initial value for the counter has been set to 0 (for
             all the 512 TCP connections)
+   The ID of a counter registered through register_vector_ctr() cannot be redefined.
    This function provides MIXFKO either in case of wrong parameters(e.g.outside allowed
-   ranges) or in case of counters already started, MIXFOVFL if the number of cumulative
-   instances of Vector Counters up to function call exceeds 65536, MIXFOK if everything is ok  */
+   ranges or ID of a registered counter) or in case of counters already started,
+   MIXFOVFL if the number of cumulative instances of Vector Counters up to function
+   call exceeds 65536, MIXFOK if everything is ok                                 */
 Error define_vector_ctr (uint16_t, uint16_t, uint8_t, uint32_t, char*, char*);
 
 /* set_vector_ctr_inst_name()
@@ -794,6 +937,335 @@ Error define_vector_ctr (uint16_t, uint16_t, uint8_t, uint32_t, char*, char*);
    already started */
 Error set_vector_ctr_inst_name(uint16_t, uint16_t, char*);
 
+/* register_scalar_ctr()
+   ---------------------
+   This function defines a Scalar Counter by name, without an ID chosen by the
+   application: the counter takes the lowest Scalar Counter ID not defined yet and, if
+   all the IDs allowed by define_scalar_ctr_num() are in use, the number of Scalar
+   Counters is increased (up to 1024), so that independent modules (e.g. plugins) never
+   need to coordinate ID allocation. The first parameter is the counter name (up to 32
+   characters, otherwise it is truncated), which identifies the counter among registered
+   Scalar Counters; the second and third parameters are the counter type and its initial
+   value, as in define_scalar_ctr(). The fourth parameter points to the handle given
+   back, to be used with incr_peg_ctr(), add_peg_ctr() and update_roller_ctr(); the
+   counter ID (e.g. for retrieve_xxx() functions) is given by CTRHANDLEID().
+   If the name is already registered with the same type, the same handle is given back
+   (so that modules may share a counter). Handles are valid until counters are redefined
+   through define_scalar_ctr_num() or stop_counters(); the ID of a registered counter
+   cannot be redefined through define_scalar_ctr().
+   This function returns:
+      - MIXFKO:   wrong parameters (e.g. NULL or empty name, invalid type), name already
+                  registered with a different type or counters already started
+      - MIXFOVFL: all the 1024 Scalar Counter IDs are in use
+      - MIXFOK:   the counter has been registered (or found) and its handle given back  */
+Error register_scalar_ctr (char*, uint8_t, uint32_t, CtrHandle*);
+
+/* register_vector_ctr()
+   ---------------------
+   This function defines a Vector Counter by name, without an ID chosen by the
+   application: the counter takes the lowest Vector Counter ID not defined yet and, if
+   all the IDs allowed by define_vector_ctr_num() are in use, the number of Vector
+   Counters is increased (up to 1024). The first parameter is the counter name (up to
+   32 characters, otherwise it is truncated), which identifies the counter among
+   registered Vector Counters; the following ones are the number of instances, the
+   counter type, its initial value and the name of the object associated to instances,
+   as in define_vector_ctr(). The last parameter points to the handle given back, to be
+   used with incr_peg_ctr(), add_peg_ctr() and update_roller_ctr(); the counter ID
+   (e.g. for set_vector_ctr_inst_name() and retrieve_xxx() functions) is given by
+   CTRHANDLEID().
+   If the name is already registered with the same type and number of instances, the
+   same handle is given back. Handles are valid until counters are redefined through
+   define_vector_ctr_num() or stop_counters(); the ID of a registered counter cannot be
+   redefined through define_vector_ctr().
+   This function returns:
+      - MIXFKO:   wrong parameters (e.g. NULL or empty name, invalid type, no instances),
+                  name already registered with a different definition or counters
+                  already started
+      - MIXFOVFL: all the 1024 Vector Counter IDs are in use, or the cumulative number
+                  of instances of Vector Counters would exceed 65536
+      - MIXFOK:   the counter has been registered (or found) and its handle given back  */
+Error register_vector_ctr (char*, uint16_t, uint8_t, uint32_t, char*, CtrHandle*);
+
+/* define_sparse_ctr_num()
+   -----------------------
+   This function is used to define the number of Sparse counters (up to 64).
+   A Sparse counter is a Peg counter whose instances are identified by arbitrary
+   64 bit keys (e.g. IP addresses, user IDs, hashes of URLs) instead of instance IDs
+   defined in advance: keys are added the first time they are updated, and only
+   keys updated since the previous dump are written to files. Sparse counters have
+   their own IDs, independent of Scalar and Vector Counters ones.
+   The function returns MIXFOK in case of success, MIXFKO in any other case
+   In case of success, internal Sparse counter structures are reset
+   and any previous Sparse counter definition is lost
+   Please observe that this function cannot be called after start_counters() */
+Error define_sparse_ctr_num (uint16_t);
+
+/* define_sparse_ctr()
+   -------------------
+   The first parameter is the Sparse Counter ID and shall be defined in the interval
+   (0,S-1), where S is the number of Sparse counters defined through
+   define_sparse_ctr_num(). The second parameter is the maximum number of keys of the
+   counter (at least 1, at most 2^28): once it is reached, updates of new keys are
+   added to a single overflow cell, dumped as key "overflow", so that memory is
+   bounded whatever the keys seen at run time. The third
+   parameter specifies the counter type, that shall be PEGCTR, possibly OR-ed with
+   CTR64BIT for a 64 bit counter (default width is 32 bits). The fourth parameter is
+   the counter name and the fifth one the name of the object identified by keys (up
+   to 32 characters each, otherwise they are truncated).
+   Example: counting requests per client IP address, with at most 100000 distinct
+            addresses:
+                 define_sparse_ctr(0,100000,PEGCTR,"Requests","Client IP")
+   Memory is reserved for about 1.5 to 3 times the maximum number of keys (32 bytes
+   of values and 8 bytes of key each), but pages are only touched as keys are added.
+   Beware that keys are never released: a key is kept until counters are stopped or
+   redefined, even when it is no longer updated. Hence the maximum number of keys
+   bounds the distinct keys seen during the whole run, not per dump interval: with
+   keys that change over time (e.g. short lived connections), all updates end up in
+   the overflow cell once the maximum is reached. Besides, each dump scans the whole
+   hash table under the counters lock, whatever the number of keys updated in the
+   interval: its cost is proportional to the maximum number of keys.
+   This function provides MIXFKO either in case of wrong parameters (e.g. outside
+   allowed ranges, Roller counter), memory that cannot be allocated or counters
+   already started, MIXFOK if everything is ok                                 */
+Error define_sparse_ctr (uint16_t, uint32_t, uint8_t, char*, char*);
+
+/* define_histo_ctr_num()
+   ----------------------
+   This function is used to define the number of Histogram counters (up to 64).
+   A Histogram counter records the distribution of values (e.g. latencies) instead
+   of their sum: each dump reports the number of values recorded in the interval,
+   their sum, minimum, maximum and a set of percentiles (see
+   define_histo_percentiles()). Histogram counters have their own IDs, independent
+   of other counters ones.
+   The function returns MIXFOK in case of success, MIXFKO in any other case
+   In case of success, internal Histogram counter structures are reset
+   and any previous Histogram counter definition is lost
+   Please observe that this function cannot be called after start_counters() */
+Error define_histo_ctr_num (uint16_t);
+
+/* define_histo_ctr()
+   ------------------
+   The first parameter is the Histogram Counter ID and shall be defined in the
+   interval (0,H-1), where H is the number of Histogram counters defined through
+   define_histo_ctr_num(). The second parameter is the number of significant bits
+   of buckets (between 4 and 10): values are counted in log-linear buckets
+   covering the whole 64 bit range, whose width is at most 2^(1-bits) times their
+   values, so that percentiles are reported with a relative error within 2^(1-bits)
+   (e.g. 0.8% with 8 bits). Each bit doubles memory: a Histogram counter takes
+   4 x (66 - bits) x 2^(bits-1) x 8 bytes (about 232 KB with 8 bits), plus half of
+   that in each thread shard in CTRSHARDEDMODE. The third parameter is a string that
+   provides the counter name (up to 32 characters, otherwise it is truncated).
+   Example: latency of requests in microseconds, with a relative error within 0.8%:
+                 define_histo_ctr(0,8,"Request latency (us)")
+   This function provides MIXFKO either in case of wrong parameters (e.g. outside
+   allowed ranges), memory that cannot be allocated or counters already started,
+   MIXFOK if everything is ok                                                   */
+Error define_histo_ctr (uint16_t, uint8_t, char*);
+
+/* define_histo_percentiles()
+   --------------------------
+   This function defines the percentiles reported by dumps of all Histogram counters.
+   The first parameter is the number of percentiles (between 1 and 8), the second one
+   points to their values (greater than 0 and not greater than 100, e.g. 99.9). They
+   are reported in ascending order, in columns named after their values (e.g. p99.9).
+   If this function is not called, p50, p90, p99 and p99.9 are reported.
+   The function returns MIXFOK in case of success, MIXFKO in case of wrong parameters
+   or counters already started. Percentiles are reset by stop_counters()       */
+Error define_histo_percentiles (uint8_t, double*);
+
+/* define_summary_ctr_num()
+   ------------------------
+   This function is used to define the number of Summary counters (up to 256).
+   A Summary counter keeps the number of values observed in the interval (e.g. queue
+   depths or payload sizes), their sum, minimum and maximum, so that peaks between
+   dumps are not lost. Summary counters have their own IDs, independent of other
+   counters ones.
+   The function returns MIXFOK in case of success, MIXFKO in any other case
+   In case of success, internal Summary counter structures are reset
+   and any previous Summary counter definition is lost
+   Please observe that this function cannot be called after start_counters() */
+Error define_summary_ctr_num (uint16_t);
+
+/* define_summary_ctr()
+   --------------------
+   The first parameter is the Summary Counter ID and shall be defined in the
+   interval (0,S-1), where S is the number of Summary counters defined through
+   define_summary_ctr_num(). The second parameter is a string that provides the
+   counter name (up to 32 characters, otherwise it is truncated).
+   Each base dump reports count, sum, min and max of the values observed in the
+   base interval; aggregated values are not updated by observe_summary_ctr(), but
+   each base interval is folded into them when it is dumped, so that aggregated dumps
+   report the base intervals dumped since the previous aggregated dump.
+   This function provides MIXFKO either in case of wrong parameters (e.g. outside
+   allowed ranges) or counters already started, MIXFOK if everything is ok      */
+Error define_summary_ctr (uint16_t, char*);
+
+/* define_rate_ctr_num()
+   ---------------------
+   This function is used to define the number of counter rates (up to 64), i.e.
+   per second rates of selected Peg counters (e.g. requests/s or bytes/s), evaluated
+   by the library once per second and smoothed over 1, 5 and 15 minutes (see
+   define_rate_ctr()). Rates have their own IDs, independent of counters ones.
+   The function returns MIXFOK in case of success, MIXFKO in any other case
+   In case of success, internal rate structures are reset and any previous
+   rate definition is lost
+   Please observe that this function cannot be called after start_counters() */
+Error define_rate_ctr_num (uint16_t);
+
+/* define_rate_ctr()
+   -----------------
+   The first parameter is the rate ID and shall be defined in the interval (0,R-1),
+   where R is the number of rates defined through define_rate_ctr_num(). The second
+   parameter is the class of the counter (CTRSCALAR or CTRVECTOR), the third one its
+   ID and the fourth one the instance (ignored for Scalar Counters); the counter shall
+   be a Peg Counter, already defined. The fifth parameter is the rate name (up to 32
+   characters, otherwise it is truncated).
+   Once per second (by check_and_dump_ctr(), or by the thread of start_counters_async())
+   the increase of the counter is taken, and both exponentially weighted moving averages
+   (as the load average of Unix systems) and averages over sliding windows of 1, 5 and 15
+   minutes are updated. Rates are written at each dump in rates_<timestamp>.csv (or
+   rates_aggr_<timestamp>.csv), six columns for each rate, and can be retrieved through
+   retrieve_ctr_rate().
+   This function provides MIXFKO either in case of wrong parameters (e.g. outside
+   allowed ranges or a counter which is not a Peg Counter), memory that cannot be
+   allocated or counters already started, MIXFOK if everything is ok            */
+Error define_rate_ctr (uint16_t, uint8_t, uint16_t, uint16_t, char*);
+
+/* define_topk_ctr_num()
+   ---------------------
+   This function is used to define the number of Top-K counters (up to 64). A Top-K
+   counter finds the heavy hitters among arbitrary keys (e.g. the top talkers among
+   connections) with a fixed memory footprint: only the K keys with the highest counts
+   in the interval are written to files, with their estimated counts and error bounds.
+   Top-K counters have their own IDs, independent of other counters ones.
+   The function returns MIXFOK in case of success, MIXFKO in any other case
+   In case of success, internal Top-K counter structures are reset
+   and any previous Top-K counter definition is lost
+   Please observe that this function cannot be called after start_counters() */
+Error define_topk_ctr_num (uint16_t);
+
+/* define_topk_ctr()
+   -----------------
+   The first parameter is the Top-K Counter ID and shall be defined in the interval
+   (0,T-1), where T is the number of Top-K counters defined through define_topk_ctr_num().
+   The second parameter is K, i.e. the number of keys dumped (between 1 and 1024), the
+   third one the number of keys monitored by the counter (between K and 2^20). The
+   counter implements the Space-Saving algorithm: when a key that is not monitored is
+   updated and all places are taken, it replaces the key with the lowest count, whose
+   count it inherits as error bound. Hence counts are never underestimated, and the
+   overestimation of each key is at most N/M, where N is the total count of the interval
+   and M the number of monitored keys: the more keys are monitored, the more accurate
+   counts are. The fourth parameter is the type of keys, CTRTOPKINTKEY (64 bit integers)
+   or CTRTOPKSTRKEY (strings, up to 32 characters, identified by a 64 bit hash). The
+   fifth parameter is the counter name and the sixth one the name of the object
+   identified by keys (up to 32 characters each, otherwise they are truncated).
+   Example: top 10 client addresses by bytes, monitoring 1000 addresses:
+                 define_topk_ctr(0,10,1000,CTRTOPKINTKEY,"Bytes","Client IP")
+   Memory takes about 200 bytes for each monitored key (330 with string keys), allocated
+   by this function and never grown.
+   This function provides MIXFKO either in case of wrong parameters (e.g. outside
+   allowed ranges), memory that cannot be allocated or counters already started,
+   MIXFOK if everything is ok                                                 */
+Error define_topk_ctr (uint16_t, uint16_t, uint32_t, uint8_t, char*, char*);
+
+/* define_distinct_ctr_num()
+   -------------------------
+   This function is used to define the number of Distinct counters (up to 64). A
+   Distinct counter estimates the number of distinct keys (e.g. client or destination
+   addresses) updated in the interval, with a fixed memory footprint and a relative
+   standard error that does not depend on the number of keys (see define_distinct_ctr()).
+   Distinct counters have their own IDs, independent of other counters ones.
+   The function returns MIXFOK in case of success, MIXFKO in any other case
+   In case of success, internal Distinct counter structures are reset
+   and any previous Distinct counter definition is lost
+   Please observe that this function cannot be called after start_counters() */
+Error define_distinct_ctr_num (uint16_t);
+
+/* define_distinct_ctr()
+   ---------------------
+   The first parameter is the Distinct Counter ID and shall be defined in the interval
+   (0,D-1), where D is the number of Distinct counters defined through
+   define_distinct_ctr_num(). The second parameter is the precision p of the counter
+   (between 4 and 16), the third one the counter name (up to 32 characters, otherwise it
+   is truncated). The counter implements HyperLogLog: each key is hashed, the first p
+   bits of the hash select one of 2^p registers, which keeps the highest position of
+   the first bit set in the remaining bits. Hence updates take a hash and a max, and
+   registers of different intervals (or threads) are merged through the max of each
+   register. The relative standard error of the estimate is about 1.04/sqrt(2^p), e.g.
+   1.6% with p = 12 and 0.8% with p = 14; small cardinalities are estimated through the
+   number of empty registers (linear counting), so that they are nearly exact.
+   Example: distinct client addresses, with a 0.8% standard error:
+                 define_distinct_ctr(0,14,"Clients")
+   Memory takes 2^p bytes for each of the four register arrays (base and aggr, two
+   each), allocated by this function, plus 2^p bytes in each thread shard in
+   CTRSHARDEDMODE (see define_ctr_update_mode()). Base intervals are merged into aggr
+   registers when dumped, so that aggr dumps report the distinct keys of the base
+   intervals dumped since the previous aggregated dump. Estimates of all Distinct
+   Counters are written at each dump as columns of distinct_<timestamp>.csv (or
+   distinct_aggr_<timestamp>.csv).
+   This function provides MIXFKO either in case of wrong parameters (e.g. outside
+   allowed ranges), memory that cannot be allocated or counters already started,
+   MIXFOK if everything is ok                                                 */
+Error define_distinct_ctr (uint16_t, uint8_t, char*);
+
+/* define_ctr_alarm_num()
+   ----------------------
+   This function is used to define the number of threshold alarms (up to 4096), i.e.
+   high/low watermarks on Scalar Counters or Vector Counter instances evaluated by the
+   library once per second (see define_ctr_alarm()). Alarms have their own IDs,
+   independent of counters ones.
+   The function returns MIXFOK in case of success, MIXFKO in any other case
+   In case of success, internal alarm structures are reset and any previous
+   alarm definition is lost
+   Please observe that this function cannot be called after start_counters() */
+Error define_ctr_alarm_num (uint16_t);
+
+/* define_ctr_alarm()
+   ------------------
+   The first parameter is the alarm ID and shall be defined in the interval (0,A-1),
+   where A is the number of alarms defined through define_ctr_alarm_num(). The second
+   parameter is the class of the counter (CTRSCALAR or CTRVECTOR), the third one its
+   ID and the fourth one the instance (ignored for Scalar Counters); the counter shall
+   be already defined. The fifth parameter is the alarm type: CTRALARMHIGH raises the
+   alarm when the watched value reaches the high watermark (sixth parameter) and clears
+   it when the value falls below the low watermark (seventh parameter), CTRALARMLOW
+   raises it when the value reaches the low watermark and clears it when the value
+   exceeds the high one. The low watermark shall not be higher than the high one: the
+   distance between them is the hysteresis, which avoids a flood of alarms when the
+   value oscillates around a threshold. The watched value is the current base value of
+   the counter (e.g. the depth of a queue kept by a Roller Counter), or, if CTRALARMRATE
+   is OR-ed with the type, the increase per second of a Peg Counter since the previous
+   evaluation (e.g. errors/s).
+   The eighth and ninth parameters are the events registered when the alarm is raised
+   and cleared (see define_event() and register_event(); UNDEFINED for none), with the
+   alarm name, the value and the crossed watermark as "%1", "%2" and "%3" parameters.
+   The last parameter is the alarm name (up to 32 characters, otherwise it is truncated).
+   Alarms are evaluated once per second by check_and_dump_ctr() (or by the thread of
+   start_counters_async()), never by update functions: evaluating thousands of alarms
+   takes tens of microseconds. The callback defined through define_ctr_alarm_callback()
+   is invoked as well at each transition.
+   This function provides MIXFKO either in case of wrong parameters (e.g. outside
+   allowed ranges, a low watermark higher than the high one, CTRALARMRATE with a
+   counter which is not a Peg Counter or an event code outside the allowed range) or
+   counters already started, MIXFOK if everything is ok                          */
+Error define_ctr_alarm (uint16_t, uint8_t, uint16_t, uint16_t, uint8_t, uint64_t, uint64_t, EventCode, EventCode, char*);
+
+/* define_ctr_alarm_callback()
+   ---------------------------
+   This function sets the function invoked at each transition of a threshold alarm
+   (see define_ctr_alarm()), with the alarm ID, true if the alarm has been raised
+   (false if cleared) and the value that crossed the watermark (NULL for no callback).
+   The callback is invoked by the thread evaluating alarms (the one calling
+   check_and_dump_ctr(), or the thread of start_counters_async()) after the lock of
+   base counters has been released, so it never blocks other threads; however that
+   thread performs dumps after the callback returns, so it shall return quickly.
+   Update, retrieve and query functions can be invoked, as well as check_and_dump_ctr()
+   (alarms are then not evaluated again), while stop_counters() and the define_xxx()
+   functions shall NOT be invoked by the callback (stop_counters() would deadlock).
+   Please observe that this function cannot be called after start_counters()
+   The function returns MIXFOK in case of success, MIXFKO in any other case    */
+Error define_ctr_alarm_callback (CtrAlarmCallback);
+
 /* define_base_dump()
    ------------------
    This function provides information needed to store counters (both scalar and vector
@@ -805,6 +1277,14 @@ Error set_vector_ctr_inst_name(uint16_t, uint16_t, char*);
       vector_<vector ID>_<timestamp>.csv -> dump of Vector Counter having ID <vector ID>
                                             in CSV format (there is a separate file for
                                             each <vector ID>)
+      sparse_<sparse ID>_<timestamp>.csv -> dump of Sparse Counter having ID <sparse ID>
+                                            (a row for each key updated in the interval)
+      histo_<histo ID>_<timestamp>.csv   -> dump of Histogram Counter having ID <histo ID>
+      summary_<summary ID>_<timestamp>.csv -> dump of Summary Counter having ID <summary ID>
+      rates_<timestamp>.csv              -> rates of counters (see define_rate_ctr())
+      topk_<topk ID>_<timestamp>.csv     -> dump of Top-K Counter having ID <topk ID>
+                                            (a row for each of the top K keys)
+      distinct_<timestamp>.csv           -> estimates of Distinct Counters (a column each)
    The second parameter is a string formatted according to strftime() man page (e.g.
    "%F" for date in the format YYYY-MM-DD, etc.). It specifies the format of the <timestamp>
    above. If NULL or empty, the time stamp will be formatted as ddmmyyyy.
@@ -812,6 +1292,11 @@ Error set_vector_ctr_inst_name(uint16_t, uint16_t, char*);
    desired dump times ("mm" format, with mm between 00 and 60). For example, in order to
    dump counters every 5 minutes, this string will be formatted as follows:
       "00,05,10,15,20,25,30,35,40,45,50,55"
+   Alternatively, the third string can specify a periodic schedule in seconds, in the
+   form "every Ns" with N between 1 and 3600 (e.g. "every 5s"). In that case counters
+   are dumped at every multiple of N seconds and the time stamp of each row also
+   reports seconds (hh:mm:ss). Values dumped in the last intervals can also be kept in
+   memory (see define_ctr_history())
    This function returns:
       - MIXFKO: if either the first parameter is not a valid file name or
              the second or third parameters are wrongly formatted or
@@ -833,6 +1318,12 @@ Error define_base_dump(char*, char*, char*);
       vector_<vector ID>_aggr_<timestamp>.csv -> dump of Vector Counter having ID <vector ID>
                                                  in CSV format (there is a separate file for
                                                  each <vector ID>)
+      sparse_<sparse ID>_aggr_<timestamp>.csv -> dump of Sparse Counter having ID <sparse ID>
+      histo_<histo ID>_aggr_<timestamp>.csv   -> dump of Histogram Counter having ID <histo ID>
+      summary_<summary ID>_aggr_<timestamp>.csv -> dump of Summary Counter having ID <summary ID>
+      rates_aggr_<timestamp>.csv         -> rates of counters (see define_rate_ctr())
+      topk_<topk ID>_aggr_<timestamp>.csv     -> dump of Top-K Counter having ID <topk ID>
+      distinct_aggr_<timestamp>.csv      -> estimates of Distinct Counters (a column each)
    The second parameter is a string formatted according to strftime() man page (e.g.
    "%F" for date in the format YYYY-MM-DD, etc.). It specifies the format of the <timestamp>
    above. If NULL or empty, the time stamp will be formatted as ddmmyyyy.
@@ -854,16 +1345,200 @@ Error define_base_dump(char*, char*, char*);
    Remember also that aggregated PEG counters are set to zero at every aggregation interval  */
 Error define_aggr_dump(char*, char*, char*);
 
+/* define_ctr_update_mode()
+   ------------------------
+   This function defines how counters are updated by incr_peg_xxx_ctr() and
+   update_roller_xxx_ctr() functions. The only parameter can be:
+      CTRPLAINMODE:  counters are updated through plain (non atomic) operations.
+                     This is the default mode and is the fastest one, but it is
+                     suitable only when counters are updated by a single thread
+      CTRATOMICMODE: counters are updated through relaxed atomic operations (Peg
+                     counters through atomic add, Roller counters through a
+                     compare-and-swap loop that applies saturation), so that they
+                     can be safely updated by several concurrent threads. At dump
+                     time, each Peg counter is read and reset through a single
+                     atomic exchange, so that no increment is lost
+      CTRSHARDEDMODE: each thread updating counters gets its own private, cache line
+                     aligned block of cells, lazily allocated at its first update,
+                     so that increments never require atomic operations nor
+                     contend on shared cache lines. Thread blocks are folded into
+                     the shared counters by check_and_dump_ctr() and by retrieve
+                     functions. The block of a thread is folded and released
+                     when the thread exits (remaining ones by stop_counters()),
+                     so that short-lived threads do not accumulate blocks. In
+                     this mode incr_peg_xxx_ctr() and update_roller_xxx_ctr() do
+                     not return MIXFOVFL (wrap and saturation are applied when
+                     thread blocks are folded)
+   The mode is applied when counters are started, therefore this function shall be
+   called before start_counters(). It is reset to CTRPLAINMODE by stop_counters().
+   This function returns:
+      - MIXFKO: if the mode is not valid or counters collection has been already
+                started through start_counters()
+      - MIXFOK: if everything is correct                                        */
+Error define_ctr_update_mode (uint8_t);
+
+/* define_ctr_storage()
+   --------------------
+   This function defines where counters values are stored. Parameters are:
+      storage:  either CTRHEAPSTORAGE, CTRSHMSTORAGE or CTRFILESTORAGE
+                CTRHEAPSTORAGE: values are stored in the private memory of the
+                                process (this is the default)
+                CTRSHMSTORAGE:  values are stored in a POSIX shared memory
+                                segment, created by start_counters() and removed
+                                by stop_counters(), so that external processes can
+                                map it read-only and read live counters without
+                                any copy (see CtrShmHeader and CtrShmDesc)
+                CTRFILESTORAGE: values are stored in a state file mapped in
+                                memory, with the same layout, which survives
+                                crashes and restarts: if counters are defined in
+                                the same way, start_counters() resumes all values
+                                from it, otherwise it is reinitialized
+      name:     CTRSHMSTORAGE: name of the shared memory segment, as required by
+                               shm_open() (i.e. starting with '/' and without other '/')
+                CTRFILESTORAGE: name of the state file (without any '/'), created
+                               within the base dump directory
+                ignored for CTRHEAPSTORAGE
+   The storage is applied when counters are started, therefore this function shall be
+   called before start_counters(). It is reset to CTRHEAPSTORAGE by stop_counters().
+   This function returns:
+      - MIXFKO: if storage or name are not valid or counters collection has been
+                already started through start_counters()
+      - MIXFOK: if everything is correct                                        */
+Error define_ctr_storage (uint8_t, char*);
+
+/* define_ctr_dump_format()
+   ------------------------
+   This function defines the format of base and aggregated dump files. The only
+   parameter can be:
+      CTRCSVDUMP:  one CSV file for Scalar Counters and one for each Vector Counter,
+                   with a text row per dump slot (this is the default)
+      CTRCSVTAGGED: a single CSV file for all counters (counters_<stamp>.csv or
+                   counters_aggr_<stamp>.csv), in which each row is tagged (third
+                   column) with "scalar", "vector_<ctrId>", "sparse_<ctrId>",
+                   "histo_<ctrId>", "summary_<ctrId>", "rates", "topk_<ctrId>" or "distinct", so that the number of
+                   files and the time to open and rotate them do not depend on the
+                   number of Vector Counters
+      CTRBINDUMP:  a single binary file for all counters (counters_<stamp>.bin or
+                   counters_aggr_<stamp>.bin), made of little-endian blocks: a schema
+                   block describing all counters, written whenever the file is opened,
+                   then a row block per dump slot (a gap block for missed slots),
+                   followed by sparse blocks holding keys of Sparse Counters, by a
+                   histogram block holding statistics of Histogram Counters, by a
+                   summary block holding values of Summary Counters, by a rate
+                   block holding rates (IEEE 754 doubles, never encoded), by top-K
+                   blocks holding top keys of Top-K Counters and by a distinct block
+                   holding estimates of Distinct Counters. By
+                   default values are fixed width (4 bytes, 8 bytes for CTR64BIT
+                   counters); one of the following encodings can be OR-ed:
+                   CTRVARINTENC: values are stored as LEB128 varints
+                   CTRDELTAENC:  values are stored as zig-zag LEB128 varints of the
+                                 difference from the previous row of the same file
+   Binary files can be converted back to the CSV files through the mixf-ctrdump tool.
+   The format is applied when counters are started, therefore this function shall be
+   called before start_counters(). It is reset to CTRCSVDUMP by stop_counters().
+   This function returns:
+      - MIXFKO: if the format is not valid or counters collection has been already
+                started through start_counters()
+      - MIXFOK: if everything is correct                                        */
+Error define_ctr_dump_format (uint8_t);
+
+/* define_ctr_dump_sync()
+   ----------------------
+   This function defines whether base and aggregated dump files are flushed to disk
+   through fdatasync(), so that dumped rows survive a crash of the system (not only of
+   the process). The only parameter is the number of dumps after which files are synced:
+      CTRNOSYNC:       files are never synced, the kernel writes them back on its own
+                       (this is the default)
+      CTRSYNCEACHDUMP: files are synced after each dump
+      any other N:     files are synced every N dumps (base and aggregated dumps are
+                       counted separately)
+   Files with dumps not synced yet are synced anyway before they are closed, i.e. at
+   rotation time and by stop_counters(). This function shall be called before
+   start_counters(); the setting is reset to CTRNOSYNC by stop_counters().
+   This function returns:
+      - MIXFKO: if counters collection has been already started through start_counters()
+      - MIXFOK: if everything is correct                                        */
+Error define_ctr_dump_sync (uint32_t);
+
+/* define_ctr_dump_writer()
+   ------------------------
+   This function defines how base and aggregated dump files are written. The only
+   parameter can be:
+      CTRDIRECTWRITER: rows are written through write() by the thread performing the
+                       dump (this is the default)
+      CTRURINGWRITER:  rows are copied and submitted to an io_uring instance owned by the
+                       library, at most one io_uring_enter() per dump, without waiting for
+                       the disk; completions are reaped at the next check_and_dump_ctr()
+                       call. If io_uring is not available, CTRTHREADWRITER is used
+                       (also if the ring cannot be entered later on, once the
+                       operations already queued to it have been completed in order)
+      CTRTHREADWRITER: rows are copied and queued to a writer thread owned by the library
+   Asynchronous writers execute writes, syncs (see define_ctr_dump_sync()) and closes in
+   the same order in which they are queued. The writer actually in use and its statistics
+   are provided by query_ctr_dump_writer(). This function shall be called before
+   start_counters(); the writer is reset to CTRDIRECTWRITER by stop_counters(), which
+   waits for all pending operations.
+   This function returns:
+      - MIXFKO: if the writer is not valid or counters collection has been already
+                started through start_counters()
+      - MIXFOK: if everything is correct                                        */
+Error define_ctr_dump_writer (uint8_t);
+
+/* query_ctr_dump_writer()
+   -----------------------
+   This function provides in the CtrWriterStats structure pointed to by its parameter
+   the writer of dump files in use (see define_ctr_dump_writer()) and its statistics:
+   bytes and operations queued and not completed yet, bytes written and operations
+   completed with an error (or partial writes) since start_counters(). Completions
+   already available are reaped first. With CTRDIRECTWRITER all statistics are 0.
+   It returns MIXFKO if the parameter is NULL, MIXFOK otherwise                   */
+Error query_ctr_dump_writer (CtrWriterStats *);
+
+/* define_ctr_history()
+   --------------------
+   This function defines how many dumped intervals of Scalar and Vector Counters are
+   kept in memory, so that they can be read through query_ctr_history() without parsing
+   dump files. The first parameter is the number of base intervals, the second one the
+   number of aggregated intervals (0 if no interval shall be kept, up to 1440, i.e. a day
+   of one minute intervals). Each dump stores the values it writes in a ring holding a
+   row for each interval, which takes 8 bytes for each Scalar Counter and each instance
+   of Vector Counters: memory is allocated by start_counters() and never grows. This
+   function shall be called before start_counters(); the setting is reset (no history)
+   by stop_counters().
+   This function returns:
+      - MIXFKO: if a parameter is greater than 1440 or counters collection has been
+                already started through start_counters()
+      - MIXFOK: if everything is correct                                        */
+Error define_ctr_history (uint16_t, uint16_t);
+
 /* start_counters()
    ----------------
    Open all counters files (base and aggregated, if defined) and start counting events
    This function may return:
-      - MIXFNOACCESS: if any of the base or aggregated files cannot be opened
+      - MIXFNOACCESS: if any of the base or aggregated files (or the counters shared
+                      memory segment or state file, see define_ctr_storage()) cannot be opened
       - MIXFKO:       if counter collection has alredy been started before through start_counters()
                       or define_base_dump() has not been called
       - MIXFOK:       if everything is OK                                                */
 Error start_counters (void);
 
+/* start_counters_async()
+   ----------------------
+   Same as start_counters(), but counters are also dumped by a thread owned by
+   the library, so that the application does not need to call check_and_dump_ctr()
+   (if called, it has no effect). The thread sleeps on a timerfd armed for the exact
+   next base/aggr dump time defined through define_base_dump()/define_aggr_dump(),
+   therefore update functions never pay for dump scheduling or file I/O and dumps
+   are not missed if the application is busy. The thread is stopped by stop_counters().
+   This function may return:
+      - MIXFNOACCESS: if any of the base or aggregated files (or the counters shared
+                      memory segment or state file, see define_ctr_storage()) cannot be opened
+      - MIXFKO:       if counter collection has alredy been started before, define_base_dump()
+                      has not been called or the thread cannot be created (in the latter
+                      case counters are not started)
+      - MIXFOK:       if everything is OK                                                */
+Error start_counters_async (void);
+
 /* stop_counters()
    ---------------
    Stops collecting counters, dumps the last values collected up to that time,
@@ -884,9 +1559,10 @@ Error stop_counters (void);
                   is a Roller Counter or counters have
                   not been started
       - MIXFOVFL: the counter has wrapped around the maximum
-                  value (i.e. 2^32 -1). This applies both to base
-                  value and to aggregate value. Note that the counter
-                  is increased anyway (i.e. the new value is 0)
+                  value (i.e. 2^32 -1, or 2^64 -1 for 64 bit counters).
+                  This applies both to base value and to aggregate value.
+                  Note that the counter is increased anyway (i.e. the
+                  new value is 0)
       - MIXFOK:   the counter has been increased without errors       */
 Error incr_peg_scalar_ctr (uint16_t);
 
@@ -909,12 +1585,64 @@ Error incr_peg_scalar_ctr (uint16_t);
                   is outside the allowed interval or counters
                   have not been started
       - MIXFOVFL: the counter has wrapped around the maximum
-                  value (i.e. 2^32 -1). This applies both to base
-                  value and to aggregate value. Note that the counter
-                  is increased anyway (i.e. the new value is 0)
+                  value (i.e. 2^32 -1, or 2^64 -1 for 64 bit counters).
+                  This applies both to base value and to aggregate value.
+                  Note that the counter is increased anyway (i.e. the
+                  new value is 0)
       - MIXFOK:   the counter has been increased without errors        */
 Error incr_peg_vector_ctr (uint16_t, uint16_t*);
 
+/* add_peg_scalar_ctr()
+   --------------------
+   This function increases a Peg Scalar Counter by an arbitrary amount
+   (e.g. the number of bytes or packets in a batch), so that volumes
+   can be counted with one call per batch instead of one per unit.
+   The first parameter is the Scalar Counter ID and shall be defined
+   in the interval (0,M-1), where M is the the maximum number of
+   Scalar counters defined through define_scalar_ctr_num().
+   The second parameter is the amount to be added (0 is a valid value).
+   incr_peg_scalar_ctr(id) is equivalent to add_peg_scalar_ctr(id,1).
+   Possible return values are:
+      - MIXFKO:   the counter ID does not exist, is outside
+                  the allowed range, the specified counter
+                  is a Roller Counter or counters have
+                  not been started
+      - MIXFOVFL: the counter has wrapped around the maximum
+                  value (i.e. 2^32 -1, or 2^64 -1 for 64 bit counters).
+                  This applies both to base value and to aggregate value.
+                  Note that the counter is increased anyway (modulo
+                  2^32 or 2^64)
+      - MIXFOK:   the counter has been increased without errors       */
+Error add_peg_scalar_ctr (uint16_t, uint64_t);
+
+/* add_peg_vector_ctr()
+   --------------------
+   This function increases a Peg Vector Counter by an arbitrary amount.
+   The first parameter is the Scalar Counter ID and shall be defined
+   in the interval (0,N-1), where N is the the maximum number of
+   Vector counters defined through define_vector_ctr_num().
+   The second parameter is a pointer to a Instance ID. If NULL
+   all the instances related to the concerned Vector counter
+   are increased, otherwise only the specified Instance Id
+   is increased. It must be included in the interval (0,P-1)
+   where P is the number of instances specified in
+   define_vector_ctr().
+   The third parameter is the amount to be added (0 is a valid value).
+   incr_peg_vector_ctr(id,inst) is equivalent to add_peg_vector_ctr(id,inst,1).
+   Possible return values are:
+      - MIXFKO:   the counter ID does not exist, is outside
+                  the allowed range, the specified counter
+                  is a Roller Counter, the instance ID
+                  is outside the allowed interval or counters
+                  have not been started
+      - MIXFOVFL: the counter has wrapped around the maximum
+                  value (i.e. 2^32 -1, or 2^64 -1 for 64 bit counters).
+                  This applies both to base value and to aggregate value.
+                  Note that the counter is increased anyway (modulo
+                  2^32 or 2^64)
+      - MIXFOK:   the counter has been increased without errors        */
+Error add_peg_vector_ctr (uint16_t, uint16_t*, uint64_t);
+
 /* update_roller_scalar_ctr()
    --------------------------
    This function updates a Roller Scalar Counter by a specified value,
@@ -930,11 +1658,11 @@ Error incr_peg_vector_ctr (uint16_t, uint16_t*);
                   the allowed range, the specified counter
                   is a Peg Counter or counters have not been started
       - MIXFOVFL: the counter should either exceed the maximum
-                  value (i.e. 2^32 -1), or decrease below 0. This
-                  applies both to base value and to aggregate value.
-                  Note that differenly from peg counters, a roller
-                  counter does not wrap (i.e. it is capped either to
-                  2^32-1 or to 0)
+                  value (i.e. 2^32 -1, or 2^64 -1 for 64 bit counters),
+                  or decrease below 0. This applies both to base value
+                  and to aggregate value. Note that differenly from peg
+                  counters, a roller counter does not wrap (i.e. it is
+                  capped either to its maximum value or to 0)
       - MIXFOK:   the counter has been updated without errors          */
 Error update_roller_scalar_ctr (uint16_t, short);
 
@@ -959,14 +1687,193 @@ Error update_roller_scalar_ctr (uint16_t, short);
                   is outside the allowed interval or counters
                   have not been started
       - MIXFOVFL: the counter should either exceed the maximum
-                  value (i.e. 2^32 -1), or decrease below 0. This
-                  applies both to base value and to aggregate value.
-                  Note that differenly from peg counters, a roller
-                  counter does not wrap (i.e. it is capped either to
-                  2^32-1 or to 0)
+                  value (i.e. 2^32 -1, or 2^64 -1 for 64 bit counters),
+                  or decrease below 0. This applies both to base value
+                  and to aggregate value. Note that differenly from peg
+                  counters, a roller counter does not wrap (i.e. it is
+                  capped either to its maximum value or to 0)
       - MIXFOK:   the counter has been updated without errors            */
 Error update_roller_vector_ctr (uint16_t, uint16_t*, short);
 
+/* incr_peg_ctr()
+   --------------
+   This function increases by one a Peg Counter registered through
+   register_scalar_ctr() or register_vector_ctr(), identified by its handle. For
+   Vector Counters the second parameter is a pointer to an Instance ID (NULL to
+   increase all the instances), as in incr_peg_vector_ctr(); it is ignored for
+   Scalar Counters. Counter ID and type are encoded in the handle, hence they are
+   not checked again on each call. It is equivalent to add_peg_ctr(handle, ctrInst, 1).
+   Possible return values are:
+      - MIXFKO:   the handle is not valid (or no longer valid, since counters have
+                  been redefined), the counter is a Roller Counter, the instance ID
+                  is outside the allowed interval or counters have not been started
+      - MIXFOVFL: the counter has wrapped around the maximum value
+      - MIXFOK:   the counter has been increased without errors             */
+Error incr_peg_ctr (CtrHandle, uint16_t*);
+
+/* add_peg_ctr()
+   -------------
+   This function increases by n (third parameter) a Peg Counter registered through
+   register_scalar_ctr() or register_vector_ctr(), identified by its handle. The
+   second parameter and the return values are the same as incr_peg_ctr()      */
+Error add_peg_ctr (CtrHandle, uint16_t*, uint64_t);
+
+/* update_roller_ctr()
+   -------------------
+   This function updates by delta (either positive or negative) a Roller Counter
+   registered through register_scalar_ctr() or register_vector_ctr(), identified by
+   its handle. For Vector Counters the second parameter is a pointer to an Instance
+   ID (NULL to update all the instances), as in update_roller_vector_ctr(); it is
+   ignored for Scalar Counters.
+   Possible return values are:
+      - MIXFKO:   the handle is not valid (or no longer valid, since counters have
+                  been redefined), the counter is a Peg Counter, the instance ID
+                  is outside the allowed interval or counters have not been started
+      - MIXFOVFL: the counter should either exceed the maximum value or decrease
+                  below 0 (it is capped)
+      - MIXFOK:   the counter has been updated without errors               */
+Error update_roller_ctr (CtrHandle, uint16_t*, short);
+
+/* incr_peg_sparse_ctr()
+   ---------------------
+   This function increases by one the value of a key (second parameter) of a Sparse
+   Counter (first parameter). The key is added if it has not been updated before; if
+   the maximum number of keys of the counter has been reached, the overflow cell is
+   increased instead. Keys are added without locks, so that concurrent threads can
+   update the same counter (values are updated through atomic adds, unless the update
+   mode is CTRPLAINMODE, see define_ctr_update_mode()).
+   Possible return values are:
+      - MIXFKO:   the counter ID does not exist, is outside
+                  the allowed range or counters have not been started
+      - MIXFOVFL: the value has wrapped around the maximum value
+      - MIXFOK:   the value has been increased without errors           */
+Error incr_peg_sparse_ctr (uint16_t, uint64_t);
+
+/* add_peg_sparse_ctr()
+   --------------------
+   This function increases by n (third parameter) the value of a key of a Sparse
+   Counter. Parameters and return values are the same as incr_peg_sparse_ctr()  */
+Error add_peg_sparse_ctr (uint16_t, uint64_t, uint64_t);
+
+/* record_histo_ctr()
+   ------------------
+   This function records a value (second parameter) in a Histogram Counter (first
+   parameter), only in its base distribution (base intervals are merged into the
+   aggregated one when dumped). Finding the bucket of the value takes a couple of
+   shifts and an add, without loops or divisions. Values are recorded through atomic
+   operations in CTRATOMICMODE, in the thread shard in CTRSHARDEDMODE (see
+   define_ctr_update_mode()).
+   Possible return values are:
+      - MIXFKO:   the counter ID does not exist, is outside the allowed
+                  range, the thread shard cannot be allocated or counters
+                  have not been started
+      - MIXFOVFL: the sum of recorded values has wrapped around 2^64 -1
+                  (not detected in CTRSHARDEDMODE)
+      - MIXFOK:   the value has been recorded without errors             */
+Error record_histo_ctr (uint16_t, uint64_t);
+
+/* observe_summary_ctr()
+   ---------------------
+   This function observes a value (second parameter) in a Summary Counter (first
+   parameter): the number of values and their sum are increased, min and max are
+   updated if needed. Values are observed through atomic operations in CTRATOMICMODE,
+   in the thread shard in CTRSHARDEDMODE (see define_ctr_update_mode()).
+   Possible return values are:
+      - MIXFKO:   the counter ID does not exist, is outside
+                  the allowed range or counters have not been started
+      - MIXFOVFL: the sum of values has wrapped around 2^64 -1
+                  (not detected in CTRSHARDEDMODE)
+      - MIXFOK:   the value has been observed without errors             */
+Error observe_summary_ctr (uint16_t, uint64_t);
+
+/* incr_topk_ctr()
+   ---------------
+   This function increases by one the count of a key (second parameter) of a Top-K
+   Counter (first parameter) defined with CTRTOPKINTKEY. If the key is not monitored,
+   it is added, replacing the key with the lowest count if all places are taken (see
+   define_topk_ctr()). Keys are kept in a hash table and a heap ordered by count, so
+   that an update takes a lookup and a logarithmic number of swaps. The counter is
+   locked while it is updated (unless the update mode is CTRPLAINMODE, see
+   define_ctr_update_mode()).
+   Possible return values are:
+      - MIXFKO:   the counter ID does not exist, is outside the allowed range, has
+                  string keys or counters have not been started
+      - MIXFOK:   the count has been increased without errors            */
+Error incr_topk_ctr (uint16_t, uint64_t);
+
+/* add_topk_ctr()
+   --------------
+   This function increases by n (third parameter) the count of a key of a Top-K
+   Counter (e.g. by the bytes of a packet). Parameters and return values are the same
+   as incr_topk_ctr()                                                        */
+Error add_topk_ctr (uint16_t, uint64_t, uint64_t);
+
+/* incr_topk_ctr_str()
+   -------------------
+   Same as incr_topk_ctr(), for Top-K Counters defined with CTRTOPKSTRKEY: the second
+   parameter is the string key (up to 32 characters, otherwise it is truncated; commas
+   and line breaks are written as spaces in dump files). Keys are identified by their
+   64 bit hash, so that two keys may be counted together only in the unlikely case that
+   their hashes collide                                                      */
+Error incr_topk_ctr_str (uint16_t, char*);
+
+/* add_topk_ctr_str()
+   ------------------
+   Same as add_topk_ctr(), for Top-K Counters defined with CTRTOPKSTRKEY (see
+   incr_topk_ctr_str())                                                      */
+Error add_topk_ctr_str (uint16_t, char*, uint64_t);
+
+/* add_distinct_ctr()
+   ------------------
+   This function adds a key (second parameter, e.g. an IPv4 address or the hash of a
+   longer key) to a Distinct Counter (first parameter): the key is hashed and a single
+   register is raised if needed, only in base registers (base intervals are merged into
+   aggr registers when dumped). Adding a key more than once has no effect on the
+   estimate. Registers are raised through compare and swap (only when they change) in
+   CTRATOMICMODE, in the thread shard in CTRSHARDEDMODE (see define_ctr_update_mode()).
+   Possible return values are:
+      - MIXFKO:   the counter ID does not exist, is outside the allowed range,
+                  the thread shard cannot be allocated or counters have not
+                  been started
+      - MIXFOK:   the key has been added without errors                  */
+Error add_distinct_ctr (uint16_t, uint64_t);
+
+/* update_ctr_bulk()
+   -----------------
+   This function applies many counter updates in a single call (e.g. all the
+   updates related to a burst of packets). The first parameter is an array of
+   CtrUpdate records, each one specifying the counter class (CTRSCALAR or
+   CTRVECTOR), the counter ID, the instance ID (Vector Counters only) and the
+   delta. For Peg counters delta is the amount to be added (as in
+   add_peg_xxx_ctr(), it shall not be negative), for Roller counters it is the
+   signed update (as in update_roller_xxx_ctr(), but not limited to short).
+   The second parameter is the number of records in the array.
+   The third parameter is either 0 or CTRBULKSORT: in the latter case records
+   are grouped in place by counter (Scalar Counters first, then Vector Counters,
+   by increasing ID) before being applied, which improves locality when the
+   array mixes many different counters. Grouping is stable, i.e. the relative
+   order of records related to the same counter is preserved.
+   The fourth parameter, if not NULL, points to a bitmap of (N+63)/64 words,
+   N being the number of records: bit i (i.e. bit i%64 of word i/64) is set if
+   record i (after sorting, if requested) has caused a wrap-around or a
+   saturation, and cleared otherwise. In CTRSHARDEDMODE bits are never set,
+   since wrap-around and saturation are applied when thread shards are folded
+   (see define_ctr_update_mode()).
+   Counter checks are performed once for each run of consecutive records
+   related to the same counter, rather than once per record. Moreover,
+   consecutive records related to the same instance of a Peg counter are
+   merged into a single update: if the merged update wraps around, only the
+   bit of the last record of the run is set in the bitmap.
+   Possible return values are:
+      - MIXFKO:   counters have not been started or at least one record is
+                  invalid (counter ID, class or instance outside the allowed
+                  range, or negative delta for a Peg counter). Invalid
+                  records are skipped, all the others are applied anyway
+      - MIXFOVFL: at least one record caused a wrap-around or a saturation
+                  (see the bitmap for details, not detected in CTRSHARDEDMODE)
+      - MIXFOK:   all the records have been applied without errors         */
+Error update_ctr_bulk (CtrUpdate *, uint32_t, uint8_t, uint64_t *);
+
 /* retrieve_peg_scalar_ctr()
    -------------------------
    This function provides back the current value of the Peg Scalar
@@ -980,6 +1887,9 @@ Error update_roller_vector_ctr (uint16_t, uint16_t*, short);
       - MIXFKO:   the counter ID does not exist, is outside
                   the allowed range the specified counter
                   is a Roller Counter or counters have not been started
+      - MIXFOVFL: the counter is a 64 bit counter and its value does not
+                  fit 32 bits; the value provided back is capped to 2^32 -1
+                  (use retrieve_peg_scalar_ctr64() for 64 bit counters)
       - MIXFOK:   the counter has been extracted without errors.
                   second and third parameter contain respectively
                   the current base and aggregated values             */
@@ -1004,18 +1914,178 @@ Error retrieve_peg_scalar_ctr (uint16_t, uint32_t *, uint32_t *);
                   is a Roller Counter, the instance ID
                   is outside the allowed interval
                   or counters have not been started
+      - MIXFOVFL: the counter is a 64 bit counter and its value does not
+                  fit 32 bits; the value provided back is capped to 2^32 -1
+                  (use retrieve_peg_vector_ctr64() for 64 bit counters)
       - MIXFOK:   the counter has been extracted without errors.
                   third and fourth parameter contain respectively
                   the current base and aggregated values              */
 Error retrieve_peg_vector_ctr (uint16_t, uint16_t, uint32_t *, uint32_t *);
 
+/* retrieve_peg_scalar_ctr64()
+   ---------------------------
+   This function is the same as retrieve_peg_scalar_ctr(), but the second
+   and third parameters are pointers to unsigned 64 bit integers. It can be
+   used with both 32 bit and 64 bit Peg Scalar Counters.
+   Possible return values are:
+      - MIXFKO:   the counter ID does not exist, is outside
+                  the allowed range, the specified counter
+                  is a Roller Counter or counters have not been started
+      - MIXFOK:   the counter has been extracted without errors.
+                  second and third parameter contain respectively
+                  the current base and aggregated values             */
+Error retrieve_peg_scalar_ctr64 (uint16_t, uint64_t *, uint64_t *);
+
+/* retrieve_peg_vector_ctr64()
+   ---------------------------
+   This function is the same as retrieve_peg_vector_ctr(), but the third
+   and fourth parameters are pointers to unsigned 64 bit integers. It can be
+   used with both 32 bit and 64 bit Peg Vector Counters.
+   Possible return values are:
+      - MIXFKO:   the counter ID does not exist, is outside
+                  the allowed range, the specified counter
+                  is a Roller Counter, the instance ID
+                  is outside the allowed interval
+                  or counters have not been started
+      - MIXFOK:   the counter has been extracted without errors.
+                  third and fourth parameter contain respectively
+                  the current base and aggregated values              */
+Error retrieve_peg_vector_ctr64 (uint16_t, uint16_t, uint64_t *, uint64_t *);
+
+/* retrieve_peg_sparse_ctr64()
+   ---------------------------
+   This function retrieves the current base and aggregated values of a key (second
+   parameter) of a Sparse Counter (first parameter), in the unsigned 64 bit integers
+   pointed to by the third and fourth parameters. A key that has never been updated
+   (or that has been counted in the overflow cell) has null values; it is not added.
+   Possible return values are:
+      - MIXFKO:   the counter ID does not exist, is outside
+                  the allowed range or counters have not been started
+      - MIXFOK:   the values have been retrieved without errors          */
+Error retrieve_peg_sparse_ctr64 (uint16_t, uint64_t, uint64_t *, uint64_t *);
+
+/* query_sparse_ctr()
+   ------------------
+   This function gives back the number of keys of a Sparse Counter (first parameter)
+   in the variable pointed to by the second parameter, and the current base and
+   aggregated values of its overflow cell (i.e. updates of keys that could not be
+   added, since the maximum number of keys had been reached) in the variables pointed
+   to by the third and fourth parameters. A growing overflow cell means that the
+   maximum number of keys defined through define_sparse_ctr() is too low.
+   Possible return values are:
+      - MIXFKO:   the counter ID does not exist, is outside
+                  the allowed range or counters have not been started
+      - MIXFOK:   the values have been retrieved without errors          */
+Error query_sparse_ctr (uint16_t, uint32_t *, uint64_t *, uint64_t *);
+
+/* retrieve_histo_ctr()
+   --------------------
+   This function retrieves a percentile (second parameter, greater than 0 and not
+   greater than 100) of the values recorded in a Histogram Counter (first parameter)
+   since the last base and aggregated dumps, in the unsigned 64 bit integers pointed
+   to by the third and fourth parameters (0 if no value has been recorded). The
+   percentile is the highest value of its bucket, within the minimum and maximum
+   recorded values. The aggregated percentile is evaluated on aggregated and live
+   base buckets, merged on the fly.
+   Possible return values are:
+      - MIXFKO:   the counter ID does not exist, is outside the allowed
+                  range, the percentile is not valid or counters have not
+                  been started
+      - MIXFOK:   the values have been retrieved without errors          */
+Error retrieve_histo_ctr (uint16_t, double, uint64_t *, uint64_t *);
+
+/* retrieve_summary_ctr()
+   ----------------------
+   This function retrieves count, sum, min and max of the values observed in a Summary
+   Counter (first parameter) since the last base dump and since the last aggregated
+   dump, in the structures pointed to by the second and third parameters.
+   Possible return values are:
+      - MIXFKO:   the counter ID does not exist, is outside the allowed
+                  range or counters have not been started
+      - MIXFOK:   the values have been retrieved without errors          */
+Error retrieve_summary_ctr (uint16_t, CtrSummary *, CtrSummary *);
+
+/* retrieve_ctr_rate()
+   -------------------
+   This function retrieves the rates (first parameter is the rate ID) evaluated at
+   the last tick, in the structure pointed to by the second parameter (see CtrRate).
+   It takes constant time and never locks: rates are published by the tick through
+   a sequence counter, and read again if a tick is in progress.
+   Possible return values are:
+      - MIXFKO:   the rate ID does not exist, is outside the allowed
+                  range or counters have not been started
+      - MIXFOK:   the rates have been retrieved without errors           */
+Error retrieve_ctr_rate (uint16_t, CtrRate *);
+
+/* query_ctr_history()
+   -------------------
+   This function retrieves the values dumped in the last intervals of a counter (see
+   define_ctr_history()). The first parameter is the class of the counter (CTRSCALAR or
+   CTRVECTOR), the second one its ID and the third one the instance (ignored for Scalar
+   Counters). The fourth parameter selects the aggregated intervals (true) or the base
+   ones (false). The fifth parameter is the maximum number of intervals to be retrieved
+   in the array pointed to by the sixth one (see CtrInterval), most recent first, and the
+   number of intervals actually retrieved (fewer if fewer intervals have been dumped
+   since start_counters()) is provided in the seventh one. Missed dump times are reported
+   as intervals with the missed flag set. The interval in progress is not included (see
+   retrieve functions). No file is read.
+   Possible return values are:
+      - MIXFKO:   the counter does not exist, is outside the allowed range, no history
+                  has been defined for the selected intervals or counters have not
+                  been started
+      - MIXFOK:   the intervals have been retrieved without errors       */
+Error query_ctr_history (uint8_t, uint16_t, uint16_t, bool, uint16_t, CtrInterval *, uint16_t *);
+
+/* retrieve_topk_ctr()
+   -------------------
+   This function retrieves the top keys of a Top-K Counter (first parameter) counted
+   since the last aggregated dump (second parameter set) or since the last base dump
+   (second parameter not set), in the array pointed to by the third parameter, which
+   shall have room for K keys (see define_topk_ctr() and CtrTopKey). Keys are sorted by
+   decreasing count, and the number of keys retrieved (fewer than K if fewer keys have
+   been updated) is provided in the fourth parameter.
+   Possible return values are:
+      - MIXFKO:   the counter ID does not exist, is outside the allowed
+                  range or counters have not been started
+      - MIXFOK:   the keys have been retrieved without errors            */
+Error retrieve_topk_ctr (uint16_t, bool, CtrTopKey *, uint16_t *);
+
+/* retrieve_distinct_ctr()
+   -----------------------
+   This function retrieves the estimated number of distinct keys added to a Distinct
+   Counter (first parameter) since the last base dump (second parameter) and since the
+   last aggregated dump (third parameter). The latter is estimated from the merge of
+   aggr registers and live base registers, which is computed on the fly.
+   Possible return values are:
+      - MIXFKO:   the counter ID does not exist, is outside the allowed
+                  range or counters have not been started
+      - MIXFOK:   the estimates have been retrieved without errors       */
+Error retrieve_distinct_ctr (uint16_t, uint64_t *, uint64_t *);
+
+/* query_ctr_alarm()
+   -----------------
+   This function retrieves the state of a threshold alarm (first parameter, see
+   define_ctr_alarm()) at its last evaluation: the second parameter is set if the
+   alarm is raised, the third one is the watched value. It never locks.
+   Possible return values are:
+      - MIXFKO:   the alarm ID does not exist, is outside the allowed
+                  range or counters have not been started
+      - MIXFOK:   the state has been retrieved without errors           */
+Error query_ctr_alarm (uint16_t, bool *, uint64_t *);
+
 /* check_and_dump_ctr()
    --------------------
    When this function is invoked, it checks current time against the next
    Base and Aggr Dump Times. If they coincide, it writes a row in the
    corresponding scalar and vector files. In order for counters to be
    regularly dumped to files, this function shall be called at regular
-   intervals during code execution.
+   intervals during code execution. When no dump is due, it only compares the
+   current time with the precomputed next dump time. Dump times missed since
+   the previous call are written as rows with empty values (up to one day),
+   while values accumulated so far are written in the row of the last elapsed
+   dump time. Calling this function is not needed if counters have been started through
+   start_counters_async(): in that case dumps are performed by a library thread
+   and this function has no effect (it just returns MIXFOK).
    It returns MIXFKO if counters have not been defined/started,
    MIXFNOACCESS if it is not able to write counters to file, MIXFOK in any
    other case.                                                          */
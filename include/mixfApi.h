@@ -69,8 +69,62 @@
 #define MAXSCALARCTRNUM      1024   /* Max number of Scalar Counters */
 #define MAXVECTORCTRNUM      1024   /* Max number of Vector Counters */
 #define MAXVECTORCTRINST    65536   /* Max number of collected Vector Counters Instances */
+#define MAXSPARSECTRNUM        64   /* Max number of Sparse Counters */
+#define MAXSPARSEKEYS   (1U << 28)  /* Max number of keys of a Sparse Counter */
+#define SPARSEVALUES            4   /* Values of each cell of a Sparse Counter: base and aggr, one per epoch (see SPARSEVAL) */
+#define SPARSEVAL(a,e)  (((a) ? 2 : 0) + (e))   /* Index of the base (a false) or aggr (a true) value of epoch e within a cell */
+#define SPARSEBUFSIZE       65536   /* Size of the buffers in which rows of Sparse Counters are encoded */
+#define SPARSEMAXROW          128   /* Max length of a row (or of a binary entry) of a Sparse Counter */
+#define MAXHISTOCTRNUM         64   /* Max number of Histogram Counters */
+#define MAXHISTOPCT             8   /* Max number of percentiles in dumps of Histogram Counters */
+#define MINHISTOBITS            4   /* Range of significant bits of buckets of Histogram Counters */
+#define MAXHISTOBITS           10
+#define HISTOBUCKETS(b)  ((uint32_t)(66 - (b)) << ((b) - 1))   /* Number of buckets with b significant bits (whole 64 bit range) */
+#define HISTOHDR                8   /* Cells before buckets in each block of a Histogram Counter (a cache line) */
+#define HISTOSUM                0   /* Cells within HISTOHDR: sum, min and max of recorded values */
+#define HISTOMIN                1
+#define HISTOMAX                2
+#define HISTOBUF(a,e)   (((a) ? 2 : 0) + (e))   /* Block of base (a false) or aggr (a true) values of epoch e */
+#define HISTOSTATS   (4 + MAXHISTOPCT)          /* Values dumped for a Histogram Counter: count, sum, min, max and percentiles */
+#define MAXSUMMARYCTRNUM      256   /* Max number of Summary Counters */
+#define SUMMARYCELLS            4   /* Cells of a Summary Counter: count, sum, min and max of observed values */
+#define SUMCOUNT                0
+#define SUMSUM                  1
+#define SUMMIN                  2
+#define SUMMAX                  3
+#define SUMMARYBUF(a,e) (((a) ? 2 : 0) + (e))   /* Buffer of base (a false) or aggr (a true) values of epoch e */
+#define MAXRATECTRNUM          64   /* Max number of counter rates */
+#define RATEWINDOW            900   /* Seconds kept for sliding windows of rates (the longest horizon, 15 minutes) */
+#define RATEVALUES   (2 * CTRRATEHORIZONS)      /* Values dumped for a rate: EWMAs and window averages */
+#define RATEDIGITS             24   /* Max number of characters of a rate in CSV files ("%.3f", up to 2^64) */
+#define MAXTOPKCTRNUM         64   /* Max number of Top-K Counters */
+#define MAXTOPK              1024   /* Max number of keys dumped by a Top-K Counter */
+#define MAXTOPKSLOTS    (1U << 20)  /* Max number of keys monitored by a Top-K Counter */
+#define TOPKBUF(a,e)    (((a) ? 2 : 0) + (e))   /* Sketch of base (a false) or aggr (a true) keys of epoch e */
+#define TOPKFREE       UINT32_MAX   /* Free cell of the hash table of a Top-K sketch */
+#define TOPKMAXROW  (SHORTSTRINGMAXLEN + 13 + CTRTOPKKEYLEN + 2 * (MAXCTRDIGITS + 1) + 1)   /* Max length of a row of a Top-K Counter */
+#define MAXDISTINCTCTRNUM      64   /* Max number of Distinct Counters */
+#define MINDISTINCTPREC         4   /* Range of the precision of Distinct Counters (2^p registers) */
+#define MAXDISTINCTPREC        16
+#define DISTINCTBUF(a,e) (((a) ? 2 : 0) + (e))  /* Registers of base (a false) or aggr (a true) values of epoch e */
+#define MAXCTRALARMNUM       4096   /* Max number of threshold alarms */
+#define MAXCTRHISTORY        1440   /* Max number of intervals kept in each history ring (see define_ctr_history()) */
 #define MAXCTRVALUE    4294967295   /* Max value for a counter (2^32-1), after that the counter overflows */
+#define MAXCTR64VALUE  UINT64_MAX   /* Max value for a 64 bit counter (2^64-1), after that the counter overflows */
 #define MAXAGGRDUMPTIMES      100   /* Max number of dump times in a day (in the form hhmm) for aggregated counters */
+#define CACHELINESIZE          64   /* Cache line size used to align counter cells updated by different threads */
+#define MAXCTRDIGITS           20   /* Max number of decimal digits of a counter value (2^64-1) */
+#define CTRSTRIDE(n)   (((size_t)(n) + CACHELINESIZE / 8 - 1) & ~(size_t)(CACHELINESIZE / 8 - 1)) /* n values rounded up to cache lines */
+#define MINUTESPERDAY        1440   /* Number of dump slots (minutes) in a day */
+#define SECONDSPERDAY       86400
+#define DUMPMAPWORDS   ((MINUTESPERDAY + 63) / 64)  /* Number of 64 bit words of a dump schedule bitmap */
+#define NODUMPTIME  ((time_t)LONG_MAX)  /* Next dump time of an empty dump schedule */
+#define MAXDUMPPERIOD        3600   /* Max base dump period (in seconds) of an "every Ns" schedule */
+#define URINGENTRIES          256   /* Number of submission queue entries of the io_uring dump writer */
+#define MAXWRITERINFLIGHT (64 << 20) /* Max bytes queued to the asynchronous dump writer, then dumps wait for completions */
+#define CTRWRITEOP              0   /* Operations queued to the asynchronous dump writer */
+#define CTRSYNCOP               1
+#define CTRCLOSEOP              2
 
 
 /********************
@@ -137,27 +191,202 @@ typedef struct param
 } Param;
 
 /* Base types for counters handling (v.2.0.0) */
-typedef uint8_t         CounterType;    /* Either PEGCTR or ROLLERCTR */
+typedef uint8_t         CounterType;    /* Either PEGCTR or ROLLERCTR, possibly OR-ed with CTR64BIT (UNDEFCTR for counters not defined) */
+#define UNDEFCTR              255   /* Type of a counter not defined yet */
+#define CTRKIND(t)      ((t) & ~CTR64BIT)                               /* Counter type without width flag */
+#define CTRLIMIT(t)     (((t) & CTR64BIT) ? MAXCTR64VALUE : MAXCTRVALUE) /* Max value (and mask) for the counter width */
+#define CTRBUF(t,e)     ((CTRKIND(t) == PEGCTR) ? (e) : 0)              /* Values buffer used in epoch e (Roller counters only use buffer 0) */
+#define SETDUMPSLOT(m,s)  ((m)[(s) / 64] |= (1ULL << ((s) % 64)))       /* Set minute of the day s in dump schedule bitmap m */
+#define ISDUMPSLOT(m,s)   (((m)[(s) / 64] >> ((s) % 64)) & 1)           /* Check minute of the day s in dump schedule bitmap m */
+#define SETREGCTR(m,i)    ((m)[(i) / 64] |= (1ULL << ((i) % 64)))       /* Set counter ID i in registered counters bitmap m */
+#define ISREGCTR(m,i)     (((m)[(i) / 64] >> ((i) % 64)) & 1)           /* Check counter ID i in registered counters bitmap m */
+#define CTRHANDLETYPE(h)  ((CounterType)((((h) >> 17) & 0x01) | (((h) >> 14) & CTR64BIT)))  /* Type of the counter of a handle (kind in bit 17, width in bit 18) */
+#define CTRHANDLEGEN(h)   ((h) >> 19)                                   /* Registry generation of a handle (never 0) */
+#define CTRHANDLE(g,c,t,i) (((CtrHandle)(g) << 19) | ((CtrHandle)((t) & CTR64BIT) << 14) | ((CtrHandle)((t) & 0x01) << 17) | \
+                            ((CtrHandle)(c) << 16) | (CtrHandle)(i))
+#define MAXHANDLEGEN         8191   /* Generations of handles (13 bits) wrap around from 8191 to 1 */
+#define CTRREGINDEXSIZE      2048   /* Slots of the hash table of registered names of each class (power of 2, at least twice MAXSCALARCTRNUM/MAXVECTORCTRNUM) */
+#define CTRREGMAPWORDS  (((MAXSCALARCTRNUM > MAXVECTORCTRNUM) ? MAXSCALARCTRNUM : MAXVECTORCTRNUM) / 64)  /* Words of registered counters bitmaps */
 
-typedef struct scalarCtrInfo            /* Structure for Scalar counter (either PEGCTR or ROLLERCTR) */
-{   /* Each element requires 32+1+4+4 = 41 bytes */
+/* Counters are stored as structure of arrays: values and data accessed on each update (hot data) */
+/* are kept in compact arrays, separated from names and file descriptors (cold data), so that */
+/* updates and dumps do not pull cold bytes into cache */
+/* Peg counters values are double buffered: updates are applied to the live buffer (selected by */
+/* the base/aggr epoch), while at dump time the epoch is flipped and the other buffer is frozen, */
+/* dumped and reset. Roller counters are never reset, therefore they only use buffer 0 */
+typedef struct scalarCtrInfo            /* Metadata for Scalar counter (either PEGCTR or ROLLERCTR) */
+{   /* Each element requires 33 bytes (type and values are kept in separate arrays) */
     ShortString     Name;
-    CounterType     Type;
-    uint32_t        BaseVal,
-                    AggrVal;
 } ScalarCtrInfo;
 
-typedef struct vectorCtrInfo            /* Structure for Vector counter (either PEGCTR or ROLLERCTR) */
-{   /* Each element requires 32+32+1+2+8+8+8+8+8+ numinst x(4+4+16) = 107 + numinst x 24 bytes */
-    ShortString     Name,
-                    InstName;
+typedef struct vectorCtrHot             /* Hot data for Vector counter (either PEGCTR or ROLLERCTR) */
+{   /* Each element requires 1+2+16+16 = 40 bytes (including padding) + numinst x (8+8) x 2 bytes */
     CounterType     Type;
     uint16_t        NumInstances;
-    uint32_t       *BaseVal,
-                   *AggrVal;
+    uint64_t       *BaseVal[2],         /* Cache line aligned arrays of values (one per epoch, see CTRBUF) */
+                   *AggrVal[2];
+} VectorCtrHot;
+
+typedef struct vectorCtrInfo            /* Metadata for Vector counter (either PEGCTR or ROLLERCTR) */
+{   /* Each element requires 32+32+8+4+4+8+8 = 96 bytes + numinst x 16 bytes */
+    ShortString     Name,
+                    InstName;
     MicroString    *InstIdName;
-    FILE           *BaseCtr_fd,
-                   *AggrCtr_fd;
+    int             BaseCtr_fd,         /* Descriptors of base and aggr files (-1 if not open) */
+                    AggrCtr_fd;
+    uint64_t       *BaseMem,            /* Heap blocks holding values (unless they are moved to shared memory, */
+                   *AggrMem;            /* see define_ctr_storage()), pointed to by VectorCtrHot */
 } VectorCtrInfo;
 
+typedef struct sparseCtrInfo           /* Sparse Counter (PEGCTR only), i.e. values keyed by arbitrary 64 bit keys */
+{   /* Open addressing hash table with linear probing: Keys has Mask + 2 cells, the last one */
+    /* being the cell of key 0 (set to 1 once used), since 0 marks free cells; Values has */
+    /* SPARSEVALUES values for each of them, followed by the values of the overflow cell */
+    ShortString     Name,
+                    KeyName;
+    CounterType     Type;               /* UNDEFCTR if not defined */
+    uint32_t        MaxKeys,            /* Max number of keys, then updates go to the overflow cell */
+                    NumKeys,            /* Keys added so far (reserved before a free cell is claimed) */
+                    Mask;               /* Cells of the hash table minus one (power of 2, above MaxKeys) */
+    uint64_t       *Keys,
+                   *Values,             /* Cache line aligned within ValMem */
+                   *ValMem;
+    int             BaseCtr_fd,         /* Descriptors of base and aggr files (-1 if not open) */
+                    AggrCtr_fd;
+} SparseCtrInfo;
+
+typedef struct histoCtrInfo            /* Histogram Counter, i.e. distribution of recorded values (see define_histo_ctr()) */
+{   /* Values are kept in four blocks (base and aggr, one per epoch, see HISTOBUF), each made of */
+    /* HISTOHDR cells (see HISTOSUM) followed by log-linear buckets: values below 2^Bits have a */
+    /* bucket each, above that each power of 2 is split into 2^(Bits-1) buckets */
+    uint8_t         Bits;               /* Significant bits of buckets (0 if not defined) */
+    uint32_t        NumBuckets;
+    uint64_t       *Val[4],             /* Blocks of values (cache line aligned within Mem) */
+                   *Mem;
+    ShortString     Name;
+    int             BaseCtr_fd,         /* Descriptors of base and aggr files (-1 if not open) */
+                    AggrCtr_fd;
+} HistoCtrInfo;
+
+typedef struct summaryCtrInfo          /* Summary Counter metadata (values are kept in summaryVal, see SUMMARYBUF) */
+{
+    ShortString     Name;               /* Counter name (empty if not defined) */
+    int             BaseCtr_fd,         /* Descriptors of base and aggr files (-1 if not open) */
+                    AggrCtr_fd;
+} SummaryCtrInfo;
+
+typedef struct rateCtrInfo             /* Rate of a Peg Counter, updated once per second (see TickRates()) */
+{
+    ShortString     Name;               /* Rate name (empty if not defined) */
+    uint8_t         Class;              /* Class (CTRSCALAR or CTRVECTOR), ID and instance of the counter */
+    uint16_t        CtrId,
+                    CtrInst;
+    uint64_t        Prev[2],            /* Value of the base cell of each epoch at the last tick */
+                    Pending,            /* Increase taken from the frozen cell by a base dump, not ticked yet */
+                    WinSum[CTRRATEHORIZONS];    /* Sum of the increases within each sliding window */
+    uint64_t       *Ring;               /* Increase in each of the last RATEWINDOW seconds (circular) */
+    uint32_t        Ticks,              /* Number of ticks since start_counters() (up to RATEWINDOW) */
+                    Seq;                /* Sequence counter of published rates (odd while they are updated) */
+    double          Ewma[CTRRATEHORIZONS];      /* Moving averages */
+    double          Pub[RATEVALUES];    /* Published rates: EWMAs, then window averages */
+} RateCtrInfo;
+
+typedef struct topKSketch              /* Keys monitored by a Top-K Counter through the Space-Saving algorithm */
+{   /* Slots hold keys with their counts and error bounds; Heap is a min-heap of slots by count */
+    /* (Pos is the position of each slot within it), Table is an open addressing hash table with */
+    /* linear probing mapping keys to slots (TOPKFREE marks free cells) */
+    uint64_t       *Keys,
+                   *Counts,
+                   *Errors;
+    uint32_t       *Heap,
+                   *Pos,
+                   *Table;
+    char           *Names;              /* String keys, CTRTOPKKEYLEN + 1 bytes per slot (NULL with integer keys) */
+    uint32_t        Used;               /* Slots taken so far */
+} TopKSketch;
+
+typedef struct topKCtrInfo             /* Top-K Counter, i.e. heavy hitters among arbitrary keys (see define_topk_ctr()) */
+{
+    ShortString     Name,
+                    KeyName;
+    uint8_t         KeyType;            /* CTRTOPKINTKEY or CTRTOPKSTRKEY */
+    uint16_t        TopK;               /* Keys dumped (0 if not defined) */
+    uint32_t        Slots,              /* Keys monitored */
+                    Mask;               /* Cells of hash tables minus one (power of 2, at least twice Slots) */
+    TopKSketch      Sketch[4];          /* Base and aggr keys, one sketch per epoch (see TOPKBUF) */
+    void           *Mem;                /* Heap block holding all sketches */
+    pthread_mutex_t Mutex;              /* Mutex serializing updates (unless in CTRPLAINMODE) */
+    int             BaseCtr_fd,         /* Descriptors of base and aggr files (-1 if not open) */
+                    AggrCtr_fd;
+} TopKCtrInfo;
+
+typedef struct distinctCtrInfo         /* Distinct Counter, i.e. HyperLogLog estimate of distinct keys (see define_distinct_ctr()) */
+{
+    ShortString     Name;
+    uint8_t         Precision;          /* Bits of hashes selecting registers (0 if not defined) */
+    uint8_t        *Reg[4];             /* Base and aggr registers, 2^Precision each, one array per epoch (see DISTINCTBUF) */
+    void           *Mem;                /* Heap block holding all registers */
+} DistinctCtrInfo;
+
+typedef struct ctrAlarmInfo            /* Threshold alarm on a Scalar Counter or Vector Counter instance (see define_ctr_alarm()) */
+{
+    uint64_t       *Cell[2],            /* Base cell of the counter in each epoch (the same one for Roller Counters), set at start */
+                   *AggrCell[2];        /* Likewise aggr cell (used to fold thread shards) */
+    uint64_t        Limit,              /* Mask of the counter width */
+                    High,               /* Watermarks */
+                    Low,
+                    Prev[2],            /* Value of the base cell of each epoch at the last evaluation (CTRALARMRATE only) */
+                    Pending,            /* Increase taken from the frozen cell by a base dump, not evaluated yet (likewise) */
+                    Value;              /* Watched value at the last evaluation */
+    uint32_t        ShardIdx;           /* Shard cell of the counter (see VectorShardOffset), set at start */
+    uint8_t         Class,              /* Class (CTRSCALAR or CTRVECTOR), ID and instance of the counter */
+                    Type;               /* CTRALARMHIGH or CTRALARMLOW, possibly OR-ed with CTRALARMRATE */
+    CounterType     CtrType;
+    uint16_t        CtrId,
+                    CtrInst;
+    bool            Raised;
+    EventCode       RaiseEvent,         /* Events registered at transitions (UNDEFINED for none) */
+                    ClearEvent;
+    ShortString     Name;               /* Alarm name (empty if not defined) */
+} CtrAlarmInfo;
+
+typedef struct ctrHistoryRing          /* Values of the last dumped intervals of all counters (see define_ctr_history()) */
+{
+    uint64_t       *Values;             /* Depth + 1 rows, each with a value for each shard cell (circular) */
+    time_t         *Slot;               /* Dump time of each row */
+    bool           *Missed;             /* Whether each row refers to a missed dump time (no values) */
+    uint32_t        Depth,              /* Number of intervals kept (0 if not defined) */
+                    Head,               /* Row filled by the dump in progress, never visible to readers */
+                    Count;              /* Number of rows visible to readers (Depth at most) */
+} CtrHistoryRing;
+
+typedef struct ctrWriteOp               /* Operation queued to the asynchronous dump writer (see define_ctr_dump_writer()) */
+{   /* Operations are executed in queuing order, data is copied so that row buffers can be reused at once */
+    struct ctrWriteOp *next;            /* Next operation in the queue of the writer thread */
+    uint8_t         Kind;               /* CTRWRITEOP, CTRSYNCOP or CTRCLOSEOP */
+    int             fd;
+    size_t          Len;                /* Number of bytes of Data (CTRWRITEOP only) */
+    char            Data[];
+} CtrWriteOp;
+
+typedef struct ctrUring                 /* io_uring instance of the asynchronous dump writer (rings mapped from the kernel) */
+{
+    int             fd;
+    unsigned        Entries,
+                    ToSubmit;           /* Entries queued in the submission ring but not submitted yet */
+    unsigned       *SqHead, *SqTail, *SqMask, *SqArray,
+                   *CqHead, *CqTail, *CqMask;
+    struct io_uring_sqe *Sqes;
+    struct io_uring_cqe *Cqes;
+    void           *SqRing, *CqRing;
+    size_t          SqRingSize, CqRingSize, SqesSize;
+} CtrUring;
+
+typedef struct ctrShard                 /* Per thread block of counter cells (used in CTRSHARDEDMODE) */
+{   /* Cells are indexed as Scalar Counter IDs first, then Vector Counter instances */
+    uint64_t       *Cell,               /* Cells updated only by the owning thread (cache line aligned) */
+                   *Folded;             /* Value of each cell at the last fold into shared counters */
+    struct ctrShard *next;
+} CtrShard;
+
 #endif /* MIXFAPI_H_ */
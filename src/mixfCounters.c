@@ -45,13 +45,19 @@
  *   Linux system files   *
  *                        *
  **************************/
-#define _XOPEN_SOURCE 500   /* glibc (2.12 or above) needs this for proper handling of the following
-                               library functions: lstat(), gethostid(), gethostname() and strptime() */
+#define _XOPEN_SOURCE 600   /* glibc (2.12 or above) needs this for proper handling of the following
+                               library functions: lstat(), gethostid(), gethostname(), strptime()
+                               and posix_memalign() */
+#define _DEFAULT_SOURCE     /* needed for syscall(), used by the io_uring dump writer */
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <ctype.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -60,6 +66,14 @@
 #include <errno.h>
 #include <sys/sysmacros.h>
 #include <pthread.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
 
 
 /****************************
@@ -80,8 +94,59 @@
 static uint16_t         numScalarCtr = 0,                     /* Number of Scalar Counters, between 0 and MAXSCALARCTRNUM */
                         numVectorCtr = 0;                     /* Number of Vector Counters, between 0 and MAXVECTORCTRNUM */
 static uint32_t         cumVectorInst = 0;                    /* Cumulative Number of Instances for Vector Counters (<=MAXVECTORCTRINST) */
-static ScalarCtrInfo    scalarCtr[MAXSCALARCTRNUM];           /* Array of Scalar Counters */
-static VectorCtrInfo    vectorCtr[MAXVECTORCTRNUM];           /* Array of Vector Counters */
+static ScalarCtrInfo    scalarCtr[MAXSCALARCTRNUM];           /* Array of Scalar Counters metadata (cold data, only used by definition and dump) */
+static VectorCtrInfo    vectorCtr[MAXVECTORCTRNUM] =          /* Array of Vector Counters metadata (cold data, only used by definition and dump) */
+                            { [0 ... MAXVECTORCTRNUM - 1] = { .BaseCtr_fd = -1, .AggrCtr_fd = -1 } };
+static VectorCtrHot     vectorHot[MAXVECTORCTRNUM]            /* Array of Vector Counters data accessed on each update (hot data) */
+                        __attribute__((aligned(CACHELINESIZE)));
+static CounterType      scalarType[MAXSCALARCTRNUM]           /* Type of Scalar Counters (UNDEFCTR if not defined through define_scalar_ctr()) */
+                        __attribute__((aligned(CACHELINESIZE)));
+static uint64_t         scalarValMem[4][MAXSCALARCTRNUM]      /* Default storage of Scalar Counters values (base and aggr, two buffers each) */
+                        __attribute__((aligned(CACHELINESIZE)));
+static uint64_t        *scalarBaseVal[2] =                    /* Base values of Scalar Counters (one buffer per epoch, see CTRBUF) */
+                            { scalarValMem[0], scalarValMem[1] },
+                       *scalarAggrVal[2] =                    /* Aggregate values of Scalar Counters (one buffer per epoch, see CTRBUF) */
+                            { scalarValMem[2], scalarValMem[3] };
+static uint16_t         numSparseCtr = 0;                     /* Number of Sparse Counters, between 0 and MAXSPARSECTRNUM */
+static SparseCtrInfo    sparseCtr[MAXSPARSECTRNUM] =          /* Array of Sparse Counters (hash tables allocated by define_sparse_ctr()) */
+                            { [0 ... MAXSPARSECTRNUM - 1] = { .Type = UNDEFCTR, .BaseCtr_fd = -1, .AggrCtr_fd = -1 } };
+static uint16_t         numHistoCtr = 0;                      /* Number of Histogram Counters, between 0 and MAXHISTOCTRNUM */
+static HistoCtrInfo     histoCtr[MAXHISTOCTRNUM] =            /* Array of Histogram Counters (buckets allocated by define_histo_ctr()) */
+                            { [0 ... MAXHISTOCTRNUM - 1] = { .BaseCtr_fd = -1, .AggrCtr_fd = -1 } };
+static const double     DefaultHistoPct[4] =                  /* Default percentiles in dumps of Histogram Counters */
+                            { 50, 90, 99, 99.9 };
+static uint8_t          numHistoPct = 4;                      /* Number of percentiles in dumps of Histogram Counters */
+static double           HistoPct[MAXHISTOPCT] =               /* Percentiles in dumps of Histogram Counters (ascending) */
+                            { 50, 90, 99, 99.9 };
+static MicroString      HistoPctName[MAXHISTOPCT] =           /* Column names of percentiles in dumps of Histogram Counters */
+                            { "p50", "p90", "p99", "p99.9" };
+static uint16_t         numSummaryCtr = 0;                    /* Number of Summary Counters, between 0 and MAXSUMMARYCTRNUM */
+static SummaryCtrInfo   summaryCtr[MAXSUMMARYCTRNUM] =        /* Array of Summary Counters metadata (cold data, only used by definition and dump) */
+                            { [0 ... MAXSUMMARYCTRNUM - 1] = { .BaseCtr_fd = -1, .AggrCtr_fd = -1 } };
+static uint64_t         summaryVal[4][MAXSUMMARYCTRNUM][SUMMARYCELLS]   /* Values of Summary Counters (base and aggr, one buffer per epoch, see SUMMARYBUF) */
+                        __attribute__((aligned(CACHELINESIZE)));
+static uint16_t         numRateCtr = 0;                       /* Number of counter rates, between 0 and MAXRATECTRNUM */
+static RateCtrInfo      rateCtr[MAXRATECTRNUM];               /* Array of counter rates (see define_rate_ctr()) */
+static time_t           RateLastTick = 0;                     /* Absolute time of the last tick of rates (see TickRates()) */
+static const uint32_t   RateHorizon[CTRRATEHORIZONS] = { 60, 300, 900 };    /* Horizons of rates in seconds */
+static const double     RateAlpha[CTRRATEHORIZONS] =          /* Smoothing factors of EWMAs ticked once per second, i.e. 1 - exp(-1 / horizon) */
+                            { 0.01652854617838251, 0.0033277839454767255, 0.0011104940557207232 };
+static const char      *RateColumn[RATEVALUES] =              /* Suffixes of the names of the columns of each rate */
+                            { "ewma1m", "ewma5m", "ewma15m", "avg1m", "avg5m", "avg15m" };
+static uint16_t         numTopkCtr = 0;                       /* Number of Top-K Counters, between 0 and MAXTOPKCTRNUM */
+static TopKCtrInfo      topkCtr[MAXTOPKCTRNUM] =              /* Array of Top-K Counters (sketches allocated by define_topk_ctr()) */
+                            { [0 ... MAXTOPKCTRNUM - 1] = { .Mutex = PTHREAD_MUTEX_INITIALIZER, .BaseCtr_fd = -1, .AggrCtr_fd = -1 } };
+static uint16_t         numDistinctCtr = 0;                   /* Number of Distinct Counters, between 0 and MAXDISTINCTCTRNUM */
+static DistinctCtrInfo  distinctCtr[MAXDISTINCTCTRNUM];       /* Array of Distinct Counters (registers allocated by define_distinct_ctr()) */
+static uint16_t         numCtrAlarm = 0;                      /* Number of threshold alarms, between 0 and MAXCTRALARMNUM */
+static CtrAlarmInfo    *ctrAlarm = NULL;                      /* Array of threshold alarms (allocated by define_ctr_alarm_num()) */
+static uint16_t        *AlarmFired = NULL;                    /* IDs of alarms toggled by the last evaluation, to be notified (see EvalCtrAlarms()) */
+static pthread_mutex_t  AlarmMutex = PTHREAD_MUTEX_INITIALIZER;/* Mutex serializing evaluations and notifications of alarms */
+static CtrAlarmCallback CtrAlarmHook = NULL;                  /* Function invoked at transitions of alarms (see define_ctr_alarm_callback()) */
+static time_t           AlarmLastTick = 0;                    /* Absolute time of the last evaluation of alarms (see EvalCtrAlarms()) */
+static uint16_t         CtrHandleGen[2] = { 1, 1 };           /* Generation of handles of Scalar and Vector Counters (see CTRHANDLEGEN), never 0 */
+static uint16_t         CtrRegIndex[2][CTRREGINDEXSIZE];      /* Hash tables of names of registered Scalar and Vector Counters (ID + 1, 0 if empty) */
+static uint64_t         CtrRegMap[2][CTRREGMAPWORDS];         /* Bitmaps of IDs of registered Scalar and Vector Counters */
 static MediumString     BaseCtrDir = "",                      /* Path to the directory in which Base counters are collected */
                         AggrCtrDir = "";                      /* Path to the directory in which Aggr counters are collected */
 static LongString       BaseDumpTimes = "";                   /* String containing base dump times (third parameter of define_base_dump) */
@@ -90,14 +155,77 @@ static MicroString      BaseCtrTimeStampFormat = "%d%m%Y",    /* String containi
                         AggrCtrTimeStampFormat = "%d%m%Y",    /* String containing aggr dump time stamp format (second parameter of define_aggr_dump) */
                         BaseDumpOpenDate = "",                /* Date when the current base ctr file was opened, local to the library */
                         AggrDumpOpenDate = "";                /* Date when the current aggr ctr file was opened, local to the library */
-char                   *BaseNextDump = NULL,                  /* Pointer within BaseDumpTimes to the next dump time */
-                       *AggrNextDump = NULL;                  /* Pointer within AggrDumpTimes to the next dump time */
+static uint64_t         BaseDumpMap[DUMPMAPWORDS],            /* Base dump times compiled as a bitmap of the minutes of the day */
+                        AggrDumpMap[DUMPMAPWORDS];            /* Aggr dump times compiled as a bitmap of the minutes of the day */
+static uint32_t         BaseDumpPeriod = 0;                   /* Base dump period in seconds ("every Ns" schedule), 0 if BaseDumpMap is used */
+static time_t           BaseNextDumpTime = NODUMPTIME,        /* Absolute time of the next base dump slot */
+                        AggrNextDumpTime = NODUMPTIME,        /* Absolute time of the next aggr dump slot */
+                        BaseLastDumpTime = 0,                 /* Absolute time of the last base dump slot (or of counters start) */
+                        AggrLastDumpTime = 0;                 /* Absolute time of the last aggr dump slot (or of counters start) */
 static bool             BaseCtrActive = false,                /* Flag used to understand whether the base ctr file is open or not (not mutex protected) */
                         AggrCtrActive = false;                /* Flag used to understand whether the aggr ctr file is open or not (not mutex protected) */
-static FILE            *BaseCtr_fd = NULL;                    /* File descriptor for base scalar counters */
-static FILE            *AggrCtr_fd = NULL;                    /* File descriptor for aggregated scalar counters */
+static int              BaseCtr_fd = -1;                      /* File descriptor for base scalar counters */
+static int              AggrCtr_fd = -1;                      /* File descriptor for aggregated scalar counters */
+static int              BaseRateCtr_fd = -1,                  /* File descriptors of base and aggr rates files (CTRCSVDUMP only) */
+                        AggrRateCtr_fd = -1;
+static int              BaseDistinctCtr_fd = -1,              /* File descriptors of base and aggr Distinct Counters files (CTRCSVDUMP only) */
+                        AggrDistinctCtr_fd = -1;
 static pthread_mutex_t  BaseMutex = PTHREAD_MUTEX_INITIALIZER;/* Mutex used to handle cuncurrent access to Base Counter file */
 static pthread_mutex_t  AggrMutex = PTHREAD_MUTEX_INITIALIZER;/* Mutex used to handle cuncurrent access to Aggr Counter file */
+static uint8_t          BaseEpoch = 0,                        /* Live buffer of Peg counters base values (the other one is frozen at dump time) */
+                        AggrEpoch = 0;                        /* Live buffer of Peg counters aggr values (the other one is frozen at dump time) */
+static uint8_t          CtrUpdateMode = CTRPLAINMODE;         /* Counter update mode (CTRPLAINMODE, CTRATOMICMODE or CTRSHARDEDMODE) */
+static uint32_t         VectorShardOffset[MAXVECTORCTRNUM];   /* Offset of the first instance of each Vector Counter within shard cells */
+static uint32_t         numShardCells = 0;                    /* Number of cells in each shard (Scalar Counters + Vector Counters instances) */
+static uint32_t         DistinctShardOffset[MAXDISTINCTCTRNUM];/* Offset of the first cell of the registers of each Distinct Counter within shard cells */
+static uint32_t         HistoShardOffset[MAXHISTOCTRNUM];     /* Offset of the first cell of the block of each Histogram Counter within shard cells */
+static uint32_t         numShardSpan = 0;                     /* Number of cells in each shard, Summary, Distinct and Histogram Counters cells included */
+static uint32_t         ShardGeneration = 0;                  /* Incremented by start_counters(), invalidates shards of previous runs */
+static CtrShard        *ShardList = NULL;                     /* List of shards registered by threads updating counters */
+static pthread_mutex_t  ShardMutex = PTHREAD_MUTEX_INITIALIZER;/* Mutex used to handle shard registration and folding */
+static __thread CtrShard *ThreadShard = NULL;                 /* Shard owned by the current thread (CTRSHARDEDMODE only) */
+static __thread uint32_t  ThreadShardGen = 0;                 /* Value of ShardGeneration when ThreadShard was registered */
+static pthread_key_t    ShardKey;                             /* Key whose destructor releases the shard of an exiting thread */
+static pthread_once_t   ShardKeyOnce = PTHREAD_ONCE_INIT;     /* Ensures that ShardKey is created once */
+static bool             ShardKeyValid = false;                /* Set if ShardKey has been created */
+static bool             DumpThreadActive = false;             /* Set if dumps are handled by the thread spawned by start_counters_async() */
+static pthread_t        DumpThread;                           /* Thread spawned by start_counters_async() */
+static uint8_t          CtrStorage = CTRHEAPSTORAGE;          /* Storage of counters values (CTRHEAPSTORAGE, CTRSHMSTORAGE or CTRFILESTORAGE) */
+static MediumString     CtrStorageName = "";                  /* Name of the shared memory segment or of the state file */
+static CtrShmHeader    *CtrSegment = NULL;                    /* Segment holding counters values (if mapped) */
+static size_t           CtrSegmentSize = 0;                   /* Size of the mapped segment */
+static bool             CtrSegmentResumed = false;            /* Set if the mapped segment is a state file resumed as is (CTRFILESTORAGE only) */
+static uint8_t          CtrDumpFormat = CTRCSVDUMP;           /* Format of dump files (CTRCSVDUMP, CTRCSVTAGGED or CTRBINDUMP, possibly OR-ed with an encoding) */
+static uint64_t        *BasePrevVal = NULL,                   /* Values of the last binary row of base counters (CTRDELTAENC only) */
+                       *AggrPrevVal = NULL;                   /* Values of the last binary row of aggr counters (CTRDELTAENC only) */
+static uint16_t         CtrHistoryDepth[2] = { 0, 0 };        /* Base and aggr intervals to be kept in history rings (see define_ctr_history()) */
+static CtrHistoryRing   CtrHistory[2];                        /* History rings of base [0] and aggr [1] values, rows also used by dumps */
+static pthread_mutex_t  HistoryMutex = PTHREAD_MUTEX_INITIALIZER;/* Mutex used to publish rows of history rings */
+static uint32_t         CtrDumpSync = CTRNOSYNC,              /* Number of dumps after which files are synced to disk (CTRNOSYNC: never) */
+                        BaseUnsyncedDumps = 0,                /* Number of base dumps written since base files were last synced */
+                        AggrUnsyncedDumps = 0;                /* Number of aggr dumps written since aggr files were last synced */
+static uint8_t          CtrDumpWriter = CTRDIRECTWRITER,      /* Writer of dump files defined through define_ctr_dump_writer() */
+                        CtrWriterActive = CTRDIRECTWRITER;    /* Writer actually in use (CTRURINGWRITER may fall back to CTRTHREADWRITER) */
+static CtrUring         CtrRing = { .fd = -1 };               /* io_uring instance (CTRURINGWRITER only) */
+static pthread_t        WriterThread;                         /* Writer thread (CTRTHREADWRITER only) */
+static CtrWriteOp      *WriterHead = NULL,                    /* Queue of operations of the writer thread (CTRTHREADWRITER only) */
+                       *WriterTail = NULL;
+static bool             WriterStop = false;                   /* Set to stop the writer thread */
+static pthread_mutex_t  WriterMutex = PTHREAD_MUTEX_INITIALIZER;/* Mutex used to handle the asynchronous writer and its statistics */
+static pthread_cond_t   WriterQueueCond = PTHREAD_COND_INITIALIZER,/* Signalled when operations are queued to the writer thread */
+                        WriterDoneCond = PTHREAD_COND_INITIALIZER; /* Signalled when operations are completed by the writer thread */
+static uint64_t         WriterInFlightBytes = 0,              /* Statistics of the asynchronous writer (see CtrWriterStats) */
+                        WriterInFlightOps = 0,
+                        WriterWrittenBytes = 0,
+                        WriterErrors = 0;
+static char            *BaseRowBuf = NULL,                    /* Buffer used to encode rows of base counters files */
+                       *AggrRowBuf = NULL;                    /* Buffer used to encode rows of aggr counters files */
+static char            *BaseSparseBuf = NULL,                 /* Buffer used to encode rows of Sparse Counters in base files */
+                       *AggrSparseBuf = NULL;                 /* Buffer used to encode rows of Sparse Counters in aggr files */
+static uint64_t        *BaseHistoBuf = NULL,                  /* Buckets of a Histogram Counter moved out of base values at dump time */
+                       *AggrHistoBuf = NULL;                  /* Buckets of a Histogram Counter moved out of aggr values at dump time */
+static int              DumpTimer_fd = -1,                    /* timerfd armed for the next dump time (used by DumpThread) */
+                        DumpStop_fd = -1;                     /* eventfd used by stop_counters() to stop DumpThread */
 
 
 /*******************************
@@ -106,6 +234,4564 @@ static pthread_mutex_t  AggrMutex = PTHREAD_MUTEX_INITIALIZER;/* Mutex used to h
  * (only visible in this file) *
  *                             *
  *******************************/
+/*
+ * This is an internal function that sets the pointers to the values of a Vector Counter
+ * (see VectorCtrHot), given the blocks holding base and aggr values. For Peg counters
+ * each block holds two buffers (one per epoch), the second one starting on the first
+ * cache line after the first one; Roller counters use a single buffer.
+ */
+static void SetVectorValues(uint16_t ctrId, CounterType type, uint16_t numInst, uint64_t *base, uint64_t *aggr)
+{
+    size_t      stride;
+
+    stride = (CTRKIND(type) == PEGCTR) ? CTRSTRIDE(numInst) : 0;
+    vectorHot[ctrId].BaseVal[0] = base;
+    vectorHot[ctrId].AggrVal[0] = aggr;
+    vectorHot[ctrId].BaseVal[1] = (base != NULL) ? base + stride : NULL;
+    vectorHot[ctrId].AggrVal[1] = (aggr != NULL) ? aggr + stride : NULL;
+}
+
+
+/*
+ * This is an internal function that increases by n a single Peg counter cell
+ * (either base or aggregate value). In CTRATOMICMODE the increase is performed
+ * through a relaxed atomic add, so that concurrent threads never lose increments,
+ * otherwise it is a plain add. Cells are always 64 bit wide: the value of 32 bit
+ * counters is obtained by masking the cell with MAXCTRVALUE, so that wrapping is
+ * preserved even with atomic adds. It returns true if the counter has wrapped
+ * around the maximum value allowed by its width (third parameter), false otherwise.
+ */
+static inline bool AddPegCell(uint64_t *cell, uint64_t n, uint64_t limit)
+{
+    uint64_t    old;
+
+    if (CtrUpdateMode == CTRATOMICMODE)
+        old = __atomic_fetch_add(cell, n, __ATOMIC_RELAXED);
+    else
+    {
+        old = *cell;
+        *cell = old + n;
+    }
+
+    return (n > limit - (old & limit));
+}
+
+
+/*
+ * This is an internal function that evaluates the new value of a Roller counter
+ * cell, given its current value, the delta to be applied and the maximum value
+ * allowed by the counter width. The result is capped to the maximum value or to 0
+ * (Roller counters never wrap); in that case the flag pointed to by the last
+ * parameter is set to true.
+ */
+static inline uint64_t SaturateRollerValue(uint64_t val, int64_t delta, uint64_t limit, bool *capped)
+{
+    uint64_t    abs;
+
+    *capped = false;
+    if (delta >= 0)
+    {
+        if ((uint64_t)delta > limit - val)
+        {   /* the counter would wrap over the maximum allowed value */
+            *capped = true;
+            return (limit);
+        }
+        return (val + (uint64_t)delta);
+    }
+
+    abs = (uint64_t)(-(delta + 1)) + 1;
+    if (abs > val)
+    {   /* the counter would become negative */
+        *capped = true;
+        return (0);
+    }
+    return (val - abs);
+}
+
+
+/*
+ * This is an internal function that updates a single Roller counter cell (either
+ * base or aggregate value) by the specified delta. In CTRATOMICMODE (and in
+ * CTRSHARDEDMODE, where it is invoked while folding shards) the update is
+ * performed through a compare-and-swap loop, so that the saturation logic is applied
+ * consistently even in case of concurrent updates. It returns true if the value has
+ * been capped (either to the maximum value or to 0), false otherwise.
+ */
+static inline bool UpdateRollerCell(uint64_t *cell, int64_t delta, uint64_t limit)
+{
+    uint64_t    old, new;
+    bool        capped;
+
+    if (CtrUpdateMode != CTRPLAINMODE)
+    {
+        old = __atomic_load_n(cell, __ATOMIC_RELAXED);
+        do
+            new = SaturateRollerValue(old, delta, limit, &capped);
+        while (!__atomic_compare_exchange_n(cell, &old, new, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    }
+    else
+        *cell = SaturateRollerValue(*cell, delta, limit, &capped);
+
+    return (capped);
+}
+
+
+/*
+ * This is an internal function used at dump time to read the value of a counter
+ * cell. Peg counters are read from the frozen buffer and reset through a single
+ * atomic exchange, so that increments applied by threads that were still using the
+ * frozen buffer while the epoch was flipped are never lost (they are dumped with the
+ * next use of this buffer). Roller counters are left unchanged. The returned value is
+ * masked according to the counter width.
+ */
+static inline uint64_t FetchCellForDump(uint64_t *cell, CounterType type)
+{
+    if (CTRKIND(type) != PEGCTR)
+        return (__atomic_load_n(cell, __ATOMIC_RELAXED));
+
+    return (__atomic_exchange_n(cell, 0, __ATOMIC_RELAXED) & CTRLIMIT(type));
+}
+
+
+/*
+ * This is an internal function used at dump time to fetch the values of all counters
+ * (Scalar Counters first, then all instances of each Vector Counter, as shard cells),
+ * either base or aggr ones, from the buffer frozen at dump time (see FetchCellForDump()).
+ * Values are stored in the head row of the history ring, which is never visible to
+ * readers until CommitHistoryRow() is called (the ring has a single row if no history
+ * is kept), and formatted from there in dump files.
+ * It returns the row of values.
+ */
+static uint64_t *FetchDumpRow(bool aggr, uint8_t frozen)
+{
+    CtrHistoryRing *h = &CtrHistory[aggr];
+    uint64_t      **scalarVal, *val, *row;
+    int             i, j;
+
+    row = h->Values + (size_t)h->Head * numShardCells;
+    scalarVal = aggr ? scalarAggrVal : scalarBaseVal;
+    for (i = 0; i < numScalarCtr; i++)
+        row[i] = FetchCellForDump(&scalarVal[CTRBUF(scalarType[i], frozen)][i], scalarType[i]);
+
+    for (i = 0; i < numVectorCtr; i++)
+    {
+        val = aggr ? vectorHot[i].AggrVal[CTRBUF(vectorHot[i].Type, frozen)] :
+                     vectorHot[i].BaseVal[CTRBUF(vectorHot[i].Type, frozen)];
+        for (j = 0; j < vectorHot[i].NumInstances; j++)
+            row[VectorShardOffset[i] + j] = FetchCellForDump(&val[j], vectorHot[i].Type);
+    }
+
+    return (row);
+}
+
+
+/*
+ * This is an internal function that publishes the head row of the base or aggr history
+ * ring once a dump slot has been written (missed tells whether the slot has been missed,
+ * so that the row has no values). The oldest row is dropped when the ring is full, and
+ * the next row becomes the head one, which readers never access.
+ */
+static void CommitHistoryRow(bool aggr, time_t slot, bool missed)
+{
+    CtrHistoryRing *h = &CtrHistory[aggr];
+
+    if (h->Depth == 0)
+        return;
+
+    pthread_mutex_lock(&HistoryMutex);
+    h->Slot[h->Head] = slot;
+    h->Missed[h->Head] = missed;
+    h->Head = (h->Head + 1) % (h->Depth + 1);
+    if (h->Count < h->Depth)
+        h->Count++;
+    pthread_mutex_unlock(&HistoryMutex);
+}
+
+
+/*
+ * This is an internal function that releases history rings (see define_ctr_history()).
+ */
+static void ReleaseCtrHistory(void)
+{
+    int     a;
+
+    pthread_mutex_lock(&HistoryMutex);
+    for (a = 0; a < 2; a++)
+    {
+        free(CtrHistory[a].Values);
+        free(CtrHistory[a].Slot);
+        free(CtrHistory[a].Missed);
+        memset(&CtrHistory[a], 0, sizeof(CtrHistoryRing));
+    }
+    pthread_mutex_unlock(&HistoryMutex);
+}
+
+
+/*
+ * This is an internal function that allocates history rings, with the depth defined
+ * through define_ctr_history(), once the layout of shard cells is known. Rings have a
+ * row more than their depth (the head one, filled by the dump in progress), so that
+ * dumps use their rows even if no history is kept.
+ * It returns MIXFOK, or MIXFKO if memory cannot be allocated.
+ */
+static Error AllocCtrHistory(void)
+{
+    CtrHistoryRing *h;
+    int             a;
+
+    ReleaseCtrHistory();
+    for (a = 0; a < 2; a++)
+    {
+        h = &CtrHistory[a];
+        h->Depth = CtrHistoryDepth[a];
+        h->Values = (uint64_t *)calloc((size_t)(h->Depth + 1) * numShardCells + 1, sizeof(uint64_t));
+        h->Slot = (time_t *)calloc(h->Depth + 1, sizeof(time_t));
+        h->Missed = (bool *)calloc(h->Depth + 1, sizeof(bool));
+        if ((h->Values == NULL) || (h->Slot == NULL) || (h->Missed == NULL))
+        {
+            ReleaseCtrHistory();
+            return (MIXFKO);
+        }
+    }
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This is an internal function that allocates the shard of the calling thread and
+ * registers it in the list of shards (CTRSHARDEDMODE only). A shard is a private,
+ * cache line aligned block of cells (one per Scalar Counter and one per instance of
+ * Vector Counters, then SUMMARYCELLS per Summary Counter, then the registers of Distinct
+ * Counters, eight per cell, then a block per Histogram Counter), which are updated only
+ * by the owning thread and are folded into the shared counters by check_and_dump_ctr()
+ * and by retrieve functions.
+ * It returns the new shard, or NULL if memory cannot be allocated.
+ */
+static CtrShard *RegisterThreadShard(void)
+{
+    CtrShard   *shard;
+    size_t      size;
+    int         i;
+
+    /* Round the size of the cell block up to a multiple of the cache line */
+    size = (((size_t)numShardSpan * sizeof(uint64_t) + CACHELINESIZE - 1) /
+            CACHELINESIZE) * CACHELINESIZE;
+    if (size == 0)
+        size = CACHELINESIZE;
+
+    if ((shard = (CtrShard *)calloc(1, sizeof(CtrShard))) == NULL)
+        return (NULL);
+    if (posix_memalign((void **)&shard->Cell, CACHELINESIZE, size) != 0)
+    {
+        free(shard);
+        return (NULL);
+    }
+    if ((shard->Folded = (uint64_t *)calloc(1, size)) == NULL)
+    {
+        free(shard->Cell);
+        free(shard);
+        return (NULL);
+    }
+    memset(shard->Cell, 0, size);
+    for (i = 0; i < numSummaryCtr; i++)
+        shard->Cell[numShardCells + (size_t)i * SUMMARYCELLS + SUMMIN] = UINT64_MAX;
+    for (i = 0; i < numHistoCtr; i++)
+        if (histoCtr[i].Bits != 0)
+            shard->Cell[HistoShardOffset[i] + HISTOMIN] = UINT64_MAX;
+
+    pthread_mutex_lock(&ShardMutex);
+    if (BaseCtrActive == false)
+    {   /* Counters stopped in the meanwhile */
+        pthread_mutex_unlock(&ShardMutex);
+        free(shard->Folded);
+        free(shard->Cell);
+        free(shard);
+        return (NULL);
+    }
+    shard->next = ShardList;
+    ShardList = shard;
+    ThreadShard = shard;
+    ThreadShardGen = ShardGeneration;
+    pthread_mutex_unlock(&ShardMutex);
+
+    /* Have the shard folded and released when the thread exits */
+    if (ShardKeyValid)
+        pthread_setspecific(ShardKey, shard);
+
+    return (shard);
+}
+
+
+/*
+ * This is an internal function that adds a signed delta to a cell of the shard owned
+ * by the calling thread (CTRSHARDEDMODE only), registering the shard if this is the
+ * first update performed by the thread. Since the cell is written only by its owner,
+ * this is a plain load/add/store (the relaxed atomic store only prevents torn writes
+ * that could be observed while folding). It returns MIXFKO if the shard cannot be
+ * allocated, MIXFOK otherwise.
+ */
+static inline Error AddShardCell(uint32_t idx, int64_t delta)
+{
+    CtrShard   *shard = ThreadShard;
+    uint64_t   *cell;
+
+    if (ThreadShardGen != ShardGeneration)
+        if ((shard = RegisterThreadShard()) == NULL)
+            return (MIXFKO);
+
+    cell = &shard->Cell[idx];
+    __atomic_store_n(cell, *cell + (uint64_t)delta, __ATOMIC_RELAXED);
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This is an internal function that folds a single shard cell into the shared base
+ * and aggregate values of a counter (CTRSHARDEDMODE only). The difference between
+ * the current value of the cell and its value at the previous fold is applied with
+ * the usual Peg (wrap) and Roller (saturation) semantics.
+ * BE AWARE that it shall be invoked while holding ShardMutex.
+ */
+static inline void FoldShardCell(CtrShard *shard, uint32_t idx, CounterType type, uint64_t *base, uint64_t *aggr)
+{
+    uint64_t    cur;
+    int64_t     delta;
+
+    cur = __atomic_load_n(&shard->Cell[idx], __ATOMIC_RELAXED);
+    if ((delta = (int64_t)(cur - shard->Folded[idx])) == 0)
+        return;
+    shard->Folded[idx] = cur;
+
+    if (CTRKIND(type) == PEGCTR)
+    {
+        __atomic_fetch_add(base, (uint64_t)delta, __ATOMIC_RELAXED);
+        __atomic_fetch_add(aggr, (uint64_t)delta, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        UpdateRollerCell(base, delta, CTRLIMIT(type));
+        UpdateRollerCell(aggr, delta, CTRLIMIT(type));
+    }
+}
+
+
+/*
+ * This is an internal function that lowers a shared cell to v, if v is lower than its
+ * value, through compare and swap (the cell is only written if it changes).
+ */
+static inline void AtomicMinCell(uint64_t *cell, uint64_t v)
+{
+    uint64_t    cur = __atomic_load_n(cell, __ATOMIC_RELAXED);
+
+    while ((v < cur) && !__atomic_compare_exchange_n(cell, &cur, v, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+
+/*
+ * This is an internal function that raises a shared cell to v, if v is greater than
+ * its value, through compare and swap (the cell is only written if it changes).
+ */
+static inline void AtomicMaxCell(uint64_t *cell, uint64_t v)
+{
+    uint64_t    cur = __atomic_load_n(cell, __ATOMIC_RELAXED);
+
+    while ((v > cur) && !__atomic_compare_exchange_n(cell, &cur, v, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+
+/*
+ * This is an internal function that raises a register of a Distinct Counter to v, if v
+ * is greater than its value, in the same way as AtomicMaxCell().
+ */
+static inline void AtomicMaxReg(uint8_t *reg, uint8_t v)
+{
+    uint8_t     cur = __atomic_load_n(reg, __ATOMIC_RELAXED);
+
+    while ((v > cur) && !__atomic_compare_exchange_n(reg, &cur, v, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+
+/*
+ * This is an internal function that folds the shard cells of a Summary Counter, starting
+ * at idx, into its shared base values (CTRSHARDEDMODE only). Count and sum are folded
+ * as differences from the previous fold, as Peg counters; min and max are taken from
+ * the shard through atomic exchanges with their initial values, so that the owner
+ * starts a new interval (a value observed while folding is at most accounted to the
+ * next interval).
+ * BE AWARE that it shall be invoked while holding ShardMutex.
+ */
+static inline void FoldShardSummary(CtrShard *shard, uint32_t idx, uint64_t *val)
+{
+    uint64_t   *cell = &shard->Cell[idx],
+                cur;
+    int         j;
+
+    for (j = SUMCOUNT; j <= SUMSUM; j++)
+        if ((cur = __atomic_load_n(&cell[j], __ATOMIC_RELAXED)) != shard->Folded[idx + j])
+        {
+            __atomic_fetch_add(&val[j], cur - shard->Folded[idx + j], __ATOMIC_RELAXED);
+            shard->Folded[idx + j] = cur;
+        }
+    if (__atomic_load_n(&cell[SUMMIN], __ATOMIC_RELAXED) != UINT64_MAX)
+        AtomicMinCell(&val[SUMMIN], __atomic_exchange_n(&cell[SUMMIN], UINT64_MAX, __ATOMIC_RELAXED));
+    if (__atomic_load_n(&cell[SUMMAX], __ATOMIC_RELAXED) != 0)
+        AtomicMaxCell(&val[SUMMAX], __atomic_exchange_n(&cell[SUMMAX], 0, __ATOMIC_RELAXED));
+}
+
+
+/*
+ * This is an internal function that folds the registers of a Distinct Counter of
+ * precision p, starting at cell idx, into its shared base registers (CTRSHARDEDMODE
+ * only). Cells without registers set are skipped at once; registers are taken from the
+ * shard through atomic exchanges with 0 and merged through their max, so that the owner
+ * starts a new interval, as in FoldShardSummary().
+ * BE AWARE that it shall be invoked while holding ShardMutex.
+ */
+static inline void FoldShardDistinct(CtrShard *shard, uint32_t idx, uint8_t p, uint8_t *reg)
+{
+    uint8_t    *cell = (uint8_t *)&shard->Cell[idx];
+    uint32_t    w, j;
+
+    for (w = 0; w < (1U << p) / 8; w++)
+    {
+        if (__atomic_load_n(&shard->Cell[idx + w], __ATOMIC_RELAXED) == 0)
+            continue;
+        for (j = 8 * w; j < 8 * w + 8; j++)
+            if (__atomic_load_n(&cell[j], __ATOMIC_RELAXED) != 0)
+                AtomicMaxReg(&reg[j], __atomic_exchange_n(&cell[j], 0, __ATOMIC_RELAXED));
+    }
+}
+
+
+/*
+ * This is an internal function that folds the block of a Histogram Counter h, starting
+ * at cell idx, into its shared base block (CTRSHARDEDMODE only). Buckets and sum are
+ * folded as differences from the previous fold, and only if they have changed; min and
+ * max are taken as in FoldShardSummary().
+ * BE AWARE that it shall be invoked while holding ShardMutex.
+ */
+static inline void FoldShardHisto(CtrShard *shard, uint32_t idx, HistoCtrInfo *h, uint64_t *blk)
+{
+    uint64_t   *cell = &shard->Cell[idx],
+                cur;
+    uint32_t    j;
+
+    for (j = 0; j < HISTOHDR + h->NumBuckets; j++)
+    {
+        if ((j == HISTOMIN) || (j == HISTOMAX))
+            continue;
+        if ((cur = __atomic_load_n(&cell[j], __ATOMIC_RELAXED)) != shard->Folded[idx + j])
+        {
+            __atomic_fetch_add(&blk[j], cur - shard->Folded[idx + j], __ATOMIC_RELAXED);
+            shard->Folded[idx + j] = cur;
+        }
+    }
+    if (__atomic_load_n(&cell[HISTOMIN], __ATOMIC_RELAXED) != UINT64_MAX)
+        AtomicMinCell(&blk[HISTOMIN], __atomic_exchange_n(&cell[HISTOMIN], UINT64_MAX, __ATOMIC_RELAXED));
+    if (__atomic_load_n(&cell[HISTOMAX], __ATOMIC_RELAXED) != 0)
+        AtomicMaxCell(&blk[HISTOMAX], __atomic_exchange_n(&cell[HISTOMAX], 0, __ATOMIC_RELAXED));
+}
+
+
+/*
+ * This is an internal function that folds the cells of a shard in the interval
+ * [first, last) into the shared counters (CTRSHARDEDMODE only). Cells are indexed
+ * as Scalar Counter IDs first, then Vector Counter instances (see VectorShardOffset),
+ * then SUMMARYCELLS cells for each Summary Counter (starting at numShardCells), then the
+ * registers of Distinct Counters (see DistinctShardOffset), then the blocks of Histogram
+ * Counters (see HistoShardOffset); registers and blocks are folded as a whole if their
+ * first cell is in the interval.
+ * BE AWARE that it shall be invoked while holding ShardMutex.
+ */
+static void FoldShard(CtrShard *shard, uint32_t first, uint32_t last)
+{
+    uint32_t    idx, from, to;
+    int         i;
+
+    /* Scalar Counters cells */
+    for (idx = first; (idx < last) && (idx < numScalarCtr); idx++)
+        FoldShardCell(shard, idx, scalarType[idx],
+                      &scalarBaseVal[CTRBUF(scalarType[idx], BaseEpoch)][idx],
+                      &scalarAggrVal[CTRBUF(scalarType[idx], AggrEpoch)][idx]);
+
+    /* Vector Counters instances cells */
+    for (i = 0; i < numVectorCtr; i++)
+    {
+        from = (first > VectorShardOffset[i]) ? first : VectorShardOffset[i];
+        to = VectorShardOffset[i] + vectorHot[i].NumInstances;
+        if (to > last)
+            to = last;
+        for (idx = from; idx < to; idx++)
+            FoldShardCell(shard, idx, vectorHot[i].Type,
+                          &vectorHot[i].BaseVal[CTRBUF(vectorHot[i].Type, BaseEpoch)][idx - VectorShardOffset[i]],
+                          &vectorHot[i].AggrVal[CTRBUF(vectorHot[i].Type, AggrEpoch)][idx - VectorShardOffset[i]]);
+    }
+
+    /* Summary Counters cells (only base values, aggr ones are folded at base dump time) */
+    for (i = 0; i < numSummaryCtr; i++)
+    {
+        idx = numShardCells + (uint32_t)i * SUMMARYCELLS;
+        if ((idx >= first) && (idx < last))
+            FoldShardSummary(shard, idx, summaryVal[SUMMARYBUF(false, BaseEpoch)][i]);
+    }
+
+    /* Distinct Counters registers (likewise only base ones) */
+    for (i = 0; i < numDistinctCtr; i++)
+    {
+        idx = DistinctShardOffset[i];
+        if ((distinctCtr[i].Precision != 0) && (idx >= first) && (idx < last))
+            FoldShardDistinct(shard, idx, distinctCtr[i].Precision, distinctCtr[i].Reg[DISTINCTBUF(false, BaseEpoch)]);
+    }
+
+    /* Histogram Counters blocks (likewise only base ones) */
+    for (i = 0; i < numHistoCtr; i++)
+    {
+        idx = HistoShardOffset[i];
+        if ((histoCtr[i].Bits != 0) && (idx >= first) && (idx < last))
+            FoldShardHisto(shard, idx, &histoCtr[i], histoCtr[i].Val[HISTOBUF(false, BaseEpoch)]);
+    }
+}
+
+
+/*
+ * This is an internal function that folds the shard cells in the interval
+ * [first, last) of all threads into the shared counters (CTRSHARDEDMODE only),
+ * see FoldShard().
+ * BE AWARE that it takes ShardMutex, therefore it shall not be invoked while
+ * holding it.
+ */
+static void FoldShards(uint32_t first, uint32_t last)
+{
+    CtrShard   *shard;
+
+    pthread_mutex_lock(&ShardMutex);
+    for (shard = ShardList; shard != NULL; shard = shard->next)
+        FoldShard(shard, first, last);
+    pthread_mutex_unlock(&ShardMutex);
+}
+
+
+/*
+ * This is an internal function invoked as destructor of ShardKey when a thread that
+ * has registered a shard exits (CTRSHARDEDMODE only). All the cells of the shard are
+ * folded into the shared counters, then the shard is unlinked and released, so that
+ * threads created and terminated while counters are running (e.g. one per connection)
+ * neither leak their shards nor slow down folds. Thread local storage is still valid
+ * while key destructors run: a shard registered before the last stop_counters() has
+ * already been released by ReleaseShards(), and it is detected through ShardGeneration.
+ */
+static void ReleaseThreadShard(void *arg)
+{
+    CtrShard   *shard = ThreadShard,
+              **prev;
+
+    (void)arg;
+    pthread_mutex_lock(&ShardMutex);
+    if ((shard != NULL) && (ThreadShardGen == ShardGeneration))
+    {
+        FoldShard(shard, 0, numShardSpan);
+        for (prev = &ShardList; *prev != NULL; prev = &(*prev)->next)
+            if (*prev == shard)
+            {
+                *prev = shard->next;
+                break;
+            }
+        free(shard->Cell);
+        free(shard->Folded);
+        free(shard);
+    }
+    ThreadShard = NULL;
+    ThreadShardGen = 0;
+    pthread_mutex_unlock(&ShardMutex);
+}
+
+
+/*
+ * This is an internal function that creates ShardKey, through which shards are
+ * released when their threads exit (see ReleaseThreadShard()). It is invoked once,
+ * through pthread_once(), by start_counters(); if the key cannot be created, shards
+ * are only released by stop_counters().
+ */
+static void CreateShardKey(void)
+{
+    ShardKeyValid = (pthread_key_create(&ShardKey, ReleaseThreadShard) == 0);
+}
+
+
+/*
+ * This is an internal function that releases all the shards registered by threads
+ * (CTRSHARDEDMODE only). It is invoked by stop_counters(); shards still referenced
+ * by thread local storage are invalidated through ShardGeneration.
+ */
+static void ReleaseShards(void)
+{
+    CtrShard   *shard;
+
+    pthread_mutex_lock(&ShardMutex);
+    while ((shard = ShardList) != NULL)
+    {
+        ShardList = shard->next;
+        free(shard->Cell);
+        free(shard->Folded);
+        free(shard);
+    }
+    ShardGeneration++;
+    pthread_mutex_unlock(&ShardMutex);
+}
+
+
+/*
+ * This is an internal function that increases by n a Peg Scalar Counter of type ctrType,
+ * once the caller has checked it (either through its ID or through its handle).
+ */
+static inline Error AddPegScalarValue(uint16_t ctrId, CounterType ctrType, uint64_t n)
+{
+    Error       res = MIXFOK;
+    uint64_t    limit,
+               *base,
+               *aggr;
+
+    if (CtrUpdateMode == CTRSHARDEDMODE)
+        return (AddShardCell(ctrId, (int64_t)n));
+
+    limit = CTRLIMIT(ctrType);
+    base = &scalarBaseVal[__atomic_load_n(&BaseEpoch, __ATOMIC_RELAXED)][ctrId];
+    aggr = &scalarAggrVal[__atomic_load_n(&AggrEpoch, __ATOMIC_RELAXED)][ctrId];
+    if (AddPegCell(base, n, limit))
+        res = MIXFOVFL;
+    if (AddPegCell(aggr, n, limit))
+        res = MIXFOVFL;
+
+    return(res);
+}
+
+
+/*
+ * This is an internal function that implements both incr_peg_scalar_ctr() and
+ * add_peg_scalar_ctr() (see the latter for parameters and return values). It is
+ * kept static, so that it can be inlined in both public functions. The counter type
+ * is checked once against both widths, so that each add path is inlined with a
+ * constant width and 32 bit counters do not pay for the 64 bit overflow check.
+ */
+static inline Error AddPegScalarCtr(uint16_t ctrId, uint64_t n)
+{
+    if (BaseCtrActive == false)     /* if counters have not been started return error */
+        return (MIXFKO);
+
+    if (ctrId >= numScalarCtr)
+        return (MIXFKO);
+
+    if (scalarType[ctrId] == PEGCTR)
+        return (AddPegScalarValue(ctrId, PEGCTR, n));
+    if (scalarType[ctrId] == (PEGCTR | CTR64BIT))
+        return (AddPegScalarValue(ctrId, PEGCTR | CTR64BIT, n));
+
+    return (MIXFKO);
+}
+
+
+/*
+ * This is an internal function that increases by n one instance of a Peg Vector Counter
+ * of type ctrType, once the caller has checked the counter (either through its ID or
+ * through its handle).
+ */
+static inline __attribute__((always_inline)) Error AddPegVectorInstance(uint16_t ctrId, CounterType ctrType, uint16_t ctrInst, uint64_t n)
+{
+    Error       res = MIXFOK;
+    uint64_t    limit;
+
+    if (ctrInst >= vectorHot[ctrId].NumInstances)
+        return (MIXFKO);
+    if (CtrUpdateMode == CTRSHARDEDMODE)
+        return (AddShardCell(VectorShardOffset[ctrId] + ctrInst, (int64_t)n));
+
+    limit = CTRLIMIT(ctrType);
+    if (AddPegCell(&vectorHot[ctrId].BaseVal[__atomic_load_n(&BaseEpoch, __ATOMIC_RELAXED)][ctrInst], n, limit))
+        res = MIXFOVFL;
+    if (AddPegCell(&vectorHot[ctrId].AggrVal[__atomic_load_n(&AggrEpoch, __ATOMIC_RELAXED)][ctrInst], n, limit))
+        res = MIXFOVFL;
+
+    return (res);
+}
+
+
+/*
+ * This is an internal function that increases by n all instances of a Peg Vector Counter
+ * of type ctrType (see AddPegVectorValue()). It is kept out of line, so that updates of a
+ * single instance are not burdened by the loop.
+ */
+static __attribute__((noinline)) Error AddPegVectorAll(uint16_t ctrId, CounterType ctrType, uint64_t n)
+{
+    Error       res = MIXFOK;
+    int         i;
+
+    for (i = 0; i < vectorHot[ctrId].NumInstances; i++)
+        switch (AddPegVectorInstance(ctrId, ctrType, (uint16_t)i, n))
+        {
+            case MIXFKO:
+                return (MIXFKO);
+            case MIXFOVFL:
+                res = MIXFOVFL;
+                break;
+            default:
+                break;
+        }
+
+    return (res);
+}
+
+
+/*
+ * This is an internal function that increases by n one instance (or all instances, if
+ * ctrInst is NULL) of a Peg Vector Counter of type ctrType, once the caller has checked
+ * it (either through its ID or through its handle).
+ */
+static inline __attribute__((always_inline)) Error AddPegVectorValue(uint16_t ctrId, CounterType ctrType, uint16_t* ctrInst, uint64_t n)
+{
+    if (ctrInst != NULL)
+        return (AddPegVectorInstance(ctrId, ctrType, *ctrInst, n));
+
+    return (AddPegVectorAll(ctrId, ctrType, n));
+}
+
+
+/*
+ * This is an internal function that implements both incr_peg_vector_ctr() and
+ * add_peg_vector_ctr() (see the latter for parameters and return values). It is
+ * kept static, so that it can be inlined in both public functions. As for Scalar
+ * Counters, the type is checked once against both widths (see AddPegScalarCtr()).
+ */
+static inline Error AddPegVectorCtr(uint16_t ctrId, uint16_t* ctrInst, uint64_t n)
+{
+    if (BaseCtrActive == false)     /* if counters have not been started return error */
+        return (MIXFKO);
+
+    if (ctrId >= numVectorCtr)
+        return (MIXFKO);
+
+    if (vectorHot[ctrId].Type == PEGCTR)
+        return (AddPegVectorValue(ctrId, PEGCTR, ctrInst, n));
+    if (vectorHot[ctrId].Type == (PEGCTR | CTR64BIT))
+        return (AddPegVectorValue(ctrId, PEGCTR | CTR64BIT, ctrInst, n));
+
+    return (MIXFKO);
+}
+
+
+/*
+ * This is an internal function that updates by delta a Roller Scalar Counter of type
+ * ctrType, once the caller has checked it (either through its ID or through its handle).
+ */
+static inline Error UpdateRollerScalarValue(uint16_t ctrId, CounterType ctrType, int64_t delta)
+{
+    Error   res = MIXFOK;
+
+    if (CtrUpdateMode == CTRSHARDEDMODE)
+        return (AddShardCell(ctrId, delta));
+
+    if (UpdateRollerCell(&scalarBaseVal[0][ctrId], delta, CTRLIMIT(ctrType)))
+        res = MIXFOVFL;
+    if (UpdateRollerCell(&scalarAggrVal[0][ctrId], delta, CTRLIMIT(ctrType)))
+        res = MIXFOVFL;
+
+    return(res);
+}
+
+
+/*
+ * This is an internal function that updates by delta one instance (or all instances, if
+ * ctrInst is NULL) of a Roller Vector Counter of type ctrType, once the caller has checked
+ * it (either through its ID or through its handle).
+ */
+static inline Error UpdateRollerVectorValue(uint16_t ctrId, CounterType ctrType, uint16_t *ctrInst, int64_t delta)
+{
+    Error   res = MIXFOK;
+
+    if (ctrInst != NULL)
+    {   /* Update a specific instance */
+        if ((*ctrInst) >= vectorHot[ctrId].NumInstances)
+            return (MIXFKO);
+
+        if (CtrUpdateMode == CTRSHARDEDMODE)
+            return (AddShardCell(VectorShardOffset[ctrId] + *ctrInst, delta));
+
+        if (UpdateRollerCell(&vectorHot[ctrId].BaseVal[0][*ctrInst], delta, CTRLIMIT(ctrType)))
+            res = MIXFOVFL;
+        if (UpdateRollerCell(&vectorHot[ctrId].AggrVal[0][*ctrInst], delta, CTRLIMIT(ctrType)))
+            res = MIXFOVFL;
+    }   /* if (ctrInst != NULL) */
+    else
+    {   /* Update all instances */
+        int     i;
+
+        for (i = 0; i < vectorHot[ctrId].NumInstances; i++)
+        {
+            if (CtrUpdateMode == CTRSHARDEDMODE)
+            {
+                if (AddShardCell(VectorShardOffset[ctrId] + i, delta) != MIXFOK)
+                    return (MIXFKO);
+                continue;
+            }
+            if (UpdateRollerCell(&vectorHot[ctrId].BaseVal[0][i], delta, CTRLIMIT(ctrType)))
+                res = MIXFOVFL;
+            if (UpdateRollerCell(&vectorHot[ctrId].AggrVal[0][i], delta, CTRLIMIT(ctrType)))
+                res = MIXFOVFL;
+        }   /* for (i = 0; i < vectorHot[ctrId].NumInstances; i++) */
+
+    }   /* else if (ctrInst != NULL) */
+
+    return (res);
+}
+
+
+/*
+ * This is an internal function that evaluates the hash of a key of a Sparse Counter (the
+ * finalizer of MurmurHash3), so that keys differing in a few bits only (e.g. consecutive
+ * IDs or addresses) are spread over the whole hash table.
+ */
+static inline uint64_t HashSparseKey(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDULL;
+    key ^= key >> 33;
+    key *= 0xC4CEB9FE1A85EC53ULL;
+
+    return (key ^ (key >> 33));
+}
+
+
+/*
+ * This is an internal function that reserves a place among the maximum number of keys of
+ * a Sparse Counter, before a cell is claimed for a new key. It returns false if no place
+ * is left.
+ */
+static inline bool ReserveSparseKey(SparseCtrInfo *sp)
+{
+    uint32_t    n = __atomic_load_n(&sp->NumKeys, __ATOMIC_RELAXED);
+
+    do
+    {
+        if (n >= sp->MaxKeys)
+            return (false);
+    } while (!__atomic_compare_exchange_n(&sp->NumKeys, &n, n + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    return (true);
+}
+
+
+/*
+ * This is an internal function that gives back the cell of a key of a Sparse Counter, i.e.
+ * its SPARSEVALUES values, adding the key if it is not in the hash table yet (unless the
+ * last parameter is false, in which case NULL is given back). Keys are added without locks:
+ * a place among the maximum number of keys is reserved first, then a free cell is claimed
+ * through compare and swap (if another thread claims it first, probing goes on, unless it
+ * has added the same key). Since the table is larger than the maximum number of keys, a
+ * free cell is always found. Key 0, which has its own cell, takes a place among keys as
+ * any other key. If no place is left, the overflow cell is given back (when
+ * the last place is contended, a key may be counted there while another thread is
+ * releasing the place it reserved).
+ */
+static inline uint64_t *FindSparseCell(SparseCtrInfo *sp, uint64_t key, bool add)
+{
+    uint64_t    cur;
+    uint32_t    i;
+
+    if (key == 0)
+    {   /* Key 0 has its own cell, since 0 marks free cells (set to 1 once claimed) */
+        cur = __atomic_load_n(&sp->Keys[sp->Mask + 1], __ATOMIC_RELAXED);
+        if (cur == 0)
+        {
+            if (!add)
+                return (NULL);
+            if (!ReserveSparseKey(sp))
+                return (&sp->Values[(size_t)(sp->Mask + 2) * SPARSEVALUES]);
+            if (!__atomic_compare_exchange_n(&sp->Keys[sp->Mask + 1], &cur, 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                __atomic_fetch_sub(&sp->NumKeys, 1, __ATOMIC_RELAXED);  /* Claimed by another thread */
+        }
+        return (&sp->Values[(size_t)(sp->Mask + 1) * SPARSEVALUES]);
+    }
+
+    for (i = (uint32_t)HashSparseKey(key) & sp->Mask; ; i = (i + 1) & sp->Mask)
+    {
+        cur = __atomic_load_n(&sp->Keys[i], __ATOMIC_ACQUIRE);
+        if (cur == key)
+            return (&sp->Values[(size_t)i * SPARSEVALUES]);
+        if (cur != 0)
+            continue;
+        if (!add)
+            return (NULL);
+
+        /* Free cell: reserve a place among keys, then claim it */
+        if (!ReserveSparseKey(sp))
+            return (&sp->Values[(size_t)(sp->Mask + 2) * SPARSEVALUES]);
+        if (__atomic_compare_exchange_n(&sp->Keys[i], &cur, key, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return (&sp->Values[(size_t)i * SPARSEVALUES]);
+        __atomic_fetch_sub(&sp->NumKeys, 1, __ATOMIC_RELAXED);
+        if (cur == key)
+            return (&sp->Values[(size_t)i * SPARSEVALUES]);
+    }
+}
+
+
+/*
+ * This is an internal function that implements incr_peg_sparse_ctr() and
+ * add_peg_sparse_ctr(): it increases by n the live base and aggr values of a key of a
+ * Sparse Counter. Sparse Counters are not sharded, hence values are updated through
+ * relaxed atomic adds in any mode but CTRPLAINMODE.
+ */
+static inline Error AddPegSparseCtr(uint16_t ctrId, uint64_t key, uint64_t n)
+{
+    SparseCtrInfo  *sp;
+    uint64_t       *val, *cell[2], old, limit;
+    Error           res = MIXFOK;
+    int             i;
+
+    if (BaseCtrActive == false)     /* if counters have not been started return error */
+        return (MIXFKO);
+
+    if ((ctrId >= numSparseCtr) || (sparseCtr[ctrId].Type == UNDEFCTR))
+        return (MIXFKO);
+
+    sp = &sparseCtr[ctrId];
+    val = FindSparseCell(sp, key, true);
+    cell[0] = &val[SPARSEVAL(false, __atomic_load_n(&BaseEpoch, __ATOMIC_RELAXED))];
+    cell[1] = &val[SPARSEVAL(true, __atomic_load_n(&AggrEpoch, __ATOMIC_RELAXED))];
+    limit = CTRLIMIT(sp->Type);
+    for (i = 0; i < 2; i++)
+    {
+        if (CtrUpdateMode != CTRPLAINMODE)
+            old = __atomic_fetch_add(cell[i], n, __ATOMIC_RELAXED);
+        else
+        {
+            old = *cell[i];
+            *cell[i] = old + n;
+        }
+        if (n > limit - (old & limit))
+            res = MIXFOVFL;
+    }
+
+    return (res);
+}
+
+
+/*
+ * This is an internal function that releases the hash tables of all Sparse Counters and
+ * closes their files (if still open), so that they are no longer defined.
+ */
+static void ReleaseSparseCtrs(void)
+{
+    int     i;
+
+    for (i = 0; i < MAXSPARSECTRNUM; i++)
+    {
+        sparseCtr[i].Name[0] = '\0';
+        sparseCtr[i].KeyName[0] = '\0';
+        sparseCtr[i].Type = UNDEFCTR;
+        sparseCtr[i].MaxKeys = sparseCtr[i].NumKeys = sparseCtr[i].Mask = 0;
+        free(sparseCtr[i].Keys);
+        free(sparseCtr[i].ValMem);
+        sparseCtr[i].Keys = sparseCtr[i].Values = sparseCtr[i].ValMem = NULL;
+        if (sparseCtr[i].BaseCtr_fd >= 0)
+            close(sparseCtr[i].BaseCtr_fd);
+        if (sparseCtr[i].AggrCtr_fd >= 0)
+            close(sparseCtr[i].AggrCtr_fd);
+        sparseCtr[i].BaseCtr_fd = sparseCtr[i].AggrCtr_fd = -1;
+    }
+}
+
+
+/*
+ * This is an internal function that evaluates the 64 bit key of a string key of a Top-K
+ * Counter (64 bit FNV-1a of its first CTRTOPKKEYLEN characters).
+ */
+static inline uint64_t HashTopKString(const char *str)
+{
+    uint64_t    h = 0xCBF29CE484222325ULL;
+    int         i;
+
+    for (i = 0; (i < CTRTOPKKEYLEN) && (str[i] != '\0'); i++)
+        h = (h ^ (uint8_t)str[i]) * 0x100000001B3ULL;
+
+    return (h);
+}
+
+
+/*
+ * This is an internal function that gives back the cell of the hash table of a Top-K
+ * sketch holding a key, or the free cell at which the key shall be added (see
+ * HashSparseKey()).
+ */
+static inline uint32_t FindTopKCell(const TopKSketch *sk, uint32_t mask, uint64_t key)
+{
+    uint32_t    i;
+
+    for (i = (uint32_t)HashSparseKey(key) & mask; sk->Table[i] != TOPKFREE; i = (i + 1) & mask)
+        if (sk->Keys[sk->Table[i]] == key)
+            break;
+
+    return (i);
+}
+
+
+/*
+ * This is an internal function that removes a cell from the hash table of a Top-K sketch,
+ * moving back the following cells of its probe sequence (backward shift deletion), so that
+ * no tombstone is left and lookups stay short however many keys are evicted.
+ */
+static void RemoveTopKCell(TopKSketch *sk, uint32_t mask, uint32_t i)
+{
+    uint32_t    j, k;
+
+    for (j = (i + 1) & mask; sk->Table[j] != TOPKFREE; j = (j + 1) & mask)
+    {
+        k = (uint32_t)HashSparseKey(sk->Keys[sk->Table[j]]) & mask;
+        /* The cell can be moved back to i unless its home is cyclically within (i,j] */
+        if ((i <= j) ? ((k <= i) || (k > j)) : ((k <= i) && (k > j)))
+        {
+            sk->Table[i] = sk->Table[j];
+            i = j;
+        }
+    }
+    sk->Table[i] = TOPKFREE;
+}
+
+
+/*
+ * This is an internal function that moves down a slot of the min-heap of a Top-K sketch
+ * whose count has increased, until its children have higher counts.
+ */
+static void SiftTopKDown(TopKSketch *sk, uint32_t h)
+{
+    uint32_t    s = sk->Heap[h],
+                c;
+
+    while ((c = 2 * h + 1) < sk->Used)
+    {
+        if ((c + 1 < sk->Used) && (sk->Counts[sk->Heap[c + 1]] < sk->Counts[sk->Heap[c]]))
+            c++;
+        if (sk->Counts[sk->Heap[c]] >= sk->Counts[s])
+            break;
+        sk->Heap[h] = sk->Heap[c];
+        sk->Pos[sk->Heap[h]] = h;
+        h = c;
+    }
+    sk->Heap[h] = s;
+    sk->Pos[s] = h;
+}
+
+
+/*
+ * This is an internal function that moves up the last slot of the min-heap of a Top-K
+ * sketch, just added, until its parent has a lower count.
+ */
+static void SiftTopKUp(TopKSketch *sk, uint32_t h)
+{
+    uint32_t    s = sk->Heap[h],
+                p;
+
+    for (; (h > 0) && (sk->Counts[sk->Heap[p = (h - 1) / 2]] > sk->Counts[s]); h = p)
+    {
+        sk->Heap[h] = sk->Heap[p];
+        sk->Pos[sk->Heap[h]] = h;
+    }
+    sk->Heap[h] = s;
+    sk->Pos[s] = h;
+}
+
+
+/*
+ * This is an internal function that increases by n the count of a key in a Top-K sketch
+ * (Space-Saving algorithm): a monitored key is increased in place, otherwise it takes a
+ * free slot (with error 0) or, if none is left, the slot of the key with the lowest count
+ * (the root of the min-heap), whose count it inherits as error bound. String keys (if
+ * str is not NULL) are copied into the slot, commas and line breaks being replaced by
+ * spaces so that dump files stay well-formed.
+ */
+static void UpdateTopKSketch(const TopKCtrInfo *tk, TopKSketch *sk, uint64_t key, const char *str, uint64_t n)
+{
+    uint32_t    i, s;
+    char       *name;
+    int         j;
+
+    i = FindTopKCell(sk, tk->Mask, key);
+    if (sk->Table[i] != TOPKFREE)
+    {   /* Monitored key */
+        s = sk->Table[i];
+        sk->Counts[s] += n;
+        SiftTopKDown(sk, sk->Pos[s]);
+        return;
+    }
+
+    if (sk->Used < tk->Slots)
+    {   /* Free slot */
+        s = sk->Used++;
+        sk->Table[i] = s;
+        sk->Keys[s] = key;
+        sk->Counts[s] = n;
+        sk->Errors[s] = 0;
+        sk->Heap[s] = s;
+        SiftTopKUp(sk, s);
+    }
+    else
+    {   /* Evict the key with the lowest count */
+        s = sk->Heap[0];
+        RemoveTopKCell(sk, tk->Mask, FindTopKCell(sk, tk->Mask, sk->Keys[s]));
+        sk->Keys[s] = key;
+        sk->Table[FindTopKCell(sk, tk->Mask, key)] = s;
+        sk->Errors[s] = sk->Counts[s];
+        sk->Counts[s] += n;
+        SiftTopKDown(sk, 0);
+    }
+
+    if (str != NULL)
+    {
+        name = &sk->Names[(size_t)s * (CTRTOPKKEYLEN + 1)];
+        for (j = 0; (j < CTRTOPKKEYLEN) && (str[j] != '\0'); j++)
+            name[j] = ((str[j] == ',') || (str[j] == '\n') || (str[j] == '\r')) ? ' ' : str[j];
+        name[j] = '\0';
+    }
+}
+
+
+/*
+ * This is an internal function that empties a Top-K sketch once dumped.
+ */
+static void ResetTopKSketch(const TopKCtrInfo *tk, TopKSketch *sk)
+{
+    if (sk->Used == 0)
+        return;
+    memset(sk->Table, 0xFF, ((size_t)tk->Mask + 1) * sizeof(uint32_t));
+    sk->Used = 0;
+}
+
+
+/*
+ * This is an internal function that tells whether a slot of a Top-K sketch ranks below
+ * another one, i.e. has a lower count or the same count and a higher key.
+ */
+static inline bool TopKBelow(const TopKSketch *sk, uint32_t a, uint32_t b)
+{
+    return ((sk->Counts[a] < sk->Counts[b]) || ((sk->Counts[a] == sk->Counts[b]) && (sk->Keys[a] > sk->Keys[b])));
+}
+
+
+/*
+ * This is an internal function that moves down an element of a heap of slots of a Top-K
+ * sketch ordered by TopKBelow() (the lowest on top).
+ */
+static void SiftTopKSel(const TopKSketch *sk, uint32_t *sel, uint32_t len, uint32_t h)
+{
+    uint32_t    s = sel[h],
+                c;
+
+    while ((c = 2 * h + 1) < len)
+    {
+        if ((c + 1 < len) && TopKBelow(sk, sel[c + 1], sel[c]))
+            c++;
+        if (!TopKBelow(sk, sel[c], s))
+            break;
+        sel[h] = sel[c];
+        h = c;
+    }
+    sel[h] = s;
+}
+
+
+/*
+ * This is an internal function that selects the (up to) k slots of a Top-K sketch with the
+ * highest counts, sorted by decreasing count (then by increasing key). A heap of k slots
+ * holds the best ones found so far (the lowest on top, replaced by any better slot), then
+ * it is sorted in place by moving each top to the end. It returns the number of slots.
+ */
+static uint32_t SelectTopKSlots(const TopKSketch *sk, uint32_t k, uint32_t *sel)
+{
+    uint32_t    len = (sk->Used < k) ? sk->Used : k,
+                i, s;
+
+    for (i = 0; i < len; i++)
+        sel[i] = i;
+    for (i = len / 2; i > 0; i--)
+        SiftTopKSel(sk, sel, len, i - 1);
+    for (s = len; s < sk->Used; s++)
+        if (TopKBelow(sk, sel[0], s))
+        {
+            sel[0] = s;
+            SiftTopKSel(sk, sel, len, 0);
+        }
+    for (i = len; i > 1; i--)
+    {
+        s = sel[0];
+        sel[0] = sel[i - 1];
+        sel[i - 1] = s;
+        SiftTopKSel(sk, sel, i - 1, 0);
+    }
+
+    return (len);
+}
+
+
+/*
+ * This is an internal function that implements incr_topk_ctr(), add_topk_ctr() and their
+ * string versions: it increases by n the count of a key in the live base and aggr
+ * sketches of a Top-K Counter. Sketches are updated under the counter mutex in any mode
+ * but CTRPLAINMODE, epochs being read within it (see DumpTopkCtrs()).
+ */
+static Error AddTopkCtr(uint16_t ctrId, uint64_t key, const char *str, uint64_t n)
+{
+    TopKCtrInfo    *tk;
+
+    if (BaseCtrActive == false)     /* if counters have not been started return error */
+        return (MIXFKO);
+
+    if ((ctrId >= numTopkCtr) || (topkCtr[ctrId].TopK == 0) ||
+        ((str != NULL) != (topkCtr[ctrId].KeyType == CTRTOPKSTRKEY)))
+        return (MIXFKO);
+
+    tk = &topkCtr[ctrId];
+    if (str != NULL)
+        key = HashTopKString(str);
+    if (CtrUpdateMode != CTRPLAINMODE)
+        pthread_mutex_lock(&tk->Mutex);
+    UpdateTopKSketch(tk, &tk->Sketch[TOPKBUF(false, __atomic_load_n(&BaseEpoch, __ATOMIC_RELAXED))], key, str, n);
+    UpdateTopKSketch(tk, &tk->Sketch[TOPKBUF(true, __atomic_load_n(&AggrEpoch, __ATOMIC_RELAXED))], key, str, n);
+    if (CtrUpdateMode != CTRPLAINMODE)
+        pthread_mutex_unlock(&tk->Mutex);
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This is an internal function that releases the sketches of all Top-K Counters and
+ * closes their files (if still open), so that they are no longer defined.
+ */
+static void ReleaseTopkCtrs(void)
+{
+    int     i;
+
+    for (i = 0; i < MAXTOPKCTRNUM; i++)
+    {
+        topkCtr[i].Name[0] = '\0';
+        topkCtr[i].KeyName[0] = '\0';
+        topkCtr[i].TopK = 0;
+        topkCtr[i].Slots = topkCtr[i].Mask = 0;
+        free(topkCtr[i].Mem);
+        topkCtr[i].Mem = NULL;
+        memset(topkCtr[i].Sketch, 0, sizeof(topkCtr[i].Sketch));
+        if (topkCtr[i].BaseCtr_fd >= 0)
+            close(topkCtr[i].BaseCtr_fd);
+        if (topkCtr[i].AggrCtr_fd >= 0)
+            close(topkCtr[i].AggrCtr_fd);
+        topkCtr[i].BaseCtr_fd = topkCtr[i].AggrCtr_fd = -1;
+    }
+}
+
+
+/*
+ * This is an internal function that releases the registers of all Distinct Counters,
+ * so that they are no longer defined (their file is closed with the other ones).
+ */
+static void ReleaseDistinctCtrs(void)
+{
+    int     i;
+
+    for (i = 0; i < MAXDISTINCTCTRNUM; i++)
+    {
+        free(distinctCtr[i].Mem);
+        memset(&distinctCtr[i], 0, sizeof(DistinctCtrInfo));
+    }
+}
+
+
+/*
+ * This is an internal function that gives back the natural logarithm of x (at least 1),
+ * so that the library does not depend on libm: x is halved down to [1,2), then the
+ * series of 2*atanh((x-1)/(x+1)) is summed, whose terms shrink at least 9 times each.
+ */
+static double NaturalLog(double x)
+{
+    double  y, y2, term, sum = 0;
+    int     k = 0, n;
+
+    for (; x >= 2; x /= 2)
+        k++;
+    y = (x - 1) / (x + 1);
+    y2 = y * y;
+    for (n = 1, term = y; n < 40; n += 2, term *= y2)
+        sum += term / n;
+
+    return (k * 0.69314718055994531 + 2 * sum);
+}
+
+
+/*
+ * This is an internal function that gives back the HyperLogLog estimate of the distinct
+ * keys of a Distinct Counter of precision p, given the number of its registers holding
+ * each value (hist, 64 - p + 2 values): the harmonic mean of 2^register, corrected by
+ * the usual alpha constant, or linear counting through the number of empty registers
+ * when the estimate is below 2.5 times the registers (where the former is biased).
+ * Hashes are 64 bit, hence no correction is needed for large cardinalities.
+ */
+static uint64_t EstimateDistinct(const uint32_t *hist, uint8_t p)
+{
+    double  m = (double)(1U << p),
+            sum = 0,
+            alpha, est;
+    int     k;
+
+    /* Sum of 2^-register, from the highest register value down (Horner's scheme) */
+    for (k = 64 - p + 1; k >= 0; k--)
+        sum = sum / 2 + hist[k];
+
+    alpha = (p == 4) ? 0.673 : (p == 5) ? 0.697 : (p == 6) ? 0.709 : 0.7213 / (1 + 1.079 / m);
+    est = alpha * m * m / sum;
+    if ((est <= 2.5 * m) && (hist[0] != 0))
+        est = m * NaturalLog(m / hist[0]);
+
+    return ((uint64_t)(est + 0.5));
+}
+
+
+/*
+ * This is an internal function that gives back the bucket of a value in a Histogram
+ * Counter with the given significant bits. Values below 2^bits have a bucket each; above
+ * that, values are shifted right until bits significant bits are left (their most
+ * significant bit being set), and each shift adds 2^(bits-1) buckets: a couple of shifts
+ * and an add, without branches.
+ */
+static inline uint32_t HistoBucket(uint64_t v, uint8_t bits)
+{
+    int     shift;
+
+    shift = (63 - __builtin_clzll(v | 1)) - (bits - 1);
+    shift &= ~(shift >> 31);
+
+    return (((uint32_t)shift << (bits - 1)) + (uint32_t)(v >> shift));
+}
+
+
+/*
+ * This is an internal function that gives back the highest value counted in a bucket of
+ * a Histogram Counter with the given significant bits (see HistoBucket()).
+ */
+static inline uint64_t HistoBucketTop(uint32_t idx, uint8_t bits)
+{
+    uint32_t    shift = idx >> (bits - 1);
+
+    if (shift <= 1)     /* Values below 2^bits */
+        return (idx);
+    shift--;
+
+    return (((uint64_t)((idx & ((1U << (bits - 1)) - 1)) | (1U << (bits - 1))) << shift) + ((1ULL << shift) - 1));
+}
+
+
+/*
+ * This is an internal function that gives back the rank of a percentile among count
+ * recorded values, i.e. the number of values not greater than the percentile (at least 1).
+ */
+static inline uint64_t HistoRank(double pct, uint64_t count)
+{
+    double      r = pct * (double)count / 100.0;
+    uint64_t    rank = (uint64_t)r;
+
+    rank += ((double)rank < r);
+
+    return ((rank > 0) ? rank : 1);
+}
+
+
+/*
+ * This is an internal function that sets the percentiles reported by dumps of Histogram
+ * Counters (already validated), sorted in ascending order, and their column names.
+ */
+static void SetHistoPercentiles(uint8_t num, const double *pct)
+{
+    double  v;
+    int     i, j;
+
+    for (i = 0; i < num; i++)
+    {   /* Insertion sort */
+        v = pct[i];
+        for (j = i; (j > 0) && (HistoPct[j - 1] > v); j--)
+            HistoPct[j] = HistoPct[j - 1];
+        HistoPct[j] = v;
+    }
+    numHistoPct = num;
+    for (i = 0; i < num; i++)
+        snprintf(HistoPctName[i], sizeof(MicroString), "p%g", HistoPct[i]);
+}
+
+
+/*
+ * This is an internal function that evaluates the statistics of the values recorded in
+ * a block of a Histogram Counter (see HISTOBUF): number of values, sum, min, max and
+ * numPct percentiles (in ascending order), in this order (min, max and percentiles are 0
+ * if no value has been recorded). If buf is not NULL the block is
+ * frozen (dump time): buckets are moved to buf (only those not null are reset, so that
+ * pages of idle buckets are not written) and the header cells are reset as well.
+ * Otherwise live values are read as they are, merged with those of the block add if it
+ * is not NULL (i.e. aggr values with the live base interval, see retrieve_histo_ctr()).
+ * Percentiles are the highest values of their buckets, within min and max, found in a
+ * single scan of cumulative counts.
+ */
+static void EvalHistoStats(HistoCtrInfo *h, uint64_t *blk, uint64_t *add, uint64_t *buf, int numPct, const double *pct, uint64_t *stats)
+{
+    uint64_t   *cells, *extra = NULL, rank[MAXHISTOPCT], count = 0, cum = 0, v;
+    uint32_t    i;
+    int         j;
+
+    if (buf != NULL)
+    {
+        for (i = 0; i < h->NumBuckets; i++)
+        {
+            if ((buf[i] = __atomic_load_n(&blk[HISTOHDR + i], __ATOMIC_RELAXED)) != 0)
+                buf[i] = __atomic_exchange_n(&blk[HISTOHDR + i], 0, __ATOMIC_RELAXED);
+            count += buf[i];
+        }
+        stats[1] = __atomic_exchange_n(&blk[HISTOSUM], 0, __ATOMIC_RELAXED);
+        stats[2] = __atomic_exchange_n(&blk[HISTOMIN], UINT64_MAX, __ATOMIC_RELAXED);
+        stats[3] = __atomic_exchange_n(&blk[HISTOMAX], 0, __ATOMIC_RELAXED);
+        cells = buf;
+    }
+    else
+    {
+        for (i = 0; i < h->NumBuckets; i++)
+            count += __atomic_load_n(&blk[HISTOHDR + i], __ATOMIC_RELAXED);
+        stats[1] = __atomic_load_n(&blk[HISTOSUM], __ATOMIC_RELAXED);
+        stats[2] = __atomic_load_n(&blk[HISTOMIN], __ATOMIC_RELAXED);
+        stats[3] = __atomic_load_n(&blk[HISTOMAX], __ATOMIC_RELAXED);
+        cells = blk + HISTOHDR;
+        if (add != NULL)
+        {
+            extra = add + HISTOHDR;
+            for (i = 0; i < h->NumBuckets; i++)
+                count += __atomic_load_n(&extra[i], __ATOMIC_RELAXED);
+            stats[1] += __atomic_load_n(&add[HISTOSUM], __ATOMIC_RELAXED);
+            if ((v = __atomic_load_n(&add[HISTOMIN], __ATOMIC_RELAXED)) < stats[2])
+                stats[2] = v;
+            if ((v = __atomic_load_n(&add[HISTOMAX], __ATOMIC_RELAXED)) > stats[3])
+                stats[3] = v;
+        }
+    }
+    stats[0] = count;
+    if (count == 0)
+    {
+        memset(&stats[2], 0, (size_t)(2 + numPct) * sizeof(uint64_t));
+        return;
+    }
+
+    for (j = 0; j < numPct; j++)
+        rank[j] = HistoRank(pct[j], count);
+    for (i = 0, j = 0; (i < h->NumBuckets) && (j < numPct); i++)
+    {
+        v = __atomic_load_n(&cells[i], __ATOMIC_RELAXED);
+        if (extra != NULL)
+            v += __atomic_load_n(&extra[i], __ATOMIC_RELAXED);
+        if (v == 0)
+            continue;
+        cum += v;
+        for (; (j < numPct) && (cum >= rank[j]); j++)
+        {
+            v = HistoBucketTop(i, h->Bits);
+            stats[4 + j] = (v > stats[3]) ? stats[3] : (v < stats[2]) ? stats[2] : v;
+        }
+    }
+    for (; j < numPct; j++)         /* Live values changed while they were read */
+        stats[4 + j] = stats[3];
+}
+
+
+/*
+ * This is an internal function that releases the buckets of all Histogram Counters and
+ * closes their files (if still open), so that they are no longer defined.
+ */
+static void ReleaseHistoCtrs(void)
+{
+    int     i;
+
+    for (i = 0; i < MAXHISTOCTRNUM; i++)
+    {
+        histoCtr[i].Name[0] = '\0';
+        histoCtr[i].Bits = 0;
+        histoCtr[i].NumBuckets = 0;
+        free(histoCtr[i].Mem);
+        histoCtr[i].Mem = NULL;
+        memset(histoCtr[i].Val, 0, sizeof(histoCtr[i].Val));
+        if (histoCtr[i].BaseCtr_fd >= 0)
+            close(histoCtr[i].BaseCtr_fd);
+        if (histoCtr[i].AggrCtr_fd >= 0)
+            close(histoCtr[i].AggrCtr_fd);
+        histoCtr[i].BaseCtr_fd = histoCtr[i].AggrCtr_fd = -1;
+    }
+}
+
+
+/*
+ * This is an internal function that resets the cells of a Summary Counter in a buffer
+ * of values (see SUMMARYBUF) to their initial values (min is UINT64_MAX, so that any
+ * observed value lowers it).
+ */
+static inline void ResetSummaryCells(uint64_t *val)
+{
+    val[SUMCOUNT] = val[SUMSUM] = val[SUMMAX] = 0;
+    val[SUMMIN] = UINT64_MAX;
+}
+
+
+/*
+ * This is an internal function that resets the values of all Summary Counters and closes
+ * their files (if still open), so that they are no longer defined.
+ */
+static void ReleaseSummaryCtrs(void)
+{
+    int     i, j;
+
+    for (i = 0; i < MAXSUMMARYCTRNUM; i++)
+    {
+        summaryCtr[i].Name[0] = '\0';
+        for (j = 0; j < 4; j++)
+            ResetSummaryCells(summaryVal[j][i]);
+        if (summaryCtr[i].BaseCtr_fd >= 0)
+            close(summaryCtr[i].BaseCtr_fd);
+        if (summaryCtr[i].AggrCtr_fd >= 0)
+            close(summaryCtr[i].AggrCtr_fd);
+        summaryCtr[i].BaseCtr_fd = summaryCtr[i].AggrCtr_fd = -1;
+    }
+}
+
+
+/*
+ * This is an internal function that releases all counter rates, so that they are no
+ * longer defined.
+ */
+static void ReleaseRateCtrs(void)
+{
+    int     i;
+
+    for (i = 0; i < MAXRATECTRNUM; i++)
+    {
+        free(rateCtr[i].Ring);
+        memset(&rateCtr[i], 0, sizeof(RateCtrInfo));
+    }
+}
+
+
+/*
+ * This is an internal function that returns the type of the Peg Counter of a rate.
+ */
+static inline CounterType RateCtrType(const RateCtrInfo *r)
+{
+    return ((r->Class == CTRSCALAR) ? scalarType[r->CtrId] : vectorHot[r->CtrId].Type);
+}
+
+
+/*
+ * This is an internal function that returns the base cell of epoch e of the Peg Counter
+ * of a rate.
+ */
+static inline uint64_t *RateCell(const RateCtrInfo *r, uint8_t e)
+{
+    return ((r->Class == CTRSCALAR) ? &scalarBaseVal[e][r->CtrId] : &vectorHot[r->CtrId].BaseVal[e][r->CtrInst]);
+}
+
+
+/*
+ * This is an internal function that resets all counter rates when counters are started:
+ * the current values of their counters (e.g. resumed from a state file) are taken as the
+ * starting point of the first tick.
+ */
+static void StartRateCtrs(void)
+{
+    RateCtrInfo    *r;
+    int             i, e;
+
+    for (i = 0; i < numRateCtr; i++)
+    {
+        r = &rateCtr[i];
+        if (r->Name[0] == '\0')
+            continue;
+        for (e = 0; e < 2; e++)
+            r->Prev[e] = *RateCell(r, e);
+        r->Pending = 0;
+        r->Ticks = r->Seq = 0;
+        memset(r->WinSum, 0, sizeof(r->WinSum));
+        memset(r->Ewma, 0, sizeof(r->Ewma));
+        memset(r->Pub, 0, sizeof(r->Pub));
+        memset(r->Ring, 0, RATEWINDOW * sizeof(uint64_t));
+    }
+    RateLastTick = time(NULL);
+}
+
+
+/*
+ * This is an internal function that takes the increase of the frozen base cells of all
+ * rates, right after a base dump has flipped the epoch and before the frozen cells are
+ * reset, so that the next tick does not lose it.
+ * BE AWARE that it shall be invoked while holding BaseMutex.
+ */
+static void FoldRateCells(uint8_t frozen)
+{
+    RateCtrInfo    *r;
+    int             i;
+
+    for (i = 0; i < numRateCtr; i++)
+    {
+        r = &rateCtr[i];
+        if (r->Name[0] == '\0')
+            continue;
+        r->Pending += (__atomic_load_n(RateCell(r, frozen), __ATOMIC_RELAXED) - r->Prev[frozen]) & CTRLIMIT(RateCtrType(r));
+        r->Prev[frozen] = 0;
+    }
+}
+
+
+/*
+ * This is an internal function that adds the increase of a counter in one second to
+ * a rate: sliding windows are moved by one second (the increase leaving each window is
+ * found in the ring of the last RATEWINDOW seconds) and EWMAs are updated (the first
+ * increase initializes them).
+ */
+static inline void StepRate(RateCtrInfo *r, uint64_t x)
+{
+    int     k;
+
+    for (k = 0; k < CTRRATEHORIZONS; k++)
+    {
+        if (r->Ticks >= RateHorizon[k])
+            r->WinSum[k] -= r->Ring[(r->Ticks - RateHorizon[k]) % RATEWINDOW];
+        r->WinSum[k] += x;
+        r->Ewma[k] = (r->Ticks == 0) ? (double)x : r->Ewma[k] + RateAlpha[k] * ((double)x - r->Ewma[k]);
+    }
+    r->Ring[r->Ticks % RATEWINDOW] = x;
+    r->Ticks++;
+}
+
+
+/*
+ * This is an internal function that publishes the rates of a counter, so that they can be
+ * read without locks (see ReadRate()): the sequence counter is odd while they are updated.
+ */
+static void PublishRate(RateCtrInfo *r)
+{
+    uint32_t    seq = r->Seq;
+    double      v;
+    int         k;
+
+    __atomic_store_n(&r->Seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (k = 0; k < CTRRATEHORIZONS; k++)
+    {
+        __atomic_store(&r->Pub[k], &r->Ewma[k], __ATOMIC_RELAXED);
+        v = (double)r->WinSum[k] / (double)((r->Ticks < RateHorizon[k]) ? r->Ticks : RateHorizon[k]);
+        __atomic_store(&r->Pub[CTRRATEHORIZONS + k], &v, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&r->Seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * This is an internal function that reads the published rates of a counter (EWMAs, then
+ * window averages) in constant time and without locks: they are read again if a tick
+ * has been publishing them in the meantime.
+ */
+static void ReadRate(RateCtrInfo *r, double *v)
+{
+    uint32_t    seq;
+    int         k;
+
+    do
+    {
+        seq = __atomic_load_n(&r->Seq, __ATOMIC_ACQUIRE);
+        for (k = 0; k < RATEVALUES; k++)
+            __atomic_load(&r->Pub[k], &v[k], __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || (seq != __atomic_load_n(&r->Seq, __ATOMIC_RELAXED)));
+}
+
+
+/*
+ * This is an internal function that ticks all counter rates, once per second: the
+ * increase of each counter since the previous tick (both base cells, plus the increase
+ * taken by base dumps, see FoldRateCells()) is added to its rates and the rates are
+ * published. If ticks have been missed (e.g. check_and_dump_ctr() not called for a
+ * while), the increase is spread evenly over the elapsed seconds (RATEWINDOW at most).
+ * If the clock has been set back, ticks start again from now on.
+ * BE AWARE that it shall be invoked while holding BaseMutex.
+ */
+static void TickRates(time_t now)
+{
+    RateCtrInfo    *r;
+    uint64_t        cur, d;
+    uint32_t        n, j, idx;
+    int             i, e;
+
+    if (now <= RateLastTick)
+    {
+        RateLastTick = now;
+        return;
+    }
+    n = (now - RateLastTick > RATEWINDOW) ? RATEWINDOW : (uint32_t)(now - RateLastTick);
+    RateLastTick = now;
+
+    for (i = 0; i < numRateCtr; i++)
+    {
+        r = &rateCtr[i];
+        if (r->Name[0] == '\0')
+            continue;
+        if (CtrUpdateMode == CTRSHARDEDMODE)
+        {
+            idx = (r->Class == CTRSCALAR) ? r->CtrId : VectorShardOffset[r->CtrId] + r->CtrInst;
+            FoldShards(idx, idx + 1);
+        }
+        d = r->Pending;
+        r->Pending = 0;
+        for (e = 0; e < 2; e++)
+        {
+            cur = __atomic_load_n(RateCell(r, e), __ATOMIC_RELAXED);
+            d += (cur - r->Prev[e]) & CTRLIMIT(RateCtrType(r));
+            r->Prev[e] = cur;
+        }
+        for (j = 0; j < n; j++)
+            StepRate(r, d / n + ((j < d % n) ? 1 : 0));
+        PublishRate(r);
+    }
+}
+
+
+/*
+ * This is an internal function that releases all threshold alarms, so that they are no
+ * longer defined.
+ */
+static void ReleaseCtrAlarms(void)
+{
+    free(ctrAlarm);
+    free(AlarmFired);
+    ctrAlarm = NULL;
+    AlarmFired = NULL;
+    numCtrAlarm = 0;
+}
+
+
+/*
+ * This is an internal function that resets all threshold alarms when counters are
+ * started: the cells of their counters are looked up (counters values may have been
+ * moved to the counters segment, shard cells are laid out by start_counters()), all
+ * alarms are cleared and the current values of the counters are taken as the starting
+ * point of rate alarms.
+ */
+static void StartCtrAlarms(void)
+{
+    CtrAlarmInfo   *a;
+    CounterType     type;
+    int             i, e;
+
+    for (i = 0; i < numCtrAlarm; i++)
+    {
+        a = &ctrAlarm[i];
+        if (a->Name[0] == '\0')
+            continue;
+        type = (a->Class == CTRSCALAR) ? scalarType[a->CtrId] : vectorHot[a->CtrId].Type;
+        for (e = 0; e < 2; e++)
+        {
+            if (a->Class == CTRSCALAR)
+            {
+                a->Cell[e] = &scalarBaseVal[CTRBUF(type, e)][a->CtrId];
+                a->AggrCell[e] = &scalarAggrVal[CTRBUF(type, e)][a->CtrId];
+            }
+            else
+            {
+                a->Cell[e] = &vectorHot[a->CtrId].BaseVal[CTRBUF(type, e)][a->CtrInst];
+                a->AggrCell[e] = &vectorHot[a->CtrId].AggrVal[CTRBUF(type, e)][a->CtrInst];
+            }
+            a->Prev[e] = *a->Cell[e];
+        }
+        a->ShardIdx = (a->Class == CTRSCALAR) ? a->CtrId : VectorShardOffset[a->CtrId] + a->CtrInst;
+        a->CtrType = type;
+        a->Limit = CTRLIMIT(type);
+        a->Pending = a->Value = 0;
+        a->Raised = false;
+    }
+    AlarmLastTick = time(NULL);
+}
+
+
+/*
+ * This is an internal function that folds the cells watched by threshold alarms from
+ * all thread shards into the shared counters (CTRSHARDEDMODE only), so that the cost
+ * only depends on the number of alarms, not on the number of counters. A cell watched
+ * by several alarms is folded once, the following folds find no change.
+ * BE AWARE that it takes ShardMutex, therefore it shall not be invoked while
+ * holding it.
+ */
+static void FoldAlarmShards(void)
+{
+    CtrShard       *shard;
+    CtrAlarmInfo   *a;
+    int             i;
+
+    pthread_mutex_lock(&ShardMutex);
+    for (shard = ShardList; shard != NULL; shard = shard->next)
+        for (i = 0; i < numCtrAlarm; i++)
+        {
+            a = &ctrAlarm[i];
+            if (a->Name[0] != '\0')
+                FoldShardCell(shard, a->ShardIdx, a->CtrType, a->Cell[BaseEpoch], a->AggrCell[AggrEpoch]);
+        }
+    pthread_mutex_unlock(&ShardMutex);
+}
+
+
+/*
+ * This is an internal function that takes the increase of the frozen base cells of
+ * rate alarms, right after a base dump has flipped the epoch and before the frozen
+ * cells are reset, so that the next evaluation does not lose it.
+ * BE AWARE that it shall be invoked while holding BaseMutex.
+ */
+static void FoldAlarmCells(uint8_t frozen)
+{
+    CtrAlarmInfo   *a;
+    int             i;
+
+    for (i = 0; i < numCtrAlarm; i++)
+    {
+        a = &ctrAlarm[i];
+        if ((a->Name[0] == '\0') || !(a->Type & CTRALARMRATE))
+            continue;
+        a->Pending += (__atomic_load_n(a->Cell[frozen], __ATOMIC_RELAXED) - a->Prev[frozen]) & a->Limit;
+        a->Prev[frozen] = 0;
+    }
+}
+
+
+/*
+ * This is an internal function that evaluates all threshold alarms, once per second:
+ * the watched value of each alarm (the base value of its counter, or with CTRALARMRATE
+ * the increase of both base cells since the previous evaluation, plus the one taken by
+ * base dumps, see FoldAlarmCells(), per elapsed second) is compared with the watermark
+ * which would toggle the alarm. The state of toggled alarms is changed at once, while
+ * their IDs are collected in AlarmFired, to be notified once BaseMutex has been
+ * released (see NotifyCtrAlarms()). In CTRSHARDEDMODE the watched cells are folded
+ * first. If the clock has been set back, evaluations start again from now on.
+ * It returns the number of toggled alarms.
+ * BE AWARE that it shall be invoked while holding AlarmMutex and BaseMutex.
+ */
+static uint32_t EvalCtrAlarms(time_t now)
+{
+    CtrAlarmInfo   *a;
+    uint64_t        cur, v, n;
+    uint32_t        fired = 0;
+    bool            cross;
+    int             i, e;
+
+    if (now <= AlarmLastTick)
+    {
+        AlarmLastTick = now;
+        return (0);
+    }
+    n = (uint64_t)(now - AlarmLastTick);
+    AlarmLastTick = now;
+
+    if (CtrUpdateMode == CTRSHARDEDMODE)
+        FoldAlarmShards();
+
+    for (i = 0; i < numCtrAlarm; i++)
+    {
+        a = &ctrAlarm[i];
+        if (a->Name[0] == '\0')
+            continue;
+        if (a->Type & CTRALARMRATE)
+        {
+            v = a->Pending;
+            a->Pending = 0;
+            for (e = 0; e < 2; e++)
+            {
+                cur = __atomic_load_n(a->Cell[e], __ATOMIC_RELAXED);
+                v += (cur - a->Prev[e]) & a->Limit;
+                a->Prev[e] = cur;
+            }
+            v /= n;
+        }
+        else
+            v = __atomic_load_n(a->Cell[BaseEpoch], __ATOMIC_RELAXED) & a->Limit;
+        __atomic_store_n(&a->Value, v, __ATOMIC_RELAXED);
+
+        /* Hysteresis: a raised alarm is only cleared beyond the other watermark */
+        if (a->Type & CTRALARMLOW)
+            cross = a->Raised ? (v > a->High) : (v <= a->Low);
+        else
+            cross = a->Raised ? (v < a->Low) : (v >= a->High);
+        if (cross)
+        {
+            __atomic_store_n(&a->Raised, !a->Raised, __ATOMIC_RELAXED);
+            AlarmFired[fired++] = (uint16_t)i;
+        }
+    }
+
+    return (fired);
+}
+
+
+/*
+ * This is an internal function that notifies the transitions of the alarms collected
+ * by EvalCtrAlarms(): for each of them the event defined for the transition (if any) is
+ * registered with alarm name, value and crossed watermark as parameters, then the
+ * callback (if any) is invoked. Since BaseMutex is not held, neither events nor the
+ * callback delay dumps or updates of other threads.
+ * BE AWARE that it shall be invoked while holding AlarmMutex (not BaseMutex).
+ */
+static void NotifyCtrAlarms(uint32_t fired)
+{
+    CtrAlarmInfo   *a;
+    char            value[MAXCTRDIGITS + 1],
+                    mark[MAXCTRDIGITS + 1];
+    EventCode       event;
+    uint32_t        j;
+
+    for (j = 0; j < fired; j++)
+    {
+        a = &ctrAlarm[AlarmFired[j]];
+        event = a->Raised ? a->RaiseEvent : a->ClearEvent;
+        if (event != UNDEFINED)
+        {
+            /* HIGH alarms are raised by the high watermark, LOW ones by the low one */
+            snprintf(value, sizeof(value), "%" PRIu64, a->Value);
+            snprintf(mark, sizeof(mark), "%" PRIu64, (a->Raised == !(a->Type & CTRALARMLOW)) ? a->High : a->Low);
+            register_event(event, a->Name, value, mark);
+        }
+        if (CtrAlarmHook != NULL)
+            CtrAlarmHook(AlarmFired[j], a->Raised, a->Value);
+    }
+}
+
+
+/*
+ * This is an internal function that evaluates the hash of a counter name (32 bit FNV-1a),
+ * used to index the registry of counters (see register_scalar_ctr()).
+ */
+static uint32_t HashCtrName(const char *name)
+{
+    uint32_t    h = 2166136261u;
+
+    while (*name != '\0')
+        h = (h ^ (uint8_t)*name++) * 16777619u;
+
+    return (h);
+}
+
+
+/*
+ * This is an internal function that resets the registry of Scalar or Vector Counters
+ * (ctrClass) whenever their definitions are lost: names are removed and the generation
+ * of handles is increased, so that handles given back before are no longer accepted.
+ */
+static void ResetCtrRegistry(uint8_t ctrClass)
+{
+    memset(CtrRegIndex[ctrClass], 0, sizeof(CtrRegIndex[ctrClass]));
+    memset(CtrRegMap[ctrClass], 0, sizeof(CtrRegMap[ctrClass]));
+    CtrHandleGen[ctrClass] = (CtrHandleGen[ctrClass] % MAXHANDLEGEN) + 1;
+}
+
+
+/*
+ * This is an internal function that looks up a name (already truncated to
+ * SHORTSTRINGMAXLEN characters) in the registry of Scalar or Vector Counters (ctrClass).
+ * It gives back the ID of the registered counter, or -1 if the name is not registered;
+ * in the latter case pos is set to the empty slot of the hash table where the name shall
+ * be inserted (the table is never full, see CTRREGINDEXSIZE).
+ */
+static int FindRegisteredCtr(uint8_t ctrClass, const char *name, uint32_t *pos)
+{
+    uint32_t    i;
+    uint16_t    id;
+    const char *regName;
+
+    for (i = HashCtrName(name) & (CTRREGINDEXSIZE - 1); (id = CtrRegIndex[ctrClass][i]) != 0; i = (i + 1) & (CTRREGINDEXSIZE - 1))
+    {
+        regName = (ctrClass == CTRSCALAR) ? scalarCtr[id - 1].Name : vectorCtr[id - 1].Name;
+        if (strcmp(regName, name) == 0)
+            return (id - 1);
+    }
+    *pos = i;
+
+    return (-1);
+}
+
+
+/*
+ * This is an internal function that gives back the lowest ID of a Scalar or Vector Counter
+ * (ctrClass) not defined yet (Vector Counters shall not have values allocated either). If
+ * all IDs up to the number defined through define_xxx_ctr_num() are in use, the first ID
+ * beyond it is given back (the caller grows the number of counters), or -1 if the maximum
+ * number of counters has been reached.
+ */
+static int FreeCtrId(uint8_t ctrClass)
+{
+    int     i;
+
+    if (ctrClass == CTRSCALAR)
+    {
+        for (i = 0; i < numScalarCtr; i++)
+            if (scalarCtr[i].Name[0] == '\0')
+                return (i);
+        return ((numScalarCtr < MAXSCALARCTRNUM) ? numScalarCtr : -1);
+    }
+    for (i = 0; i < numVectorCtr; i++)
+        if ((vectorCtr[i].Name[0] == '\0') && (vectorCtr[i].BaseMem == NULL))
+            return (i);
+    return ((numVectorCtr < MAXVECTORCTRNUM) ? numVectorCtr : -1);
+}
+
+
+/*
+ * This is an internal function that checks a counter handle of class ctrClass given back
+ * by register_scalar_ctr() or register_vector_ctr() before an update of a counter of kind
+ * ctrKind (PEGCTR or ROLLERCTR): the handle shall belong to the current generation of its
+ * class (i.e. counters have not been redefined since registration) and counters shall
+ * have been started. Since generations wrap around, the counter ID is also checked
+ * against the current number of counters and the type against the current type of the
+ * counter, so that a stale handle never indexes values of a counter that does not exist
+ * or has a different layout.
+ */
+static inline bool CheckCtrHandle(CtrHandle handle, uint8_t ctrClass, CounterType ctrKind)
+{
+    uint16_t    id = CTRHANDLEID(handle);
+
+    if ( (BaseCtrActive == false) ||
+         (CTRHANDLEGEN(handle) != CtrHandleGen[ctrClass]) ||
+         (CTRKIND(CTRHANDLETYPE(handle)) != ctrKind) )
+        return (false);
+
+    if (ctrClass == CTRSCALAR)
+        return ((id < numScalarCtr) && (scalarType[id] == CTRHANDLETYPE(handle)));
+
+    return ((id < numVectorCtr) && (vectorHot[id].Type == CTRHANDLETYPE(handle)));
+}
+
+
+/*
+ * This is an internal function that implements both incr_peg_ctr() and add_peg_ctr()
+ * (see the latter for parameters and return values). It is kept static, so that it
+ * can be inlined in both public functions.
+ */
+static inline Error AddPegCtrHandle(CtrHandle handle, uint16_t *ctrInst, uint64_t n)
+{
+    if (CTRHANDLECLASS(handle) == CTRSCALAR)
+    {
+        if (!CheckCtrHandle(handle, CTRSCALAR, PEGCTR))
+            return (MIXFKO);
+        return (AddPegScalarValue(CTRHANDLEID(handle), CTRHANDLETYPE(handle), n));
+    }
+
+    if (!CheckCtrHandle(handle, CTRVECTOR, PEGCTR))
+        return (MIXFKO);
+    return (AddPegVectorValue(CTRHANDLEID(handle), CTRHANDLETYPE(handle), ctrInst, n));
+}
+
+
+/*
+ * This is an internal function that provides the sort key of a bulk update record:
+ * Scalar Counters come first (key = ID), then Vector Counters (key = numScalarCtr + ID),
+ * while records referring to counters outside the allowed ranges get the highest key.
+ */
+static inline uint32_t CtrUpdateKey(const CtrUpdate *u)
+{
+    if ((u->ctrClass == CTRSCALAR) && (u->ctrId < numScalarCtr))
+        return (u->ctrId);
+    if ((u->ctrClass == CTRVECTOR) && (u->ctrId < numVectorCtr))
+        return (numScalarCtr + u->ctrId);
+    return (numScalarCtr + numVectorCtr);
+}
+
+
+/*
+ * This is an internal function used by update_ctr_bulk() when CTRBULKSORT is specified.
+ * Records are grouped by counter through a counting sort, which is stable: the relative
+ * order of records related to the same counter is preserved, so that the saturation of
+ * Roller counters is the same as if records were applied in the original order.
+ * Nothing is done if records are already grouped or if memory cannot be allocated.
+ */
+static void SortCtrUpdates(CtrUpdate *updates, uint32_t numUpdates)
+{
+    uint32_t    start[MAXSCALARCTRNUM + MAXVECTORCTRNUM + 1];
+    uint32_t    numKeys = numScalarCtr + numVectorCtr + 1,
+                i, pos, n;
+    CtrUpdate  *sorted;
+
+    for (i = 1; i < numUpdates; i++)
+        if (CtrUpdateKey(&updates[i-1]) > CtrUpdateKey(&updates[i]))
+            break;
+    if (i >= numUpdates)    /* Already sorted */
+        return;
+
+    if ((sorted = (CtrUpdate *)malloc((size_t)numUpdates * sizeof(CtrUpdate))) == NULL)
+        return;
+
+    /* Count records for each counter, then turn counts into start positions */
+    memset(start, 0, numKeys * sizeof(uint32_t));
+    for (i = 0; i < numUpdates; i++)
+        start[CtrUpdateKey(&updates[i])]++;
+    for (i = 0, pos = 0; i < numKeys; i++)
+    {
+        n = start[i];
+        start[i] = pos;
+        pos += n;
+    }
+
+    for (i = 0; i < numUpdates; i++)
+        sorted[start[CtrUpdateKey(&updates[i])]++] = updates[i];
+    memcpy(updates, sorted, (size_t)numUpdates * sizeof(CtrUpdate));
+    free(sorted);
+}
+
+
+/*
+ * This is an internal function that encodes a counter value as decimal ASCII text
+ * starting from the position pointed to by p, without any terminator. The number of
+ * digits is evaluated first (from the position of the most significant bit, without
+ * divisions), then digits are produced two at a time through a lookup table, from the
+ * least significant pair, using 32 bit divisions as soon as the value fits. It returns
+ * a pointer to the first character after the encoded value.
+ */
+static inline char *EncodeCtrValue(char *p, uint64_t val)
+{
+    static const char DigitPairs[201] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    static const uint64_t Pow10[20] =
+        { 1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+          1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+          100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+          1000000000000000000ULL, 10000000000000000000ULL };
+    uint32_t    v32;
+    int         len;
+    char       *end;
+
+    len = ((64 - __builtin_clzll(val | 1)) * 1233) >> 12;
+    len += (val >= Pow10[len]);
+    len += (len == 0);
+    end = p + len;
+
+    p = end;
+    while (val > UINT32_MAX)
+    {
+        p -= 2;
+        memcpy(p, &DigitPairs[(val % 100) * 2], 2);
+        val /= 100;
+    }
+    v32 = (uint32_t)val;
+    while (v32 >= 100)
+    {
+        p -= 2;
+        memcpy(p, &DigitPairs[(v32 % 100) * 2], 2);
+        v32 /= 100;
+    }
+    if (v32 >= 10)
+    {
+        p -= 2;
+        memcpy(p, &DigitPairs[v32 * 2], 2);
+    }
+    else
+        *--p = (char)('0' + v32);
+
+    return (end);
+}
+
+
+/*
+ * This is an internal function that writes to a counters file the buffers described by
+ * an array of iovec, through a single writev() on the raw descriptor (or a few of them,
+ * if there are more than IOV_MAX buffers), retrying in case of partial writes. Counters
+ * files are never accessed through stdio, so that no stream needs to be flushed. The
+ * array is modified. It returns the number of bytes written, or -1 in case of errors.
+ */
+static ssize_t WriteCtrIovDirect(int fd, struct iovec *iov, int cnt)
+{
+    ssize_t     n, total = 0;
+
+    while (cnt > 0)
+    {
+        if ((n = writev(fd, iov, (cnt < IOV_MAX) ? cnt : IOV_MAX)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return (-1);
+        }
+        total += n;
+        /* Skip buffers written completely, then the part written of the next one */
+        while ((cnt > 0) && ((size_t)n >= iov->iov_len))
+        {
+            n -= (ssize_t)iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= (size_t)n;
+        }
+    }
+
+    return (total);
+}
+
+
+/*
+ * This is an internal function that executes a file operation (CTRWRITEOP, CTRSYNCOP or
+ * CTRCLOSEOP) at once on the raw descriptor: either the direct writer, the writer thread
+ * or an operation that cannot be queued (see CtrFileOp()). It returns the result of the
+ * system call (the number of bytes written for CTRWRITEOP), negative in case of errors.
+ */
+static long RunCtrFileOp(uint8_t kind, int fd, struct iovec *iov, int cnt)
+{
+    if (kind == CTRWRITEOP)
+        return ((long)WriteCtrIovDirect(fd, iov, cnt));
+    if (kind == CTRSYNCOP)
+        return ((long)fdatasync(fd));
+
+    return ((long)close(fd));
+}
+
+
+/*
+ * This is an internal function that releases the io_uring instance of the asynchronous
+ * dump writer, unmapping its rings.
+ */
+static void ReleaseCtrUring(CtrUring *r)
+{
+    if ((r->Sqes != NULL) && (r->Sqes != MAP_FAILED))
+        munmap(r->Sqes, r->SqesSize);
+    if ((r->CqRing != NULL) && (r->CqRing != MAP_FAILED) && (r->CqRing != r->SqRing))
+        munmap(r->CqRing, r->CqRingSize);
+    if ((r->SqRing != NULL) && (r->SqRing != MAP_FAILED))
+        munmap(r->SqRing, r->SqRingSize);
+    if (r->fd >= 0)
+        close(r->fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+
+/*
+ * This is an internal function that creates the io_uring instance of the asynchronous
+ * dump writer and maps its rings (through the raw system calls, so that no additional
+ * library is required). Kernels older than 5.6 (without IORING_OP_WRITE and
+ * IORING_OP_CLOSE, detected through IORING_FEAT_RW_CUR_POS) are not used. It returns 0
+ * in case of success, -1 if io_uring is not available (e.g. not supported by the kernel
+ * or forbidden by a seccomp policy).
+ */
+static int SetupCtrUring(CtrUring *r)
+{
+    struct io_uring_params  params;
+    char                   *sq, *cq;
+
+    memset(r, 0, sizeof(*r));
+    memset(&params, 0, sizeof(params));
+    if ((r->fd = (int)syscall(__NR_io_uring_setup, URINGENTRIES, &params)) < 0)
+    {
+        r->fd = -1;
+        return (-1);
+    }
+    if (!(params.features & IORING_FEAT_RW_CUR_POS))
+    {
+        ReleaseCtrUring(r);
+        return (-1);
+    }
+
+    r->Entries = params.sq_entries;
+    r->SqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    r->CqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    r->SqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) && (r->CqRingSize > r->SqRingSize))
+        r->SqRingSize = r->CqRingSize;
+    r->SqRing = mmap(NULL, r->SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, IORING_OFF_SQ_RING);
+    if (r->SqRing == MAP_FAILED)
+    {
+        ReleaseCtrUring(r);
+        return (-1);
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        r->CqRing = r->SqRing;
+    else
+        r->CqRing = mmap(NULL, r->CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, IORING_OFF_CQ_RING);
+    r->Sqes = mmap(NULL, r->SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, IORING_OFF_SQES);
+    if ((r->CqRing == MAP_FAILED) || (r->Sqes == MAP_FAILED))
+    {
+        ReleaseCtrUring(r);
+        return (-1);
+    }
+
+    sq = (char *)r->SqRing;
+    cq = (char *)r->CqRing;
+    r->SqHead = (unsigned *)(sq + params.sq_off.head);
+    r->SqTail = (unsigned *)(sq + params.sq_off.tail);
+    r->SqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+    r->SqArray = (unsigned *)(sq + params.sq_off.array);
+    r->CqHead = (unsigned *)(cq + params.cq_off.head);
+    r->CqTail = (unsigned *)(cq + params.cq_off.tail);
+    r->CqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+    r->Cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    return (0);
+}
+
+
+/*
+ * This is an internal function that accounts an operation completed by the asynchronous
+ * writer (res is either the result of the system call or a negative errno value, as in
+ * io_uring completions) and releases it. If the kernel does not support IORING_OP_CLOSE,
+ * the descriptor is closed here (all previous operations are completed anyway, see
+ * QueueCtrWriteOp()). After a short write (io_uring only) the remainder is written at
+ * once, so that it is not dropped. It shall be called with WriterMutex locked.
+ */
+static void CompleteCtrWriteOp(CtrWriteOp *op, long res)
+{
+    struct iovec    iov;
+    long            n;
+
+    if ((op->Kind == CTRCLOSEOP) && (res == -EINVAL))
+        res = close(op->fd);
+    if ((op->Kind == CTRWRITEOP) && (res > 0) && ((size_t)res < op->Len))
+    {
+        iov.iov_base = op->Data + res;
+        iov.iov_len = op->Len - (size_t)res;
+        if ((n = RunCtrFileOp(CTRWRITEOP, op->fd, &iov, 1)) > 0)
+            res += n;
+    }
+    if ((res < 0) || ((op->Kind == CTRWRITEOP) && ((size_t)res != op->Len)))
+        WriterErrors++;
+    if ((op->Kind == CTRWRITEOP) && (res > 0))
+        WriterWrittenBytes += (uint64_t)res;
+    WriterInFlightBytes -= op->Len;
+    WriterInFlightOps--;
+    free(op);
+}
+
+
+/*
+ * This is the body of the writer thread (CTRTHREADWRITER): it executes the queued
+ * operations one at a time, in queuing order, until StopCtrWriter() sets WriterStop and
+ * the queue is empty.
+ */
+static void *CtrWriterLoop(void *arg)
+{
+    CtrWriteOp     *op;
+    struct iovec    iov;
+    long            res;
+
+    pthread_mutex_lock(&WriterMutex);
+    for (;;)
+    {
+        while ((WriterHead == NULL) && !WriterStop)
+            pthread_cond_wait(&WriterQueueCond, &WriterMutex);
+        if ((op = WriterHead) == NULL)
+            break;
+        pthread_mutex_unlock(&WriterMutex);
+
+        iov.iov_base = op->Data;
+        iov.iov_len = op->Len;
+        res = RunCtrFileOp(op->Kind, op->fd, &iov, 1);
+
+        pthread_mutex_lock(&WriterMutex);
+        if ((WriterHead = op->next) == NULL)
+            WriterTail = NULL;
+        CompleteCtrWriteOp(op, res);
+        pthread_cond_broadcast(&WriterDoneCond);
+    }
+    pthread_mutex_unlock(&WriterMutex);
+
+    return (arg);
+}
+
+
+/*
+ * This is an internal function that reaps all completions available in the io_uring
+ * completion ring, without any system call. It shall be called with WriterMutex locked.
+ */
+static void ReapCtrUring(void)
+{
+    struct io_uring_cqe    *cqe;
+    unsigned                head, tail;
+
+    head = *CtrRing.CqHead;
+    tail = __atomic_load_n(CtrRing.CqTail, __ATOMIC_ACQUIRE);
+    while (head != tail)
+    {
+        cqe = &CtrRing.Cqes[head & *CtrRing.CqMask];
+        CompleteCtrWriteOp((CtrWriteOp *)(uintptr_t)cqe->user_data, cqe->res);
+        head++;
+    }
+    __atomic_store_n(CtrRing.CqHead, head, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * This is an internal function that gives up io_uring once the ring cannot be entered
+ * anymore. Operations already submitted are waited for by polling the completion ring
+ * (the kernel completes them anyway), then the entries queued but not submitted are
+ * executed at once, in queuing order, so that no operation overtakes a previous one.
+ * The ring is released and the writer thread is used from then on (direct writes, if it
+ * cannot be created). It shall be called with WriterMutex locked.
+ */
+static void AbandonCtrUring(void)
+{
+    struct timespec         ts = { .tv_sec = 0, .tv_nsec = 1000000L };
+    struct io_uring_sqe    *sqe;
+    struct iovec            iov;
+    CtrWriteOp             *op;
+    unsigned                tail = *CtrRing.SqTail,
+                            i;
+
+    ReapCtrUring();
+    while (WriterInFlightOps > CtrRing.ToSubmit)
+    {
+        nanosleep(&ts, NULL);
+        ReapCtrUring();
+    }
+    for (i = tail - CtrRing.ToSubmit; i != tail; i++)
+    {
+        sqe = &CtrRing.Sqes[CtrRing.SqArray[i & *CtrRing.SqMask]];
+        op = (CtrWriteOp *)(uintptr_t)sqe->user_data;
+        iov.iov_base = op->Data;
+        iov.iov_len = op->Len;
+        CompleteCtrWriteOp(op, RunCtrFileOp(op->Kind, op->fd, &iov, 1));
+    }
+    ReleaseCtrUring(&CtrRing);
+
+    CtrWriterActive = CTRDIRECTWRITER;
+    WriterStop = false;
+    WriterHead = WriterTail = NULL;
+    if (pthread_create(&WriterThread, NULL, CtrWriterLoop, NULL) == 0)
+        CtrWriterActive = CTRTHREADWRITER;
+}
+
+
+/*
+ * This is an internal function that submits to the kernel the entries queued in the
+ * io_uring submission ring and, if minComplete is not 0, waits until at least minComplete
+ * operations are completed; completions are then reaped. If the ring cannot be entered,
+ * io_uring is given up (see AbandonCtrUring()) and -1 is returned, 0 otherwise. It shall
+ * be called with WriterMutex locked.
+ */
+static int SubmitCtrUring(unsigned minComplete)
+{
+    long    n;
+
+    for (;;)
+    {
+        n = syscall(__NR_io_uring_enter, CtrRing.fd, CtrRing.ToSubmit, minComplete,
+                    minComplete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (n >= 0)
+        {
+            CtrRing.ToSubmit -= (unsigned)n;
+            break;
+        }
+        if (errno == EINTR)
+            continue;
+        if ((errno != EAGAIN) && (errno != EBUSY))
+        {
+            AbandonCtrUring();
+            return (-1);
+        }
+        ReapCtrUring();         /* Completion ring full, make room and retry */
+    }
+    ReapCtrUring();
+
+    return (0);
+}
+
+
+/*
+ * This is an internal function that waits until at most maxOps operations are in flight
+ * in the asynchronous writer (0 to wait for all of them). It shall be called with
+ * WriterMutex locked.
+ */
+static void WaitCtrWriter(uint64_t maxOps)
+{
+    while (WriterInFlightOps > maxOps)
+    {
+        if (CtrWriterActive == CTRURINGWRITER)
+            SubmitCtrUring(1);      /* If io_uring is given up, operations are completed */
+        else if (CtrWriterActive == CTRTHREADWRITER)
+            pthread_cond_wait(&WriterDoneCond, &WriterMutex);
+        else
+            break;
+    }
+}
+
+
+/*
+ * This is an internal function that queues an operation to the asynchronous writer. With
+ * io_uring each operation is flagged with IOSQE_IO_DRAIN, so that it is started only once
+ * all previous ones are completed: rows are appended to each file in the same order in
+ * which they are dumped, and syncs and closes never overtake writes. Entries are submitted
+ * when the submission ring is full, otherwise by SubmitCtrWriter(); if the ring cannot be
+ * entered, io_uring is given up and the operation is queued to the writer thread (see
+ * AbandonCtrUring()). If too many bytes are in flight (MAXWRITERINFLIGHT, e.g. the disk
+ * is stuck), it waits for completions.
+ */
+static void QueueCtrWriteOp(CtrWriteOp *op)
+{
+    struct io_uring_sqe    *sqe;
+    struct iovec            iov;
+    unsigned                tail;
+
+    pthread_mutex_lock(&WriterMutex);
+    while ((WriterInFlightOps > 0) && (WriterInFlightBytes + op->Len > MAXWRITERINFLIGHT))
+        WaitCtrWriter(WriterInFlightOps - 1);
+    tail = (CtrWriterActive == CTRURINGWRITER) ? *CtrRing.SqTail : 0;
+    while ((CtrWriterActive == CTRURINGWRITER) &&
+           (tail - __atomic_load_n(CtrRing.SqHead, __ATOMIC_ACQUIRE) >= CtrRing.Entries))
+        SubmitCtrUring(0);      /* If the ring cannot be entered, io_uring is given up */
+    WriterInFlightBytes += op->Len;
+    WriterInFlightOps++;
+
+    if (CtrWriterActive == CTRURINGWRITER)
+    {
+        sqe = &CtrRing.Sqes[tail & *CtrRing.SqMask];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->fd = op->fd;
+        sqe->flags = IOSQE_IO_DRAIN;
+        sqe->user_data = (uint64_t)(uintptr_t)op;
+        if (op->Kind == CTRWRITEOP)
+        {
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->addr = (uint64_t)(uintptr_t)op->Data;
+            sqe->len = (uint32_t)op->Len;
+            sqe->off = (uint64_t)-1;            /* Current position (files are in append mode anyway) */
+        }
+        else if (op->Kind == CTRSYNCOP)
+        {
+            sqe->opcode = IORING_OP_FSYNC;
+            sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        }
+        else
+            sqe->opcode = IORING_OP_CLOSE;
+        CtrRing.SqArray[tail & *CtrRing.SqMask] = tail & *CtrRing.SqMask;
+        __atomic_store_n(CtrRing.SqTail, tail + 1, __ATOMIC_RELEASE);
+        CtrRing.ToSubmit++;
+    }
+    else if (CtrWriterActive == CTRTHREADWRITER)
+    {
+        op->next = NULL;
+        if (WriterTail != NULL)
+            WriterTail->next = op;
+        else
+            WriterHead = op;
+        WriterTail = op;
+        pthread_cond_signal(&WriterQueueCond);
+    }
+    else
+    {   /* io_uring given up and no writer thread: all previous operations are completed */
+        iov.iov_base = op->Data;
+        iov.iov_len = op->Len;
+        CompleteCtrWriteOp(op, RunCtrFileOp(op->Kind, op->fd, &iov, 1));
+    }
+    pthread_mutex_unlock(&WriterMutex);
+}
+
+
+/*
+ * This is an internal function that submits to the kernel the operations queued to the
+ * io_uring writer (if any) without waiting for them, and reaps completions already
+ * available. It is invoked at the end of each dump, so that each dump costs a single
+ * io_uring_enter() at most. It has no effect with other writers.
+ */
+static void SubmitCtrWriter(void)
+{
+    if (CtrWriterActive != CTRURINGWRITER)
+        return;
+    pthread_mutex_lock(&WriterMutex);
+    if (CtrRing.ToSubmit > 0)
+        SubmitCtrUring(0);
+    else
+        ReapCtrUring();
+    pthread_mutex_unlock(&WriterMutex);
+}
+
+
+/*
+ * This is an internal function that performs an operation (CTRWRITEOP, CTRSYNCOP or
+ * CTRCLOSEOP) on a counters file, either at once or through the asynchronous writer
+ * defined through define_ctr_dump_writer(). Data to be written (if any) is described by
+ * an array of iovec, and it is copied into the queued operation. If the operation cannot
+ * be allocated, it is performed at once, after all queued operations have completed.
+ */
+static void CtrFileOp(uint8_t kind, int fd, struct iovec *iov, int cnt)
+{
+    CtrWriteOp *op;
+    size_t      len = 0;
+    int         i;
+
+    for (i = 0; i < cnt; i++)
+        len += iov[i].iov_len;
+    if (CtrWriterActive == CTRDIRECTWRITER)
+    {
+        RunCtrFileOp(kind, fd, iov, cnt);
+        return;
+    }
+    if ((op = (CtrWriteOp *)malloc(sizeof(CtrWriteOp) + len)) == NULL)
+    {   /* The operation cannot be queued: it never overtakes the ones already queued (e.g. a */
+        /* close while writes to the same descriptor are pending), they are completed first */
+        pthread_mutex_lock(&WriterMutex);
+        WaitCtrWriter(0);
+        if (RunCtrFileOp(kind, fd, iov, cnt) < 0)
+            WriterErrors++;
+        pthread_mutex_unlock(&WriterMutex);
+        return;
+    }
+
+    op->Kind = kind;
+    op->fd = fd;
+    op->Len = len;
+    for (len = 0, i = 0; i < cnt; i++)
+    {
+        memcpy(op->Data + len, iov[i].iov_base, iov[i].iov_len);
+        len += iov[i].iov_len;
+    }
+    QueueCtrWriteOp(op);
+}
+
+
+/*
+ * This is an internal function that writes to a counters file the buffers described by
+ * an array of iovec (see CtrFileOp()).
+ */
+static void WriteCtrIov(int fd, struct iovec *iov, int cnt)
+{
+    CtrFileOp(CTRWRITEOP, fd, iov, cnt);
+}
+
+
+/*
+ * This is an internal function that starts the writer of dump files defined through
+ * define_ctr_dump_writer(): io_uring falls back to a writer thread if it is not available,
+ * and the writer thread falls back to direct writes if the thread cannot be created.
+ * Statistics are reset.
+ */
+static void StartCtrWriter(void)
+{
+    CtrWriterActive = CTRDIRECTWRITER;
+    WriterInFlightBytes = WriterInFlightOps = WriterWrittenBytes = WriterErrors = 0;
+
+    if ((CtrDumpWriter == CTRURINGWRITER) && (SetupCtrUring(&CtrRing) == 0))
+        CtrWriterActive = CTRURINGWRITER;
+    else if (CtrDumpWriter != CTRDIRECTWRITER)
+    {
+        WriterStop = false;
+        if (pthread_create(&WriterThread, NULL, CtrWriterLoop, NULL) == 0)
+            CtrWriterActive = CTRTHREADWRITER;
+    }
+}
+
+
+/*
+ * This is an internal function that waits until all operations queued to the writer of
+ * dump files are completed, then stops it (releasing io_uring or terminating the writer
+ * thread). Direct writes are used afterwards.
+ */
+static void StopCtrWriter(void)
+{
+    if (CtrWriterActive == CTRDIRECTWRITER)
+        return;
+
+    pthread_mutex_lock(&WriterMutex);
+    WaitCtrWriter(0);
+    if (CtrWriterActive == CTRTHREADWRITER)
+    {
+        WriterStop = true;
+        pthread_cond_signal(&WriterQueueCond);
+    }
+    pthread_mutex_unlock(&WriterMutex);
+
+    if (CtrWriterActive == CTRTHREADWRITER)
+        pthread_join(WriterThread, NULL);
+    else
+        ReleaseCtrUring(&CtrRing);
+    CtrWriterActive = CTRDIRECTWRITER;
+}
+
+
+/*
+ * This is an internal function that writes to a counters file a row (or a set of rows)
+ * encoded in a buffer through EncodeCtrValue(), with a single write() on the raw descriptor.
+ */
+static void WriteCtrRow(int fd, const char *row, size_t len)
+{
+    struct iovec    iov = { .iov_base = (void *)row, .iov_len = len };
+
+    WriteCtrIov(fd, &iov, 1);
+}
+
+
+/*
+ * This is an internal function that writes the header row of a counters file: a prefix
+ * (e.g. "Date,Time,") followed by num names separated by commas, taken from a table in
+ * which consecutive names are stride bytes apart (e.g. scalarCtr[].Name). Names are
+ * gathered directly from the table through writev(), without copying them.
+ */
+static void WriteCtrHeader(int fd, const char *prefix, const char *names, size_t stride, uint32_t num)
+{
+    struct iovec   *iov;
+    uint32_t        i;
+    int             cnt = 0;
+
+    if ((iov = (struct iovec *)malloc((2 * (size_t)num + 2) * sizeof(struct iovec))) == NULL)
+        return;
+    iov[cnt].iov_base = (void *)prefix;
+    iov[cnt++].iov_len = strlen(prefix);
+    for (i = 0; i < num; i++, names += stride)
+    {
+        iov[cnt].iov_base = (void *)names;
+        iov[cnt++].iov_len = strlen(names);
+        iov[cnt].iov_base = (void *)((i < num - 1) ? "," : "\n");
+        iov[cnt++].iov_len = 1;
+    }
+    if (num == 0)
+    {
+        iov[cnt].iov_base = (void *)"\n";
+        iov[cnt++].iov_len = 1;
+    }
+    WriteCtrIov(fd, iov, cnt);
+    free(iov);
+}
+
+
+/*
+ * This is an internal function that writes the header rows of the file of a Vector
+ * Counter (a description row, then a row with the names of all instances). If tagged
+ * is set, the second row is tagged with "vector_<ctrId>" (see CTRCSVTAGGED).
+ */
+static void WriteVectorCtrHeader(int fd, uint16_t ctrId, bool tagged)
+{
+    LongString  prefix;
+
+    snprintf(prefix, sizeof(prefix), tagged ? "Vector Counter: %s - Instances: %s\nDate,Time,vector_%d," :
+                                              "Vector Counter: %s - Instances: %s\nDate,Time,",
+             vectorCtr[ctrId].Name, vectorCtr[ctrId].InstName, ctrId);
+    WriteCtrHeader(fd, prefix, (vectorHot[ctrId].NumInstances > 0) ? vectorCtr[ctrId].InstIdName[0] : "",
+                   sizeof(MicroString), vectorHot[ctrId].NumInstances);
+}
+
+
+/*
+ * This is an internal function that writes the header rows of the file of a Sparse
+ * Counter (a description row, then a row naming the key and value columns). If tagged
+ * is set, the second row is tagged with "sparse_<ctrId>" (see CTRCSVTAGGED).
+ */
+static void WriteSparseCtrHeader(int fd, uint16_t ctrId, bool tagged)
+{
+    LongString  header;
+    ShortString tag = "";
+    int         len;
+
+    if (tagged)
+        snprintf(tag, sizeof(tag), "sparse_%d,", ctrId);
+    len = snprintf(header, sizeof(header), "Sparse Counter: %s - Keys: %s\nDate,Time,%s%s,%s\n", sparseCtr[ctrId].Name,
+                   sparseCtr[ctrId].KeyName, tag, sparseCtr[ctrId].KeyName, sparseCtr[ctrId].Name);
+    WriteCtrRow(fd, header, (size_t)len);
+}
+
+
+/*
+ * This is an internal function that writes the header rows of the file of a Histogram
+ * Counter (a description row, then a row naming number of values, sum, min, max and
+ * percentiles). If tagged is set, the second row is tagged with "histo_<ctrId>" (see
+ * CTRCSVTAGGED).
+ */
+static void WriteHistoCtrHeader(int fd, uint16_t ctrId, bool tagged)
+{
+    LongString  header;
+    ShortString tag = "";
+    int         len, i;
+
+    if (tagged)
+        snprintf(tag, sizeof(tag), "histo_%d,", ctrId);
+    len = snprintf(header, sizeof(header), "Histogram Counter: %s\nDate,Time,%scount,sum,min,max", histoCtr[ctrId].Name, tag);
+    for (i = 0; i < numHistoPct; i++)
+        len += snprintf(header + len, sizeof(header) - len, ",%s", HistoPctName[i]);
+    header[len++] = '\n';
+    WriteCtrRow(fd, header, (size_t)len);
+}
+
+
+/*
+ * This is an internal function that writes the header rows of the file of a Summary
+ * Counter (a description row, then a row naming count, sum, min and max). If tagged is
+ * set, the second row is tagged with "summary_<ctrId>" (see CTRCSVTAGGED).
+ */
+static void WriteSummaryCtrHeader(int fd, uint16_t ctrId, bool tagged)
+{
+    LongString  header;
+    ShortString tag = "";
+    int         len;
+
+    if (tagged)
+        snprintf(tag, sizeof(tag), "summary_%d,", ctrId);
+    len = snprintf(header, sizeof(header), "Summary Counter: %s\nDate,Time,%scount,sum,min,max\n", summaryCtr[ctrId].Name, tag);
+    WriteCtrRow(fd, header, (size_t)len);
+}
+
+
+/*
+ * This is an internal function that writes the header rows of the file of a Top-K
+ * Counter (a description row, then a row naming key, count and error columns). If tagged
+ * is set, the second row is tagged with "topk_<ctrId>" (see CTRCSVTAGGED).
+ */
+static void WriteTopkCtrHeader(int fd, uint16_t ctrId, bool tagged)
+{
+    LongString  header;
+    ShortString tag = "";
+    int         len;
+
+    if (tagged)
+        snprintf(tag, sizeof(tag), "topk_%d,", ctrId);
+    len = snprintf(header, sizeof(header), "Top-K Counter: %s - Keys: %s\nDate,Time,%s%s,%s,error\n", topkCtr[ctrId].Name,
+                   topkCtr[ctrId].KeyName, tag, topkCtr[ctrId].KeyName, topkCtr[ctrId].Name);
+    WriteCtrRow(fd, header, (size_t)len);
+}
+
+
+/*
+ * This is an internal function that writes the header rows of the rates file (a
+ * description row, then a row naming the RATEVALUES columns of each defined rate, e.g.
+ * "<name> ewma1m"). If tagged is set, the second row is tagged with "rates" (see
+ * CTRCSVTAGGED).
+ */
+static void WriteRateCtrHeader(int fd, bool tagged)
+{
+    char   *header;
+    size_t  size = 64 + (size_t)numRateCtr * RATEVALUES * (SHORTSTRINGMAXLEN + 10);
+    int     len, i, k;
+
+    if ((header = (char *)malloc(size)) == NULL)
+        return;
+    len = snprintf(header, size, "Counter Rates\nDate,Time%s", tagged ? ",rates" : "");
+    for (i = 0; i < numRateCtr; i++)
+        if (rateCtr[i].Name[0] != '\0')
+            for (k = 0; k < RATEVALUES; k++)
+                len += snprintf(header + len, size - len, ",%s %s", rateCtr[i].Name, RateColumn[k]);
+    header[len++] = '\n';
+    WriteCtrRow(fd, header, (size_t)len);
+    free(header);
+}
+
+
+/*
+ * This is an internal function that writes the header rows of the Distinct Counters file
+ * (a description row, then a row naming the column of each defined Distinct Counter). If
+ * tagged is set, the second row is tagged with "distinct" (see CTRCSVTAGGED).
+ */
+static void WriteDistinctCtrHeader(int fd, bool tagged)
+{
+    char   *header;
+    size_t  size = 64 + (size_t)numDistinctCtr * (SHORTSTRINGMAXLEN + 1);
+    int     len, i;
+
+    if ((header = (char *)malloc(size)) == NULL)
+        return;
+    len = snprintf(header, size, "Distinct Counters\nDate,Time%s", tagged ? ",distinct" : "");
+    for (i = 0; i < numDistinctCtr; i++)
+        if (distinctCtr[i].Precision != 0)
+            len += snprintf(header + len, size - len, ",%s", distinctCtr[i].Name);
+    header[len++] = '\n';
+    WriteCtrRow(fd, header, (size_t)len);
+    free(header);
+}
+
+
+/*
+ * This is an internal function that opens a counters file in append mode (creating it if
+ * needed) as a raw descriptor. If the last parameter is not NULL, it is set if the file is
+ * initially empty (i.e. header rows shall be written). It returns the descriptor, or -1
+ * if the file cannot be opened.
+ */
+static int OpenCtrFile(const char *path, bool *empty)
+{
+    struct stat FileStat;
+    int         fd;
+
+    if ((fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0666)) < 0)
+        return (-1);
+    if (empty != NULL)
+    {
+        if (fstat(fd, &FileStat) != 0)
+        {
+            close(fd);
+            return (-1);
+        }
+        *empty = (FileStat.st_size == 0);
+    }
+
+    return (fd);
+}
+
+
+/*
+ * This is an internal function that flushes to disk (through fdatasync()) all base or
+ * aggr counters files, according to the durability defined through define_ctr_dump_sync(),
+ * and resets the number of dumps not synced yet. With an asynchronous writer, syncs are
+ * queued after the writes of the dump.
+ */
+static void SyncCtrFiles(bool aggr)
+{
+    int     i, fd;
+
+    if ((fd = aggr ? AggrCtr_fd : BaseCtr_fd) >= 0)
+        CtrFileOp(CTRSYNCOP, fd, NULL, 0);
+    for (i = 0; i < numVectorCtr; i++)
+        if ((fd = aggr ? vectorCtr[i].AggrCtr_fd : vectorCtr[i].BaseCtr_fd) >= 0)
+            CtrFileOp(CTRSYNCOP, fd, NULL, 0);
+    for (i = 0; i < numSparseCtr; i++)
+        if ((fd = aggr ? sparseCtr[i].AggrCtr_fd : sparseCtr[i].BaseCtr_fd) >= 0)
+            CtrFileOp(CTRSYNCOP, fd, NULL, 0);
+    for (i = 0; i < numHistoCtr; i++)
+        if ((fd = aggr ? histoCtr[i].AggrCtr_fd : histoCtr[i].BaseCtr_fd) >= 0)
+            CtrFileOp(CTRSYNCOP, fd, NULL, 0);
+    for (i = 0; i < numSummaryCtr; i++)
+        if ((fd = aggr ? summaryCtr[i].AggrCtr_fd : summaryCtr[i].BaseCtr_fd) >= 0)
+            CtrFileOp(CTRSYNCOP, fd, NULL, 0);
+    for (i = 0; i < numTopkCtr; i++)
+        if ((fd = aggr ? topkCtr[i].AggrCtr_fd : topkCtr[i].BaseCtr_fd) >= 0)
+            CtrFileOp(CTRSYNCOP, fd, NULL, 0);
+    if ((fd = aggr ? AggrRateCtr_fd : BaseRateCtr_fd) >= 0)
+        CtrFileOp(CTRSYNCOP, fd, NULL, 0);
+    if ((fd = aggr ? AggrDistinctCtr_fd : BaseDistinctCtr_fd) >= 0)
+        CtrFileOp(CTRSYNCOP, fd, NULL, 0);
+
+    if (aggr)
+        AggrUnsyncedDumps = 0;
+    else
+        BaseUnsyncedDumps = 0;
+}
+
+
+/*
+ * This is an internal function that closes all base or aggr counters files (if open),
+ * after syncing them if some dumps have not been synced yet (see define_ctr_dump_sync()).
+ * With an asynchronous writer, closes are queued after pending writes, so that rotation
+ * never waits for them.
+ */
+static void CloseCtrFiles(bool aggr)
+{
+    int    *fd;
+    int     i;
+
+    if ((CtrDumpSync != CTRNOSYNC) && ((aggr ? AggrUnsyncedDumps : BaseUnsyncedDumps) > 0))
+        SyncCtrFiles(aggr);
+
+    fd = aggr ? &AggrCtr_fd : &BaseCtr_fd;
+    if (*fd >= 0)
+        CtrFileOp(CTRCLOSEOP, *fd, NULL, 0);
+    *fd = -1;
+    for (i = 0; i < numVectorCtr; i++)
+    {
+        fd = aggr ? &vectorCtr[i].AggrCtr_fd : &vectorCtr[i].BaseCtr_fd;
+        if (*fd >= 0)
+            CtrFileOp(CTRCLOSEOP, *fd, NULL, 0);
+        *fd = -1;
+    }
+    for (i = 0; i < numSparseCtr; i++)
+    {
+        fd = aggr ? &sparseCtr[i].AggrCtr_fd : &sparseCtr[i].BaseCtr_fd;
+        if (*fd >= 0)
+            CtrFileOp(CTRCLOSEOP, *fd, NULL, 0);
+        *fd = -1;
+    }
+    for (i = 0; i < numHistoCtr; i++)
+    {
+        fd = aggr ? &histoCtr[i].AggrCtr_fd : &histoCtr[i].BaseCtr_fd;
+        if (*fd >= 0)
+            CtrFileOp(CTRCLOSEOP, *fd, NULL, 0);
+        *fd = -1;
+    }
+    for (i = 0; i < numSummaryCtr; i++)
+    {
+        fd = aggr ? &summaryCtr[i].AggrCtr_fd : &summaryCtr[i].BaseCtr_fd;
+        if (*fd >= 0)
+            CtrFileOp(CTRCLOSEOP, *fd, NULL, 0);
+        *fd = -1;
+    }
+    for (i = 0; i < numTopkCtr; i++)
+    {
+        fd = aggr ? &topkCtr[i].AggrCtr_fd : &topkCtr[i].BaseCtr_fd;
+        if (*fd >= 0)
+            CtrFileOp(CTRCLOSEOP, *fd, NULL, 0);
+        *fd = -1;
+    }
+    fd = aggr ? &AggrRateCtr_fd : &BaseRateCtr_fd;
+    if (*fd >= 0)
+        CtrFileOp(CTRCLOSEOP, *fd, NULL, 0);
+    *fd = -1;
+    fd = aggr ? &AggrDistinctCtr_fd : &BaseDistinctCtr_fd;
+    if (*fd >= 0)
+        CtrFileOp(CTRCLOSEOP, *fd, NULL, 0);
+    *fd = -1;
+}
+
+
+/*
+ * This is an internal function that returns the absolute time of the first dump slot
+ * starting at or after time t. If the second parameter is not 0 the schedule is periodic
+ * ("every Ns"), and slots are the multiples of the period. Otherwise slots are the minutes
+ * set in the schedule bitmap passed as first parameter, and t is rounded up to the minute.
+ * The bitmap is scanned one word at a time starting from the local minute of the day of
+ * t; in the unlikely case that local time changes in between (e.g. daylight saving time),
+ * the next 25 hours are scanned minute by minute. It returns NODUMPTIME if the schedule
+ * is empty.
+ */
+static time_t NextSlotTime(const uint64_t *map, uint32_t period, time_t t)
+{
+    struct tm   tm;
+    uint64_t    word;
+    time_t      slot;
+    int         minute, bit, i;
+
+    if (period)
+        return (t + (period - t % period) % period);
+
+    slot = t + (60 - t % 60) % 60;
+    localtime_r(&slot, &tm);
+    minute = tm.tm_hour * 60 + tm.tm_min;
+
+    for (i = 0; i < MINUTESPERDAY; )
+    {
+        bit = (minute + i) % MINUTESPERDAY;
+        if ((word = map[bit / 64] >> (bit % 64)) == 0)
+        {   /* No slot in the rest of this word */
+            i += 64 - bit % 64;
+            if (bit / 64 == DUMPMAPWORDS - 1)   /* Last word: wrap to minute 0 */
+                i -= 64 - MINUTESPERDAY % 64;
+            continue;
+        }
+        i += __builtin_ctzll(word);
+        if (i >= MINUTESPERDAY)
+            break;
+
+        t = slot + (time_t)i * 60;
+        localtime_r(&t, &tm);
+        if (ISDUMPSLOT(map, tm.tm_hour * 60 + tm.tm_min))
+            return (t);
+
+        /* Local time has changed in between: scan minute by minute */
+        for (i = 0, t = slot; i < 25 * 60; i++, t += 60)
+        {
+            localtime_r(&t, &tm);
+            if (ISDUMPSLOT(map, tm.tm_hour * 60 + tm.tm_min))
+                return (t);
+        }
+        break;
+    }   /* for (i = 0; i < MINUTESPERDAY; ) */
+
+    return (NODUMPTIME);
+}
+
+
+/*
+ * This is an internal function that writes into a row buffer the time stamp of a dump
+ * slot (in the form dd/mm/yyyy,hh:mm, or dd/mm/yyyy,hh:mm:ss if the last parameter is
+ * set) followed by a comma. It returns a pointer to the first character after the comma,
+ * where counter values shall be encoded.
+ */
+static char *FormatRowStamp(char *row, time_t slot, bool seconds)
+{
+    struct tm   tm;
+    size_t      len;
+
+    localtime_r(&slot, &tm);
+    len = strftime(row, SHORTSTRINGMAXLEN + 1, seconds ? "%d/%m/%Y,%H:%M:%S" : "%d/%m/%Y,%H:%M", &tm);
+    row[len] = ',';
+
+    return (row + len + 1);
+}
+
+
+/*
+ * This is an internal function that writes a row for a dump slot that has been missed
+ * (i.e. check_and_dump_ctr() was not invoked in time). The row contains the time stamp
+ * already formatted in the buffer (up to p) followed by numValues empty values, so that
+ * gaps are explicit in the CSV file instead of being merged into the next interval.
+ */
+static void WriteGapRow(int fd, char *row, char *p, uint32_t numValues)
+{
+    memset(p, ',', numValues);
+    p += numValues;
+    p[-1] = '\n';
+    WriteCtrRow(fd, row, (size_t)(p - row));
+}
+
+
+/*
+ * This is an internal function that encodes in a buffer all rows of a dump slot of the
+ * single CSV file written with CTRCSVTAGGED: a row for Scalar Counters, tagged "scalar",
+ * then a row for each Vector Counter, tagged "vector_<ctrId>". If a row of values is
+ * given (see FetchDumpRow()), rows report its values, otherwise they have empty values
+ * (missed slot). It returns a pointer to the first character after the last row, so that all
+ * rows can be written at once.
+ */
+static char *EncodeTaggedRows(char *buf, time_t slot, bool seconds, const uint64_t *row)
+{
+    size_t      stampLen;
+    char       *p;
+    int         i, j;
+
+    p = FormatRowStamp(buf, slot, seconds);
+    stampLen = (size_t)(p - buf);
+    memcpy(p, "scalar,", 7);
+    p += 7;
+    if (row != NULL)
+    {
+        for (i = 0; i < numScalarCtr; i++)
+        {
+            p = EncodeCtrValue(p, row[i]);
+            *p++ = ',';
+        }
+    }
+    else
+    {
+        memset(p, ',', numScalarCtr);
+        p += numScalarCtr;
+    }
+    p[-1] = '\n';
+
+    for (i = 0; i < numVectorCtr; i++)
+    {
+        memcpy(p, buf, stampLen);       /* Same time stamp of the first row */
+        p += stampLen;
+        memcpy(p, "vector_", 7);
+        p = EncodeCtrValue(p + 7, (uint64_t)i);
+        *p++ = ',';
+        if (row != NULL)
+        {
+            for (j = 0; j < vectorHot[i].NumInstances; j++)
+            {
+                p = EncodeCtrValue(p, row[VectorShardOffset[i] + j]);
+                *p++ = ',';
+            }
+        }
+        else
+        {
+            memset(p, ',', vectorHot[i].NumInstances);
+            p += vectorHot[i].NumInstances;
+        }
+        p[-1] = '\n';
+    }
+
+    return (p);
+}
+
+
+/*
+ * This is an internal function that opens (in append mode) the single CSV file of all
+ * counters written with CTRCSVTAGGED, named counters_<infix><stamp>.csv within the given
+ * directory. If the file is initially empty, it prints first the header rows, tagged as
+ * the rows they refer to (Vector, Sparse and Histogram Counters headers are preceded by
+ * the same description row of vector_<ctrId>, sparse_<ctrId> and histo_<ctrId> files).
+ * It returns MIXFOK in case of success, MIXFNOACCESS if the file cannot be opened.
+ */
+static Error OpenTaggedDumpFile(int *fd, const char *dir, const char *infix, const char *stamp)
+{
+    LongString  DumpFile;
+    bool        empty;
+    int         i;
+
+    if (snprintf(DumpFile, sizeof(DumpFile), "%scounters_%s%s.csv", dir, infix, stamp) >= sizeof(DumpFile))
+        return (MIXFNOACCESS);
+    if ((*fd = OpenCtrFile(DumpFile, &empty)) < 0)
+        return (MIXFNOACCESS);
+
+    if (empty)
+    {
+        WriteCtrHeader(*fd, "Date,Time,scalar,", scalarCtr[0].Name, sizeof(ScalarCtrInfo), numScalarCtr);
+        for (i = 0; i < numVectorCtr; i++)
+            WriteVectorCtrHeader(*fd, i, true);
+        for (i = 0; i < numSparseCtr; i++)
+            if (sparseCtr[i].Type != UNDEFCTR)
+                WriteSparseCtrHeader(*fd, i, true);
+        for (i = 0; i < numHistoCtr; i++)
+            if (histoCtr[i].Bits != 0)
+                WriteHistoCtrHeader(*fd, i, true);
+        for (i = 0; i < numSummaryCtr; i++)
+            if (summaryCtr[i].Name[0] != '\0')
+                WriteSummaryCtrHeader(*fd, i, true);
+        if (numRateCtr > 0)
+            WriteRateCtrHeader(*fd, true);
+        for (i = 0; i < numTopkCtr; i++)
+            if (topkCtr[i].TopK != 0)
+                WriteTopkCtrHeader(*fd, i, true);
+        if (numDistinctCtr > 0)
+            WriteDistinctCtrHeader(*fd, true);
+    }
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This is an internal function that opens (in append mode) the CSV files of all Sparse
+ * Counters written with CTRCSVDUMP, named sparse_<ctrId>_<stamp>.csv (or
+ * sparse_<ctrId>_aggr_<stamp>.csv) within the base or aggr directory. If a file is
+ * initially empty, it prints first the header rows. It returns MIXFOK in case of success,
+ * MIXFNOACCESS if a file cannot be opened (files already open are closed by the caller
+ * through CloseCtrFiles()).
+ */
+static Error OpenSparseCtrFiles(bool aggr, const char *stamp)
+{
+    LongString  DumpFile;
+    bool        empty;
+    int        *fd;
+    int         i;
+
+    for (i = 0; i < numSparseCtr; i++)
+    {
+        if (sparseCtr[i].Type == UNDEFCTR)
+            continue;
+        fd = aggr ? &sparseCtr[i].AggrCtr_fd : &sparseCtr[i].BaseCtr_fd;
+        if (snprintf(DumpFile, sizeof(DumpFile), "%ssparse_%d_%s%s.csv", aggr ? AggrCtrDir : BaseCtrDir, i,
+                     aggr ? "aggr_" : "", stamp) >= sizeof(DumpFile))
+            return (MIXFNOACCESS);
+        if ((*fd = OpenCtrFile(DumpFile, &empty)) < 0)
+            return (MIXFNOACCESS);
+        if (empty)
+            WriteSparseCtrHeader(*fd, i, false);
+    }
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This is an internal function that opens (in append mode) the CSV files of all Histogram
+ * Counters written with CTRCSVDUMP, named histo_<ctrId>_<stamp>.csv (or
+ * histo_<ctrId>_aggr_<stamp>.csv) within the base or aggr directory, in the same way as
+ * OpenSparseCtrFiles().
+ */
+static Error OpenHistoCtrFiles(bool aggr, const char *stamp)
+{
+    LongString  DumpFile;
+    bool        empty;
+    int        *fd;
+    int         i;
+
+    for (i = 0; i < numHistoCtr; i++)
+    {
+        if (histoCtr[i].Bits == 0)
+            continue;
+        fd = aggr ? &histoCtr[i].AggrCtr_fd : &histoCtr[i].BaseCtr_fd;
+        if (snprintf(DumpFile, sizeof(DumpFile), "%shisto_%d_%s%s.csv", aggr ? AggrCtrDir : BaseCtrDir, i,
+                     aggr ? "aggr_" : "", stamp) >= sizeof(DumpFile))
+            return (MIXFNOACCESS);
+        if ((*fd = OpenCtrFile(DumpFile, &empty)) < 0)
+            return (MIXFNOACCESS);
+        if (empty)
+            WriteHistoCtrHeader(*fd, i, false);
+    }
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This is an internal function that opens (in append mode) the CSV files of all Summary
+ * Counters written with CTRCSVDUMP, named summary_<ctrId>_<stamp>.csv (or
+ * summary_<ctrId>_aggr_<stamp>.csv) within the base or aggr directory, in the same way
+ * as OpenSparseCtrFiles().
+ */
+static Error OpenSummaryCtrFiles(bool aggr, const char *stamp)
+{
+    LongString  DumpFile;
+    bool        empty;
+    int        *fd;
+    int         i;
+
+    for (i = 0; i < numSummaryCtr; i++)
+    {
+        if (summaryCtr[i].Name[0] == '\0')
+            continue;
+        fd = aggr ? &summaryCtr[i].AggrCtr_fd : &summaryCtr[i].BaseCtr_fd;
+        if (snprintf(DumpFile, sizeof(DumpFile), "%ssummary_%d_%s%s.csv", aggr ? AggrCtrDir : BaseCtrDir, i,
+                     aggr ? "aggr_" : "", stamp) >= sizeof(DumpFile))
+            return (MIXFNOACCESS);
+        if ((*fd = OpenCtrFile(DumpFile, &empty)) < 0)
+            return (MIXFNOACCESS);
+        if (empty)
+            WriteSummaryCtrHeader(*fd, i, false);
+    }
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This is an internal function that opens (in append mode) the CSV file of counter rates
+ * written with CTRCSVDUMP, named rates_<stamp>.csv (or rates_aggr_<stamp>.csv) within
+ * the base or aggr directory, in the same way as OpenSparseCtrFiles().
+ */
+static Error OpenRateCtrFile(bool aggr, const char *stamp)
+{
+    LongString  DumpFile;
+    bool        empty;
+    int        *fd = aggr ? &AggrRateCtr_fd : &BaseRateCtr_fd;
+
+    if (numRateCtr == 0)
+        return (MIXFOK);
+    if (snprintf(DumpFile, sizeof(DumpFile), "%srates_%s%s.csv", aggr ? AggrCtrDir : BaseCtrDir,
+                 aggr ? "aggr_" : "", stamp) >= sizeof(DumpFile))
+        return (MIXFNOACCESS);
+    if ((*fd = OpenCtrFile(DumpFile, &empty)) < 0)
+        return (MIXFNOACCESS);
+    if (empty)
+        WriteRateCtrHeader(*fd, false);
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This is an internal function that opens (in append mode) the CSV file of Distinct
+ * Counters written with CTRCSVDUMP, named distinct_<stamp>.csv (or
+ * distinct_aggr_<stamp>.csv) within the base or aggr directory, in the same way as
+ * OpenRateCtrFile().
+ */
+static Error OpenDistinctCtrFile(bool aggr, const char *stamp)
+{
+    LongString  DumpFile;
+    bool        empty;
+    int        *fd = aggr ? &AggrDistinctCtr_fd : &BaseDistinctCtr_fd;
+
+    if (numDistinctCtr == 0)
+        return (MIXFOK);
+    if (snprintf(DumpFile, sizeof(DumpFile), "%sdistinct_%s%s.csv", aggr ? AggrCtrDir : BaseCtrDir,
+                 aggr ? "aggr_" : "", stamp) >= sizeof(DumpFile))
+        return (MIXFNOACCESS);
+    if ((*fd = OpenCtrFile(DumpFile, &empty)) < 0)
+        return (MIXFNOACCESS);
+    if (empty)
+        WriteDistinctCtrHeader(*fd, false);
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This is an internal function that opens (in append mode) the CSV files of all Top-K
+ * Counters written with CTRCSVDUMP, named topk_<ctrId>_<stamp>.csv (or
+ * topk_<ctrId>_aggr_<stamp>.csv) within the base or aggr directory, in the same way as
+ * OpenSparseCtrFiles().
+ */
+static Error OpenTopkCtrFiles(bool aggr, const char *stamp)
+{
+    LongString  DumpFile;
+    bool        empty;
+    int        *fd;
+    int         i;
+
+    for (i = 0; i < numTopkCtr; i++)
+    {
+        if (topkCtr[i].TopK == 0)
+            continue;
+        fd = aggr ? &topkCtr[i].AggrCtr_fd : &topkCtr[i].BaseCtr_fd;
+        if (snprintf(DumpFile, sizeof(DumpFile), "%stopk_%d_%s%s.csv", aggr ? AggrCtrDir : BaseCtrDir, i,
+                     aggr ? "aggr_" : "", stamp) >= sizeof(DumpFile))
+            return (MIXFNOACCESS);
+        if ((*fd = OpenCtrFile(DumpFile, &empty)) < 0)
+            return (MIXFNOACCESS);
+        if (empty)
+            WriteTopkCtrHeader(*fd, i, false);
+    }
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This is an internal function that stores the n least significant bytes of a value in
+ * little-endian order. It returns a pointer to the first byte after the value.
+ */
+static inline char *PutBinLE(char *p, uint64_t v, int n)
+{
+    for (; n > 0; n--, v >>= 8)
+        *p++ = (char)(v & 0xFF);
+
+    return (p);
+}
+
+
+/*
+ * This is an internal function that stores a value as an unsigned LEB128 varint (7 bits
+ * per byte, least significant group first, most significant bit set on all bytes but
+ * the last one). It returns a pointer to the first byte after the value.
+ */
+static inline char *PutBinVarint(char *p, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        *p++ = (char)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (char)v;
+
+    return (p);
+}
+
+
+/*
+ * This is an internal function that encodes a counter value in a binary row according
+ * to the encoding selected through define_ctr_dump_format(): fixed width (CTRDUMPWIDTH()
+ * bytes), varint (CTRVARINTENC) or zig-zag varint of the difference from the value of the
+ * same counter in the previous row of the file, kept in *prev (CTRDELTAENC).
+ */
+static inline char *EncodeBinValue(char *p, uint64_t v, CounterType type, uint64_t *prev)
+{
+    uint64_t    d;
+
+    if (CtrDumpFormat & CTRDELTAENC)
+    {
+        d = v - *prev;
+        *prev = v;
+        return (PutBinVarint(p, (d << 1) ^ (uint64_t)((int64_t)d >> 63)));
+    }
+    if (CtrDumpFormat & CTRVARINTENC)
+        return (PutBinVarint(p, v));
+
+    return (PutBinLE(p, v, CTRDUMPWIDTH(type)));
+}
+
+
+/*
+ * This is an internal function that starts a row (CTRBLKROW), gap (CTRBLKGAP), sparse
+ * (CTRBLKSPARSE) or histogram (CTRBLKHISTO) block of a binary dump file in a buffer:
+ * block header (whose size is set by WriteBinBlock()), time of the slot and offset of
+ * local time from UTC at that time, so that the decoder can rebuild the same time stamp
+ * of CSV rows. It returns a pointer to the first byte after the block header, where
+ * values shall be encoded (all blocks but gaps).
+ */
+static char *StartBinBlock(char *buf, uint16_t type, time_t slot)
+{
+    struct tm   lt, ut;
+    int32_t     offset;
+    char       *p;
+
+    /* Offset of local time from UTC (local and UTC dates differ by one day at most) */
+    localtime_r(&slot, &lt);
+    gmtime_r(&slot, &ut);
+    offset = (lt.tm_hour - ut.tm_hour) * 3600 + (lt.tm_min - ut.tm_min) * 60 + (lt.tm_sec - ut.tm_sec);
+    if (lt.tm_year != ut.tm_year)
+        offset += (lt.tm_year > ut.tm_year) ? SECONDSPERDAY : -SECONDSPERDAY;
+    else if (lt.tm_yday != ut.tm_yday)
+        offset += (lt.tm_yday > ut.tm_yday) ? SECONDSPERDAY : -SECONDSPERDAY;
+
+    p = PutBinLE(buf + 4, type, 2);
+    p = PutBinLE(p, (type != CTRBLKGAP) ? (CtrDumpFormat & (CTRVARINTENC | CTRDELTAENC)) : 0, 2);
+    p = PutBinLE(p, (uint64_t)(int64_t)slot, 8);
+    p = PutBinLE(p, (uint64_t)(int64_t)offset, 4);
+
+    return (PutBinLE(p, 0, 4));
+}
+
+
+/*
+ * This is an internal function that completes a block of a binary dump file, encoded
+ * in a buffer up to p, by setting its size, and writes it through WriteCtrRow().
+ */
+static void WriteBinBlock(int fd, char *buf, char *p)
+{
+    PutBinLE(buf, (uint64_t)(p - buf), 4);
+    WriteCtrRow(fd, buf, (size_t)(p - buf));
+}
+
+
+/*
+ * This is an internal function that encodes in a binary row the values of all counters
+ * (Scalar Counters first, then all instances of each Vector Counter), either base or
+ * aggr ones, fetched at dump time (see FetchDumpRow()). The last parameter points to the
+ * values of the previous row (used by CTRDELTAENC only). It returns a pointer to the
+ * first byte after the values.
+ */
+static char *EncodeBinValues(char *p, const uint64_t *row, uint64_t *prev)
+{
+    int         i, j;
+
+    for (i = 0; i < numScalarCtr; i++)
+        p = EncodeBinValue(p, row[i], scalarType[i], prev + i);
+
+    for (i = 0; i < numVectorCtr; i++)
+        for (j = 0; j < vectorHot[i].NumInstances; j++)
+            p = EncodeBinValue(p, row[VectorShardOffset[i] + j], vectorHot[i].Type,
+                               prev + VectorShardOffset[i] + j);
+
+    return (p);
+}
+
+
+/*
+ * This is an internal function that stores a string (at most 255 characters) in a
+ * binary dump file, preceded by its length. It returns a pointer to the first byte
+ * after the string.
+ */
+static inline char *PutBinString(char *p, const char *s)
+{
+    size_t  len = strlen(s);
+
+    *p++ = (char)len;
+    memcpy(p, s, len);
+
+    return (p + len);
+}
+
+
+/*
+ * This is an internal function that opens (in append mode) the binary dump file of all
+ * counters, named counters_<infix><stamp>.bin within the given directory, and writes a
+ * schema block (CTRBLKSCHEMA) describing all counters, so that every run appended to the
+ * file can be decoded on its own (Sparse, Histogram, Summary, Top-K and Distinct Counters
+ * and rates, if any, are described at the end of the schema). The schema also specifies
+ * whether time stamps report seconds. The values of the previous row used by CTRDELTAENC
+ * (if any) are reset, since differences never span schema blocks. It returns MIXFOK in
+ * case of success, MIXFNOACCESS if the file cannot be opened, MIXFKO if memory cannot be
+ * allocated.
+ */
+static Error OpenBinDumpFile(int *fd, const char *dir, const char *infix, const char *stamp, bool seconds, uint64_t *prev)
+{
+    LongString  DumpFile;
+    char       *buf, *p;
+    size_t      len;
+    int         i, j;
+
+    if (snprintf(DumpFile, sizeof(DumpFile), "%scounters_%s%s.bin", dir, infix, stamp) >= sizeof(DumpFile))
+        return (MIXFNOACCESS);
+
+    len = 24 + (size_t)numScalarCtr * (2 + SHORTSTRINGMAXLEN);
+    for (i = 0; i < numVectorCtr; i++)
+        len += 5 + 2 * (1 + SHORTSTRINGMAXLEN) + (size_t)vectorHot[i].NumInstances * (1 + MICROSTRINGMAXLEN);
+    len += 2 + (size_t)numSparseCtr * (1 + 2 * (1 + SHORTSTRINGMAXLEN));
+    len += 3 + MAXHISTOPCT * (1 + MICROSTRINGMAXLEN) + (size_t)numHistoCtr * (2 + SHORTSTRINGMAXLEN);
+    len += 2 + (size_t)numSummaryCtr * (2 + SHORTSTRINGMAXLEN);
+    len += 2 + (size_t)numRateCtr * (2 + SHORTSTRINGMAXLEN);
+    len += 2 + (size_t)numTopkCtr * (3 + 2 * (1 + SHORTSTRINGMAXLEN));
+    len += 2 + (size_t)numDistinctCtr * (2 + SHORTSTRINGMAXLEN);
+    if ((buf = (char *)malloc(len)) == NULL)
+        return (MIXFKO);
+    if ((*fd = OpenCtrFile(DumpFile, NULL)) < 0)
+    {
+        free(buf);
+        return (MIXFNOACCESS);
+    }
+
+    p = PutBinLE(buf + 4, CTRBLKSCHEMA, 2);
+    p = PutBinLE(p, 0, 2);
+    memcpy(p, CTRDUMPMAGIC, sizeof(CTRDUMPMAGIC));
+    p += 8;
+    p = PutBinLE(p, CTRDUMPVERSION, 2);
+    p = PutBinLE(p, seconds ? CTRSCHEMASECONDS : 0, 2);
+    p = PutBinLE(p, numScalarCtr, 2);
+    p = PutBinLE(p, numVectorCtr, 2);
+    for (i = 0; i < numScalarCtr; i++)
+    {
+        *p++ = (char)scalarType[i];
+        p = PutBinString(p, scalarCtr[i].Name);
+    }
+    for (i = 0; i < numVectorCtr; i++)
+    {
+        *p++ = (char)vectorHot[i].Type;
+        p = PutBinString(p, vectorCtr[i].Name);
+        p = PutBinString(p, vectorCtr[i].InstName);
+        p = PutBinLE(p, vectorHot[i].NumInstances, 2);
+        for (j = 0; j < vectorHot[i].NumInstances; j++)
+            p = PutBinString(p, vectorCtr[i].InstIdName[j]);
+    }
+    if ( (numSparseCtr > 0) || (numHistoCtr > 0) || (numSummaryCtr > 0) || (numRateCtr > 0) || (numTopkCtr > 0) ||
+         (numDistinctCtr > 0) )
+    {   /* Sparse Counters are described at the end of the schema, only if defined */
+        p = PutBinLE(p, numSparseCtr, 2);
+        for (i = 0; i < numSparseCtr; i++)
+        {
+            *p++ = (char)sparseCtr[i].Type;
+            p = PutBinString(p, sparseCtr[i].Name);
+            p = PutBinString(p, sparseCtr[i].KeyName);
+        }
+    }
+    if ((numHistoCtr > 0) || (numSummaryCtr > 0) || (numRateCtr > 0) || (numTopkCtr > 0) || (numDistinctCtr > 0))
+    {   /* ... followed by percentiles and Histogram Counters (significant bits, 0 if not defined) */
+        p = PutBinLE(p, numHistoCtr, 2);
+        *p++ = (char)numHistoPct;
+        for (i = 0; i < numHistoPct; i++)
+            p = PutBinString(p, HistoPctName[i]);
+        for (i = 0; i < numHistoCtr; i++)
+        {
+            *p++ = (char)histoCtr[i].Bits;
+            p = PutBinString(p, histoCtr[i].Name);
+        }
+    }
+    if ((numSummaryCtr > 0) || (numRateCtr > 0) || (numTopkCtr > 0) || (numDistinctCtr > 0))
+    {   /* ... followed by Summary Counters (1 if defined, 0 otherwise) */
+        p = PutBinLE(p, numSummaryCtr, 2);
+        for (i = 0; i < numSummaryCtr; i++)
+        {
+            *p++ = (char)(summaryCtr[i].Name[0] != '\0');
+            p = PutBinString(p, summaryCtr[i].Name);
+        }
+    }
+    if ((numRateCtr > 0) || (numTopkCtr > 0) || (numDistinctCtr > 0))
+    {   /* ... followed by rates (1 if defined, 0 otherwise) */
+        p = PutBinLE(p, numRateCtr, 2);
+        for (i = 0; i < numRateCtr; i++)
+        {
+            *p++ = (char)(rateCtr[i].Name[0] != '\0');
+            p = PutBinString(p, rateCtr[i].Name);
+        }
+    }
+    if ((numTopkCtr > 0) || (numDistinctCtr > 0))
+    {   /* ... followed by Top-K Counters (key type, 0xFF if not defined, and K) */
+        p = PutBinLE(p, numTopkCtr, 2);
+        for (i = 0; i < numTopkCtr; i++)
+        {
+            *p++ = (char)((topkCtr[i].TopK != 0) ? topkCtr[i].KeyType : 0xFF);
+            p = PutBinLE(p, topkCtr[i].TopK, 2);
+            p = PutBinString(p, topkCtr[i].Name);
+            p = PutBinString(p, topkCtr[i].KeyName);
+        }
+    }
+    if (numDistinctCtr > 0)
+    {   /* ... followed by Distinct Counters (precision, 0 if not defined) */
+        p = PutBinLE(p, numDistinctCtr, 2);
+        for (i = 0; i < numDistinctCtr; i++)
+        {
+            *p++ = (char)distinctCtr[i].Precision;
+            p = PutBinString(p, distinctCtr[i].Name);
+        }
+    }
+    WriteBinBlock(*fd, buf, p);
+    free(buf);
+
+    if (prev != NULL)
+        memset(prev, 0, numShardCells * sizeof(uint64_t));
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This is an internal function that starts a sparse block (CTRBLKSPARSE) of a binary dump
+ * file in a buffer: block header, ID of the Sparse Counter and flags (CTRSPARSEOVFL is set
+ * later, if needed). It returns a pointer to the first byte after flags, where pairs of key
+ * and value shall be encoded.
+ */
+static char *StartSparseBlock(char *buf, uint16_t ctrId, time_t slot)
+{
+    char   *p;
+
+    p = StartBinBlock(buf, CTRBLKSPARSE, slot);
+    p = PutBinLE(p, ctrId, 2);
+
+    return (PutBinLE(p, 0, 2));
+}
+
+
+/*
+ * This is an internal function that dumps a Sparse Counter, i.e. the keys whose base or
+ * aggr value, taken from the buffer frozen at dump time (and reset while it is read), is
+ * not null (keys updated since the previous dump), then the overflow cell, if not null.
+ * Only cells holding a key are read, and values are reset only if not null, so that
+ * pages of idle keys are not written. Rows are encoded in a buffer of SPARSEBUFSIZE bytes,
+ * written each time it is nearly full: in CSV files each row reports time stamp, key and
+ * value (tagged with "sparse_<ctrId>" with CTRCSVTAGGED); in binary files each buffer is
+ * a CTRBLKSPARSE block holding pairs of key and value (fixed width, or varints with any
+ * encoding, since keys are not ordered). If the values parameter is not set the slot has
+ * been missed, and a row with empty key and value is written (nothing in binary files,
+ * where gap blocks apply to all counters).
+ */
+static void DumpSparseCtr(int fd, char *buf, uint16_t ctrId, time_t slot, bool seconds, bool values, bool aggr, uint8_t frozen)
+{
+    SparseCtrInfo  *sp = &sparseCtr[ctrId];
+    uint64_t       *val, v;
+    char            prefix[SHORTSTRINGMAXLEN + 16];
+    char           *p, *start;
+    size_t          prefixLen = 0;
+    uint32_t        i;
+    bool            bin = (CtrDumpFormat & CTRBINDUMP),
+                    varint = (CtrDumpFormat & (CTRVARINTENC | CTRDELTAENC));
+
+    if (bin)
+    {
+        if (!values)
+            return;
+        p = start = StartSparseBlock(buf, ctrId, slot);
+    }
+    else
+    {   /* All rows start with the same time stamp (and tag) */
+        p = FormatRowStamp(prefix, slot, seconds);
+        if (CtrDumpFormat & CTRCSVTAGGED)
+        {
+            memcpy(p, "sparse_", 7);
+            p = EncodeCtrValue(p + 7, (uint64_t)ctrId);
+            *p++ = ',';
+        }
+        prefixLen = (size_t)(p - prefix);
+        if (!values)
+        {
+            memcpy(p, ",\n", 2);
+            WriteCtrRow(fd, prefix, prefixLen + 2);
+            return;
+        }
+        p = start = buf;
+    }
+
+    /* Cells of the hash table, then the cell of key 0 */
+    for (i = 0; i <= sp->Mask + 1; i++)
+    {
+        if (__atomic_load_n(&sp->Keys[i], __ATOMIC_RELAXED) == 0)
+            continue;
+        val = &sp->Values[(size_t)i * SPARSEVALUES + SPARSEVAL(aggr, frozen)];
+        if ((__atomic_load_n(val, __ATOMIC_RELAXED) == 0) || ((v = FetchCellForDump(val, sp->Type)) == 0))
+            continue;
+
+        if (bin)
+        {
+            p = varint ? PutBinVarint(p, (i > sp->Mask) ? 0 : sp->Keys[i]) : PutBinLE(p, (i > sp->Mask) ? 0 : sp->Keys[i], 8);
+            p = varint ? PutBinVarint(p, v) : PutBinLE(p, v, CTRDUMPWIDTH(sp->Type));
+        }
+        else
+        {
+            memcpy(p, prefix, prefixLen);
+            p = EncodeCtrValue(p + prefixLen, (i > sp->Mask) ? 0 : sp->Keys[i]);
+            *p++ = ',';
+            p = EncodeCtrValue(p, v);
+            *p++ = '\n';
+        }
+
+        if (p > buf + SPARSEBUFSIZE - SPARSEMAXROW)
+        {   /* Buffer nearly full: write it and start a new one */
+            if (bin)
+            {
+                WriteBinBlock(fd, buf, p);
+                p = start = StartSparseBlock(buf, ctrId, slot);
+            }
+            else
+            {
+                WriteCtrRow(fd, buf, (size_t)(p - buf));
+                p = buf;
+            }
+        }
+    }   /* for (i = 0; i <= sp->Mask + 1; i++) */
+
+    /* Overflow cell */
+    val = &sp->Values[(size_t)(sp->Mask + 2) * SPARSEVALUES + SPARSEVAL(aggr, frozen)];
+    if ((__atomic_load_n(val, __ATOMIC_RELAXED) != 0) && ((v = FetchCellForDump(val, sp->Type)) != 0))
+    {
+        if (bin)
+        {
+            PutBinLE(start - 2, CTRSPARSEOVFL, 2);
+            p = varint ? PutBinVarint(p, v) : PutBinLE(p, v, CTRDUMPWIDTH(sp->Type));
+        }
+        else
+        {
+            memcpy(p, prefix, prefixLen);
+            memcpy(p + prefixLen, "overflow,", 9);
+            p = EncodeCtrValue(p + prefixLen + 9, v);
+            *p++ = '\n';
+        }
+    }
+
+    if (p > start)
+    {
+        if (bin)
+            WriteBinBlock(fd, buf, p);
+        else
+            WriteCtrRow(fd, buf, (size_t)(p - buf));
+    }
+}
+
+
+/*
+ * This is an internal function that dumps all Sparse Counters (see DumpSparseCtr()) either
+ * to their own CSV files or to the single file of all counters (CTRCSVTAGGED and
+ * CTRBINDUMP), using the buffer of base or aggr Sparse Counters.
+ */
+static void DumpSparseCtrs(time_t slot, bool seconds, bool values, bool aggr, uint8_t frozen)
+{
+    int     i, fd;
+
+    for (i = 0; i < numSparseCtr; i++)
+    {
+        if (sparseCtr[i].Type == UNDEFCTR)
+            continue;
+        if (CtrDumpFormat & (CTRBINDUMP | CTRCSVTAGGED))
+            fd = aggr ? AggrCtr_fd : BaseCtr_fd;
+        else
+            fd = aggr ? sparseCtr[i].AggrCtr_fd : sparseCtr[i].BaseCtr_fd;
+        DumpSparseCtr(fd, aggr ? AggrSparseBuf : BaseSparseBuf, i, slot, seconds, values, aggr, frozen);
+    }
+}
+
+
+/*
+ * This is an internal function that folds a base interval of a Histogram Counter, i.e.
+ * the buckets moved to buf and the statistics given back by EvalHistoStats(), into a
+ * block of aggr values: buckets and sums are added, min and max are merged.
+ */
+static void FoldHistoCells(HistoCtrInfo *h, const uint64_t *buf, const uint64_t *stats, uint64_t *blk)
+{
+    uint32_t    i;
+
+    if (stats[0] == 0)
+        return;
+    for (i = 0; i < h->NumBuckets; i++)
+        if (buf[i] != 0)
+            __atomic_fetch_add(&blk[HISTOHDR + i], buf[i], __ATOMIC_RELAXED);
+    __atomic_fetch_add(&blk[HISTOSUM], stats[1], __ATOMIC_RELAXED);
+    AtomicMinCell(&blk[HISTOMIN], stats[2]);
+    AtomicMaxCell(&blk[HISTOMAX], stats[3]);
+}
+
+
+/*
+ * This is an internal function that dumps all Histogram Counters, i.e. the statistics of
+ * the values recorded since the previous dump (see EvalHistoStats()), taken from the
+ * buffer frozen at dump time, using the base or aggr row buffer. Each base interval is
+ * folded into the live aggr block once dumped (see FoldHistoCells()), as for Summary
+ * Counters. In CSV files each
+ * Histogram Counter has a row with time stamp, number of values, sum, min, max and
+ * percentiles (tagged with "histo_<ctrId>" with CTRCSVTAGGED), in which min, max and
+ * percentiles are empty if no value has been recorded. In binary files a single
+ * CTRBLKHISTO block holds the statistics of all defined Histogram Counters (fixed width,
+ * or varints with any encoding). If the values parameter is not set the slot has been
+ * missed, and rows with empty values are written (nothing in binary files, where gap
+ * blocks apply to all counters).
+ */
+static void DumpHistoCtrs(time_t slot, bool seconds, bool values, bool aggr, uint8_t frozen)
+{
+    uint64_t    stats[HISTOSTATS];
+    uint64_t   *scratch = aggr ? AggrHistoBuf : BaseHistoBuf;
+    char       *buf = aggr ? AggrRowBuf : BaseRowBuf;
+    char       *p;
+    int         i, j, fd;
+    bool        varint = (CtrDumpFormat & (CTRVARINTENC | CTRDELTAENC));
+
+    if (numHistoCtr == 0)
+        return;
+
+    if (CtrDumpFormat & CTRBINDUMP)
+    {
+        if (!values)
+            return;
+        p = StartBinBlock(buf, CTRBLKHISTO, slot);
+        for (i = 0; i < numHistoCtr; i++)
+        {
+            if (histoCtr[i].Bits == 0)
+                continue;
+            EvalHistoStats(&histoCtr[i], histoCtr[i].Val[HISTOBUF(aggr, frozen)], NULL, scratch, numHistoPct, HistoPct, stats);
+            if (!aggr)
+                FoldHistoCells(&histoCtr[i], scratch, stats, histoCtr[i].Val[HISTOBUF(true, __atomic_load_n(&AggrEpoch, __ATOMIC_RELAXED))]);
+            for (j = 0; j < 4 + numHistoPct; j++)
+                p = varint ? PutBinVarint(p, stats[j]) : PutBinLE(p, stats[j], 8);
+        }
+        WriteBinBlock(aggr ? AggrCtr_fd : BaseCtr_fd, buf, p);
+        return;
+    }
+
+    for (i = 0; i < numHistoCtr; i++)
+    {
+        if (histoCtr[i].Bits == 0)
+            continue;
+        p = FormatRowStamp(buf, slot, seconds);
+        if (CtrDumpFormat & CTRCSVTAGGED)
+        {
+            fd = aggr ? AggrCtr_fd : BaseCtr_fd;
+            memcpy(p, "histo_", 6);
+            p = EncodeCtrValue(p + 6, (uint64_t)i);
+            *p++ = ',';
+        }
+        else
+            fd = aggr ? histoCtr[i].AggrCtr_fd : histoCtr[i].BaseCtr_fd;
+        if (!values)
+        {
+            WriteGapRow(fd, buf, p, 4 + numHistoPct);
+            continue;
+        }
+
+        EvalHistoStats(&histoCtr[i], histoCtr[i].Val[HISTOBUF(aggr, frozen)], NULL, scratch, numHistoPct, HistoPct, stats);
+        if (!aggr)
+            FoldHistoCells(&histoCtr[i], scratch, stats, histoCtr[i].Val[HISTOBUF(true, __atomic_load_n(&AggrEpoch, __ATOMIC_RELAXED))]);
+        for (j = 0; j < 4 + numHistoPct; j++)
+        {
+            if ((j < 2) || (stats[0] != 0))
+                p = EncodeCtrValue(p, stats[j]);
+            *p++ = ',';
+        }
+        p[-1] = '\n';
+        WriteCtrRow(fd, buf, (size_t)(p - buf));
+    }
+}
+
+
+/*
+ * This is an internal function that takes the values of a Summary Counter from a frozen
+ * buffer (see SUMMARYBUF), resetting them to their initial values. Min and max are set
+ * to 0 if no value has been observed.
+ */
+static void FetchSummaryCells(uint64_t *val, uint64_t *out)
+{
+    out[SUMCOUNT] = __atomic_exchange_n(&val[SUMCOUNT], 0, __ATOMIC_RELAXED);
+    out[SUMSUM] = __atomic_exchange_n(&val[SUMSUM], 0, __ATOMIC_RELAXED);
+    out[SUMMIN] = __atomic_exchange_n(&val[SUMMIN], UINT64_MAX, __ATOMIC_RELAXED);
+    out[SUMMAX] = __atomic_exchange_n(&val[SUMMAX], 0, __ATOMIC_RELAXED);
+    if (out[SUMCOUNT] == 0)
+        out[SUMMIN] = out[SUMMAX] = 0;
+}
+
+
+/*
+ * This is an internal function that folds the values of a base interval of a Summary
+ * Counter (as given back by FetchSummaryCells()) into a buffer of aggr values: counts
+ * and sums are added, min and max are merged.
+ */
+static void FoldSummaryCells(const uint64_t *in, uint64_t *val)
+{
+    if (in[SUMCOUNT] == 0)
+        return;
+    __atomic_fetch_add(&val[SUMCOUNT], in[SUMCOUNT], __ATOMIC_RELAXED);
+    __atomic_fetch_add(&val[SUMSUM], in[SUMSUM], __ATOMIC_RELAXED);
+    AtomicMinCell(&val[SUMMIN], in[SUMMIN]);
+    AtomicMaxCell(&val[SUMMAX], in[SUMMAX]);
+}
+
+
+/*
+ * This is an internal function that dumps all Summary Counters, i.e. count, sum, min and
+ * max of the values observed since the previous dump, taken from the buffer frozen at
+ * dump time, using the base or aggr row buffer. Each base interval is folded into the
+ * live aggr values once dumped, so that aggr dumps report the base intervals dumped since
+ * the previous aggr dump. In CSV files each Summary Counter has a row with time stamp,
+ * count, sum, min and max (tagged with "summary_<ctrId>" with CTRCSVTAGGED), in which min
+ * and max are empty if no value has been observed. In binary files a single
+ * CTRBLKSUMMARY block holds the values of all defined Summary Counters (fixed width, or
+ * varints with any encoding). If the values parameter is not set the slot has been
+ * missed, and rows with empty values are written (nothing in binary files).
+ */
+static void DumpSummaryCtrs(time_t slot, bool seconds, bool values, bool aggr, uint8_t frozen)
+{
+    uint64_t    v[SUMMARYCELLS];
+    char       *buf = aggr ? AggrRowBuf : BaseRowBuf;
+    char       *p = NULL;
+    int         i, j, fd;
+    bool        varint = (CtrDumpFormat & (CTRVARINTENC | CTRDELTAENC));
+
+    if ((numSummaryCtr == 0) || (!values && (CtrDumpFormat & CTRBINDUMP)))
+        return;
+
+    if (CtrDumpFormat & CTRBINDUMP)
+        p = StartBinBlock(buf, CTRBLKSUMMARY, slot);
+    for (i = 0; i < numSummaryCtr; i++)
+    {
+        if (summaryCtr[i].Name[0] == '\0')
+            continue;
+        if (values)
+        {
+            FetchSummaryCells(summaryVal[SUMMARYBUF(aggr, frozen)][i], v);
+            if (!aggr)
+                FoldSummaryCells(v, summaryVal[SUMMARYBUF(true, __atomic_load_n(&AggrEpoch, __ATOMIC_RELAXED))][i]);
+        }
+        if (CtrDumpFormat & CTRBINDUMP)
+        {
+            for (j = 0; j < SUMMARYCELLS; j++)
+                p = varint ? PutBinVarint(p, v[j]) : PutBinLE(p, v[j], 8);
+            continue;
+        }
+
+        p = FormatRowStamp(buf, slot, seconds);
+        if (CtrDumpFormat & CTRCSVTAGGED)
+        {
+            fd = aggr ? AggrCtr_fd : BaseCtr_fd;
+            memcpy(p, "summary_", 8);
+            p = EncodeCtrValue(p + 8, (uint64_t)i);
+            *p++ = ',';
+        }
+        else
+            fd = aggr ? summaryCtr[i].AggrCtr_fd : summaryCtr[i].BaseCtr_fd;
+        if (!values)
+        {
+            WriteGapRow(fd, buf, p, SUMMARYCELLS);
+            continue;
+        }
+        for (j = 0; j < SUMMARYCELLS; j++)
+        {
+            if ((j < SUMMIN) || (v[SUMCOUNT] != 0))
+                p = EncodeCtrValue(p, v[j]);
+            *p++ = ',';
+        }
+        p[-1] = '\n';
+        WriteCtrRow(fd, buf, (size_t)(p - buf));
+    }
+    if (CtrDumpFormat & CTRBINDUMP)
+        WriteBinBlock(aggr ? AggrCtr_fd : BaseCtr_fd, buf, p);
+}
+
+
+/*
+ * This is an internal function that dumps the rates published by the last tick (see
+ * TickRates()), using the base or aggr row buffer. In CSV files a single row holds the
+ * time stamp and the RATEVALUES values of each defined rate (tagged with "rates" with
+ * CTRCSVTAGGED), with three decimals. In binary files a CTRBLKRATE block holds the same
+ * values as IEEE 754 doubles (8 bytes, never encoded). If the values parameter is not set
+ * the slot has been missed, and a row with empty values is written (nothing in binary
+ * files).
+ */
+static void DumpRateCtrs(time_t slot, bool seconds, bool values, bool aggr)
+{
+    double      v[RATEVALUES];
+    uint64_t    bits;
+    char       *buf = aggr ? AggrRowBuf : BaseRowBuf;
+    char       *p;
+    int         i, k, fd, num = 0;
+
+    if ((numRateCtr == 0) || (!values && (CtrDumpFormat & CTRBINDUMP)))
+        return;
+
+    if (CtrDumpFormat & CTRBINDUMP)
+    {
+        p = StartBinBlock(buf, CTRBLKRATE, slot);
+        for (i = 0; i < numRateCtr; i++)
+        {
+            if (rateCtr[i].Name[0] == '\0')
+                continue;
+            ReadRate(&rateCtr[i], v);
+            for (k = 0; k < RATEVALUES; k++)
+            {
+                memcpy(&bits, &v[k], sizeof(bits));
+                p = PutBinLE(p, bits, 8);
+            }
+        }
+        WriteBinBlock(aggr ? AggrCtr_fd : BaseCtr_fd, buf, p);
+        return;
+    }
+
+    p = FormatRowStamp(buf, slot, seconds);
+    if (CtrDumpFormat & CTRCSVTAGGED)
+    {
+        fd = aggr ? AggrCtr_fd : BaseCtr_fd;
+        memcpy(p, "rates,", 6);
+        p += 6;
+    }
+    else
+        fd = aggr ? AggrRateCtr_fd : BaseRateCtr_fd;
+    for (i = 0; i < numRateCtr; i++)
+    {
+        if (rateCtr[i].Name[0] == '\0')
+            continue;
+        num += RATEVALUES;
+        if (!values)
+            continue;
+        ReadRate(&rateCtr[i], v);
+        for (k = 0; k < RATEVALUES; k++)
+            p += snprintf(p, RATEDIGITS + 2, "%.3f,", v[k]);
+    }
+    if (!values)
+    {
+        WriteGapRow(fd, buf, p, num);
+        return;
+    }
+    p[-1] = '\n';
+    WriteCtrRow(fd, buf, (size_t)(p - buf));
+}
+
+
+/*
+ * This is an internal function that dumps the top keys of a Top-K Counter, i.e. the (up
+ * to) K keys with the highest counts in the sketch frozen at dump time, which is then
+ * emptied. In CSV files each key has a row with time stamp, key, count and error bound
+ * (tagged with "topk_<ctrId>" with CTRCSVTAGGED), by decreasing count; in binary files a
+ * CTRBLKTOPK block holds the ID of the counter, the number of keys and, for each of them,
+ * key (string, or fixed width or varint integer), count and error (fixed width, or varints
+ * with any encoding), and it is not written if no key has been updated. If the values
+ * parameter is not set the slot has been missed, and a row with empty key, count and
+ * error is written (nothing in binary files).
+ */
+static void DumpTopkCtr(int fd, char *buf, uint16_t ctrId, time_t slot, bool seconds, bool values, bool aggr, uint8_t frozen)
+{
+    TopKCtrInfo    *tk = &topkCtr[ctrId];
+    TopKSketch     *sk = &tk->Sketch[TOPKBUF(aggr, frozen)];
+    uint32_t        sel[MAXTOPK];
+    uint32_t        i, s, num;
+    char           *p, *q;
+    size_t          prefixLen;
+    bool            varint = (CtrDumpFormat & (CTRVARINTENC | CTRDELTAENC));
+
+    if (CtrDumpFormat & CTRBINDUMP)
+    {
+        if (!values || ((num = SelectTopKSlots(sk, tk->TopK, sel)) == 0))
+            return;
+        p = StartBinBlock(buf, CTRBLKTOPK, slot);
+        p = PutBinLE(p, ctrId, 2);
+        p = PutBinLE(p, num, 2);
+        for (i = 0; i < num; i++)
+        {
+            s = sel[i];
+            if (tk->KeyType == CTRTOPKSTRKEY)
+                p = PutBinString(p, &sk->Names[(size_t)s * (CTRTOPKKEYLEN + 1)]);
+            else
+                p = varint ? PutBinVarint(p, sk->Keys[s]) : PutBinLE(p, sk->Keys[s], 8);
+            p = varint ? PutBinVarint(p, sk->Counts[s]) : PutBinLE(p, sk->Counts[s], 8);
+            p = varint ? PutBinVarint(p, sk->Errors[s]) : PutBinLE(p, sk->Errors[s], 8);
+        }
+        WriteBinBlock(fd, buf, p);
+        ResetTopKSketch(tk, sk);
+        return;
+    }
+
+    /* All rows start with the same time stamp (and tag) */
+    q = FormatRowStamp(buf, slot, seconds);
+    if (CtrDumpFormat & CTRCSVTAGGED)
+    {
+        memcpy(q, "topk_", 5);
+        q = EncodeCtrValue(q + 5, (uint64_t)ctrId);
+        *q++ = ',';
+    }
+    if (!values)
+    {
+        WriteGapRow(fd, buf, q, 3);
+        return;
+    }
+    if ((num = SelectTopKSlots(sk, tk->TopK, sel)) == 0)
+        return;
+    prefixLen = (size_t)(q - buf);
+    for (i = 0, p = q; i < num; i++)
+    {
+        s = sel[i];
+        if (i > 0)
+        {
+            memcpy(p, buf, prefixLen);
+            p += prefixLen;
+        }
+        if (tk->KeyType == CTRTOPKSTRKEY)
+            p = stpcpy(p, &sk->Names[(size_t)s * (CTRTOPKKEYLEN + 1)]);
+        else
+            p = EncodeCtrValue(p, sk->Keys[s]);
+        *p++ = ',';
+        p = EncodeCtrValue(p, sk->Counts[s]);
+        *p++ = ',';
+        p = EncodeCtrValue(p, sk->Errors[s]);
+        *p++ = '\n';
+    }
+    WriteCtrRow(fd, buf, (size_t)(p - buf));
+    ResetTopKSketch(tk, sk);
+}
+
+
+/*
+ * This is an internal function that dumps all Top-K Counters (see DumpTopkCtr()) either
+ * to their own CSV files or to the single file of all counters (CTRCSVTAGGED and
+ * CTRBINDUMP), using the base or aggr row buffer. Since the epoch has just been flipped,
+ * the mutex of each counter is taken and released first (unless in CTRPLAINMODE), so
+ * that updates still in progress on the frozen sketch are completed.
+ */
+static void DumpTopkCtrs(time_t slot, bool seconds, bool values, bool aggr, uint8_t frozen)
+{
+    int     i, fd;
+
+    for (i = 0; i < numTopkCtr; i++)
+    {
+        if (topkCtr[i].TopK == 0)
+            continue;
+        if (values && (CtrUpdateMode != CTRPLAINMODE))
+        {
+            pthread_mutex_lock(&topkCtr[i].Mutex);
+            pthread_mutex_unlock(&topkCtr[i].Mutex);
+        }
+        if (CtrDumpFormat & (CTRBINDUMP | CTRCSVTAGGED))
+            fd = aggr ? AggrCtr_fd : BaseCtr_fd;
+        else
+            fd = aggr ? topkCtr[i].AggrCtr_fd : topkCtr[i].BaseCtr_fd;
+        DumpTopkCtr(fd, aggr ? AggrRowBuf : BaseRowBuf, i, slot, seconds, values, aggr, frozen);
+    }
+}
+
+
+/*
+ * This is an internal function that takes the registers of a Distinct Counter of
+ * precision p from a frozen array (see DISTINCTBUF), resetting them (only those which
+ * are set, through atomic exchanges), and merges them into the registers pointed to by
+ * the second parameter (if not NULL). It gives back the estimate of the frozen registers
+ * (see EstimateDistinct()).
+ */
+static uint64_t FetchDistinctRegs(uint8_t *reg, uint8_t *merge, uint8_t p)
+{
+    uint32_t    hist[64 - MINDISTINCTPREC + 2] = { 0 };
+    uint32_t    j;
+    uint8_t     r;
+
+    for (j = 0; j < (1U << p); j++)
+    {
+        if ((r = __atomic_load_n(&reg[j], __ATOMIC_RELAXED)) != 0)
+        {
+            r = __atomic_exchange_n(&reg[j], 0, __ATOMIC_RELAXED);
+            if (merge != NULL)
+                AtomicMaxReg(&merge[j], r);
+        }
+        hist[r]++;
+    }
+
+    return (EstimateDistinct(hist, p));
+}
+
+
+/*
+ * This is an internal function that dumps the estimates of all Distinct Counters, taken
+ * from the registers frozen at dump time, using the base or aggr row buffer. Each base
+ * interval is merged into the live aggr registers once dumped, so that aggr dumps report
+ * the distinct keys of the base intervals dumped since the previous aggr dump. In CSV
+ * files a single row holds the time stamp and the estimate of each defined Distinct
+ * Counter (tagged with "distinct" with CTRCSVTAGGED). In binary files a CTRBLKDISTINCT
+ * block holds the same estimates (fixed width, or varints with any encoding). If the
+ * values parameter is not set the slot has been missed, and a row with empty values is
+ * written (nothing in binary files).
+ */
+static void DumpDistinctCtrs(time_t slot, bool seconds, bool values, bool aggr, uint8_t frozen)
+{
+    DistinctCtrInfo    *d;
+    uint64_t            v;
+    char               *buf = aggr ? AggrRowBuf : BaseRowBuf;
+    char               *p;
+    int                 i, fd, num = 0;
+    bool                varint = (CtrDumpFormat & (CTRVARINTENC | CTRDELTAENC));
+
+    if ((numDistinctCtr == 0) || (!values && (CtrDumpFormat & CTRBINDUMP)))
+        return;
+
+    if (CtrDumpFormat & CTRBINDUMP)
+    {
+        fd = aggr ? AggrCtr_fd : BaseCtr_fd;
+        p = StartBinBlock(buf, CTRBLKDISTINCT, slot);
+    }
+    else
+    {
+        p = FormatRowStamp(buf, slot, seconds);
+        if (CtrDumpFormat & CTRCSVTAGGED)
+        {
+            fd = aggr ? AggrCtr_fd : BaseCtr_fd;
+            memcpy(p, "distinct,", 9);
+            p += 9;
+        }
+        else
+            fd = aggr ? AggrDistinctCtr_fd : BaseDistinctCtr_fd;
+    }
+    for (i = 0; i < numDistinctCtr; i++)
+    {
+        d = &distinctCtr[i];
+        if (d->Precision == 0)
+            continue;
+        num++;
+        if (!values)
+            continue;
+        v = FetchDistinctRegs(d->Reg[DISTINCTBUF(aggr, frozen)],
+                              aggr ? NULL : d->Reg[DISTINCTBUF(true, __atomic_load_n(&AggrEpoch, __ATOMIC_RELAXED))],
+                              d->Precision);
+        if (CtrDumpFormat & CTRBINDUMP)
+            p = varint ? PutBinVarint(p, v) : PutBinLE(p, v, 8);
+        else
+        {
+            p = EncodeCtrValue(p, v);
+            *p++ = ',';
+        }
+    }
+    if (CtrDumpFormat & CTRBINDUMP)
+        WriteBinBlock(fd, buf, p);
+    else if (!values)
+        WriteGapRow(fd, buf, p, num);
+    else
+    {
+        p[-1] = '\n';
+        WriteCtrRow(fd, buf, (size_t)(p - buf));
+    }
+}
+
+
+/*
+ * This is an internal function that evaluates the checksum of the layout of the counters
+ * segment, i.e. of the header fields from version to descOffset and of all descriptors
+ * (32 bit FNV-1a). Values, epochs and dump times are not covered, since they change at
+ * run time.
+ */
+static uint32_t CtrSegmentChecksum(const CtrShmHeader *hdr, const CtrShmDesc *desc)
+{
+    const uint8_t  *p;
+    size_t          n;
+    uint32_t        h = 2166136261u;
+
+    p = (const uint8_t *)&hdr->version;
+    for (n = offsetof(CtrShmHeader, checksum) - offsetof(CtrShmHeader, version); n > 0; n--)
+        h = (h ^ *p++) * 16777619u;
+    p = (const uint8_t *)desc;
+    for (n = ((size_t)hdr->numScalarCtr + hdr->numVectorCtr) * sizeof(CtrShmDesc); n > 0; n--)
+        h = (h ^ *p++) * 16777619u;
+
+    return (h);
+}
+
+
+/*
+ * This is an internal function that unmaps the segment of counters (if any) and, for
+ * CTRSHMSTORAGE, removes it (the state file of CTRFILESTORAGE is kept, so that the next
+ * start_counters() resumes from it). If values had been moved into the segment by
+ * AttachCtrSegment(), pointers are restored to the default storage first (values are not
+ * copied back, since this function is only invoked when counters are stopped or not
+ * started yet).
+ */
+static void CloseCtrSegment(void)
+{
+    int     i;
+
+    if (CtrSegment == NULL)
+        return;
+
+    scalarBaseVal[0] = scalarValMem[0];
+    scalarBaseVal[1] = scalarValMem[1];
+    scalarAggrVal[0] = scalarValMem[2];
+    scalarAggrVal[1] = scalarValMem[3];
+    for (i = 0; i < numVectorCtr; i++)
+        SetVectorValues(i, vectorHot[i].Type, vectorHot[i].NumInstances, vectorCtr[i].BaseMem, vectorCtr[i].AggrMem);
+
+    munmap(CtrSegment, CtrSegmentSize);
+    if (CtrStorage == CTRSHMSTORAGE)
+        shm_unlink(CtrStorageName);
+    CtrSegment = NULL;
+    CtrSegmentSize = 0;
+    CtrSegmentResumed = false;
+}
+
+
+/*
+ * This is an internal function that creates the segment of counters, sized for all
+ * defined counters, and maps it: either a shared memory segment (CTRSHMSTORAGE) or a
+ * state file under the base dump directory (CTRFILESTORAGE). The header and the
+ * descriptors of all counters are evaluated first; if an existing state file has the
+ * same size, a valid magic string and the same layout (checked through the checksum),
+ * it is kept as is and CtrSegmentResumed is set, otherwise it is reinitialized. Values
+ * are not moved into the segment yet (see AttachCtrSegment()), so that start_counters()
+ * can still fail without side effects. All value arrays start on a cache line. It
+ * returns MIXFOK in case of success, MIXFNOACCESS if the segment cannot be created or
+ * mapped, MIXFKO if memory cannot be allocated.
+ */
+static Error OpenCtrSegment(void)
+{
+    CtrShmHeader   *hdr;
+    CtrShmDesc     *desc;
+    LongString      path;
+    struct stat     st;
+    size_t          size, offset, stride, descOffset, descEnd;
+    int             fd, i, e;
+
+    CloseCtrSegment();      /* Left by a previous start_counters() that failed */
+
+    /* Evaluate the layout: header, descriptors, scalar values, vector values */
+    descOffset = CTRSTRIDE(sizeof(CtrShmHeader) / 8) * 8;
+    descEnd = descOffset + CTRSTRIDE(((size_t)numScalarCtr + numVectorCtr) * sizeof(CtrShmDesc) / 8) * 8;
+    size = descEnd + 4 * CTRSTRIDE(numScalarCtr) * sizeof(uint64_t);
+    for (i = 0; i < numVectorCtr; i++)
+        size += ((CTRKIND(vectorHot[i].Type) == PEGCTR) ? 4 : 2) * CTRSTRIDE(vectorHot[i].NumInstances) * sizeof(uint64_t);
+
+    /* Build header (but the magic string) and descriptors in a private buffer */
+    if ((hdr = (CtrShmHeader *)calloc(1, descEnd)) == NULL)
+        return (MIXFKO);
+    hdr->version = CTRSHMVERSION;
+    hdr->headerSize = sizeof(CtrShmHeader);
+    hdr->segmentSize = size;
+    hdr->numScalarCtr = numScalarCtr;
+    hdr->numVectorCtr = numVectorCtr;
+    hdr->descOffset = descOffset;
+    desc = (CtrShmDesc *)((char *)hdr + descOffset);
+
+    offset = descEnd;
+    stride = CTRSTRIDE(numScalarCtr) * sizeof(uint64_t);
+    for (i = 0; i < numScalarCtr; i++, desc++)
+    {
+        snprintf(desc->name, CTRSHMNAMELEN, "%.*s", CTRSHMNAMELEN - 1, scalarCtr[i].Name);
+        desc->ctrClass = CTRSCALAR;
+        desc->ctrType = scalarType[i];
+        desc->numInstances = 1;
+        for (e = 0; e < 2; e++)
+        {
+            desc->baseOffset[e] = offset + e * stride + i * sizeof(uint64_t);
+            desc->aggrOffset[e] = offset + (2 + e) * stride + i * sizeof(uint64_t);
+        }
+    }
+    offset += 4 * stride;
+
+    for (i = 0; i < numVectorCtr; i++, desc++)
+    {
+        snprintf(desc->name, CTRSHMNAMELEN, "%.*s", CTRSHMNAMELEN - 1, vectorCtr[i].Name);
+        snprintf(desc->instName, CTRSHMNAMELEN, "%.*s", CTRSHMNAMELEN - 1, vectorCtr[i].InstName);
+        desc->ctrClass = CTRVECTOR;
+        desc->ctrType = vectorHot[i].Type;
+        desc->numInstances = vectorHot[i].NumInstances;
+        stride = CTRSTRIDE(vectorHot[i].NumInstances) * sizeof(uint64_t);
+        desc->baseOffset[0] = offset;
+        desc->baseOffset[1] = offset + ((CTRKIND(vectorHot[i].Type) == PEGCTR) ? stride : 0);
+        offset = desc->baseOffset[1] + stride;
+        desc->aggrOffset[0] = offset;
+        desc->aggrOffset[1] = offset + ((CTRKIND(vectorHot[i].Type) == PEGCTR) ? stride : 0);
+        offset = desc->aggrOffset[1] + stride;
+    }
+    hdr->checksum = CtrSegmentChecksum(hdr, (CtrShmDesc *)((char *)hdr + descOffset));
+
+    /* Open the segment: a stale shared memory segment is unlinked rather than truncated, */
+    /* so that readers still mapping it are not hit; a state file is opened as is */
+    if (CtrStorage == CTRSHMSTORAGE)
+    {
+        shm_unlink(CtrStorageName);
+        fd = shm_open(CtrStorageName, O_CREAT | O_EXCL | O_RDWR, 0644);
+    }
+    else if (snprintf(path, sizeof(path), "%s%s", BaseCtrDir, CtrStorageName) < (int)sizeof(path))
+        fd = open(path, O_CREAT | O_RDWR, 0644);
+    else
+        fd = -1;
+    if ((fd < 0) || (fstat(fd, &st) != 0))
+    {
+        if (fd >= 0)
+            close(fd);
+        free(hdr);
+        return (MIXFNOACCESS);
+    }
+
+    /* A segment of a different size is reinitialized with all values set to zero */
+    if ( ((size_t)st.st_size != size) &&
+         ((ftruncate(fd, 0) != 0) || (ftruncate(fd, (off_t)size) != 0)) )
+    {
+        close(fd);
+        free(hdr);
+        if (CtrStorage == CTRSHMSTORAGE)
+            shm_unlink(CtrStorageName);
+        return (MIXFNOACCESS);
+    }
+    CtrSegment = (CtrShmHeader *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (CtrSegment == MAP_FAILED)
+    {
+        CtrSegment = NULL;
+        free(hdr);
+        if (CtrStorage == CTRSHMSTORAGE)
+            shm_unlink(CtrStorageName);
+        return (MIXFNOACCESS);
+    }
+    CtrSegmentSize = size;
+
+    /* Resume from a state file with the same layout, otherwise reinitialize it */
+    CtrSegmentResumed = ( (CtrStorage == CTRFILESTORAGE) &&
+                          (memcmp(CtrSegment->magic, CTRSHMMAGIC, sizeof(CTRSHMMAGIC)) == 0) &&
+                          (CtrSegment->checksum == hdr->checksum) &&
+                          (memcmp(&CtrSegment->version, &hdr->version,
+                                  offsetof(CtrShmHeader, baseEpoch) - offsetof(CtrShmHeader, version)) == 0) &&
+                          (memcmp((char *)CtrSegment + descOffset, (char *)hdr + descOffset, descEnd - descOffset) == 0) );
+    if (!CtrSegmentResumed)
+    {
+        memset(CtrSegment, 0, size);
+        memcpy((char *)CtrSegment + sizeof(CtrSegment->magic), (char *)hdr + sizeof(hdr->magic),
+               descEnd - sizeof(hdr->magic));
+    }
+    free(hdr);
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This is an internal function that moves counters values into the segment created by
+ * OpenCtrSegment() (if any) and redirects all pointers used by update, retrieve and dump
+ * functions to it. Current values are copied into a new segment, while values of a
+ * resumed state file are kept: epochs are restored and Peg values left in the frozen
+ * buffers by a dump that did not complete are added to the live ones. In the latter case
+ * the time of the last dump slot is restored too, so that slots missed while counters
+ * were not running are written as gap rows and resumed values are dumped in the row of
+ * the last elapsed slot. Finally the magic string is set, so that external readers can
+ * start using the segment.
+ */
+static void AttachCtrSegment(void)
+{
+    CtrShmDesc *desc;
+    uint64_t   *live, *frozen;
+    char       *seg;
+    time_t      now;
+    int         i, j, e;
+
+    if (CtrSegment == NULL)
+        return;
+
+    seg = (char *)CtrSegment;
+    desc = (CtrShmDesc *)(seg + CtrSegment->descOffset);
+    if (CtrSegmentResumed)
+    {
+        BaseEpoch = CtrSegment->baseEpoch & 1;
+        AggrEpoch = CtrSegment->aggrEpoch & 1;
+        for (i = 0; i < numScalarCtr + numVectorCtr; i++)
+        {
+            if (CTRKIND(desc[i].ctrType) != PEGCTR)
+                continue;
+            for (e = 0; e < 2; e++)
+            {
+                live = (uint64_t *)(seg + (e ? desc[i].aggrOffset[AggrEpoch] : desc[i].baseOffset[BaseEpoch]));
+                frozen = (uint64_t *)(seg + (e ? desc[i].aggrOffset[AggrEpoch ^ 1] : desc[i].baseOffset[BaseEpoch ^ 1]));
+                for (j = 0; j < desc[i].numInstances; j++)
+                {
+                    live[j] = (live[j] + frozen[j]) & CTRLIMIT(desc[i].ctrType);
+                    frozen[j] = 0;
+                }
+            }
+        }
+    }
+
+    if (numScalarCtr > 0)
+        for (e = 0; e < 2; e++)
+        {
+            if (!CtrSegmentResumed)
+            {
+                memcpy(seg + desc->baseOffset[e], scalarBaseVal[e], numScalarCtr * sizeof(uint64_t));
+                memcpy(seg + desc->aggrOffset[e], scalarAggrVal[e], numScalarCtr * sizeof(uint64_t));
+            }
+            scalarBaseVal[e] = (uint64_t *)(seg + desc->baseOffset[e]);
+            scalarAggrVal[e] = (uint64_t *)(seg + desc->aggrOffset[e]);
+        }
+
+    desc += numScalarCtr;
+    for (i = 0; i < numVectorCtr; i++, desc++)
+    {
+        for (e = 0; (e < ((CTRKIND(vectorHot[i].Type) == PEGCTR) ? 2 : 1)) && !CtrSegmentResumed; e++)
+        {
+            memcpy(seg + desc->baseOffset[e], vectorHot[i].BaseVal[e], vectorHot[i].NumInstances * sizeof(uint64_t));
+            memcpy(seg + desc->aggrOffset[e], vectorHot[i].AggrVal[e], vectorHot[i].NumInstances * sizeof(uint64_t));
+        }
+        SetVectorValues(i, vectorHot[i].Type, vectorHot[i].NumInstances,
+                        (uint64_t *)(seg + desc->baseOffset[0]), (uint64_t *)(seg + desc->aggrOffset[0]));
+    }
+
+    /* Restore the last dump slots (if consistent with the current time) */
+    now = time(NULL);
+    if ( CtrSegmentResumed && (CtrSegment->baseLastDump > 0) && (CtrSegment->baseLastDump <= now) )
+    {
+        BaseLastDumpTime = (time_t)CtrSegment->baseLastDump;
+        BaseNextDumpTime = NextSlotTime(BaseDumpMap, BaseDumpPeriod, BaseLastDumpTime + 1);
+    }
+    if ( CtrSegmentResumed && (AggrNextDumpTime != NODUMPTIME) &&
+         (CtrSegment->aggrLastDump > 0) && (CtrSegment->aggrLastDump <= now) )
+    {
+        AggrLastDumpTime = (time_t)CtrSegment->aggrLastDump;
+        AggrNextDumpTime = NextSlotTime(AggrDumpMap, 0, AggrLastDumpTime + 1);
+    }
+
+    CtrSegment->baseEpoch = BaseEpoch;
+    CtrSegment->aggrEpoch = AggrEpoch;
+    CtrSegment->baseLastDump = BaseLastDumpTime;
+    CtrSegment->aggrLastDump = AggrLastDumpTime;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(CtrSegment->magic, CTRSHMMAGIC, sizeof(CTRSHMMAGIC));
+}
+
+
 /*
  * This in an internal function that closes and reopens all existing base counters file
  * without handling locks. It cannot be invoked from outside the library, it is part of the
@@ -116,168 +4802,1898 @@ static pthread_mutex_t  AggrMutex = PTHREAD_MUTEX_INITIALIZER;/* Mutex used to h
  * This function provides MIXFOK in case of SUCCESS, MIXFKO if base counters are not open,
  * MIXFNOACCESS if the filenames cannot be reopened.
  */
-static Error CloseReopenBaseCounters(void)
+static Error CloseReopenBaseCounters(void)
+{
+    /* Local variables */
+    LongString   DumpFile;
+    ShortString  TimeStamp;
+    int          i;
+
+    /* Do not manage MUTEX. They are handled by calling function */
+    if (BaseCtrActive==false)   /* Base counters not running - return MIXFKO error */
+        return (MIXFKO);
+
+    /* Evaluates and keeps the date of counters reopening in ddmmyyyy format */
+    /* This is stored for Rotation */
+    retrieve_time_date(BaseDumpOpenDate,"%d%m%Y");
+
+    /* Close the existing base counters files */
+    CloseCtrFiles(false);
+
+    /* Evaluate Time Stamp */
+    retrieve_time_date(TimeStamp, BaseCtrTimeStampFormat);
+
+    /* A single binary or CSV file for all counters, if so defined */
+    if (CtrDumpFormat & CTRBINDUMP)
+        return (OpenBinDumpFile(&BaseCtr_fd, BaseCtrDir, "", TimeStamp, (BaseDumpPeriod != 0), BasePrevVal));
+    if (CtrDumpFormat & CTRCSVTAGGED)
+        return (OpenTaggedDumpFile(&BaseCtr_fd, BaseCtrDir, "", TimeStamp));
+
+    /* Open first scalar counters file... */
+    sprintf(DumpFile, "%sscalar_%s.csv", BaseCtrDir, TimeStamp);
+    if ( (BaseCtr_fd=OpenCtrFile(DumpFile, NULL)) < 0)
+        return (MIXFNOACCESS);
+    WriteCtrHeader(BaseCtr_fd, "Date,Time,", scalarCtr[0].Name, sizeof(ScalarCtrInfo), numScalarCtr);
+
+    /* ... then open again vector counters files */
+    for (i = 0; i<numVectorCtr; i++)
+    {
+        sprintf(DumpFile, "%svector_%d_%s.csv", BaseCtrDir, i, TimeStamp);
+        if ((vectorCtr[i].BaseCtr_fd = OpenCtrFile(DumpFile, NULL)) < 0)
+            return (MIXFNOACCESS);
+        WriteVectorCtrHeader(vectorCtr[i].BaseCtr_fd, i, false);
+    }
+
+    /* ... and finally Sparse, Histogram, Summary and Top-K Counters files, rates and Distinct Counters files */
+    if ((OpenSparseCtrFiles(false, TimeStamp) != MIXFOK) || (OpenHistoCtrFiles(false, TimeStamp) != MIXFOK))
+        return (MIXFNOACCESS);
+    if ((OpenSummaryCtrFiles(false, TimeStamp) != MIXFOK) || (OpenTopkCtrFiles(false, TimeStamp) != MIXFOK))
+        return (MIXFNOACCESS);
+    if (OpenRateCtrFile(false, TimeStamp) != MIXFOK)
+        return (MIXFNOACCESS);
+    return (OpenDistinctCtrFile(false, TimeStamp));
+}
+
+
+/*
+ * This in an internal function that closes and reopens all existing aggr counters file
+ * without handling locks. It cannot be invoked from outside the library, it is part of the
+ * implementation of the check_and_dump_ctr() function, which invokes it when it needs
+ * to rotate counters file at 00:00.
+ * BE AWARE that it doesn't set/clear locks, which are managed within the calling
+ * function.
+ * This function provides MIXFOK in case of SUCCESS, MIXFKO if aggr counters are not open,
+ * MIXFNOACCESS if the filenames cannot be reopened.
+ */
+static Error CloseReopenAggrCounters(void)
+{
+    /* Local variables */
+    LongString  DumpFile;
+    ShortString TimeStamp;
+    int         i;
+
+    /* Do not manage MUTEX. They are handled by calling function */
+    if (AggrCtrActive==false)   /* Aggr counters not running - return MIXFKO error */
+        return (MIXFKO);
+
+    /* Evaluates and keeps the date of counters reopening in ddmmyyyy format */
+    /* This is stored for Rotation */
+    retrieve_time_date(AggrDumpOpenDate,"%d%m%Y");
+
+    /* Close the existing base counters files */
+    CloseCtrFiles(true);
+
+    /* Evaluate Time Stamp */
+    retrieve_time_date(TimeStamp, AggrCtrTimeStampFormat);
+
+    /* A single binary or CSV file for all counters, if so defined */
+    if (CtrDumpFormat & CTRBINDUMP)
+        return (OpenBinDumpFile(&AggrCtr_fd, AggrCtrDir, "aggr_", TimeStamp, false, AggrPrevVal));
+    if (CtrDumpFormat & CTRCSVTAGGED)
+        return (OpenTaggedDumpFile(&AggrCtr_fd, AggrCtrDir, "aggr_", TimeStamp));
+
+    /* Open first scalar counters file... */
+    sprintf(DumpFile, "%sscalar_aggr_%s.csv", AggrCtrDir, TimeStamp);
+    if ( (AggrCtr_fd=OpenCtrFile(DumpFile, NULL)) < 0)
+        return (MIXFNOACCESS);
+    WriteCtrHeader(AggrCtr_fd, "Date,Time,", scalarCtr[0].Name, sizeof(ScalarCtrInfo), numScalarCtr);
+
+    /* ... then open again vector counters files */
+    for (i = 0; i<numVectorCtr; i++)
+    {
+        sprintf(DumpFile, "%svector_%d_aggr_%s.csv", AggrCtrDir, i, TimeStamp);
+        if ((vectorCtr[i].AggrCtr_fd = OpenCtrFile(DumpFile, NULL)) < 0)
+            return (MIXFNOACCESS);
+        WriteVectorCtrHeader(vectorCtr[i].AggrCtr_fd, i, false);
+    }
+
+    /* ... and finally Sparse, Histogram, Summary and Top-K Counters files, rates and Distinct Counters files */
+    if ((OpenSparseCtrFiles(true, TimeStamp) != MIXFOK) || (OpenHistoCtrFiles(true, TimeStamp) != MIXFOK))
+        return (MIXFNOACCESS);
+    if ((OpenSummaryCtrFiles(true, TimeStamp) != MIXFOK) || (OpenTopkCtrFiles(true, TimeStamp) != MIXFOK))
+        return (MIXFNOACCESS);
+    if (OpenRateCtrFile(true, TimeStamp) != MIXFOK)
+        return (MIXFNOACCESS);
+    return (OpenDistinctCtrFile(true, TimeStamp));
+}
+
+
+/*
+ * This is an internal function that implements check_and_dump_ctr(): it checks
+ * current time against the next Base and Aggr Dump Times and, if they coincide,
+ * it writes a row in the corresponding scalar and vector files. It is invoked
+ * either by check_and_dump_ctr() or by DumpThread (see start_counters_async()).
+ * It returns MIXFKO if counters have not been defined/started, MIXFNOACCESS if
+ * it is not able to write counters to file, MIXFOK in any other case.
+ */
+static Error CheckAndDumpCtr(void)
+{
+    /* Local variables */
+    ShortString CurrentDate;
+    Error       result;
+    bool        DumpBase = false,
+                DumpAggr = false,
+                TickRate = false,
+                TickAlarm = false,
+                AlarmLock = false;
+    uint32_t    fired = 0;
+    uint64_t   *row;
+    uint8_t     frozen;
+    time_t      now, slot, next, gap;
+    char       *p, *q;
+    int         i,j;
+
+    /* Check if counters are actually running */
+    if ( (BaseCtrActive==false) || (BaseCtrDir[0]=='\0') )  /* Either counters not started yet or define_base_dump() not called */
+        return (MIXFKO);
+
+    /* Reap completions of previous dumps (io_uring writer only) */
+    SubmitCtrWriter();
+
+    /* First check if there is something to dump, i.e. if the next dump slot has been */
+    /* reached or the clock has been set back before the last one (not mutex protected, */
+    /* checked again within the critical sections) */
+    now = time(NULL);
+    DumpBase = ((now >= BaseNextDumpTime) || (now < BaseLastDumpTime));
+    DumpAggr = (AggrCtrActive && ((now >= AggrNextDumpTime) || (now < AggrLastDumpTime)));
+    TickRate = ((numRateCtr > 0) && (now != RateLastTick));
+    TickAlarm = ((numCtrAlarm > 0) && (now != AlarmLastTick));
+    if (!DumpBase && !DumpAggr && !TickRate && !TickAlarm)
+        return (MIXFOK);
+
+    /* Tick rates and evaluate alarms once per second (before dumps, which write rates */
+    /* and reset Peg counters) */
+    /* (alarms are skipped if another thread is evaluating or notifying them, e.g. a callback */
+    /* invoking check_and_dump_ctr(), and notified once BaseMutex has been released) */
+    if (TickRate || TickAlarm)
+    {
+        AlarmLock = (TickAlarm && (pthread_mutex_trylock(&AlarmMutex) == 0));
+        pthread_mutex_lock(&BaseMutex);
+        if (TickRate)
+            TickRates(now);
+        if (AlarmLock)
+            fired = EvalCtrAlarms(now);
+        pthread_mutex_unlock(&BaseMutex);
+        if (AlarmLock)
+        {
+            NotifyCtrAlarms(fired);
+            pthread_mutex_unlock(&AlarmMutex);
+        }
+    }
+    if (!DumpBase && !DumpAggr)
+        return (MIXFOK);
+
+    retrieve_time_date(CurrentDate, "%d%m%Y");
+
+    /* Dump Base counters if needed */
+    if (DumpBase)
+    {
+        /* Enter the critical section for base counters */
+        pthread_mutex_lock(&BaseMutex);
+
+        if (now < BaseLastDumpTime)
+        {   /* Clock set back: schedule the next slot from now on, without dumping */
+            BaseLastDumpTime = now;
+            BaseNextDumpTime = NextSlotTime(BaseDumpMap, BaseDumpPeriod, now + 1);
+        }
+        else if (now >= BaseNextDumpTime)   /* Otherwise already dumped by another thread */
+        {
+            /* Check if base counters shall be rotated */
+            if ( strcmp(CurrentDate,BaseDumpOpenDate) )
+                if ( (result=CloseReopenBaseCounters()) != MIXFOK)
+                {
+                    pthread_mutex_unlock(&BaseMutex);
+                    return (result);
+                }
+
+            /* Slots missed since the last dump (one day, or 1440 slots of an "every Ns" schedule, */
+            /* at most) are written as gap rows, values accumulated up to now are dumped in the */
+            /* row of the last elapsed slot */
+            slot = BaseNextDumpTime;
+            gap = (time_t)(BaseDumpPeriod ? BaseDumpPeriod : 60) * MINUTESPERDAY;
+            if (now - slot > gap)
+                slot = NextSlotTime(BaseDumpMap, BaseDumpPeriod, now - gap);
+            while ((next = NextSlotTime(BaseDumpMap, BaseDumpPeriod, slot + 1)) <= now)
+            {
+                if (CtrDumpFormat & CTRBINDUMP)
+                    WriteBinBlock(BaseCtr_fd, BaseRowBuf, StartBinBlock(BaseRowBuf, CTRBLKGAP, slot));
+                else if (CtrDumpFormat & CTRCSVTAGGED)
+                    WriteCtrRow(BaseCtr_fd, BaseRowBuf,
+                                (size_t)(EncodeTaggedRows(BaseRowBuf, slot, (BaseDumpPeriod != 0), NULL) - BaseRowBuf));
+                else
+                {
+                    q = FormatRowStamp(BaseRowBuf, slot, (BaseDumpPeriod != 0));
+                    WriteGapRow(BaseCtr_fd, BaseRowBuf, q, numScalarCtr);
+                    for (i = 0; i<numVectorCtr; i++)
+                        WriteGapRow(vectorCtr[i].BaseCtr_fd, BaseRowBuf, q, vectorHot[i].NumInstances);
+                }
+                DumpSparseCtrs(slot, (BaseDumpPeriod != 0), false, false, 0);
+                DumpHistoCtrs(slot, (BaseDumpPeriod != 0), false, false, 0);
+                DumpSummaryCtrs(slot, (BaseDumpPeriod != 0), false, false, 0);
+                DumpRateCtrs(slot, (BaseDumpPeriod != 0), false, false);
+                DumpTopkCtrs(slot, (BaseDumpPeriod != 0), false, false, 0);
+                DumpDistinctCtrs(slot, (BaseDumpPeriod != 0), false, false, 0);
+                CommitHistoryRow(false, slot, true);
+                slot = next;
+            }
+            BaseLastDumpTime = slot;
+            BaseNextDumpTime = next;
+
+            /* In CTRSHARDEDMODE fold all thread shards into shared counters */
+            if (CtrUpdateMode == CTRSHARDEDMODE)
+                FoldShards(0, numShardSpan);
+
+            /* Flip the epoch: updates go to the other buffer, while the frozen one is dumped */
+            frozen = BaseEpoch;
+            __atomic_store_n(&BaseEpoch, frozen ^ 1, __ATOMIC_RELAXED);
+            if (CtrSegment != NULL)
+                __atomic_store_n(&CtrSegment->baseEpoch, frozen ^ 1, __ATOMIC_RELAXED);
+            if (numRateCtr > 0)     /* Rates (and rate alarms) take the increase of frozen cells before they are reset */
+                FoldRateCells(frozen);
+            if (numCtrAlarm > 0)
+                FoldAlarmCells(frozen);
+
+            /* Fetch values of all counters (PEG Counters are reset while they are fetched) */
+            row = FetchDumpRow(false, frozen);
+
+            if (CtrDumpFormat & CTRBINDUMP)
+            {   /* A single binary row for all counters */
+                p = StartBinBlock(BaseRowBuf, CTRBLKROW, slot);
+                WriteBinBlock(BaseCtr_fd, BaseRowBuf, EncodeBinValues(p, row, BasePrevVal));
+            }
+            else if (CtrDumpFormat & CTRCSVTAGGED)
+            {   /* All rows of the slot are written at once in the single CSV file */
+                p = EncodeTaggedRows(BaseRowBuf, slot, (BaseDumpPeriod != 0), row);
+                WriteCtrRow(BaseCtr_fd, BaseRowBuf, (size_t)(p - BaseRowBuf));
+            }
+            else
+            {
+                /* All rows start with the same time stamp (the one of the slot) */
+                q = FormatRowStamp(BaseRowBuf, slot, (BaseDumpPeriod != 0));
+
+                /* Dump Scalar Counters (PEG and ROLLER) */
+                /* Each row is encoded in BaseRowBuf and written with a single write() */
+                p = q;
+                for (i = 0; i < numScalarCtr; i++)
+                {
+                    p = EncodeCtrValue(p, row[i]);
+                    *p++ = ',';
+                }
+                p[-1] = '\n';
+                WriteCtrRow(BaseCtr_fd, BaseRowBuf, (size_t)(p - BaseRowBuf));
+
+                /* Dump Vector Counter (PEG and ROLLER) */
+                for (i = 0; i<numVectorCtr; i++)
+                {
+                    p = q;
+                    for (j = 0; j < vectorHot[i].NumInstances; j++)
+                    {
+                        p = EncodeCtrValue(p, row[VectorShardOffset[i] + j]);
+                        *p++ = ',';
+                    }
+                    p[-1] = '\n';
+                    WriteCtrRow(vectorCtr[i].BaseCtr_fd, BaseRowBuf, (size_t)(p - BaseRowBuf));
+                }
+            }   /* if (CtrDumpFormat & CTRBINDUMP) */
+
+            /* Dump keys of Sparse Counters updated since the previous dump */
+            DumpSparseCtrs(slot, (BaseDumpPeriod != 0), true, false, frozen);
+
+            /* Dump statistics of Histogram and Summary Counters, rates, top keys of Top-K Counters */
+            /* and estimates of Distinct Counters */
+            DumpHistoCtrs(slot, (BaseDumpPeriod != 0), true, false, frozen);
+            DumpSummaryCtrs(slot, (BaseDumpPeriod != 0), true, false, frozen);
+            DumpRateCtrs(slot, (BaseDumpPeriod != 0), true, false);
+            DumpTopkCtrs(slot, (BaseDumpPeriod != 0), true, false, frozen);
+            DumpDistinctCtrs(slot, (BaseDumpPeriod != 0), true, false, frozen);
+
+            /* Keep values in the history ring (see define_ctr_history()) */
+            CommitHistoryRow(false, slot, false);
+
+            /* Flush files to disk if so defined through define_ctr_dump_sync() */
+            if ((CtrDumpSync != CTRNOSYNC) && (++BaseUnsyncedDumps >= CtrDumpSync))
+                SyncCtrFiles(false);
+
+            /* Submit all rows of the dump at once (io_uring writer only) */
+            SubmitCtrWriter();
+        }   /* else if (now >= BaseNextDumpTime) */
+        if (CtrSegment != NULL)
+            CtrSegment->baseLastDump = BaseLastDumpTime;
+
+        /* Exit from the critical section for base counters */
+        pthread_mutex_unlock(&BaseMutex);
+    }   /* if (DumpBase) */
+
+    /* Dump Aggr counters if needed */
+    if (DumpAggr)
+    {
+        /* Enter the critical section for aggr counters */
+        pthread_mutex_lock(&AggrMutex);
+
+        if (now < AggrLastDumpTime)
+        {   /* Clock set back: schedule the next slot from now on, without dumping */
+            AggrLastDumpTime = now;
+            AggrNextDumpTime = NextSlotTime(AggrDumpMap, 0, now + 1);
+        }
+        else if (now >= AggrNextDumpTime)   /* Otherwise already dumped by another thread */
+        {
+            /* Check if aggr counters shall be rotated */
+            if ( strcmp(CurrentDate,AggrDumpOpenDate) )
+                if ( (result=CloseReopenAggrCounters()) != MIXFOK)
+                {
+                    pthread_mutex_unlock(&AggrMutex);
+                    return (result);
+                }
+
+            /* Slots missed since the last dump (one day at most) are written as gap rows, */
+            /* values accumulated up to now are dumped in the row of the last elapsed slot */
+            slot = AggrNextDumpTime;
+            if (now - slot > SECONDSPERDAY)
+                slot = NextSlotTime(AggrDumpMap, 0, now - SECONDSPERDAY);
+            while ((next = NextSlotTime(AggrDumpMap, 0, slot + 1)) <= now)
+            {
+                if (CtrDumpFormat & CTRBINDUMP)
+                    WriteBinBlock(AggrCtr_fd, AggrRowBuf, StartBinBlock(AggrRowBuf, CTRBLKGAP, slot));
+                else if (CtrDumpFormat & CTRCSVTAGGED)
+                    WriteCtrRow(AggrCtr_fd, AggrRowBuf,
+                                (size_t)(EncodeTaggedRows(AggrRowBuf, slot, false, NULL) - AggrRowBuf));
+                else
+                {
+                    q = FormatRowStamp(AggrRowBuf, slot, false);
+                    WriteGapRow(AggrCtr_fd, AggrRowBuf, q, numScalarCtr);
+                    for (i = 0; i<numVectorCtr; i++)
+                        WriteGapRow(vectorCtr[i].AggrCtr_fd, AggrRowBuf, q, vectorHot[i].NumInstances);
+                }
+                DumpSparseCtrs(slot, false, false, true, 0);
+                DumpHistoCtrs(slot, false, false, true, 0);
+                DumpSummaryCtrs(slot, false, false, true, 0);
+                DumpRateCtrs(slot, false, false, true);
+                DumpTopkCtrs(slot, false, false, true, 0);
+                DumpDistinctCtrs(slot, false, false, true, 0);
+                CommitHistoryRow(true, slot, true);
+                slot = next;
+            }
+            AggrLastDumpTime = slot;
+            AggrNextDumpTime = next;
+
+            /* In CTRSHARDEDMODE fold all thread shards into shared counters */
+            if (CtrUpdateMode == CTRSHARDEDMODE)
+                FoldShards(0, numShardSpan);
+
+            /* Flip the epoch: updates go to the other buffer, while the frozen one is dumped */
+            frozen = AggrEpoch;
+            __atomic_store_n(&AggrEpoch, frozen ^ 1, __ATOMIC_RELAXED);
+            if (CtrSegment != NULL)
+                __atomic_store_n(&CtrSegment->aggrEpoch, frozen ^ 1, __ATOMIC_RELAXED);
+
+            /* Fetch values of all counters (PEG Counters are reset while they are fetched) */
+            row = FetchDumpRow(true, frozen);
+
+            if (CtrDumpFormat & CTRBINDUMP)
+            {   /* A single binary row for all counters */
+                p = StartBinBlock(AggrRowBuf, CTRBLKROW, slot);
+                WriteBinBlock(AggrCtr_fd, AggrRowBuf, EncodeBinValues(p, row, AggrPrevVal));
+            }
+            else if (CtrDumpFormat & CTRCSVTAGGED)
+            {   /* All rows of the slot are written at once in the single CSV file */
+                p = EncodeTaggedRows(AggrRowBuf, slot, false, row);
+                WriteCtrRow(AggrCtr_fd, AggrRowBuf, (size_t)(p - AggrRowBuf));
+            }
+            else
+            {
+                /* All rows start with the same time stamp (the one of the slot) */
+                q = FormatRowStamp(AggrRowBuf, slot, false);
+
+                /* Dump Scalar Counters (PEG and ROLLER) */
+                /* Each row is encoded in AggrRowBuf and written with a single write() */
+                p = q;
+                for (i = 0; i < numScalarCtr; i++)
+                {
+                    p = EncodeCtrValue(p, row[i]);
+                    *p++ = ',';
+                }
+                p[-1] = '\n';
+                WriteCtrRow(AggrCtr_fd, AggrRowBuf, (size_t)(p - AggrRowBuf));
+
+                /* Dump Vector Counter (PEG and ROLLER) */
+                for (i = 0; i<numVectorCtr; i++)
+                {
+                    p = q;
+                    for (j = 0; j < vectorHot[i].NumInstances; j++)
+                    {
+                        p = EncodeCtrValue(p, row[VectorShardOffset[i] + j]);
+                        *p++ = ',';
+                    }
+                    p[-1] = '\n';
+                    WriteCtrRow(vectorCtr[i].AggrCtr_fd, AggrRowBuf, (size_t)(p - AggrRowBuf));
+                }
+            }   /* if (CtrDumpFormat & CTRBINDUMP) */
+
+            /* Dump keys of Sparse Counters updated since the previous dump */
+            DumpSparseCtrs(slot, false, true, true, frozen);
+
+            /* Dump statistics of Histogram and Summary Counters, rates, top keys of Top-K Counters */
+            /* and estimates of Distinct Counters */
+            DumpHistoCtrs(slot, false, true, true, frozen);
+            DumpSummaryCtrs(slot, false, true, true, frozen);
+            DumpRateCtrs(slot, false, true, true);
+            DumpTopkCtrs(slot, false, true, true, frozen);
+            DumpDistinctCtrs(slot, false, true, true, frozen);
+
+            /* Keep values in the history ring (see define_ctr_history()) */
+            CommitHistoryRow(true, slot, false);
+
+            /* Flush files to disk if so defined through define_ctr_dump_sync() */
+            if ((CtrDumpSync != CTRNOSYNC) && (++AggrUnsyncedDumps >= CtrDumpSync))
+                SyncCtrFiles(true);
+
+            /* Submit all rows of the dump at once (io_uring writer only) */
+            SubmitCtrWriter();
+        }   /* else if (now >= AggrNextDumpTime) */
+        if (CtrSegment != NULL)
+            CtrSegment->aggrLastDump = AggrLastDumpTime;
+
+        /* Exit from the critical section for aggr counters */
+        pthread_mutex_unlock(&AggrMutex);
+    }   /* if (DumpAggr) */
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This is the body of the thread spawned by start_counters_async(). It sleeps on a
+ * timerfd armed (in absolute CLOCK_REALTIME) for the next dump time and, when it
+ * expires, it performs the dump. If the system clock is changed the timer is
+ * cancelled (TFD_TIMER_CANCEL_ON_SET) and simply re-armed. The thread terminates
+ * when stop_counters() writes to DumpStop_fd.
+ */
+static void *DumpThreadLoop(void *arg)
+{
+    struct itimerspec   its;
+    struct pollfd       pfd[2];
+    uint64_t            expirations;
+
+    memset(&its, 0, sizeof(its));
+    pfd[0].fd = DumpTimer_fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = DumpStop_fd;
+    pfd[1].events = POLLIN;
+
+    for (;;)
+    {
+        /* Arm the timer for the first of the next base/aggr dump slots */
+        its.it_value.tv_sec = (BaseNextDumpTime < AggrNextDumpTime) ? BaseNextDumpTime : AggrNextDumpTime;
+        if ((numRateCtr > 0) && (RateLastTick + 1 < its.it_value.tv_sec))  /* Rates are ticked once per second */
+            its.it_value.tv_sec = RateLastTick + 1;
+        if ((numCtrAlarm > 0) && (AlarmLastTick + 1 < its.it_value.tv_sec))    /* Likewise alarms are evaluated */
+            its.it_value.tv_sec = AlarmLastTick + 1;
+        if (its.it_value.tv_sec == NODUMPTIME)  /* Empty schedules, just wake up once a day */
+            its.it_value.tv_sec = time(NULL) + SECONDSPERDAY;
+        if (timerfd_settime(DumpTimer_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL) != 0)
+            break;
+
+        if (poll(pfd, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (pfd[1].revents & POLLIN)    /* stop_counters() has been invoked */
+            break;
+
+        /* read() fails with ECANCELED if the clock has been changed: CheckAndDumpCtr() */
+        /* is invoked anyway, since it also reschedules dumps if the clock has been set back */
+        if (pfd[0].revents & POLLIN)
+        {
+            if (read(DumpTimer_fd, &expirations, sizeof(expirations)) < 0 && errno != ECANCELED)
+                break;
+            CheckAndDumpCtr();
+        }
+    }   /* for (;;) */
+
+    return (NULL);
+}
+
+
+/*
+ * This is an internal function that stops the thread spawned by start_counters_async()
+ * (if any) and releases the related file descriptors. It is invoked by stop_counters()
+ * before taking the locks, since the thread may be dumping counters.
+ */
+static void StopDumpThread(void)
+{
+    uint64_t    one = 1;
+
+    if (DumpThreadActive == false)
+        return;
+
+    if (write(DumpStop_fd, &one, sizeof(one)) == sizeof(one))
+        pthread_join(DumpThread, NULL);
+    else
+        pthread_cancel(DumpThread);
+    close(DumpTimer_fd);
+    close(DumpStop_fd);
+    DumpTimer_fd = DumpStop_fd = -1;
+    DumpThreadActive = false;
+}
+
+
+/***********************************
+ *                                 *
+ *        Visible Functions        *
+ * (can be used outside this file  *
+ *  and are part of the library)   *
+ *                                 *
+ ***********************************/
+/* ---------------------------
+ * Counters Handling (v.2.0.0)
+ * --------------------------- */
+/*
+ * Define the maximum number of Scalar counters, between 0 and 1024.
+ * Scalar counters are global counters, i.e. they refer to the whole
+ * piece of code and are not related to a specific object/instance.
+ * The function returns MIXFOK in case of success, MIXFKO in any other case
+ * In case of success, internal counter structures are reset
+ * and any previous counter definition is lost
+ * Please observe that this function cannot be called after start_counters()
+ */
+Error define_scalar_ctr_num(uint16_t numcounters)
+{
+    int i;
+
+    if (BaseCtrActive == true)      /*if counters have already been started return error */
+        return (MIXFKO);
+
+    if (numcounters > MAXSCALARCTRNUM)
+        return (MIXFKO);
+
+    numScalarCtr = numcounters;
+    ResetCtrRegistry(CTRSCALAR);
+
+    /* Reset internal counter structures */
+    for (i = 0; i < MAXSCALARCTRNUM; i++)
+    {
+        scalarCtr[i].Name[0] = '\0';
+        scalarType[i] = UNDEFCTR;
+        scalarBaseVal[0][i] = scalarBaseVal[1][i] = 0;
+        scalarAggrVal[0][i] = scalarAggrVal[1][i] = 0;
+    }
+    if (BaseCtr_fd >= 0)
+    {
+        close(BaseCtr_fd);
+        BaseCtr_fd = -1;
+    }
+    if (AggrCtr_fd >= 0)
+    {
+        close(AggrCtr_fd);
+        AggrCtr_fd = -1;
+    }
+
+    return (MIXFOK);
+}
+
+
+/*
+ * Define the maximum number of Vector counters, between 0 and 1024.
+ * Vector counters are collected for a set of objects/instances of the
+ * same type. For example the number of bytes sent over a specific TCP
+ * connection shall be considered a Vector counter (the counter is one,
+ * i.e. the number of bytes sent, but given N the number of TCP
+ * connections, it comes in N instances). Be aware that the library
+ * can collect up to 65536 total instances of Vector counters.
+ * Here follows some examples of allowed combinations:
+ *   - 2 Vector counters (each with up to 32768 instances)
+ *   - 3 Vector counters (e.g. the first with up to 32768 instances,
+ *       the others up to 16536 instances)
+ *   - 1024 Vector counters of 64 instances each
+ * or any other combination, given that the total amount of collected
+ * counter instances does not exceed 65536.
+ * The function returns MIXFOK in case of success, MIXFKO in any other case
+ * In case of success, internal counter structures are reset
+ * and any previous counter definition is lost
+ * Please observe that this function cannot be called after start_counters()
+ */
+Error define_vector_ctr_num(uint16_t numcounters)
+{
+    int     i;
+
+    if (BaseCtrActive == true)      /*if counters have already been started return error */
+        return (MIXFKO);
+
+    if (numcounters > MAXVECTORCTRNUM)
+        return (MIXFKO);
+
+    numVectorCtr = numcounters;
+    cumVectorInst = 0;
+    ResetCtrRegistry(CTRVECTOR);
+
+    /* Reset internal counter structures */
+    for (i = 0; i < MAXVECTORCTRNUM; i++)
+    {
+        vectorCtr[i].Name[0] = '\0';
+        vectorCtr[i].InstName[0] = '\0';
+        vectorHot[i].Type = UNDEFCTR;
+        vectorHot[i].NumInstances = 0;
+        if (vectorCtr[i].BaseMem)
+            free(vectorCtr[i].BaseMem);
+        if (vectorCtr[i].AggrMem)
+            free(vectorCtr[i].AggrMem);
+        vectorCtr[i].BaseMem = vectorCtr[i].AggrMem = NULL;
+        SetVectorValues(i, UNDEFCTR, 0, NULL, NULL);
+        if (vectorCtr[i].InstIdName)
+            free(vectorCtr[i].InstIdName);
+        vectorCtr[i].InstIdName = NULL;
+        if (vectorCtr[i].BaseCtr_fd >= 0)
+        {
+            close(vectorCtr[i].BaseCtr_fd);
+            vectorCtr[i].BaseCtr_fd = -1;
+        }
+        if (vectorCtr[i].AggrCtr_fd >= 0)
+        {
+            close(vectorCtr[i].AggrCtr_fd);
+            vectorCtr[i].AggrCtr_fd = -1;
+        }
+    }
+    return (MIXFOK);
+}
+
+
+/* The first parameter is the Scalar Counter ID and shall be defined
+ * in the interval (0,M-1), where M is the the maximum number of
+ * Scalar counters defined through define_scalar_ctr_num(). The second
+ * parameter specifies the counter type (PEGCTR or ROLLERCTR), possibly
+ * OR-ed with CTR64BIT for a 64 bit counter (default width is 32 bits).
+ * PEG Counters are counters that are characterized by the following
+ * properties: they have initial value set to 0, they can only increase
+ * and they are reset every time that counters are dumped to file
+ * (i.e. at each base interval). ROLLER Counters are slightly different:
+ * they can have a non null initial value, they can increase and decrease
+ * (but never become negative) and when they are dumped to file,
+ * they are not reset. The third parameter represents the initial value
+ * for the counter and is valid only for ROLLER Counters (it is meaningless
+ * in case that counter type is PEGCTR).
+ * The fourth parameter is a string that provides the counter name (up to 32
+ * characters, otherwise it is truncated).
+ * The ID of a counter registered through register_scalar_ctr() cannot be redefined.
+ * This function provides MIXFKO either in case of wrong parameters (e.g. outside allowed
+ * ranges or ID of a registered counter) or in case of counters already started, MIXFOK
+ * if everything is ok */
+Error define_scalar_ctr(uint16_t ctrId, uint8_t ctrType, uint32_t ctrInitial, char* ctrName)
+{
+    if (BaseCtrActive == true)      /*if counters have already been started return error */
+        return (MIXFKO);
+
+    if ( (ctrId >= numScalarCtr) || ISREGCTR(CtrRegMap[CTRSCALAR], ctrId) )
+        return (MIXFKO);
+
+    if ((CTRKIND(ctrType) != PEGCTR) && (CTRKIND(ctrType) != ROLLERCTR))
+        return (MIXFKO);
+
+    if (strlen(ctrName) > SHORTSTRINGMAXLEN)
+    {   /* The name is too long, truncate it to 32 characters */
+        strncpy(scalarCtr[ctrId].Name, ctrName, SHORTSTRINGMAXLEN);
+        scalarCtr[ctrId].Name[SHORTSTRINGMAXLEN] = '\0';
+    }
+    else
+        strcpy(scalarCtr[ctrId].Name, ctrName);
+    /* A counter with an empty name is not considered as defined (as in previous releases) */
+    scalarType[ctrId] = (scalarCtr[ctrId].Name[0] != '\0') ? ctrType : UNDEFCTR;
+    scalarBaseVal[1][ctrId] = scalarAggrVal[1][ctrId] = 0;
+    if (CTRKIND(ctrType) == PEGCTR)
+    {   /* PEG Counter - Initial value always NULL */
+        scalarBaseVal[0][ctrId] = 0;
+        scalarAggrVal[0][ctrId] = 0;
+    }
+    else
+    {   /* ROLLER Counter - Initial value set by caller */
+        scalarBaseVal[0][ctrId] = ctrInitial;
+        scalarAggrVal[0][ctrId] = ctrInitial;
+    }
+
+    return (MIXFOK);
+}
+
+
+/* The first parameter is the Vector Counter ID and shall be defined
+ * in the interval (0,N-1), where N is the the maximum number of
+ * Vector counters defined through define_vector_ctr_num(). The second
+ * parameter is the maximum number of instances allowed for the
+ * Vector Counter ID specified by parameter 1. It shall be at least 1.
+ * The maximum value is limited by the fact that the maximum
+ * number of instances cannot exceed 65536. The third
+ * parameter specifies the counter type(PEGCTR or ROLLERCTR), possibly
+ * OR-ed with CTR64BIT for a 64 bit counter (default width is 32 bits).
+ * PEG Counters are counters that are characterized by the following
+ * properties: they have initial value set to 0, they can only increase
+ * and they are reset every time that counters are dumped to file
+ * (i.e.at each base interval).ROLLER Counters are slightly different :
+ * they can have a non null initial value, they can increaseand decrease
+ * (but never become negative) and when they are dumped to file,
+ * they are not reset.The fourth parameter represents the initial value
+ * for the counter and is valid only for ROLLER Counters(it is meaningless
+ * in case that counter type is PEGCTR).This value is assigned to all
+ * intances of the counter.
+ * The fifth parameter is a string that provides the counter name (up to 32
+ * characters, otherwise it is truncated).The sixth parameter is another
+ * string(up to 32 characters length, otherwise it is truncated) that
+ * provides the name of the object associated to instances.
+ * Example: referring to the number of bytes sent for different TCP
+ * connections, assuming that this is a ROLLER Counter whose ID is 12
+ * andthat the maximum number of TCP Connections is 512, the call
+ * might be :
+ *      define_vector_ctr(12, 512, ROLLERCTR, 0, "Total Bytes Sent", "TCP Conn. ID")
+ * In this case the initial value for the counter has been set to 0 (for
+ * all the 512 TCP connections)
+ * The ID of a counter registered through register_vector_ctr() cannot be redefined.
+ * This function provides MIXFKO either in case of wrong parameters(e.g.outside allowed
+ * ranges or ID of a registered counter) or in case of counters already started,
+ * MIXFOVFL if the number of cumulative instances of Vector Counters up to function
+ * call exceeds 65536, MIXFOK if everything is ok
+ */
+Error define_vector_ctr(uint16_t ctrId, uint16_t ctrInst, uint8_t ctrType, uint32_t ctrInitial, char* ctrName, char* instName)
+{
+    uint32_t    cum;
+    size_t      size;
+    int         i;
+
+    if (BaseCtrActive == true)      /*if counters have already been started return error */
+        return (MIXFKO);
+
+    if ( (ctrId >= numVectorCtr) || (ctrInst < 1) || ISREGCTR(CtrRegMap[CTRVECTOR], ctrId) )
+        return (MIXFKO);
+
+    /* Check that the cumulative number of instances of Vector Counters up to */
+    /* function call does not exceed 65536 (done before to avoid counter wrap) */
+    if (cumVectorInst > MAXVECTORCTRINST - ctrInst)
+        return (MIXFOVFL);
+
+    cum = cumVectorInst + ctrInst;
+
+    if ((CTRKIND(ctrType) != PEGCTR) && (CTRKIND(ctrType) != ROLLERCTR))
+        return (MIXFKO);
+
+    if (strlen(ctrName) > SHORTSTRINGMAXLEN)
+    {   /* The name is too long, truncate it to 32 characters */
+        strncpy(vectorCtr[ctrId].Name, ctrName, SHORTSTRINGMAXLEN);
+        vectorCtr[ctrId].Name[SHORTSTRINGMAXLEN] = '\0';
+    }
+    else
+        strcpy(vectorCtr[ctrId].Name, ctrName);
+
+    if (strlen(instName) > SHORTSTRINGMAXLEN)
+    {   /* The name is too long, truncate it to 32 characters */
+        strncpy(vectorCtr[ctrId].InstName, instName, SHORTSTRINGMAXLEN);
+        vectorCtr[ctrId].InstName[SHORTSTRINGMAXLEN] = '\0';
+    }
+    else
+        strcpy(vectorCtr[ctrId].InstName, instName);
+
+    /* Values are allocated in cache line aligned arrays, so that the dump scans them sequentially */
+    /* Peg counters get two buffers (one per epoch) in the same block, each starting on a cache line */
+    size = ((CTRKIND(ctrType) == PEGCTR) ? 2 : 1) * CTRSTRIDE(ctrInst) * sizeof(uint64_t);
+    if (posix_memalign((void **)&vectorCtr[ctrId].BaseMem, CACHELINESIZE, size) != 0)
+    {
+        vectorCtr[ctrId].BaseMem = NULL;
+        return (MIXFKO);
+    }
+    if (posix_memalign((void **)&vectorCtr[ctrId].AggrMem, CACHELINESIZE, size) != 0)
+    {
+        vectorCtr[ctrId].AggrMem = NULL;
+        free(vectorCtr[ctrId].BaseMem);
+        vectorCtr[ctrId].BaseMem = NULL;
+        return (MIXFKO);
+    }
+    vectorCtr[ctrId].InstIdName = (MicroString *)calloc((size_t)ctrInst, sizeof(MicroString));
+    if (vectorCtr[ctrId].InstIdName == NULL)
+    {
+        free(vectorCtr[ctrId].BaseMem);
+        free(vectorCtr[ctrId].AggrMem);
+        vectorCtr[ctrId].BaseMem = NULL;
+        vectorCtr[ctrId].AggrMem = NULL;
+        return (MIXFKO);
+    }
+    SetVectorValues(ctrId, ctrType, ctrInst, vectorCtr[ctrId].BaseMem, vectorCtr[ctrId].AggrMem);
+
+    for (i = 0; i < ctrInst; i++)
+    {
+        vectorCtr[ctrId].InstIdName[i][0] = '\0';   /* Instance ID Name initially set to empty string */
+        if (CTRKIND(ctrType) == PEGCTR) /* PEG Counter - Initial values always NULL for all instances */
+        {
+            vectorHot[ctrId].BaseVal[0][i] = vectorHot[ctrId].AggrVal[0][i] = 0;
+            vectorHot[ctrId].BaseVal[1][i] = vectorHot[ctrId].AggrVal[1][i] = 0;
+        }
+        else                    /* ROLLER Counter - Initial values set for all instances */
+            vectorHot[ctrId].BaseVal[0][i] = vectorHot[ctrId].AggrVal[0][i] = ctrInitial;
+    }
+
+    /* A counter with an empty name is not considered as defined (as in previous releases) */
+    vectorHot[ctrId].Type = (vectorCtr[ctrId].Name[0] != '\0') ? ctrType : UNDEFCTR;
+    vectorHot[ctrId].NumInstances = ctrInst;
+
+    /* Update cumulated number of instances */
+    cumVectorInst = cum;
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This function is used to associate a name to an instance of a Vector Counter
+ * The first parameter specifies the Vector Counter ID, the second one represents
+ * the Instance Id. They shall be defined within the limits specified through
+ * define_vector_ctr_num() and define_vector_ctr(), otherwise MIXFKO is returned.
+ * The third parameter is a string that specifies the name of the concerned
+ * instance (e.g. if the counter is used to collect Total Bytes Sent for
+ * several TCP connections, this name could be used to store the connection ID).
+ * If NULL, the call has no effect (i.e. the name is not changed), otherwise it
+ * is overwritten. Please observe that up to 16 chars are allowed, if more
+ * the name is truncated.
+ * Please observe that this function can be called even if counters have been
+ * already started
+ */
+Error set_vector_ctr_inst_name(uint16_t ctrId, uint16_t ctrInst, char *instIdName)
+{
+    if ((ctrId >= numVectorCtr) || (ctrInst >= vectorHot[ctrId].NumInstances) )
+        return (MIXFKO);
+
+    if (instIdName == NULL) /* If instIdName is not specified */
+        return (MIXFOK);
+
+    if (strlen(instIdName) >= MICROSTRINGMAXLEN)
+    {   /* The name is too long, truncate it to 16 characters */
+        strncpy(vectorCtr[ctrId].InstIdName[ctrInst], instIdName, MICROSTRINGMAXLEN);
+        vectorCtr[ctrId].InstIdName[ctrInst][MICROSTRINGMAXLEN] = '\0';
+    }
+    else
+        strcpy(vectorCtr[ctrId].InstIdName[ctrInst], instIdName);
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This function defines a Scalar Counter by name, without an ID chosen by the
+ * application: the counter takes the lowest Scalar Counter ID not defined yet and, if
+ * all the IDs allowed by define_scalar_ctr_num() are in use, the number of Scalar
+ * Counters is increased (up to 1024), so that independent modules (e.g. plugins) never
+ * need to coordinate ID allocation. The first parameter is the counter name (up to 32
+ * characters, otherwise it is truncated), which identifies the counter among registered
+ * Scalar Counters; the second and third parameters are the counter type and its initial
+ * value, as in define_scalar_ctr(). The fourth parameter points to the handle given back,
+ * to be used with incr_peg_ctr(), add_peg_ctr() and update_roller_ctr(); the counter ID
+ * (e.g. for retrieve_xxx() functions) is given by CTRHANDLEID().
+ * If the name is already registered with the same type, the same handle is given back
+ * (so that modules may share a counter). Handles are valid until counters are redefined
+ * through define_scalar_ctr_num() or stop_counters(); the ID of a registered counter
+ * cannot be redefined through define_scalar_ctr().
+ * This function returns:
+ *     - MIXFKO:   wrong parameters (e.g. NULL or empty name, invalid type), name already
+ *                 registered with a different type or counters already started
+ *     - MIXFOVFL: all the 1024 Scalar Counter IDs are in use
+ *     - MIXFOK:   the counter has been registered (or found) and its handle given back
+ */
+Error register_scalar_ctr(char *ctrName, uint8_t ctrType, uint32_t ctrInitial, CtrHandle *handle)
+{
+    ShortString name;
+    uint32_t    pos;
+    int         id;
+    Error       res;
+
+    if (BaseCtrActive == true)      /*if counters have already been started return error */
+        return (MIXFKO);
+
+    if ( (ctrName == NULL) || (ctrName[0] == '\0') || (handle == NULL) )
+        return (MIXFKO);
+
+    strncpy(name, ctrName, SHORTSTRINGMAXLEN);
+    name[SHORTSTRINGMAXLEN] = '\0';
+
+    if ((id = FindRegisteredCtr(CTRSCALAR, name, &pos)) >= 0)
+    {   /* Already registered (e.g. by another module), the definition shall be the same */
+        if (scalarType[id] != ctrType)
+            return (MIXFKO);
+        *handle = CTRHANDLE(CtrHandleGen[CTRSCALAR], CTRSCALAR, ctrType, id);
+        return (MIXFOK);
+    }
+
+    if ((id = FreeCtrId(CTRSCALAR)) < 0)
+        return (MIXFOVFL);
+    if (id == numScalarCtr)
+    {   /* Grow the number of Scalar Counters (IDs beyond it have been reset) */
+        numScalarCtr++;
+        if ((res = define_scalar_ctr(id, ctrType, ctrInitial, name)) != MIXFOK)
+            numScalarCtr--;
+    }
+    else
+        res = define_scalar_ctr(id, ctrType, ctrInitial, name);
+    if (res != MIXFOK)
+        return (res);
+
+    CtrRegIndex[CTRSCALAR][pos] = id + 1;
+    SETREGCTR(CtrRegMap[CTRSCALAR], id);
+    *handle = CTRHANDLE(CtrHandleGen[CTRSCALAR], CTRSCALAR, ctrType, id);
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This function defines a Vector Counter by name, without an ID chosen by the
+ * application: the counter takes the lowest Vector Counter ID not defined yet and, if
+ * all the IDs allowed by define_vector_ctr_num() are in use, the number of Vector
+ * Counters is increased (up to 1024). The first parameter is the counter name (up to
+ * 32 characters, otherwise it is truncated), which identifies the counter among
+ * registered Vector Counters; the following ones are the number of instances, the
+ * counter type, its initial value and the name of the object associated to instances,
+ * as in define_vector_ctr(). The last parameter points to the handle given back, to be
+ * used with incr_peg_ctr(), add_peg_ctr() and update_roller_ctr(); the counter ID
+ * (e.g. for set_vector_ctr_inst_name() and retrieve_xxx() functions) is given by
+ * CTRHANDLEID().
+ * If the name is already registered with the same type and number of instances, the
+ * same handle is given back. Handles are valid until counters are redefined through
+ * define_vector_ctr_num() or stop_counters(); the ID of a registered counter cannot be
+ * redefined through define_vector_ctr().
+ * This function returns:
+ *     - MIXFKO:   wrong parameters (e.g. NULL or empty name, invalid type, no instances),
+ *                 name already registered with a different definition or counters
+ *                 already started
+ *     - MIXFOVFL: all the 1024 Vector Counter IDs are in use, or the cumulative number
+ *                 of instances of Vector Counters would exceed 65536
+ *     - MIXFOK:   the counter has been registered (or found) and its handle given back
+ */
+Error register_vector_ctr(char *ctrName, uint16_t ctrInst, uint8_t ctrType, uint32_t ctrInitial, char *instName, CtrHandle *handle)
+{
+    ShortString name;
+    uint32_t    pos;
+    int         id;
+    Error       res;
+
+    if (BaseCtrActive == true)      /*if counters have already been started return error */
+        return (MIXFKO);
+
+    if ( (ctrName == NULL) || (ctrName[0] == '\0') || (instName == NULL) || (handle == NULL) )
+        return (MIXFKO);
+
+    strncpy(name, ctrName, SHORTSTRINGMAXLEN);
+    name[SHORTSTRINGMAXLEN] = '\0';
+
+    if ((id = FindRegisteredCtr(CTRVECTOR, name, &pos)) >= 0)
+    {   /* Already registered (e.g. by another module), the definition shall be the same */
+        if ( (vectorHot[id].Type != ctrType) || (vectorHot[id].NumInstances != ctrInst) )
+            return (MIXFKO);
+        *handle = CTRHANDLE(CtrHandleGen[CTRVECTOR], CTRVECTOR, ctrType, id);
+        return (MIXFOK);
+    }
+
+    if ((id = FreeCtrId(CTRVECTOR)) < 0)
+        return (MIXFOVFL);
+    if (id == numVectorCtr)
+    {   /* Grow the number of Vector Counters (IDs beyond it have been reset) */
+        numVectorCtr++;
+        if ((res = define_vector_ctr(id, ctrInst, ctrType, ctrInitial, name, instName)) != MIXFOK)
+            numVectorCtr--;
+    }
+    else
+        res = define_vector_ctr(id, ctrInst, ctrType, ctrInitial, name, instName);
+    if (res != MIXFOK)
+        return (res);
+
+    CtrRegIndex[CTRVECTOR][pos] = id + 1;
+    SETREGCTR(CtrRegMap[CTRVECTOR], id);
+    *handle = CTRHANDLE(CtrHandleGen[CTRVECTOR], CTRVECTOR, ctrType, id);
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This function is used to define the number of Sparse counters (up to 64), i.e.
+ * Peg counters whose instances are identified by arbitrary 64 bit keys, added the
+ * first time they are updated (see define_sparse_ctr()). Sparse counters have their
+ * own IDs, independent of Scalar and Vector Counters ones.
+ * The function returns MIXFOK in case of success, MIXFKO in any other case
+ * In case of success, internal Sparse counter structures are reset
+ * and any previous Sparse counter definition is lost
+ * Please observe that this function cannot be called after start_counters()
+ */
+Error define_sparse_ctr_num(uint16_t numcounters)
+{
+    if (BaseCtrActive == true)      /*if counters have already been started return error */
+        return (MIXFKO);
+
+    if (numcounters > MAXSPARSECTRNUM)
+        return (MIXFKO);
+
+    ReleaseSparseCtrs();
+    numSparseCtr = numcounters;
+
+    return (MIXFOK);
+}
+
+
+/*
+ * The first parameter is the Sparse Counter ID and shall be defined in the interval
+ * (0,S-1), where S is the number of Sparse counters defined through
+ * define_sparse_ctr_num(). The second parameter is the maximum number of keys of the
+ * counter (at least 1, at most 2^28): once it is reached, updates of new keys are
+ * added to a single overflow cell. The third parameter specifies the counter type,
+ * that shall be PEGCTR, possibly OR-ed with CTR64BIT. The fourth parameter is the
+ * counter name and the fifth one the name of the object identified by keys (up to 32
+ * characters each, otherwise they are truncated).
+ * The hash table is sized to a power of 2 at least 1.5 times the maximum number of
+ * keys, so that probe sequences stay short even when it is full; it is allocated
+ * zeroed, so that pages are only touched as keys are added.
+ * This function provides MIXFKO either in case of wrong parameters (e.g. outside
+ * allowed ranges, Roller counter), memory that cannot be allocated or counters
+ * already started, MIXFOK if everything is ok
+ */
+Error define_sparse_ctr(uint16_t ctrId, uint32_t maxKeys, uint8_t ctrType, char *ctrName, char *keyName)
+{
+    SparseCtrInfo  *sp;
+    uint32_t        size;
+
+    if (BaseCtrActive == true)      /*if counters have already been started return error */
+        return (MIXFKO);
+
+    if ( (ctrId >= numSparseCtr) || (maxKeys < 1) || (maxKeys > MAXSPARSEKEYS) || (CTRKIND(ctrType) != PEGCTR) )
+        return (MIXFKO);
+
+    /* Release a previous definition of the same counter, if any */
+    sp = &sparseCtr[ctrId];
+    free(sp->Keys);
+    free(sp->ValMem);
+    sp->Keys = sp->Values = sp->ValMem = NULL;
+    sp->Type = UNDEFCTR;
+
+    strncpy(sp->Name, ctrName, SHORTSTRINGMAXLEN);
+    sp->Name[SHORTSTRINGMAXLEN] = '\0';
+    strncpy(sp->KeyName, keyName, SHORTSTRINGMAXLEN);
+    sp->KeyName[SHORTSTRINGMAXLEN] = '\0';
+    /* A counter with an empty name is not considered as defined (as other counters) */
+    if (sp->Name[0] == '\0')
+        return (MIXFOK);
+
+    /* Keys: cells of the hash table, then the cell of key 0 */
+    /* Values: SPARSEVALUES for each key cell, then the overflow cell (cache line aligned) */
+    for (size = 16; size < maxKeys + maxKeys / 2 + 1; size <<= 1)
+        ;
+    sp->Keys = (uint64_t *)calloc((size_t)size + 1, sizeof(uint64_t));
+    sp->ValMem = (uint64_t *)calloc(((size_t)size + 2) * SPARSEVALUES + CACHELINESIZE / 8, sizeof(uint64_t));
+    if ((sp->Keys == NULL) || (sp->ValMem == NULL))
+    {
+        free(sp->Keys);
+        free(sp->ValMem);
+        sp->Keys = sp->ValMem = NULL;
+        return (MIXFKO);
+    }
+    sp->Values = (uint64_t *)(((uintptr_t)sp->ValMem + CACHELINESIZE - 1) & ~(uintptr_t)(CACHELINESIZE - 1));
+    sp->Mask = size - 1;
+    sp->MaxKeys = maxKeys;
+    sp->NumKeys = 0;
+    sp->Type = ctrType;
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This function is used to define the number of Histogram counters (up to 64), i.e.
+ * counters recording the distribution of values (e.g. latencies) in log-linear
+ * buckets, whose dumps report number of values, sum, min, max and percentiles (see
+ * define_histo_ctr()). Histogram counters have their own IDs, independent of other
+ * counters ones.
+ * The function returns MIXFOK in case of success, MIXFKO in any other case
+ * In case of success, internal Histogram counter structures are reset
+ * and any previous Histogram counter definition is lost
+ * Please observe that this function cannot be called after start_counters()
+ */
+Error define_histo_ctr_num(uint16_t numcounters)
+{
+    if (BaseCtrActive == true)      /*if counters have already been started return error */
+        return (MIXFKO);
+
+    if (numcounters > MAXHISTOCTRNUM)
+        return (MIXFKO);
+
+    ReleaseHistoCtrs();
+    numHistoCtr = numcounters;
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This function is used to define the number of Summary counters, i.e.
+ * counters keeping number, sum, min and max of the values observed in the
+ * interval (see observe_summary_ctr()). Summary counters have their own IDs,
+ * independent of other counters ones.
+ * The function returns MIXFOK in case of success, MIXFKO in any other case
+ * In case of success, internal Summary counter structures are reset
+ * and any previous Summary counter definition is lost
+ * Please observe that this function cannot be called after start_counters()
+ */
+Error define_summary_ctr_num(uint16_t numcounters)
+{
+    if (BaseCtrActive == true)      /*if counters have already been started return error */
+        return (MIXFKO);
+
+    if (numcounters > MAXSUMMARYCTRNUM)
+        return (MIXFKO);
+
+    ReleaseSummaryCtrs();
+    numSummaryCtr = numcounters;
+
+    return (MIXFOK);
+}
+
+
+/*
+ * The first parameter is the Summary Counter ID and shall be defined in the interval
+ * (0,S-1), where S is the number of Summary counters defined through
+ * define_summary_ctr_num(). The second parameter is the counter name (up to 32
+ * characters, otherwise it is truncated).
+ * This function provides MIXFKO either in case of wrong parameters (e.g. outside
+ * allowed ranges) or counters already started, MIXFOK if everything is ok
+ */
+Error define_summary_ctr(uint16_t ctrId, char *ctrName)
+{
+    if (BaseCtrActive == true)      /*if counters have already been started return error */
+        return (MIXFKO);
+
+    if (ctrId >= numSummaryCtr)
+        return (MIXFKO);
+
+    /* A counter with an empty name is not considered as defined (as other counters) */
+    strncpy(summaryCtr[ctrId].Name, ctrName, SHORTSTRINGMAXLEN);
+    summaryCtr[ctrId].Name[SHORTSTRINGMAXLEN] = '\0';
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This function is used to define the number of counter rates, i.e. per second
+ * rates of Peg counters evaluated once per second (see define_rate_ctr()).
+ * Rates have their own IDs, independent of counters ones.
+ * The function returns MIXFOK in case of success, MIXFKO in any other case
+ * In case of success, internal rate structures are reset
+ * and any previous rate definition is lost
+ * Please observe that this function cannot be called after start_counters()
+ */
+Error define_rate_ctr_num(uint16_t numrates)
+{
+    if (BaseCtrActive == true)      /*if counters have already been started return error */
+        return (MIXFKO);
+
+    if (numrates > MAXRATECTRNUM)
+        return (MIXFKO);
+
+    ReleaseRateCtrs();
+    numRateCtr = numrates;
+
+    return (MIXFOK);
+}
+
+
+/*
+ * The first parameter is the rate ID and shall be defined in the interval (0,R-1),
+ * where R is the number of rates defined through define_rate_ctr_num(). The
+ * second, third and fourth parameters are class (CTRSCALAR or CTRVECTOR), ID and
+ * instance (only for Vector Counters) of the counter, which shall be a Peg Counter
+ * already defined. The fifth parameter is the rate name (up to 32 characters,
+ * otherwise it is truncated). The ring of the increases of the last RATEWINDOW
+ * seconds, used by sliding windows, is allocated here.
+ * This function provides MIXFKO either in case of wrong parameters (e.g. outside
+ * allowed ranges), memory that cannot be allocated or counters already started,
+ * MIXFOK if everything is ok
+ */
+Error define_rate_ctr(uint16_t rateId, uint8_t ctrClass, uint16_t ctrId, uint16_t ctrInst, char *rateName)
+{
+    RateCtrInfo    *r;
+
+    if (BaseCtrActive == true)      /*if counters have already been started return error */
+        return (MIXFKO);
+
+    if (rateId >= numRateCtr)
+        return (MIXFKO);
+    if (ctrClass == CTRSCALAR)
+    {
+        if ((ctrId >= numScalarCtr) || (CTRKIND(scalarType[ctrId]) != PEGCTR))
+            return (MIXFKO);
+        ctrInst = 0;
+    }
+    else if ( (ctrClass != CTRVECTOR) || (ctrId >= numVectorCtr) || (CTRKIND(vectorHot[ctrId].Type) != PEGCTR) ||
+              (ctrInst >= vectorHot[ctrId].NumInstances) )
+        return (MIXFKO);
+
+    r = &rateCtr[rateId];
+    r->Name[0] = '\0';
+    if ((r->Ring == NULL) && ((r->Ring = (uint64_t *)calloc(RATEWINDOW, sizeof(uint64_t))) == NULL))
+        return (MIXFKO);
+    r->Class = ctrClass;
+    r->CtrId = ctrId;
+    r->CtrInst = ctrInst;
+
+    /* A rate with an empty name is not considered as defined (as counters) */
+    strncpy(r->Name, rateName, SHORTSTRINGMAXLEN);
+    r->Name[SHORTSTRINGMAXLEN] = '\0';
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This function is used to define the number of Top-K counters (up to 64), i.e. the
+ * heavy hitters among arbitrary keys (see define_topk_ctr()). Top-K counters have
+ * their own IDs, independent of other counters ones.
+ * The function returns MIXFOK in case of success, MIXFKO in any other case
+ * In case of success, internal Top-K counter structures are reset
+ * and any previous Top-K counter definition is lost
+ * Please observe that this function cannot be called after start_counters()
+ */
+Error define_topk_ctr_num(uint16_t numcounters)
+{
+    if (BaseCtrActive == true)      /*if counters have already been started return error */
+        return (MIXFKO);
+
+    if (numcounters > MAXTOPKCTRNUM)
+        return (MIXFKO);
+
+    ReleaseTopkCtrs();
+    numTopkCtr = numcounters;
+
+    return (MIXFOK);
+}
+
+
+/*
+ * The first parameter is the Top-K Counter ID and shall be defined in the interval
+ * (0,T-1), where T is the number of Top-K counters defined through
+ * define_topk_ctr_num(). The second parameter is the number K of keys dumped (at
+ * least 1, at most MAXTOPK), the third one the number of keys monitored (at least K,
+ * at most MAXTOPKSLOTS), the fourth one the type of keys (CTRTOPKINTKEY or
+ * CTRTOPKSTRKEY). The fifth parameter is the counter name and the sixth one the name
+ * of the object identified by keys (up to 32 characters each, otherwise they are
+ * truncated).
+ * Base and aggr keys, one sketch per epoch (see TOPKBUF), are allocated in a single
+ * area, hash tables being sized to a power of 2 at least twice the monitored keys.
+ * This function provides MIXFKO either in case of wrong parameters (e.g. outside
+ * allowed ranges), memory that cannot be allocated or counters already started,
+ * MIXFOK if everything is ok
+ */
+Error define_topk_ctr(uint16_t ctrId, uint16_t topK, uint32_t slots, uint8_t keyType, char *ctrName, char *keyName)
+{
+    TopKCtrInfo    *tk;
+    TopKSketch     *sk;
+    uint32_t        size;
+    size_t          len;
+    char           *mem;
+    int             e;
+
+    if (BaseCtrActive == true)      /*if counters have already been started return error */
+        return (MIXFKO);
+
+    if ( (ctrId >= numTopkCtr) || (topK < 1) || (topK > MAXTOPK) || (slots < topK) || (slots > MAXTOPKSLOTS) ||
+         ((keyType != CTRTOPKINTKEY) && (keyType != CTRTOPKSTRKEY)) )
+        return (MIXFKO);
+
+    /* Release a previous definition of the same counter, if any */
+    tk = &topkCtr[ctrId];
+    free(tk->Mem);
+    tk->Mem = NULL;
+    memset(tk->Sketch, 0, sizeof(tk->Sketch));
+    tk->TopK = 0;
+
+    strncpy(tk->Name, ctrName, SHORTSTRINGMAXLEN);
+    tk->Name[SHORTSTRINGMAXLEN] = '\0';
+    strncpy(tk->KeyName, keyName, SHORTSTRINGMAXLEN);
+    tk->KeyName[SHORTSTRINGMAXLEN] = '\0';
+    /* A counter with an empty name is not considered as defined (as other counters) */
+    if (tk->Name[0] == '\0')
+        return (MIXFOK);
+
+    /* Each sketch: keys, counts and errors, heap and positions, hash table, then string keys */
+    for (size = 16; size < 2 * slots; size <<= 1)
+        ;
+    len = (size_t)slots * (3 * sizeof(uint64_t) + 2 * sizeof(uint32_t)) + (size_t)size * sizeof(uint32_t);
+    if (keyType == CTRTOPKSTRKEY)
+        len += (size_t)slots * (CTRTOPKKEYLEN + 1);
+    len = (len + CACHELINESIZE - 1) & ~(size_t)(CACHELINESIZE - 1);
+    if ((mem = (char *)malloc(4 * len)) == NULL)
+        return (MIXFKO);
+    tk->Mem = mem;
+    for (e = 0; e < 4; e++, mem += len)
+    {
+        sk = &tk->Sketch[e];
+        sk->Keys = (uint64_t *)mem;
+        sk->Counts = sk->Keys + slots;
+        sk->Errors = sk->Counts + slots;
+        sk->Heap = (uint32_t *)(sk->Errors + slots);
+        sk->Pos = sk->Heap + slots;
+        sk->Table = sk->Pos + slots;
+        sk->Names = (keyType == CTRTOPKSTRKEY) ? (char *)(sk->Table + size) : NULL;
+        sk->Used = 0;
+        memset(sk->Table, 0xFF, (size_t)size * sizeof(uint32_t));
+    }
+    tk->Slots = slots;
+    tk->Mask = size - 1;
+    tk->KeyType = keyType;
+    tk->TopK = topK;
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This function is used to define the number of Distinct counters (up to 64), i.e. the
+ * estimates of the distinct keys updated in the interval (see define_distinct_ctr()).
+ * Distinct counters have their own IDs, independent of other counters ones.
+ * The function returns MIXFOK in case of success, MIXFKO in any other case
+ * In case of success, internal Distinct counter structures are reset
+ * and any previous Distinct counter definition is lost
+ * Please observe that this function cannot be called after start_counters()
+ */
+Error define_distinct_ctr_num(uint16_t numcounters)
+{
+    if (BaseCtrActive == true)      /*if counters have already been started return error */
+        return (MIXFKO);
+
+    if (numcounters > MAXDISTINCTCTRNUM)
+        return (MIXFKO);
+
+    ReleaseDistinctCtrs();
+    numDistinctCtr = numcounters;
+
+    return (MIXFOK);
+}
+
+
+/*
+ * The first parameter is the Distinct Counter ID and shall be defined in the interval
+ * (0,D-1), where D is the number of Distinct counters defined through
+ * define_distinct_ctr_num(). The second parameter is the precision, i.e. the number of
+ * bits of hashes selecting registers (between MINDISTINCTPREC and MAXDISTINCTPREC), the
+ * third one the counter name (up to 32 characters, otherwise it is truncated).
+ * Base and aggr registers, 2^precision bytes for each epoch (see DISTINCTBUF), are
+ * allocated zeroed in a single area, each array starting on a cache line.
+ * This function provides MIXFKO either in case of wrong parameters (e.g. outside
+ * allowed ranges), memory that cannot be allocated or counters already started,
+ * MIXFOK if everything is ok
+ */
+Error define_distinct_ctr(uint16_t ctrId, uint8_t precision, char *ctrName)
 {
-    /* Local variables */
-    LongString   DumpFile;
-    ShortString  TimeStamp;
-    int          i,j;
+    DistinctCtrInfo    *d;
+    size_t              len;
+    uint8_t            *mem;
+    int                 e;
 
-    /* Do not manage MUTEX. They are handled by calling function */
-    if (BaseCtrActive==false)   /* Base counters not running - return MIXFKO error */
+    if (BaseCtrActive == true)      /*if counters have already been started return error */
+        return (MIXFKO);
+
+    if ((ctrId >= numDistinctCtr) || (precision < MINDISTINCTPREC) || (precision > MAXDISTINCTPREC))
+        return (MIXFKO);
+
+    /* Release a previous definition of the same counter, if any */
+    d = &distinctCtr[ctrId];
+    free(d->Mem);
+    memset(d, 0, sizeof(DistinctCtrInfo));
+
+    /* A counter with an empty name is not considered as defined (as other counters) */
+    strncpy(d->Name, ctrName, SHORTSTRINGMAXLEN);
+    d->Name[SHORTSTRINGMAXLEN] = '\0';
+    if (d->Name[0] == '\0')
+        return (MIXFOK);
+
+    len = ((size_t)1 << precision);
+    len = (len + CACHELINESIZE - 1) & ~(size_t)(CACHELINESIZE - 1);
+    if (posix_memalign((void **)&mem, CACHELINESIZE, 4 * len) != 0)
+        return (MIXFKO);
+    memset(mem, 0, 4 * len);
+    d->Mem = mem;
+    for (e = 0; e < 4; e++)
+        d->Reg[e] = mem + e * len;
+    d->Precision = precision;
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This function is used to define the number of threshold alarms (up to 4096), i.e.
+ * watermarks on Scalar Counters or Vector Counter instances (see define_ctr_alarm()).
+ * Alarms have their own IDs, independent of counters ones; their array is allocated
+ * here, zeroed (i.e. not defined).
+ * The function returns MIXFOK in case of success, MIXFKO in any other case
+ * In case of success, internal alarm structures are reset
+ * and any previous alarm definition is lost
+ * Please observe that this function cannot be called after start_counters()
+ */
+Error define_ctr_alarm_num(uint16_t numalarms)
+{
+    if (BaseCtrActive == true)      /*if counters have already been started return error */
+        return (MIXFKO);
+
+    if (numalarms > MAXCTRALARMNUM)
+        return (MIXFKO);
+
+    ReleaseCtrAlarms();
+    if (numalarms > 0)
+    {
+        ctrAlarm = (CtrAlarmInfo *)calloc(numalarms, sizeof(CtrAlarmInfo));
+        AlarmFired = (uint16_t *)calloc(numalarms, sizeof(uint16_t));
+        if ((ctrAlarm == NULL) || (AlarmFired == NULL))
+        {
+            ReleaseCtrAlarms();
+            return (MIXFKO);
+        }
+    }
+    numCtrAlarm = numalarms;
+
+    return (MIXFOK);
+}
+
+
+/*
+ * The first parameter is the alarm ID and shall be defined in the interval (0,A-1),
+ * where A is the number of alarms defined through define_ctr_alarm_num(). The second,
+ * third and fourth parameters are class (CTRSCALAR or CTRVECTOR), ID and instance
+ * (only for Vector Counters) of the counter, which shall be already defined (a Peg
+ * Counter if CTRALARMRATE is set in the type, fifth parameter). The sixth and seventh
+ * parameters are the high and low watermarks (low not higher than high), the eighth and
+ * ninth ones the events registered when the alarm is raised and cleared (UNDEFINED for
+ * none), the last one the alarm name (up to 32 characters, otherwise it is truncated).
+ * Cells of the counter are looked up when counters are started (see StartCtrAlarms()).
+ * This function provides MIXFKO either in case of wrong parameters (e.g. outside
+ * allowed ranges) or counters already started, MIXFOK if everything is ok
+ */
+Error define_ctr_alarm(uint16_t alarmId, uint8_t ctrClass, uint16_t ctrId, uint16_t ctrInst, uint8_t alarmType,
+                       uint64_t high, uint64_t low, EventCode raiseEvent, EventCode clearEvent, char *alarmName)
+{
+    CtrAlarmInfo   *a;
+    CounterType     type;
+
+    if (BaseCtrActive == true)      /*if counters have already been started return error */
+        return (MIXFKO);
+
+    if ((alarmId >= numCtrAlarm) || (alarmType & ~(CTRALARMLOW | CTRALARMRATE)) || (low > high))
+        return (MIXFKO);
+    if ( ((raiseEvent >= EVENTARRAYSIZE) && (raiseEvent != UNDEFINED)) ||
+         ((clearEvent >= EVENTARRAYSIZE) && (clearEvent != UNDEFINED)) )
+        return (MIXFKO);
+    if (ctrClass == CTRSCALAR)
+    {
+        if (ctrId >= numScalarCtr)
+            return (MIXFKO);
+        type = scalarType[ctrId];
+        ctrInst = 0;
+    }
+    else if ( (ctrClass != CTRVECTOR) || (ctrId >= numVectorCtr) || (ctrInst >= vectorHot[ctrId].NumInstances) )
+        return (MIXFKO);
+    else
+        type = vectorHot[ctrId].Type;
+    if ( (type == UNDEFCTR) || ((alarmType & CTRALARMRATE) && (CTRKIND(type) != PEGCTR)) )
+        return (MIXFKO);
+
+    a = &ctrAlarm[alarmId];
+    memset(a, 0, sizeof(CtrAlarmInfo));
+    a->Class = ctrClass;
+    a->CtrId = ctrId;
+    a->CtrInst = ctrInst;
+    a->Type = alarmType;
+    a->High = high;
+    a->Low = low;
+    a->RaiseEvent = raiseEvent;
+    a->ClearEvent = clearEvent;
+
+    /* An alarm with an empty name is not considered as defined (as counters) */
+    strncpy(a->Name, alarmName, SHORTSTRINGMAXLEN);
+    a->Name[SHORTSTRINGMAXLEN] = '\0';
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This function sets the function invoked at each transition of threshold alarms
+ * (see NotifyCtrAlarms()), NULL for none.
+ * The function returns MIXFOK in case of success, MIXFKO if counters have already
+ * been started
+ */
+Error define_ctr_alarm_callback(CtrAlarmCallback callback)
+{
+    if (BaseCtrActive == true)      /*if counters have already been started return error */
+        return (MIXFKO);
+
+    CtrAlarmHook = callback;
+
+    return (MIXFOK);
+}
+
+
+/*
+ * The first parameter is the Histogram Counter ID and shall be defined in the interval
+ * (0,H-1), where H is the number of Histogram counters defined through
+ * define_histo_ctr_num(). The second parameter is the number of significant bits of
+ * buckets (between MINHISTOBITS and MAXHISTOBITS): values below 2^bits have a bucket
+ * each, then each power of 2 up to 2^64 is split into 2^(bits-1) buckets, so that the
+ * relative error of percentiles is within 2^(1-bits) (see HistoBucket()). The third
+ * parameter is the counter name (up to 32 characters, otherwise it is truncated).
+ * Base and aggr values, two blocks each (one per epoch, see HISTOBUF), are allocated
+ * zeroed in a single area, each block starting on a cache line.
+ * This function provides MIXFKO either in case of wrong parameters (e.g. outside
+ * allowed ranges), memory that cannot be allocated or counters already started,
+ * MIXFOK if everything is ok
+ */
+Error define_histo_ctr(uint16_t ctrId, uint8_t bits, char *ctrName)
+{
+    HistoCtrInfo   *h;
+    size_t          stride;
+    int             i;
+
+    if (BaseCtrActive == true)      /*if counters have already been started return error */
+        return (MIXFKO);
+
+    if ( (ctrId >= numHistoCtr) || (bits < MINHISTOBITS) || (bits > MAXHISTOBITS) )
+        return (MIXFKO);
+
+    /* Release a previous definition of the same counter, if any */
+    h = &histoCtr[ctrId];
+    free(h->Mem);
+    h->Mem = NULL;
+    memset(h->Val, 0, sizeof(h->Val));
+    h->Bits = 0;
+
+    strncpy(h->Name, ctrName, SHORTSTRINGMAXLEN);
+    h->Name[SHORTSTRINGMAXLEN] = '\0';
+    /* A counter with an empty name is not considered as defined (as other counters) */
+    if (h->Name[0] == '\0')
+        return (MIXFOK);
+
+    h->NumBuckets = HISTOBUCKETS(bits);
+    stride = CTRSTRIDE(HISTOHDR + h->NumBuckets);
+    if ((h->Mem = (uint64_t *)calloc(4 * stride + CACHELINESIZE / 8, sizeof(uint64_t))) == NULL)
+        return (MIXFKO);
+    h->Val[0] = (uint64_t *)(((uintptr_t)h->Mem + CACHELINESIZE - 1) & ~(uintptr_t)(CACHELINESIZE - 1));
+    for (i = 0; i < 4; i++)
+    {
+        h->Val[i] = h->Val[0] + i * stride;
+        h->Val[i][HISTOMIN] = UINT64_MAX;
+    }
+    h->Bits = bits;
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This function defines the percentiles (second parameter, as many as the first one,
+ * between 1 and MAXHISTOPCT) reported by dumps of all Histogram counters, each greater
+ * than 0 and not greater than 100. They are sorted in ascending order, and their columns
+ * are named after their values (e.g. p99.9).
+ * The function returns MIXFOK in case of success, MIXFKO in case of wrong parameters
+ * or counters already started
+ */
+Error define_histo_percentiles(uint8_t numPct, double *pct)
+{
+    int     i;
+
+    if (BaseCtrActive == true)      /*if counters have already been started return error */
+        return (MIXFKO);
+
+    if ((numPct < 1) || (numPct > MAXHISTOPCT) || (pct == NULL))
+        return (MIXFKO);
+    for (i = 0; i < numPct; i++)
+        if (!(pct[i] > 0) || (pct[i] > 100))
+            return (MIXFKO);
+
+    SetHistoPercentiles(numPct, pct);
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This function increases a Peg Scalar Counter by one.
+ * The only parameter is the Scalar Counter ID and shall be defined
+ * in the interval (0,M-1), where M is the the maximum number of
+ * Scalar counters defined through define_scalar_ctr_num().
+ * It is equivalent to add_peg_scalar_ctr(ctrId, 1).
+ * Possible return values are:
+ *    - MIXFKO:   the counter ID does not exist, is outside
+ *                the allowed range, the specified counter
+ *                is a Roller Counter or counters have
+ *                not been started
+ *    - MIXFOVFL: the counter has wrapped around the maximum
+ *                value (i.e. 2^32 -1, or 2^64 -1 for 64 bit counters).
+ *                This applies both to base value and to aggregate value.
+ *                Note that the counter is increased anyway (i.e. the
+ *                new value is 0)
+ *    - MIXFOK:   the counter has been increased without errors
+ */
+Error incr_peg_scalar_ctr(uint16_t ctrId)
+{
+    return (AddPegScalarCtr(ctrId, 1));
+}
+
+
+/*
+ * This function increases a Peg Vector Counter by one.
+ * The first parameter is the Scalar Counter ID and shall be defined
+ * in the interval (0,N-1), where N is the the maximum number of
+ * Vector counters defined through define_vector_ctr_num().
+ * The second parameter is a pointer to a Instance ID. If NULL
+ * all the instances related to the concerned Vector counter
+ * are increased by 1, otherwise only the specified Instance Id
+ * is increased. It must be included in the interval (0,P-1)
+ * where P is the number of instances specified in
+ * define_vector_ctr().
+ * It is equivalent to add_peg_vector_ctr(ctrId, ctrInst, 1).
+ * Possible return values are:
+ *    - MIXFKO:   the counter ID does not exist, is outside
+ *                the allowed range, the specified counter
+ *                is a Roller Counter, the instance ID
+ *                is outside the allowed interval or counters
+ *                have not been started
+ *    - MIXFOVFL: the counter has wrapped around the maximum
+ *                value (i.e. 2^32 -1, or 2^64 -1 for 64 bit counters).
+ *                This applies both to base value and to aggregate value.
+ *                Note that the counter is increased anyway (i.e. the
+ *                new value is 0)
+ *    - MIXFOK:   the counter has been increased without errors
+ */
+Error incr_peg_vector_ctr(uint16_t ctrId, uint16_t* ctrInst)
+{
+    return (AddPegVectorCtr(ctrId, ctrInst, 1));
+}
+
+
+/*
+ * This function increases a Peg Scalar Counter by an arbitrary amount
+ * (e.g. the number of bytes or packets in a batch).
+ * The first parameter is the Scalar Counter ID and shall be defined
+ * in the interval (0,M-1), where M is the the maximum number of
+ * Scalar counters defined through define_scalar_ctr_num().
+ * The second parameter is the amount to be added (0 is a valid value).
+ * Possible return values are:
+ *    - MIXFKO:   the counter ID does not exist, is outside
+ *                the allowed range, the specified counter
+ *                is a Roller Counter or counters have
+ *                not been started
+ *    - MIXFOVFL: the counter has wrapped around the maximum
+ *                value (i.e. 2^32 -1, or 2^64 -1 for 64 bit counters).
+ *                This applies both to base value and to aggregate value.
+ *                Note that the counter is increased anyway (modulo
+ *                2^32 or 2^64)
+ *    - MIXFOK:   the counter has been increased without errors
+ */
+Error add_peg_scalar_ctr(uint16_t ctrId, uint64_t n)
+{
+    return (AddPegScalarCtr(ctrId, n));
+}
+
+
+/*
+ * This function increases a Peg Vector Counter by an arbitrary amount
+ * (e.g. the number of bytes or packets in a batch).
+ * The first parameter is the Scalar Counter ID and shall be defined
+ * in the interval (0,N-1), where N is the the maximum number of
+ * Vector counters defined through define_vector_ctr_num().
+ * The second parameter is a pointer to a Instance ID. If NULL
+ * all the instances related to the concerned Vector counter
+ * are increased, otherwise only the specified Instance Id
+ * is increased. It must be included in the interval (0,P-1)
+ * where P is the number of instances specified in
+ * define_vector_ctr().
+ * The third parameter is the amount to be added (0 is a valid value).
+ * Possible return values are:
+ *    - MIXFKO:   the counter ID does not exist, is outside
+ *                the allowed range, the specified counter
+ *                is a Roller Counter, the instance ID
+ *                is outside the allowed interval or counters
+ *                have not been started
+ *    - MIXFOVFL: the counter has wrapped around the maximum
+ *                value (i.e. 2^32 -1, or 2^64 -1 for 64 bit counters).
+ *                This applies both to base value and to aggregate value.
+ *                Note that the counter is increased anyway (modulo
+ *                2^32 or 2^64)
+ *    - MIXFOK:   the counter has been increased without errors
+ */
+Error add_peg_vector_ctr(uint16_t ctrId, uint16_t* ctrInst, uint64_t n)
+{
+    return (AddPegVectorCtr(ctrId, ctrInst, n));
+}
+
+
+/*
+ * This function provides back the current value of the Peg Scalar
+ * Counter defined by the first parameter (i.e. the Scalar Counter
+ * ID), which shall be defined in the interval (0,M-1),being M the
+ * maximum number of Scalar counters defined through
+ * define_scalar_ctr_num(). The second and third parameters are
+ * pointers to unsigned 32 bit integers, which are set respectively
+ * set to the current base and aggregated values of the counter
+ * Possible return values are:
+ *    - MIXFKO:   the counter ID does not exist, is outside
+ *                the allowed range, the specified counter
+ *                is a Roller Counter or counters have not been started
+ *    - MIXFOVFL: the counter is a 64 bit counter and its value does not
+ *                fit 32 bits; the value provided back is capped to 2^32 -1
+ *                (use retrieve_peg_scalar_ctr64() for 64 bit counters)
+ *    - MIXFOK:   the counter has been extracted without errors.
+ *                second and third parameter contain respectively
+ *                the current base and aggregated values
+ */
+Error retrieve_peg_scalar_ctr(uint16_t ctrId, uint32_t* ctrBase, uint32_t* ctrAggr)
+{
+    uint64_t    base, aggr;
+    Error       res;
+
+    if ((res = retrieve_peg_scalar_ctr64(ctrId, &base, &aggr)) != MIXFOK)
+        return (res);
+
+    if ((base > MAXCTRVALUE) || (aggr > MAXCTRVALUE))
+        res = MIXFOVFL;
+    *ctrBase = (base > MAXCTRVALUE) ? MAXCTRVALUE : (uint32_t)base;
+    *ctrAggr = (aggr > MAXCTRVALUE) ? MAXCTRVALUE : (uint32_t)aggr;
+
+    return (res);
+}
+
+
+/*
+ * This function provides back the current value of an instance of
+ * the Peg Vector Counter defined by the first parameter (i.e. the
+ * Vector Counter ID) and the second parameter (i.e. the Instance ID).
+ * The first parameter shall be defined in the interval (0,N-1),
+ * being N the maximum number of Vector counters defined through
+ * define_vector_ctr_num(), while the second parameter shall be
+ * defined within (0,P-1) where P is the number of instances
+ * specified in define_vector_ctr().
+ * The third and fourth parameters are pointers to unsigned 32 bit
+ * integers, which are set respectively set to the current base and
+ * aggregated values of the concerned counter/instance.
+ * Possible return values are:
+ *    - MIXFKO:   the counter ID does not exist, is outside
+ *                the allowed range, the specified counter
+ *                is a Roller Counter, the instance ID
+ *                is outside the allowed interval
+ *                or counters have not been started
+ *    - MIXFOVFL: the counter is a 64 bit counter and its value does not
+ *                fit 32 bits; the value provided back is capped to 2^32 -1
+ *                (use retrieve_peg_vector_ctr64() for 64 bit counters)
+ *    - MIXFOK:   the counter has been extracted without errors.
+ *                third and fourth parameter contain respectively
+ *                the current base and aggregated values
+ */
+Error retrieve_peg_vector_ctr(uint16_t ctrId, uint16_t ctrInst, uint32_t* ctrBase, uint32_t* ctrAggr)
+{
+    uint64_t    base, aggr;
+    Error       res;
+
+    if ((res = retrieve_peg_vector_ctr64(ctrId, ctrInst, &base, &aggr)) != MIXFOK)
+        return (res);
+
+    if ((base > MAXCTRVALUE) || (aggr > MAXCTRVALUE))
+        res = MIXFOVFL;
+    *ctrBase = (base > MAXCTRVALUE) ? MAXCTRVALUE : (uint32_t)base;
+    *ctrAggr = (aggr > MAXCTRVALUE) ? MAXCTRVALUE : (uint32_t)aggr;
+
+    return (res);
+}
+
+
+/*
+ * This function is the same as retrieve_peg_scalar_ctr(), but the second
+ * and third parameters are pointers to unsigned 64 bit integers. It can be
+ * used with both 32 bit and 64 bit Peg Scalar Counters.
+ * Possible return values are:
+ *    - MIXFKO:   the counter ID does not exist, is outside
+ *                the allowed range, the specified counter
+ *                is a Roller Counter or counters have not been started
+ *    - MIXFOK:   the counter has been extracted without errors.
+ *                second and third parameter contain respectively
+ *                the current base and aggregated values
+ */
+Error retrieve_peg_scalar_ctr64(uint16_t ctrId, uint64_t* ctrBase, uint64_t* ctrAggr)
+{
+    if (BaseCtrActive == false)     /* if counters have not been started return error */
         return (MIXFKO);
 
-    /* Evaluates and keeps the date of counters reopening in ddmmyyyy format */
-    /* This is stored for Rotation */
-    retrieve_time_date(BaseDumpOpenDate,"%d%m%Y");
-
-    /* Close the existing base counters files */
-    fclose (BaseCtr_fd);
-    BaseCtr_fd = NULL;
-    for (i = 0; i<numVectorCtr; i++)
-    {
-        fclose (vectorCtr[i].BaseCtr_fd);
-        vectorCtr[i].BaseCtr_fd = NULL;
-    }
+    if ((ctrId >= numScalarCtr) || (CTRKIND(scalarType[ctrId]) != PEGCTR))
+        return (MIXFKO);
 
-    /* Evaluate Time Stamp */
-    retrieve_time_date(TimeStamp, BaseCtrTimeStampFormat);
 
-    /* Open first scalar counters file... */
-    sprintf(DumpFile, "%sscalar_%s.csv", BaseCtrDir, TimeStamp);
-    if ( (BaseCtr_fd=fopen(DumpFile,"a")) == NULL)
-        return (MIXFNOACCESS);
-    fprintf(BaseCtr_fd, "Date,Time,");
-    for (j = 0; j < (numScalarCtr - 1); j++)
-        fprintf(BaseCtr_fd, "%s,", scalarCtr[j].Name);
-    fprintf(BaseCtr_fd, "%s\n", scalarCtr[numScalarCtr - 1].Name);
+    if (CtrUpdateMode == CTRSHARDEDMODE)
+        FoldShards(ctrId, ctrId + 1);
 
-    /* ... then open again vector counters files */
-    for (i = 0; i<numVectorCtr; i++)
-    {
-        sprintf(DumpFile, "%svector_%d_%s.csv", BaseCtrDir, i, TimeStamp);
-        if ((vectorCtr[i].BaseCtr_fd = fopen(DumpFile, "a")) == NULL)
-            return (MIXFNOACCESS);
-        fprintf(vectorCtr[i].BaseCtr_fd, "Vector Counter: %s - Instances: %s\nDate,Time,", vectorCtr[i].Name, vectorCtr[i].InstName);
-        for (j = 0; j < (vectorCtr[i].NumInstances - 1); j++)
-            fprintf(vectorCtr[i].BaseCtr_fd, "%s,", vectorCtr[i].InstIdName[j]);
-        fprintf(vectorCtr[i].BaseCtr_fd, "%s\n", vectorCtr[i].InstIdName[j]);
-    }
+    *ctrBase = __atomic_load_n(&scalarBaseVal[__atomic_load_n(&BaseEpoch, __ATOMIC_RELAXED)][ctrId], __ATOMIC_RELAXED) & CTRLIMIT(scalarType[ctrId]);
+    *ctrAggr = __atomic_load_n(&scalarAggrVal[__atomic_load_n(&AggrEpoch, __ATOMIC_RELAXED)][ctrId], __ATOMIC_RELAXED) & CTRLIMIT(scalarType[ctrId]);
 
     return (MIXFOK);
 }
 
 
 /*
- * This in an internal function that closes and reopens all existing aggr counters file
- * without handling locks. It cannot be invoked from outside the library, it is part of the
- * implementation of the check_and_dump_ctr() function, which invokes it when it needs
- * to rotate counters file at 00:00.
- * BE AWARE that it doesn't set/clear locks, which are managed within the calling
- * function.
- * This function provides MIXFOK in case of SUCCESS, MIXFKO if aggr counters are not open,
- * MIXFNOACCESS if the filenames cannot be reopened.
+ * This function is the same as retrieve_peg_vector_ctr(), but the third
+ * and fourth parameters are pointers to unsigned 64 bit integers. It can be
+ * used with both 32 bit and 64 bit Peg Vector Counters.
+ * Possible return values are:
+ *    - MIXFKO:   the counter ID does not exist, is outside
+ *                the allowed range, the specified counter
+ *                is a Roller Counter, the instance ID
+ *                is outside the allowed interval
+ *                or counters have not been started
+ *    - MIXFOK:   the counter has been extracted without errors.
+ *                third and fourth parameter contain respectively
+ *                the current base and aggregated values
  */
-static Error CloseReopenAggrCounters(void)
+Error retrieve_peg_vector_ctr64(uint16_t ctrId, uint16_t ctrInst, uint64_t* ctrBase, uint64_t* ctrAggr)
 {
-    /* Local variables */
-    LongString  DumpFile;
-    ShortString TimeStamp;
-    int         i,j;
-
-    /* Do not manage MUTEX. They are handled by calling function */
-    if (AggrCtrActive==false)   /* Aggr counters not running - return MIXFKO error */
+    if (BaseCtrActive == false)     /* if counters have not been started return error */
         return (MIXFKO);
 
-    /* Evaluates and keeps the date of counters reopening in ddmmyyyy format */
-    /* This is stored for Rotation */
-    retrieve_time_date(AggrDumpOpenDate,"%d%m%Y");
+    if ((ctrId >= numVectorCtr) || (CTRKIND(vectorHot[ctrId].Type) != PEGCTR))
+        return (MIXFKO);
 
-    /* Close the existing base counters files */
-    fclose (AggrCtr_fd);
-    AggrCtr_fd = NULL;
-    for (i = 0; i<numVectorCtr; i++)
-    {
-        fclose (vectorCtr[i].AggrCtr_fd);
-        vectorCtr[i].AggrCtr_fd = NULL;
-    }
 
-    /* Evaluate Time Stamp */
-    retrieve_time_date(TimeStamp, AggrCtrTimeStampFormat);
+    if (ctrInst >= vectorHot[ctrId].NumInstances)
+        return (MIXFKO);
 
-    /* Open first scalar counters file... */
-    sprintf(DumpFile, "%sscalar_aggr_%s.csv", AggrCtrDir, TimeStamp);
-    if ( (AggrCtr_fd=fopen(DumpFile,"a")) == NULL)
-        return (MIXFNOACCESS);
-    fprintf(AggrCtr_fd, "Date,Time,");
-    for (j = 0; j < (numScalarCtr - 1); j++)
-        fprintf(AggrCtr_fd, "%s,", scalarCtr[j].Name);
-    fprintf(AggrCtr_fd, "%s\n", scalarCtr[numScalarCtr - 1].Name);
+    if (CtrUpdateMode == CTRSHARDEDMODE)
+        FoldShards(VectorShardOffset[ctrId] + ctrInst, VectorShardOffset[ctrId] + ctrInst + 1);
 
-    /* ... then open again vector counters files */
-    for (i = 0; i<numVectorCtr; i++)
-    {
-        sprintf(DumpFile, "%svector_%d_aggr_%s.csv", AggrCtrDir, i, TimeStamp);
-        if ((vectorCtr[i].AggrCtr_fd = fopen(DumpFile, "a")) == NULL)
-            return (MIXFNOACCESS);
-        fprintf(vectorCtr[i].AggrCtr_fd, "Vector Counter: %s - Instances: %s\nDate,Time,", vectorCtr[i].Name, vectorCtr[i].InstName);
-        for (j = 0; j < (vectorCtr[i].NumInstances - 1); j++)
-            fprintf(vectorCtr[i].AggrCtr_fd, "%s,", vectorCtr[i].InstIdName[j]);
-        fprintf(vectorCtr[i].AggrCtr_fd, "%s\n", vectorCtr[i].InstIdName[j]);
-    }
+    *ctrBase = __atomic_load_n(&vectorHot[ctrId].BaseVal[__atomic_load_n(&BaseEpoch, __ATOMIC_RELAXED)][ctrInst], __ATOMIC_RELAXED) & CTRLIMIT(vectorHot[ctrId].Type);
+    *ctrAggr = __atomic_load_n(&vectorHot[ctrId].AggrVal[__atomic_load_n(&AggrEpoch, __ATOMIC_RELAXED)][ctrInst], __ATOMIC_RELAXED) & CTRLIMIT(vectorHot[ctrId].Type);
 
     return (MIXFOK);
 }
 
 
-/***********************************
- *                                 *
- *        Visible Functions        *
- * (can be used outside this file  *
- *  and are part of the library)   *
- *                                 *
- ***********************************/
-/* ---------------------------
- * Counters Handling (v.2.0.0)
- * --------------------------- */
 /*
- * Define the maximum number of Scalar counters, between 0 and 1024.
- * Scalar counters are global counters, i.e. they refer to the whole
- * piece of code and are not related to a specific object/instance.
- * The function returns MIXFOK in case of success, MIXFKO in any other case
- * In case of success, internal counter structures are reset
- * and any previous counter definition is lost
- * Please observe that this function cannot be called after start_counters()
+ * This function retrieves the current base and aggregated values of a key (second
+ * parameter) of a Sparse Counter (first parameter). A key that has never been updated
+ * (or that has been counted in the overflow cell) has null values; it is not added.
+ * Possible return values are:
+ *    - MIXFKO:   the counter ID does not exist, is outside
+ *                the allowed range or counters have not been started
+ *    - MIXFOK:   the values have been retrieved without errors
  */
-Error define_scalar_ctr_num(uint16_t numcounters)
+Error retrieve_peg_sparse_ctr64(uint16_t ctrId, uint64_t key, uint64_t* ctrBase, uint64_t* ctrAggr)
 {
-    int i;
+    uint64_t   *val;
 
-    if (BaseCtrActive == true)      /*if counters have already been started return error */
+    if (BaseCtrActive == false)     /* if counters have not been started return error */
         return (MIXFKO);
 
-    if (numcounters > MAXSCALARCTRNUM)
+    if ((ctrId >= numSparseCtr) || (sparseCtr[ctrId].Type == UNDEFCTR))
         return (MIXFKO);
 
-    numScalarCtr = numcounters;
-
-    /* Reset internal counter structures */
-    for (i = 0; i < MAXSCALARCTRNUM; i++)
-    {
-        scalarCtr[i].Name[0] = '\0';
-        scalarCtr[i].Type = 0;
-        scalarCtr[i].BaseVal = 0;
-        scalarCtr[i].AggrVal = 0;
-    }
-    if (BaseCtr_fd != NULL)
+    *ctrBase = *ctrAggr = 0;
+    if ((val = FindSparseCell(&sparseCtr[ctrId], key, false)) != NULL)
     {
-        fclose(BaseCtr_fd);
-        BaseCtr_fd = NULL;
-    }
-    if (AggrCtr_fd != NULL)
-    {
-        fclose(AggrCtr_fd);
-        AggrCtr_fd = NULL;
+        *ctrBase = __atomic_load_n(&val[SPARSEVAL(false, __atomic_load_n(&BaseEpoch, __ATOMIC_RELAXED))], __ATOMIC_RELAXED) & CTRLIMIT(sparseCtr[ctrId].Type);
+        *ctrAggr = __atomic_load_n(&val[SPARSEVAL(true, __atomic_load_n(&AggrEpoch, __ATOMIC_RELAXED))], __ATOMIC_RELAXED) & CTRLIMIT(sparseCtr[ctrId].Type);
     }
 
     return (MIXFOK);
@@ -285,612 +6701,857 @@ Error define_scalar_ctr_num(uint16_t numcounters)
 
 
 /*
- * Define the maximum number of Vector counters, between 0 and 1024.
- * Vector counters are collected for a set of objects/instances of the
- * same type. For example the number of bytes sent over a specific TCP
- * connection shall be considered a Vector counter (the counter is one,
- * i.e. the number of bytes sent, but given N the number of TCP
- * connections, it comes in N instances). Be aware that the library
- * can collect up to 65536 total instances of Vector counters.
- * Here follows some examples of allowed combinations:
- *   - 2 Vector counters (each with up to 32768 instances)
- *   - 3 Vector counters (e.g. the first with up to 32768 instances,
- *       the others up to 16536 instances)
- *   - 1024 Vector counters of 64 instances each
- * or any other combination, given that the total amount of collected
- * counter instances does not exceed 65536.
- * The function returns MIXFOK in case of success, MIXFKO in any other case
- * In case of success, internal counter structures are reset
- * and any previous counter definition is lost
- * Please observe that this function cannot be called after start_counters()
+ * This function gives back the number of keys of a Sparse Counter (first parameter),
+ * and the current base and aggregated values of its overflow cell, i.e. updates of
+ * keys that could not be added since the maximum number of keys had been reached.
+ * Possible return values are:
+ *    - MIXFKO:   the counter ID does not exist, is outside
+ *                the allowed range or counters have not been started
+ *    - MIXFOK:   the values have been retrieved without errors
  */
-Error define_vector_ctr_num(uint16_t numcounters)
+Error query_sparse_ctr(uint16_t ctrId, uint32_t* numKeys, uint64_t* ovflBase, uint64_t* ovflAggr)
 {
-    int     i;
+    SparseCtrInfo  *sp;
+    uint64_t       *val;
 
-    if (BaseCtrActive == true)      /*if counters have already been started return error */
+    if (BaseCtrActive == false)     /* if counters have not been started return error */
         return (MIXFKO);
 
-    if (numcounters > MAXVECTORCTRNUM)
+    if ((ctrId >= numSparseCtr) || (sparseCtr[ctrId].Type == UNDEFCTR))
         return (MIXFKO);
 
-    numVectorCtr = numcounters;
-    cumVectorInst = 0;
+    sp = &sparseCtr[ctrId];
+    val = &sp->Values[(size_t)(sp->Mask + 2) * SPARSEVALUES];
+    *numKeys = __atomic_load_n(&sp->NumKeys, __ATOMIC_RELAXED);
+    *ovflBase = __atomic_load_n(&val[SPARSEVAL(false, __atomic_load_n(&BaseEpoch, __ATOMIC_RELAXED))], __ATOMIC_RELAXED) & CTRLIMIT(sp->Type);
+    *ovflAggr = __atomic_load_n(&val[SPARSEVAL(true, __atomic_load_n(&AggrEpoch, __ATOMIC_RELAXED))], __ATOMIC_RELAXED) & CTRLIMIT(sp->Type);
 
-    /* Reset internal counter structures */
-    for (i = 0; i < MAXVECTORCTRNUM; i++)
-    {
-        vectorCtr[i].Name[0] = '\0';
-        vectorCtr[i].InstName[0] = '\0';
-        vectorCtr[i].Type = 0;
-        vectorCtr[i].NumInstances = 0;
-        if (vectorCtr[i].BaseVal)
-            free(vectorCtr[i].BaseVal);
-        vectorCtr[i].BaseVal = NULL;
-        if (vectorCtr[i].AggrVal)
-            free(vectorCtr[i].AggrVal);
-        vectorCtr[i].AggrVal = NULL;
-        if (vectorCtr[i].InstIdName)
-            free(vectorCtr[i].InstIdName);
-        vectorCtr[i].InstIdName = NULL;
-        if (vectorCtr[i].BaseCtr_fd != NULL)
-        {
-            fclose(vectorCtr[i].BaseCtr_fd);
-            vectorCtr[i].BaseCtr_fd = NULL;
-        }
-        if (vectorCtr[i].AggrCtr_fd != NULL)
-        {
-            fclose(vectorCtr[i].AggrCtr_fd);
-            vectorCtr[i].AggrCtr_fd = NULL;
-        }
-    }
     return (MIXFOK);
 }
 
 
-/* The first parameter is the Scalar Counter ID and shall be defined
- * in the interval (0,M-1), where M is the the maximum number of
- * Scalar counters defined through define_scalar_ctr_num(). The second
- * parameter specifies the counter type (PEGCTR or ROLLERCTR).
- * PEG Counters are counters that are characterized by the following
- * properties: they have initial value set to 0, they can only increase
- * and they are reset every time that counters are dumped to file
- * (i.e. at each base interval). ROLLER Counters are slightly different:
- * they can have a non null initial value, they can increase and decrease
- * (but never become negative) and when they are dumped to file,
- * they are not reset. The third parameter represents the initial value
- * for the counter and is valid only for ROLLER Counters (it is meaningless
- * in case that counter type is PEGCTR).
- * The fourth parameter is a string that provides the counter name (up to 32
- * characters, otherwise it is truncated).
- * This function provides MIXFKO either in case of wrong parameters (e.g. outside allowed
- * ranges) or in case of counters already started, MIXFOK if everything is ok */
-Error define_scalar_ctr(uint16_t ctrId, uint8_t ctrType, uint32_t ctrInitial, char* ctrName)
+/*
+ * This function retrieves a percentile (second parameter) of the values recorded in a
+ * Histogram Counter (first parameter) since the last base and aggregated dumps, i.e. the
+ * highest value of its bucket, within the minimum and maximum recorded values (0 if no
+ * value has been recorded). Since base intervals are folded into aggr values only when
+ * dumped, the aggr percentile is evaluated on aggr and live base buckets merged on the
+ * fly. In CTRSHARDEDMODE the thread shards of the counter are folded first. Live
+ * buckets are scanned while they may be updated, hence the result is approximate if
+ * values are recorded in the meantime.
+ * Possible return values are:
+ *    - MIXFKO:   the counter ID does not exist, is outside the allowed range,
+ *                the percentile is not valid or counters have not been started
+ *    - MIXFOK:   the values have been retrieved without errors
+ */
+Error retrieve_histo_ctr(uint16_t ctrId, double pct, uint64_t* ctrBase, uint64_t* ctrAggr)
 {
-    if (BaseCtrActive == true)      /*if counters have already been started return error */
-        return (MIXFKO);
+    HistoCtrInfo   *h;
+    uint64_t        stats[5],
+                   *base;
 
-    if (ctrId >= numScalarCtr)
+    if (BaseCtrActive == false)     /* if counters have not been started return error */
         return (MIXFKO);
 
-    if ((ctrType != PEGCTR) && (ctrType != ROLLERCTR))
+    if ((ctrId >= numHistoCtr) || (histoCtr[ctrId].Bits == 0) || !(pct > 0) || (pct > 100))
         return (MIXFKO);
 
-    if (strlen(ctrName) > SHORTSTRINGMAXLEN)
-    {   /* The name is too long, truncate it to 32 characters */
-        strncpy(scalarCtr[ctrId].Name, ctrName, SHORTSTRINGMAXLEN);
-        scalarCtr[ctrId].Name[SHORTSTRINGMAXLEN] = '\0';
-    }
-    else
-        strcpy(scalarCtr[ctrId].Name, ctrName);
-    scalarCtr[ctrId].Type = ctrType;
-    if (ctrType == PEGCTR)
-    {   /* PEG Counter - Initial value always NULL */
-        scalarCtr[ctrId].BaseVal = 0;
-        scalarCtr[ctrId].AggrVal = 0;
-    }
-    else
-    {   /* ROLLER Counter - Initial value set by caller */
-        scalarCtr[ctrId].BaseVal = ctrInitial;
-        scalarCtr[ctrId].AggrVal = ctrInitial;
-    }
+    if (CtrUpdateMode == CTRSHARDEDMODE)
+        FoldShards(HistoShardOffset[ctrId], HistoShardOffset[ctrId] + 1);
+
+    h = &histoCtr[ctrId];
+    base = h->Val[HISTOBUF(false, __atomic_load_n(&BaseEpoch, __ATOMIC_RELAXED))];
+    EvalHistoStats(h, base, NULL, NULL, 1, &pct, stats);
+    *ctrBase = stats[4];
+    EvalHistoStats(h, h->Val[HISTOBUF(true, __atomic_load_n(&AggrEpoch, __ATOMIC_RELAXED))], base, NULL, 1, &pct, stats);
+    *ctrAggr = stats[4];
 
     return (MIXFOK);
 }
 
 
-/* The first parameter is the Vector Counter ID and shall be defined
- * in the interval (0,N-1), where N is the the maximum number of
- * Vector counters defined through define_vector_ctr_num(). The second
- * parameter is the maximum number of instances allowed for the
- * Vector Counter ID specified by parameter 1. It shall be at least 1.
- * The maximum value is limited by the fact that the maximum
- * number of instances cannot exceed 65536. The third
- * parameter specifies the counter type(PEGCTR or ROLLERCTR).
- * PEG Counters are counters that are characterized by the following
- * properties: they have initial value set to 0, they can only increase
- * and they are reset every time that counters are dumped to file
- * (i.e.at each base interval).ROLLER Counters are slightly different :
- * they can have a non null initial value, they can increaseand decrease
- * (but never become negative) and when they are dumped to file,
- * they are not reset.The fourth parameter represents the initial value
- * for the counter and is valid only for ROLLER Counters(it is meaningless
- * in case that counter type is PEGCTR).This value is assigned to all
- * intances of the counter.
- * The fifth parameter is a string that provides the counter name (up to 32
- * characters, otherwise it is truncated).The sixth parameter is another
- * string(up to 32 characters length, otherwise it is truncated) that
- * provides the name of the object associated to instances.
- * Example: referring to the number of bytes sent for different TCP
- * connections, assuming that this is a ROLLER Counter whose ID is 12
- * andthat the maximum number of TCP Connections is 512, the call
- * might be :
- *      define_vector_ctr(12, 512, ROLLERCTR, 0, "Total Bytes Sent", "TCP Conn. ID")
- * In this case the initial value for the counter has been set to 0 (for
- * all the 512 TCP connections)
- * This function provides MIXFKO either in case of wrong parameters(e.g.outside allowed
- * ranges) or in case of counters already started, MIXFOVFL if the number of cumulative
- * instances of Vector Counters up to function call exceeds 65536, MIXFOK if everything is ok
+/*
+ * This function retrieves the rates of a counter evaluated at the last tick (see
+ * TickRates()): EWMAs and averages over sliding windows of 1, 5 and 15 minutes. It
+ * takes constant time and never locks (see ReadRate()).
+ * Possible return values are:
+ *    - MIXFKO:   the rate ID does not exist, is outside the allowed range
+ *                or counters have not been started
+ *    - MIXFOK:   the rates have been retrieved without errors
  */
-Error define_vector_ctr(uint16_t ctrId, uint16_t ctrInst, uint8_t ctrType, uint32_t ctrInitial, char* ctrName, char* instName)
+Error retrieve_ctr_rate(uint16_t rateId, CtrRate* rate)
 {
-    uint32_t    cum;
-    int         i;
+    double      v[RATEVALUES];
 
-    if (BaseCtrActive == true)      /*if counters have already been started return error */
+    if (BaseCtrActive == false)     /* if counters have not been started return error */
         return (MIXFKO);
 
-    if ( (ctrId >= numVectorCtr) || (ctrInst < 1) )
+    if ((rateId >= numRateCtr) || (rateCtr[rateId].Name[0] == '\0'))
         return (MIXFKO);
 
-    /* Check that the cumulative number of instances of Vector Counters up to */
-    /* function call does not exceed 65536 (done before to avoid counter wrap) */
-    if (cumVectorInst > MAXVECTORCTRINST - ctrInst)
-        return (MIXFOVFL);
+    ReadRate(&rateCtr[rateId], v);
+    memcpy(rate->ewma, v, sizeof(rate->ewma));
+    memcpy(rate->window, v + CTRRATEHORIZONS, sizeof(rate->window));
 
-    cum = cumVectorInst + ctrInst;
+    return (MIXFOK);
+}
+
+
+/*
+ * This function retrieves the values dumped in the last intervals (up to the fifth
+ * parameter, most recent first) of a Scalar or Vector Counter (class, ID and instance,
+ * ignored for Scalar Counters), either base or aggr ones (fourth parameter), from the
+ * history ring (see define_ctr_history()). The number of intervals actually retrieved
+ * is provided in the last parameter. Missed dump times are reported with the missed
+ * flag set and a 0 value.
+ * Possible return values are:
+ *    - MIXFKO:   the counter does not exist, is outside the allowed range, no history
+ *                is kept for the selected intervals or counters have not been started
+ *    - MIXFOK:   the intervals have been retrieved without errors
+ */
+Error query_ctr_history(uint8_t ctrClass, uint16_t ctrId, uint16_t ctrInst, bool aggr,
+                        uint16_t n, CtrInterval *out, uint16_t *numOut)
+{
+    CtrHistoryRing *h = &CtrHistory[aggr ? 1 : 0];
+    uint32_t        cell, row, k;
 
-    if ((ctrType != PEGCTR) && (ctrType != ROLLERCTR))
+    if (BaseCtrActive == false)     /* if counters have not been started return error */
         return (MIXFKO);
 
-    if (strlen(ctrName) > SHORTSTRINGMAXLEN)
-    {   /* The name is too long, truncate it to 32 characters */
-        strncpy(vectorCtr[ctrId].Name, ctrName, SHORTSTRINGMAXLEN);
-        vectorCtr[ctrId].Name[SHORTSTRINGMAXLEN] = '\0';
+    if (ctrClass == CTRSCALAR)
+    {
+        if ((ctrId >= numScalarCtr) || (scalarType[ctrId] == UNDEFCTR))
+            return (MIXFKO);
+        cell = ctrId;
     }
+    else if ( (ctrClass != CTRVECTOR) || (ctrId >= numVectorCtr) || (vectorHot[ctrId].Type == UNDEFCTR) ||
+              (ctrInst >= vectorHot[ctrId].NumInstances) )
+        return (MIXFKO);
     else
-        strcpy(vectorCtr[ctrId].Name, ctrName);
+        cell = VectorShardOffset[ctrId] + ctrInst;
 
-    if (strlen(instName) > SHORTSTRINGMAXLEN)
-    {   /* The name is too long, truncate it to 32 characters */
-        strncpy(vectorCtr[ctrId].InstName, instName, SHORTSTRINGMAXLEN);
-        vectorCtr[ctrId].InstName[SHORTSTRINGMAXLEN] = '\0';
+    if ((out == NULL) || (numOut == NULL))
+        return (MIXFKO);
+
+    pthread_mutex_lock(&HistoryMutex);
+    if (h->Depth == 0)
+    {
+        pthread_mutex_unlock(&HistoryMutex);
+        return (MIXFKO);
     }
-    else
-        strcpy(vectorCtr[ctrId].InstName, instName);
+    if (n > h->Count)
+        n = (uint16_t)h->Count;
+    row = h->Head;
+    for (k = 0; k < n; k++)
+    {   /* Rows are read backwards from the one before the head */
+        row = (row == 0) ? h->Depth : row - 1;
+        out[k].slot = h->Slot[row];
+        out[k].missed = h->Missed[row];
+        out[k].value = h->Missed[row] ? 0 : h->Values[(size_t)row * numShardCells + cell];
+    }
+    pthread_mutex_unlock(&HistoryMutex);
+    *numOut = n;
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This function retrieves the top keys of a Top-K Counter (first parameter) counted
+ * since the last aggr dump (second parameter set) or base dump (second parameter not
+ * set), sorted by decreasing count, in the array pointed to by the third parameter
+ * (room for K keys). The number of keys is provided in the last parameter. The live
+ * sketch is read under the counter mutex (unless in CTRPLAINMODE).
+ * Possible return values are:
+ *    - MIXFKO:   the counter ID does not exist, is outside the allowed
+ *                range or counters have not been started
+ *    - MIXFOK:   the keys have been retrieved without errors
+ */
+Error retrieve_topk_ctr(uint16_t ctrId, bool aggr, CtrTopKey *out, uint16_t *num)
+{
+    TopKCtrInfo    *tk;
+    TopKSketch     *sk;
+    uint32_t        sel[MAXTOPK];
+    uint32_t        i, s, n;
 
-    vectorCtr[ctrId].Type = ctrType;
-    vectorCtr[ctrId].NumInstances = ctrInst;
-    vectorCtr[ctrId].BaseVal = (uint32_t*)calloc((size_t)ctrInst, (size_t) sizeof(uint32_t));
-    if (vectorCtr[ctrId].BaseVal == NULL)
+    if (BaseCtrActive == false)     /* if counters have not been started return error */
         return (MIXFKO);
-    vectorCtr[ctrId].AggrVal = (uint32_t*)calloc((size_t)ctrInst, (size_t) sizeof(uint32_t));
-    if (vectorCtr[ctrId].AggrVal == NULL)
-    {
-        free(vectorCtr[ctrId].BaseVal);
-        vectorCtr[ctrId].BaseVal = NULL;
+
+    if ((ctrId >= numTopkCtr) || (topkCtr[ctrId].TopK == 0) || (out == NULL) || (num == NULL))
         return (MIXFKO);
-    }
-    vectorCtr[ctrId].InstIdName = (MicroString *)calloc((size_t)ctrInst, sizeof(MicroString));
-    if (vectorCtr[ctrId].InstIdName == NULL)
+
+    tk = &topkCtr[ctrId];
+    if (CtrUpdateMode != CTRPLAINMODE)
+        pthread_mutex_lock(&tk->Mutex);
+    sk = &tk->Sketch[TOPKBUF(aggr, __atomic_load_n(aggr ? &AggrEpoch : &BaseEpoch, __ATOMIC_RELAXED))];
+    n = SelectTopKSlots(sk, tk->TopK, sel);
+    for (i = 0; i < n; i++)
     {
-        free(vectorCtr[ctrId].BaseVal);
-        free(vectorCtr[ctrId].AggrVal);
-        vectorCtr[ctrId].BaseVal = NULL;
-        vectorCtr[ctrId].AggrVal = NULL;
-        return (MIXFKO);
+        s = sel[i];
+        out[i].key = sk->Keys[s];
+        out[i].count = sk->Counts[s];
+        out[i].error = sk->Errors[s];
+        out[i].str[0] = '\0';
+        if (tk->KeyType == CTRTOPKSTRKEY)
+            memcpy(out[i].str, &sk->Names[(size_t)s * (CTRTOPKKEYLEN + 1)], CTRTOPKKEYLEN + 1);
     }
+    if (CtrUpdateMode != CTRPLAINMODE)
+        pthread_mutex_unlock(&tk->Mutex);
+    *num = (uint16_t)n;
 
-    for (i = 0; i < ctrInst; i++)
+    return (MIXFOK);
+}
+
+
+/*
+ * This function retrieves the estimated number of distinct keys added to a Distinct
+ * Counter (first parameter) since the last base dump (second parameter) and since the
+ * last aggregated dump (third parameter). Since base intervals are merged into aggr
+ * registers only when dumped, the latter are merged on the fly with the live base
+ * registers (no register is written). In CTRSHARDEDMODE thread shards of the counter
+ * are folded first.
+ * Possible return values are:
+ *    - MIXFKO:   the counter ID does not exist, is outside the allowed range
+ *                or counters have not been started
+ *    - MIXFOK:   the estimates have been retrieved without errors
+ */
+Error retrieve_distinct_ctr(uint16_t ctrId, uint64_t* ctrBase, uint64_t* ctrAggr)
+{
+    DistinctCtrInfo    *d;
+    uint32_t            base[64 - MINDISTINCTPREC + 2] = { 0 },
+                        aggr[64 - MINDISTINCTPREC + 2] = { 0 };
+    uint32_t            j;
+    uint8_t            *b, *a, rb, ra;
+
+    if (BaseCtrActive == false)     /* if counters have not been started return error */
+        return (MIXFKO);
+
+    if ((ctrId >= numDistinctCtr) || (distinctCtr[ctrId].Precision == 0))
+        return (MIXFKO);
+
+    if (CtrUpdateMode == CTRSHARDEDMODE)
+        FoldShards(DistinctShardOffset[ctrId], DistinctShardOffset[ctrId] + 1);
+
+    d = &distinctCtr[ctrId];
+    b = d->Reg[DISTINCTBUF(false, __atomic_load_n(&BaseEpoch, __ATOMIC_RELAXED))];
+    a = d->Reg[DISTINCTBUF(true, __atomic_load_n(&AggrEpoch, __ATOMIC_RELAXED))];
+    for (j = 0; j < (1U << d->Precision); j++)
     {
-        vectorCtr[ctrId].InstIdName[i][0] = '\0';   /* Instance ID Name initially set to empty string */
-        if (ctrType == PEGCTR)  /* PEG Counter - Initial values always NULL for all instances */
-            vectorCtr[ctrId].BaseVal[i] = vectorCtr[ctrId].AggrVal[i] = 0;
-        else                    /* ROLLER Counter - Initial values set for all instances */
-            vectorCtr[ctrId].BaseVal[i] = vectorCtr[ctrId].AggrVal[i] = ctrInitial;
+        rb = __atomic_load_n(&b[j], __ATOMIC_RELAXED);
+        ra = __atomic_load_n(&a[j], __ATOMIC_RELAXED);
+        base[rb]++;
+        aggr[(ra > rb) ? ra : rb]++;
     }
-
-    /* Update cumulated number of instances */
-    cumVectorInst = cum;
+    *ctrBase = EstimateDistinct(base, d->Precision);
+    *ctrAggr = EstimateDistinct(aggr, d->Precision);
 
     return (MIXFOK);
 }
 
 
 /*
- * This function is used to associate a name to an instance of a Vector Counter
- * The first parameter specifies the Vector Counter ID, the second one represents
- * the Instance Id. They shall be defined within the limits specified through
- * define_vector_ctr_num() and define_vector_ctr(), otherwise MIXFKO is returned.
- * The third parameter is a string that specifies the name of the concerned
- * instance (e.g. if the counter is used to collect Total Bytes Sent for
- * several TCP connections, this name could be used to store the connection ID).
- * If NULL, the call has no effect (i.e. the name is not changed), otherwise it
- * is overwritten. Please observe that up to 16 chars are allowed, if more
- * the name is truncated.
- * Please observe that this function can be called even if counters have been
- * already started
+ * This function retrieves the state of a threshold alarm (first parameter) and its
+ * watched value (third parameter) at the last evaluation (see EvalCtrAlarms()). It
+ * takes constant time and never locks.
+ * Possible return values are:
+ *    - MIXFKO:   the alarm ID does not exist, is outside the allowed range
+ *                or counters have not been started
+ *    - MIXFOK:   the state has been retrieved without errors
  */
-Error set_vector_ctr_inst_name(uint16_t ctrId, uint16_t ctrInst, char *instIdName)
+Error query_ctr_alarm(uint16_t alarmId, bool* raised, uint64_t* value)
 {
-    if ((ctrId >= numVectorCtr) || (ctrInst >= vectorCtr[ctrId].NumInstances) )
+    if (BaseCtrActive == false)     /* if counters have not been started return error */
         return (MIXFKO);
 
-    if (instIdName == NULL) /* If instIdName is not specified */
-        return (MIXFOK);
+    if ((alarmId >= numCtrAlarm) || (ctrAlarm[alarmId].Name[0] == '\0'))
+        return (MIXFKO);
 
-    if (strlen(instIdName) >= MICROSTRINGMAXLEN)
-    {   /* The name is too long, truncate it to 16 characters */
-        strncpy(vectorCtr[ctrId].InstIdName[ctrInst], instIdName, MICROSTRINGMAXLEN);
-        vectorCtr[ctrId].InstIdName[ctrInst][MICROSTRINGMAXLEN] = '\0';
-    }
-    else
-        strcpy(vectorCtr[ctrId].InstIdName[ctrInst], instIdName);
+    *raised = __atomic_load_n(&ctrAlarm[alarmId].Raised, __ATOMIC_RELAXED);
+    *value = __atomic_load_n(&ctrAlarm[alarmId].Value, __ATOMIC_RELAXED);
 
     return (MIXFOK);
 }
 
 
 /*
- * This function increases a Peg Scalar Counter by one.
- * The only parameter is the Scalar Counter ID and shall be defined
- * in the interval (0,M-1), where M is the the maximum number of
- * Scalar counters defined through define_scalar_ctr_num().
+ * This function retrieves count, sum, min and max of the values observed in a Summary
+ * Counter (first parameter) since the last base dump (second parameter) and since the
+ * last aggregated dump (third parameter). Since base intervals are folded into aggr
+ * values only when dumped, the latter are merged with the live base values. In
+ * CTRSHARDEDMODE thread shards of the counter are folded first.
  * Possible return values are:
- *    - MIXFKO:   the counter ID does not exist, is outside
- *                the allowed range, the specified counter
- *                is a Roller Counter or counters have
- *                not been started
- *    - MIXFOVFL: the counter has wrapped around the maximum
- *                value (i.e. 2^32 -1). This applies both to base
- *                value and to aggregate value. Note that the counter
- *                is increased anyway (i.e. the new value is 0)
- *    - MIXFOK:   the counter has been increased without errors
+ *    - MIXFKO:   the counter ID does not exist, is outside the allowed range
+ *                or counters have not been started
+ *    - MIXFOK:   the values have been retrieved without errors
  */
-Error incr_peg_scalar_ctr(uint16_t ctrId)
+Error retrieve_summary_ctr(uint16_t ctrId, CtrSummary* ctrBase, CtrSummary* ctrAggr)
 {
-    Error   res = MIXFOK;
+    uint64_t   *base, *aggr;
 
     if (BaseCtrActive == false)     /* if counters have not been started return error */
         return (MIXFKO);
 
-    if ( (ctrId >= numScalarCtr) || (scalarCtr[ctrId].Type != PEGCTR) )
+    if ((ctrId >= numSummaryCtr) || (summaryCtr[ctrId].Name[0] == '\0'))
         return (MIXFKO);
 
-    if (scalarCtr[ctrId].Name[0] == '\0')   /* the counter has not been defined through define_scalar_ctr() */
-        return (MIXFKO);
+    if (CtrUpdateMode == CTRSHARDEDMODE)
+        FoldShards(numShardCells + (uint32_t)ctrId * SUMMARYCELLS, numShardCells + (uint32_t)(ctrId + 1) * SUMMARYCELLS);
+
+    base = summaryVal[SUMMARYBUF(false, __atomic_load_n(&BaseEpoch, __ATOMIC_RELAXED))][ctrId];
+    aggr = summaryVal[SUMMARYBUF(true, __atomic_load_n(&AggrEpoch, __ATOMIC_RELAXED))][ctrId];
+    ctrBase->count = __atomic_load_n(&base[SUMCOUNT], __ATOMIC_RELAXED);
+    ctrBase->sum = __atomic_load_n(&base[SUMSUM], __ATOMIC_RELAXED);
+    ctrBase->min = __atomic_load_n(&base[SUMMIN], __ATOMIC_RELAXED);
+    ctrBase->max = __atomic_load_n(&base[SUMMAX], __ATOMIC_RELAXED);
+    ctrAggr->count = __atomic_load_n(&aggr[SUMCOUNT], __ATOMIC_RELAXED) + ctrBase->count;
+    ctrAggr->sum = __atomic_load_n(&aggr[SUMSUM], __ATOMIC_RELAXED) + ctrBase->sum;
+    ctrAggr->min = __atomic_load_n(&aggr[SUMMIN], __ATOMIC_RELAXED);
+    ctrAggr->max = __atomic_load_n(&aggr[SUMMAX], __ATOMIC_RELAXED);
+    if (ctrBase->min < ctrAggr->min)
+        ctrAggr->min = ctrBase->min;
+    if (ctrBase->max > ctrAggr->max)
+        ctrAggr->max = ctrBase->max;
+    if (ctrBase->count == 0)
+        ctrBase->min = ctrBase->max = 0;
+    if (ctrAggr->count == 0)
+        ctrAggr->min = ctrAggr->max = 0;
 
-    if ((scalarCtr[ctrId].BaseVal == MAXCTRVALUE) || (scalarCtr[ctrId].AggrVal == MAXCTRVALUE))
-        res = MIXFOVFL;
+    return (MIXFOK);
+}
 
-    scalarCtr[ctrId].BaseVal += 1;
-    scalarCtr[ctrId].AggrVal += 1;
 
-    return(res);
+/*
+ * This function updates a Roller Scalar Counter by a specified value,
+ * either positive or negative. The first parameter is the Scalar
+ * Counter ID and shall be defined in the interval (0,M-1), where M
+ * is the the maximum number of Scalar counters defined through
+ * define_scalar_ctr_num(). The second parameter represents either
+ * the increase (if positive) or the decrease (if negative). 0
+ * is a valid value (i.e. it is accepted even if the corresponding
+ * counter is not modified in such case).
+ * Possible return values are:
+ *    - MIXFKO:   the counter ID does not exist, is outside
+ *                the allowed range, the specified counter
+ *                is a Peg Counter or counters have not been started
+ *    - MIXFOVFL: the counter should either exceed the maximum
+ *                value (i.e. 2^32 -1, or 2^64 -1 for 64 bit counters),
+ *                or decrease below 0. This applies both to base value
+ *                and to aggregate value. Note that differenly from peg
+ *                counters, a roller counter does not wrap (i.e. it is
+ *                capped either to its maximum value or to 0)
+ *    - MIXFOK:   the counter has been updated without errors
+ */
+Error update_roller_scalar_ctr(uint16_t ctrId, short delta)
+{
+    if (BaseCtrActive == false)     /* if counters have not been started return error */
+        return (MIXFKO);
+
+    if ((ctrId >= numScalarCtr) || (CTRKIND(scalarType[ctrId]) != ROLLERCTR))
+        return (MIXFKO);
 
+    return (UpdateRollerScalarValue(ctrId, scalarType[ctrId], delta));
 }
 
 
 /*
- * This function increases a Peg Vector Counter by one.
- * The first parameter is the Scalar Counter ID and shall be defined
- * in the interval (0,N-1), where N is the the maximum number of
- * Vector counters defined through define_vector_ctr_num().
- * The second parameter is a pointer to a Instance ID. If NULL
- * all the instances related to the concerned Vector counter
- * are increased by 1, otherwise only the specified Instance Id
- * is increased. It must be included in the interval (0,P-1)
- * where P is the number of instances specified in
- * define_vector_ctr().
+ * This function updates a Roller Vector Counter by a specified value,
+ * either positive or negative. The first parameter is the Vector
+ * Counter ID and shall be defined in the interval (0,N-1), where N
+ * is the the maximum number of Vector counters defined through
+ * define_vector_ctr_num(). The second parameter is a pointer to an
+ * Instance ID. If NULL all the instances related to the concerned
+ * Vector counter are updated, otherwise only the specified Instance Id
+ * is affected. It must be included in the interval (0,P-1) where P
+ * is the number of instances specified in define_vector_ctr()
+ * The third parameter represents either the increase (if positive)
+ * or the decrease (if negative). 0 s a valid value (i.e. it is accepted
+ * even if the corresponding counter is not modified in such case).
  * Possible return values are:
  *    - MIXFKO:   the counter ID does not exist, is outside
  *                the allowed range, the specified counter
- *                is a Roller Counter, the instance ID
+ *                is a Peg Counter, the instance ID
  *                is outside the allowed interval or counters
  *                have not been started
- *    - MIXFOVFL: the counter has wrapped around the maximum
- *                value (i.e. 2^32 -1). This applies both to base
- *                value and to aggregate value. Note that the counter
- *                is increased anyway (i.e. the new value is 0)
- *    - MIXFOK:   the counter has been increased without errors
+ *    - MIXFOVFL: the counter should either exceed the maximum
+ *                value (i.e. 2^32 -1, or 2^64 -1 for 64 bit counters),
+ *                or decrease below 0. This applies both to base value
+ *                and to aggregate value. Note that differenly from peg
+ *                counters, a roller counter does not wrap (i.e. it is
+ *                capped either to its maximum value or to 0)
+ *    - MIXFOK:   the counter has been updated without errors
  */
-Error incr_peg_vector_ctr(uint16_t ctrId, uint16_t* ctrInst)
+Error update_roller_vector_ctr(uint16_t ctrId, uint16_t *ctrInst, short delta)
 {
-    Error   res = MIXFOK;
-
     if (BaseCtrActive == false)     /* if counters have not been started return error */
         return (MIXFKO);
 
-    if ((ctrId >= numVectorCtr) || (vectorCtr[ctrId].Type != PEGCTR))
+    if ((ctrId >= numVectorCtr) || (CTRKIND(vectorHot[ctrId].Type) != ROLLERCTR))
         return (MIXFKO);
 
-    if (vectorCtr[ctrId].Name[0] == '\0')   /* the counter has not been defined through define_vector_ctr() */
-        return (MIXFKO);
+    return (UpdateRollerVectorValue(ctrId, vectorHot[ctrId].Type, ctrInst, delta));
+}
 
-    if (ctrInst != NULL)
-    {   /* Update a specific instance */
-        if ((*ctrInst) >= vectorCtr[ctrId].NumInstances)
-            return (MIXFKO);
-        if ((vectorCtr[ctrId].BaseVal[*ctrInst] == MAXCTRVALUE) || (vectorCtr[ctrId].AggrVal[*ctrInst] == MAXCTRVALUE))
-            res = MIXFOVFL;
-        vectorCtr[ctrId].BaseVal[*ctrInst] += 1;
-        vectorCtr[ctrId].AggrVal[*ctrInst] += 1;
-    }   /* if (ctrInst != NULL) */
-    else
-    {   /* Update all instances */
-        int     i;
-        for (i = 0; i < vectorCtr[ctrId].NumInstances; i++)
-        {
-            if ((vectorCtr[ctrId].BaseVal[i] == MAXCTRVALUE) || (vectorCtr[ctrId].AggrVal[i] == MAXCTRVALUE))
-                res = MIXFOVFL;
-            vectorCtr[ctrId].BaseVal[i] += 1;
-            vectorCtr[ctrId].AggrVal[i] += 1;
-        }   /* for (i = 0; i < vectorCtr[ctrId]... */
 
-    }   /* else if (ctrInst != NULL) */
+/*
+ * This function increases by one a Peg Counter registered through register_scalar_ctr()
+ * or register_vector_ctr(), identified by its handle. For Vector Counters the second
+ * parameter is a pointer to an Instance ID (NULL to increase all the instances), as in
+ * incr_peg_vector_ctr(); it is ignored for Scalar Counters.
+ * Counter ID and type are encoded in the handle, hence they are not checked again on
+ * each call. It is equivalent to add_peg_ctr(handle, ctrInst, 1).
+ * Possible return values are:
+ *    - MIXFKO:   the handle is not valid (or no longer valid, since counters have been
+ *                redefined), the counter is a Roller Counter, the instance ID is outside
+ *                the allowed interval or counters have not been started
+ *    - MIXFOVFL: the counter has wrapped around the maximum value
+ *    - MIXFOK:   the counter has been increased without errors
+ */
+Error incr_peg_ctr(CtrHandle handle, uint16_t *ctrInst)
+{
+    return (AddPegCtrHandle(handle, ctrInst, 1));
+}
 
-    return(res);
+
+/*
+ * This function increases by n a Peg Counter registered through register_scalar_ctr()
+ * or register_vector_ctr(), identified by its handle. For Vector Counters the second
+ * parameter is a pointer to an Instance ID (NULL to increase all the instances), as in
+ * add_peg_vector_ctr(); it is ignored for Scalar Counters.
+ * Return values are the same as incr_peg_ctr().
+ */
+Error add_peg_ctr(CtrHandle handle, uint16_t *ctrInst, uint64_t n)
+{
+    return (AddPegCtrHandle(handle, ctrInst, n));
 }
 
 
 /*
- * This function provides back the current value of the Peg Scalar
- * Counter defined by the first parameter (i.e. the Scalar Counter
- * ID), which shall be defined in the interval (0,M-1),being M the
- * maximum number of Scalar counters defined through
- * define_scalar_ctr_num(). The second and third parameters are
- * pointers to unsigned 32 bit integers, which are set respectively
- * set to the current base and aggregated values of the counter
+ * This function updates by delta (either positive or negative) a Roller Counter
+ * registered through register_scalar_ctr() or register_vector_ctr(), identified by its
+ * handle. For Vector Counters the second parameter is a pointer to an Instance ID (NULL
+ * to update all the instances), as in update_roller_vector_ctr(); it is ignored for
+ * Scalar Counters.
+ * Possible return values are:
+ *    - MIXFKO:   the handle is not valid (or no longer valid, since counters have been
+ *                redefined), the counter is a Peg Counter, the instance ID is outside
+ *                the allowed interval or counters have not been started
+ *    - MIXFOVFL: the counter should either exceed the maximum value or decrease
+ *                below 0 (it is capped)
+ *    - MIXFOK:   the counter has been updated without errors
+ */
+Error update_roller_ctr(CtrHandle handle, uint16_t *ctrInst, short delta)
+{
+    if (CTRHANDLECLASS(handle) == CTRSCALAR)
+    {
+        if (!CheckCtrHandle(handle, CTRSCALAR, ROLLERCTR))
+            return (MIXFKO);
+        return (UpdateRollerScalarValue(CTRHANDLEID(handle), CTRHANDLETYPE(handle), delta));
+    }
+
+    if (!CheckCtrHandle(handle, CTRVECTOR, ROLLERCTR))
+        return (MIXFKO);
+    return (UpdateRollerVectorValue(CTRHANDLEID(handle), CTRHANDLETYPE(handle), ctrInst, delta));
+}
+
+
+/*
+ * This function increases by one the value of a key (second parameter) of a Sparse
+ * Counter (first parameter). The key is added if it has not been updated before; if
+ * the maximum number of keys of the counter has been reached, the overflow cell is
+ * increased instead. It is equivalent to add_peg_sparse_ctr(ctrId, key, 1).
  * Possible return values are:
  *    - MIXFKO:   the counter ID does not exist, is outside
- *                the allowed range, the specified counter
- *                is a Roller Counter or counters have not been started
- *    - MIXFOK:   the counter has been extracted without errors.
- *                second and third parameter contain respectively
- *                the current base and aggregated values
+ *                the allowed range or counters have not been started
+ *    - MIXFOVFL: the value has wrapped around the maximum value
+ *    - MIXFOK:   the value has been increased without errors
  */
-Error retrieve_peg_scalar_ctr(uint16_t ctrId, uint32_t* ctrBase, uint32_t* ctrAggr)
+Error incr_peg_sparse_ctr(uint16_t ctrId, uint64_t key)
+{
+    return (AddPegSparseCtr(ctrId, key, 1));
+}
+
+
+/*
+ * This function increases by n (third parameter) the value of a key of a Sparse
+ * Counter. Parameters and return values are the same as incr_peg_sparse_ctr().
+ */
+Error add_peg_sparse_ctr(uint16_t ctrId, uint64_t key, uint64_t n)
+{
+    return (AddPegSparseCtr(ctrId, key, n));
+}
+
+
+/*
+ * This function records a value (second parameter) in a Histogram Counter (first
+ * parameter): the bucket of the value (see HistoBucket()) and the sum of values are
+ * increased, and min and max are updated if needed, only in the live base block (base
+ * intervals are folded into aggr values when dumped, see DumpHistoCtrs()). Values are
+ * recorded through plain stores in CTRPLAINMODE, through relaxed atomic operations in
+ * CTRATOMICMODE (min and max through compare and swap, only when they change), and in
+ * the block of the thread shard in CTRSHARDEDMODE (see RegisterThreadShard()).
+ * Possible return values are:
+ *    - MIXFKO:   the counter ID does not exist, is outside the allowed range,
+ *                the thread shard cannot be allocated or counters have not
+ *                been started
+ *    - MIXFOVFL: the sum of values has wrapped around 2^64 -1 (not detected
+ *                in CTRSHARDEDMODE)
+ *    - MIXFOK:   the value has been recorded without errors
+ */
+Error record_histo_ctr(uint16_t ctrId, uint64_t value)
 {
+    CtrShard       *shard = ThreadShard;
+    HistoCtrInfo   *h;
+    uint64_t       *blk, old;
+    uint32_t        idx;
+
     if (BaseCtrActive == false)     /* if counters have not been started return error */
         return (MIXFKO);
 
-    if ((ctrId >= numScalarCtr) || (scalarCtr[ctrId].Type != PEGCTR))
+    if ((ctrId >= numHistoCtr) || (histoCtr[ctrId].Bits == 0))
+        return (MIXFKO);
+
+    h = &histoCtr[ctrId];
+    idx = HISTOHDR + HistoBucket(value, h->Bits);
+    if (CtrUpdateMode == CTRSHARDEDMODE)
+    {
+        if (ThreadShardGen != ShardGeneration)
+            if ((shard = RegisterThreadShard()) == NULL)
+                return (MIXFKO);
+        blk = &shard->Cell[HistoShardOffset[ctrId]];
+        __atomic_store_n(&blk[idx], blk[idx] + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&blk[HISTOSUM], blk[HISTOSUM] + value, __ATOMIC_RELAXED);
+        if (value < __atomic_load_n(&blk[HISTOMIN], __ATOMIC_RELAXED))
+            __atomic_store_n(&blk[HISTOMIN], value, __ATOMIC_RELAXED);
+        if (value > __atomic_load_n(&blk[HISTOMAX], __ATOMIC_RELAXED))
+            __atomic_store_n(&blk[HISTOMAX], value, __ATOMIC_RELAXED);
+        return (MIXFOK);
+    }
+
+    blk = h->Val[HISTOBUF(false, __atomic_load_n(&BaseEpoch, __ATOMIC_RELAXED))];
+    if (CtrUpdateMode == CTRATOMICMODE)
+    {
+        __atomic_fetch_add(&blk[idx], 1, __ATOMIC_RELAXED);
+        old = __atomic_fetch_add(&blk[HISTOSUM], value, __ATOMIC_RELAXED);
+        AtomicMinCell(&blk[HISTOMIN], value);
+        AtomicMaxCell(&blk[HISTOMAX], value);
+    }
+    else
+    {
+        blk[idx]++;
+        old = blk[HISTOSUM];
+        blk[HISTOSUM] = old + value;
+        if (value < blk[HISTOMIN])
+            blk[HISTOMIN] = value;
+        if (value > blk[HISTOMAX])
+            blk[HISTOMAX] = value;
+    }
+
+    return ((value > UINT64_MAX - old) ? MIXFOVFL : MIXFOK);
+}
+
+
+/*
+ * This function observes a value in a Summary Counter: its number of values and
+ * their sum are increased, min and max are updated if needed, only in the base
+ * values (base intervals are folded into aggr values when dumped, see
+ * DumpSummaryCtrs()). Min and max are updated through conditional moves in
+ * CTRPLAINMODE, and through compare and swap only when they change in CTRATOMICMODE;
+ * in CTRSHARDEDMODE values are observed in the cells of the thread shard (see
+ * FoldShardSummary()), where min and max are stored only when they change, so that
+ * they are not reset by the owner while they are folded.
+ * Possible return values are:
+ *    - MIXFKO:   the counter ID does not exist, is outside the allowed range,
+ *                the shard cannot be allocated or counters have not been started
+ *    - MIXFOVFL: the sum of values has wrapped around 2^64 -1 (not detected
+ *                in CTRSHARDEDMODE)
+ *    - MIXFOK:   the value has been observed without errors
+ */
+Error observe_summary_ctr(uint16_t ctrId, uint64_t value)
+{
+    CtrShard   *shard = ThreadShard;
+    uint64_t   *val, old;
+
+    if (BaseCtrActive == false)     /* if counters have not been started return error */
         return (MIXFKO);
 
-    if (scalarCtr[ctrId].Name[0] == '\0')   /* the counter has not been defined through define_scalar_ctr() */
+    if ((ctrId >= numSummaryCtr) || (summaryCtr[ctrId].Name[0] == '\0'))
         return (MIXFKO);
 
-    *ctrBase = scalarCtr[ctrId].BaseVal;
-    *ctrAggr = scalarCtr[ctrId].AggrVal;
+    if (CtrUpdateMode == CTRSHARDEDMODE)
+    {
+        if (ThreadShardGen != ShardGeneration)
+            if ((shard = RegisterThreadShard()) == NULL)
+                return (MIXFKO);
+        val = &shard->Cell[numShardCells + (uint32_t)ctrId * SUMMARYCELLS];
+        __atomic_store_n(&val[SUMCOUNT], val[SUMCOUNT] + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&val[SUMSUM], val[SUMSUM] + value, __ATOMIC_RELAXED);
+        if (value < __atomic_load_n(&val[SUMMIN], __ATOMIC_RELAXED))
+            __atomic_store_n(&val[SUMMIN], value, __ATOMIC_RELAXED);
+        if (value > __atomic_load_n(&val[SUMMAX], __ATOMIC_RELAXED))
+            __atomic_store_n(&val[SUMMAX], value, __ATOMIC_RELAXED);
+        return (MIXFOK);
+    }
+
+    val = summaryVal[SUMMARYBUF(false, __atomic_load_n(&BaseEpoch, __ATOMIC_RELAXED))][ctrId];
+    if (CtrUpdateMode == CTRATOMICMODE)
+    {
+        __atomic_fetch_add(&val[SUMCOUNT], 1, __ATOMIC_RELAXED);
+        old = __atomic_fetch_add(&val[SUMSUM], value, __ATOMIC_RELAXED);
+        AtomicMinCell(&val[SUMMIN], value);
+        AtomicMaxCell(&val[SUMMAX], value);
+    }
+    else
+    {
+        val[SUMCOUNT]++;
+        old = val[SUMSUM];
+        val[SUMSUM] = old + value;
+        val[SUMMIN] = (value < val[SUMMIN]) ? value : val[SUMMIN];
+        val[SUMMAX] = (value > val[SUMMAX]) ? value : val[SUMMAX];
+    }
 
-    return (MIXFOK);
+    return ((value > UINT64_MAX - old) ? MIXFOVFL : MIXFOK);
 }
 
 
 /*
- * This function provides back the current value of an instance of
- * the Peg Vector Counter defined by the first parameter (i.e. the
- * Vector Counter ID) and the second parameter (i.e. the Instance ID).
- * The first parameter shall be defined in the interval (0,N-1),
- * being N the maximum number of Vector counters defined through
- * define_vector_ctr_num(), while the second parameter shall be
- * defined within (0,P-1) where P is the number of instances
- * specified in define_vector_ctr().
- * The third and fourth parameters are pointers to unsigned 32 bit
- * integers, which are set respectively set to the current base and
- * aggregated values of the concerned counter/instance.
+ * This function increases by one the count of a key (second parameter) of a Top-K
+ * Counter (first parameter) with integer keys. A key that is not monitored replaces
+ * the one with the lowest count if all places are taken (see define_topk_ctr()).
+ * It is equivalent to add_topk_ctr(ctrId, key, 1).
  * Possible return values are:
- *    - MIXFKO:   the counter ID does not exist, is outside
- *                the allowed range, the specified counter
- *                is a Roller Counter, the instance ID
- *                is outside the allowed interval
- *                or counters have not been started
- *    - MIXFOK:   the counter has been extracted without errors.
- *                third and fourth parameter contain respectively
- *                the current base and aggregated values
+ *    - MIXFKO:   the counter ID does not exist, is outside the allowed range,
+ *                has string keys or counters have not been started
+ *    - MIXFOK:   the count has been increased without errors
  */
-Error retrieve_peg_vector_ctr(uint16_t ctrId, uint16_t ctrInst, uint32_t* ctrBase, uint32_t* ctrAggr)
+Error incr_topk_ctr(uint16_t ctrId, uint64_t key)
+{
+    return (AddTopkCtr(ctrId, key, NULL, 1));
+}
+
+
+/*
+ * This function increases by n (third parameter) the count of a key of a Top-K
+ * Counter with integer keys, in the same way as incr_topk_ctr().
+ */
+Error add_topk_ctr(uint16_t ctrId, uint64_t key, uint64_t n)
+{
+    return (AddTopkCtr(ctrId, key, NULL, n));
+}
+
+
+/*
+ * This function increases by one the count of a string key (second parameter) of a
+ * Top-K Counter (first parameter) with string keys, identified by the 64 bit hash of
+ * their first CTRTOPKKEYLEN characters (see HashTopKString()). Return values are the
+ * same as incr_topk_ctr() (MIXFKO is also given back for a NULL key or a counter with
+ * integer keys).
+ */
+Error incr_topk_ctr_str(uint16_t ctrId, char *key)
 {
-    if (BaseCtrActive == false)     /* if counters have not been started return error */
+    if (key == NULL)
         return (MIXFKO);
 
-    if ((ctrId >= numVectorCtr) || (vectorCtr[ctrId].Type != PEGCTR))
-        return (MIXFKO);
+    return (AddTopkCtr(ctrId, 0, key, 1));
+}
 
-    if (vectorCtr[ctrId].Name[0] == '\0')   /* the counter has not been defined through define_vector_ctr() */
-        return (MIXFKO);
 
-    if (ctrInst >= vectorCtr[ctrId].NumInstances)
+/*
+ * This function increases by n (third parameter) the count of a string key of a Top-K
+ * Counter with string keys, in the same way as incr_topk_ctr_str().
+ */
+Error add_topk_ctr_str(uint16_t ctrId, char *key, uint64_t n)
+{
+    if (key == NULL)
         return (MIXFKO);
 
-    *ctrBase = vectorCtr[ctrId].BaseVal[ctrInst];
-    *ctrAggr = vectorCtr[ctrId].AggrVal[ctrInst];
-
-    return (MIXFOK);
+    return (AddTopkCtr(ctrId, 0, key, n));
 }
 
 
 /*
- * This function updates a Roller Scalar Counter by a specified value,
- * either positive or negative. The first parameter is the Scalar
- * Counter ID and shall be defined in the interval (0,M-1), where M
- * is the the maximum number of Scalar counters defined through
- * define_scalar_ctr_num(). The second parameter represents either
- * the increase (if positive) or the decrease (if negative). 0
- * is a valid value (i.e. it is accepted even if the corresponding
- * counter is not modified in such case).
+ * This function adds a key (second parameter) to a Distinct Counter (first parameter):
+ * the first Precision bits of the 64 bit hash of the key (see HashSparseKey()) select a
+ * register, which is raised to the position of the first bit set in the remaining bits
+ * (a sentinel bit bounds it), only in the base registers (base intervals are merged into
+ * aggr registers when dumped, see DumpDistinctCtrs()). Registers are raised through a
+ * conditional store in CTRPLAINMODE, through compare and swap only when they change in
+ * CTRATOMICMODE; in CTRSHARDEDMODE they are raised in the thread shard (see
+ * FoldShardDistinct()), only when they change.
  * Possible return values are:
- *    - MIXFKO:   the counter ID does not exist, is outside
- *                the allowed range, the specified counter
- *                is a Peg Counter or counters have not been started
- *    - MIXFOVFL: the counter should either exceed the maximum
- *                value (i.e. 2^32 -1), or decrease below 0. This
- *                applies both to base value and to aggregate value.
- *                Note that differenly from peg counters, a roller
- *                counter does not wrap (i.e. it is capped either to
- *                2^32-1 or to 0)
- *    - MIXFOK:   the counter has been updated without errors
+ *    - MIXFKO:   the counter ID does not exist, is outside the allowed range,
+ *                the shard cannot be allocated or counters have not been started
+ *    - MIXFOK:   the key has been added without errors
  */
-Error update_roller_scalar_ctr(uint16_t ctrId, short delta)
+Error add_distinct_ctr(uint16_t ctrId, uint64_t key)
 {
-    Error   res = MIXFOK;
+    CtrShard   *shard = ThreadShard;
+    uint64_t    h;
+    uint8_t    *reg, p, rank;
 
     if (BaseCtrActive == false)     /* if counters have not been started return error */
         return (MIXFKO);
 
-    if ((ctrId >= numScalarCtr) || (scalarCtr[ctrId].Type != ROLLERCTR))
+    if ((ctrId >= numDistinctCtr) || ((p = distinctCtr[ctrId].Precision) == 0))
         return (MIXFKO);
 
-    if (scalarCtr[ctrId].Name[0] == '\0')   /* the counter has not been defined through define_scalar_ctr() */
-        return (MIXFKO);
+    h = HashSparseKey(key);
+    rank = (uint8_t)(__builtin_clzll((h << p) | (1ULL << (p - 1))) + 1);
+    h >>= 64 - p;
 
-    if ( (delta>0) && ((scalarCtr[ctrId].BaseVal+delta) < scalarCtr[ctrId].BaseVal) )
-    {   /* delta is positive and the base counter would wrap over the maximum allowed value */
-        scalarCtr[ctrId].BaseVal = MAXCTRVALUE;
-        res = MIXFOVFL;
-    }
-    else if ((delta < 0) && ((scalarCtr[ctrId].BaseVal + delta) > scalarCtr[ctrId].BaseVal))
-    {   /* delta is negative and the base counter would become negative */
-        scalarCtr[ctrId].BaseVal = 0;
-        res = MIXFOVFL;
+    if (CtrUpdateMode == CTRSHARDEDMODE)
+    {
+        if (ThreadShardGen != ShardGeneration)
+            if ((shard = RegisterThreadShard()) == NULL)
+                return (MIXFKO);
+        reg = (uint8_t *)&shard->Cell[DistinctShardOffset[ctrId]] + h;
+        if (rank > __atomic_load_n(reg, __ATOMIC_RELAXED))
+            __atomic_store_n(reg, rank, __ATOMIC_RELAXED);
+        return (MIXFOK);
     }
-    else
-        scalarCtr[ctrId].BaseVal += delta;
 
-    if ((delta > 0) && ((scalarCtr[ctrId].AggrVal + delta) < scalarCtr[ctrId].AggrVal))
-    {   /* delta is positive and the aggregate counter would wrap over the maximum allowed value */
-        scalarCtr[ctrId].AggrVal = MAXCTRVALUE;
-        res = MIXFOVFL;
-    }
-    else if ((delta < 0) && ((scalarCtr[ctrId].AggrVal + delta) > scalarCtr[ctrId].AggrVal))
-    {   /* delta is negative and the aggregate counter would become negative */
-        scalarCtr[ctrId].AggrVal = 0;
-        res = MIXFOVFL;
-    }
-    else
-        scalarCtr[ctrId].AggrVal += delta;
+    reg = distinctCtr[ctrId].Reg[DISTINCTBUF(false, __atomic_load_n(&BaseEpoch, __ATOMIC_RELAXED))] + h;
+    if (CtrUpdateMode == CTRATOMICMODE)
+        AtomicMaxReg(reg, rank);
+    else if (rank > *reg)
+        *reg = rank;
 
-    return(res);
+    return (MIXFOK);
 }
 
 
 /*
- * This function updates a Roller Vector Counter by a specified value,
- * either positive or negative. The first parameter is the Vector
- * Counter ID and shall be defined in the interval (0,N-1), where N
- * is the the maximum number of Vector counters defined through
- * define_vector_ctr_num(). The second parameter is a pointer to an
- * Instance ID. If NULL all the instances related to the concerned
- * Vector counter are updated, otherwise only the specified Instance Id
- * is affected. It must be included in the interval (0,P-1) where P
- * is the number of instances specified in define_vector_ctr()
- * The third parameter represents either the increase (if positive)
- * or the decrease (if negative). 0 s a valid value (i.e. it is accepted
- * even if the corresponding counter is not modified in such case).
+ * This function applies an array of counter updates in a single call.
+ * The first parameter is an array of CtrUpdate records (counter class,
+ * counter ID, instance ID and delta), the second one is the number of
+ * records. The third parameter is either 0 or CTRBULKSORT (records are
+ * grouped in place by counter before being applied, preserving the relative
+ * order of records related to the same counter). The fourth parameter,
+ * if not NULL, points to a bitmap of (N+63)/64 words in which bit i is set
+ * if record i has caused a wrap-around (Peg) or a saturation (Roller); bits
+ * are never set in CTRSHARDEDMODE, since wrap-around and saturation are then
+ * applied when thread shards are folded.
+ * Counter checks and lookups are performed once for each run of consecutive
+ * records related to the same counter, and consecutive records related to the
+ * same instance of a Peg counter are merged into a single update (in that case
+ * only the bit of the last record of the run may be set in the bitmap).
  * Possible return values are:
- *    - MIXFKO:   the counter ID does not exist, is outside
- *                the allowed range, the specified counter
- *                is a Peg Counter, the instance ID
- *                is outside the allowed interval or counters
- *                have not been started
- *    - MIXFOVFL: the counter should either exceed the maximum
- *                value (i.e. 2^32 -1), or decrease below 0. This
- *                applies both to base value and to aggregate value.
- *                Note that differenly from peg counters, a roller
- *                counter does not wrap (i.e. it is capped either to
- *                2^32-1 or to 0)
- *    - MIXFOK:   the counter has been updated without errors
+ *    - MIXFKO:   counters have not been started or at least one record
+ *                is invalid (invalid records are skipped, the others
+ *                are applied anyway)
+ *    - MIXFOVFL: at least one record caused a wrap-around or a saturation
+ *                (not detected in CTRSHARDEDMODE)
+ *    - MIXFOK:   all the records have been applied without errors
  */
-Error update_roller_vector_ctr(uint16_t ctrId, uint16_t *ctrInst, short delta)
+Error update_ctr_bulk(CtrUpdate *updates, uint32_t numUpdates, uint8_t bulkOptions, uint64_t *ovflMap)
 {
-    Error   res = MIXFOK;
+    CtrUpdate      *u;
+    uint64_t       *base = NULL,
+                   *aggr = NULL,
+                    limit = 0;
+    uint32_t        i,
+                    numInst = 0,
+                    shardIdx = 0,
+                    inst;
+    int64_t         delta;
+    uint16_t        lastId = 0;
+    uint8_t         lastClass = UNDEFINED;
+    CounterType     kind = UNDEFCTR;
+    bool            sharded,
+                    ovfl,
+                    invalid = false,
+                    anyOvfl = false;
 
     if (BaseCtrActive == false)     /* if counters have not been started return error */
         return (MIXFKO);
 
-    if ((ctrId >= numVectorCtr) || (vectorCtr[ctrId].Type != ROLLERCTR))
+    if ((updates == NULL) && (numUpdates > 0))
         return (MIXFKO);
 
-    if (vectorCtr[ctrId].Name[0] == '\0')   /* the counter has not been defined through define_vector_ctr() */
-        return (MIXFKO);
+    if ((bulkOptions & CTRBULKSORT) && (numUpdates > 1))
+        SortCtrUpdates(updates, numUpdates);
 
-    if (ctrInst != NULL)
-    {   /* Update a specific instance */
-        if ((*ctrInst) >= vectorCtr[ctrId].NumInstances)
-            return (MIXFKO);
+    if (ovflMap != NULL)
+        memset(ovflMap, 0, ((numUpdates + 63) / 64) * sizeof(uint64_t));
 
-        if ( (delta>0) && ((vectorCtr[ctrId].BaseVal[*ctrInst]+delta) < vectorCtr[ctrId].BaseVal[*ctrInst]) )
-        {   /* delta is positive and the base counter would wrap over the maximum allowed value */
-            vectorCtr[ctrId].BaseVal[*ctrInst] = MAXCTRVALUE;
-            res = MIXFOVFL;
+    sharded = (CtrUpdateMode == CTRSHARDEDMODE);
+
+    for (i = 0, u = updates; i < numUpdates; i++, u++)
+    {
+        if ((u->ctrClass != lastClass) || (u->ctrId != lastId))
+        {   /* First record of a run related to a new counter: check it and cache its data */
+            lastClass = u->ctrClass;
+            lastId = u->ctrId;
+            kind = UNDEFCTR;
+            numInst = 0;
+            if ((u->ctrClass == CTRSCALAR) && (u->ctrId < numScalarCtr))
+            {
+                kind = scalarType[u->ctrId];
+                base = &scalarBaseVal[CTRBUF(kind, __atomic_load_n(&BaseEpoch, __ATOMIC_RELAXED))][u->ctrId];
+                aggr = &scalarAggrVal[CTRBUF(kind, __atomic_load_n(&AggrEpoch, __ATOMIC_RELAXED))][u->ctrId];
+                numInst = 1;
+                shardIdx = u->ctrId;
+            }
+            else if ((u->ctrClass == CTRVECTOR) && (u->ctrId < numVectorCtr))
+            {
+                kind = vectorHot[u->ctrId].Type;
+                base = vectorHot[u->ctrId].BaseVal[CTRBUF(kind, __atomic_load_n(&BaseEpoch, __ATOMIC_RELAXED))];
+                aggr = vectorHot[u->ctrId].AggrVal[CTRBUF(kind, __atomic_load_n(&AggrEpoch, __ATOMIC_RELAXED))];
+                numInst = vectorHot[u->ctrId].NumInstances;
+                shardIdx = VectorShardOffset[u->ctrId];
+            }
+            limit = CTRLIMIT(kind);
+            kind = CTRKIND(kind);
+        }   /* if ((u->ctrClass != lastClass) || (u->ctrId != lastId)) */
+
+        inst = (u->ctrClass == CTRVECTOR) ? u->instId : 0;
+        delta = u->delta;
+        if ( (inst >= numInst) || ((kind != PEGCTR) && (kind != ROLLERCTR)) ||
+             ((kind == PEGCTR) && (delta < 0)) )
+        {   /* Invalid record (numInst is 0 for undefined counters) */
+            invalid = true;
+            continue;
         }
-        else if ((delta < 0) && ((vectorCtr[ctrId].BaseVal[*ctrInst] + delta) > vectorCtr[ctrId].BaseVal[*ctrInst]))
-        {   /* delta is negative and the base counter would become negative */
-            vectorCtr[ctrId].BaseVal[*ctrInst] = 0;
-            res = MIXFOVFL;
+
+        if (kind == PEGCTR)
+        {   /* Consecutive records for the same Peg instance are merged into a single update */
+            while ( (i + 1 < numUpdates) && (u[1].ctrClass == lastClass) && (u[1].ctrId == lastId) &&
+                    ((lastClass == CTRSCALAR) || (u[1].instId == inst)) &&
+                    (u[1].delta >= 0) && (u[1].delta <= INT64_MAX - delta) )
+            {
+                i++;
+                u++;
+                delta += u->delta;
+            }
         }
-        else
-            vectorCtr[ctrId].BaseVal[*ctrInst] += delta;
 
-        if ((delta > 0) && ((vectorCtr[ctrId].AggrVal[*ctrInst] + delta) < vectorCtr[ctrId].AggrVal[*ctrInst]))
-        {   /* delta is positive and the aggregate counter would wrap over the maximum allowed value */
-            vectorCtr[ctrId].AggrVal[*ctrInst] = MAXCTRVALUE;
-            res = MIXFOVFL;
+        if (sharded)
+        {
+            if (AddShardCell(shardIdx + inst, delta) != MIXFOK)
+                return (MIXFKO);
+            continue;
         }
-        else if ((delta < 0) && ((vectorCtr[ctrId].AggrVal[*ctrInst] + delta) > vectorCtr[ctrId].AggrVal[*ctrInst]))
-        {   /* delta is negative and the aggregate counter would become negative */
-            vectorCtr[ctrId].AggrVal[*ctrInst] = 0;
-            res = MIXFOVFL;
+
+        if (kind == PEGCTR)
+        {
+            ovfl = AddPegCell(&base[inst], (uint64_t)delta, limit);
+            ovfl |= AddPegCell(&aggr[inst], (uint64_t)delta, limit);
         }
         else
-            vectorCtr[ctrId].AggrVal[*ctrInst] += delta;
-    }   /* if (ctrInst != NULL) */
-    else
-    {   /* Update all instances */
-        int     i;
-
-        for (i = 0; i < vectorCtr[ctrId].NumInstances; i++)
         {
-            if ( (delta>0) && ((vectorCtr[ctrId].BaseVal[i]+delta) < vectorCtr[ctrId].BaseVal[i]) )
-            {   /* delta is positive and the base counter would wrap over the maximum allowed value */
-                vectorCtr[ctrId].BaseVal[i] = MAXCTRVALUE;
-                res = MIXFOVFL;
-            }
-            else if ((delta < 0) && ((vectorCtr[ctrId].BaseVal[i] + delta) > vectorCtr[ctrId].BaseVal[i]))
-            {   /* delta is negative and the base counter would become negative */
-                vectorCtr[ctrId].BaseVal[i] = 0;
-                res = MIXFOVFL;
-            }
-            else
-                vectorCtr[ctrId].BaseVal[i] += delta;
-
-            if ((delta > 0) && ((vectorCtr[ctrId].AggrVal[i] + delta) < vectorCtr[ctrId].AggrVal[i]))
-            {   /* delta is positive and the aggregate counter would wrap over the maximum allowed value */
-                vectorCtr[ctrId].AggrVal[i] = MAXCTRVALUE;
-                res = MIXFOVFL;
-            }
-            else if ((delta < 0) && ((vectorCtr[ctrId].AggrVal[i] + delta) > vectorCtr[ctrId].AggrVal[i]))
-            {   /* delta is negative and the aggregate counter would become negative */
-                vectorCtr[ctrId].AggrVal[i] = 0;
-                res = MIXFOVFL;
-            }
-            else
-                vectorCtr[ctrId].AggrVal[i] += delta;
-        }   /* for (i = 0; i < vectorCtr[ctrId].NumInstances; i++) */
-
-    }   /* else if (ctrInst != NULL) */
+            ovfl = UpdateRollerCell(&base[inst], delta, limit);
+            ovfl |= UpdateRollerCell(&aggr[inst], delta, limit);
+        }
+        if (ovfl)
+        {
+            anyOvfl = true;
+            if (ovflMap != NULL)
+                ovflMap[i / 64] |= (uint64_t)1 << (i % 64);
+        }
+    }   /* for (i = 0, u = updates; i < numUpdates; i++, u++) */
 
-    return (res);
+    if (invalid)
+        return (MIXFKO);
+    return (anyOvfl ? MIXFOVFL : MIXFOK);
 }
 
 
@@ -911,6 +7572,10 @@ Error update_roller_vector_ctr(uint16_t ctrId, uint16_t *ctrInst, short delta)
  * desired dump times ("mm" format, with mm between 00 and 60). For example, in order to
  * dump counters every 5 minutes, this string will be formatted as follows:
  *     "00,05,10,15,20,25,30,35,40,45,50,55"
+ * Alternatively, the third string can specify a periodic schedule in seconds, in the
+ * form "every Ns" with N between 1 and 3600 (e.g. "every 5s"). In that case counters
+ * are dumped at every multiple of N seconds and the time stamp of each row also
+ * reports seconds (hh:mm:ss)
  * This function returns:
  *     - MIXFKO: if either the first parameter is not a valid file name or
  *            the second or third parameters are wrongly formatted or
@@ -923,9 +7588,11 @@ Error define_base_dump(char* baseDir, char* baseTimeFormat, char* baseTimes)
 {
     /* Local variables */
     ExtendedString Dir;
-    char           minutes[3] = { '\0','\0','\0' };
+    char           minutes[3] = { '\0','\0','\0' },
+                   unit, extra;
+    unsigned int   period;
     short          s;
-    int            i,len;
+    int            i,h,len;
 
     if (BaseCtrActive==true)    /* Base Counters already started, returns MIXFKO */
         return (MIXFKO);
@@ -933,8 +7600,18 @@ Error define_base_dump(char* baseDir, char* baseTimeFormat, char* baseTimes)
     if (baseTimes==NULL)
         return (MIXFKO);
 
-    len = strlen(baseTimes);
     /* First check third parameter and evaluate if it is correct */
+    /* It is either a periodic schedule ("every Ns") or a list of minutes */
+    period = 0;
+    if (strncmp(baseTimes, "every ", 6) == 0)
+    {
+        if (sscanf(baseTimes + 6, "%u%c%c", &period, &unit, &extra) != 2 || unit != 's' ||
+            !isdigit((unsigned char)baseTimes[6]) || (period < 1) || (period > MAXDUMPPERIOD))
+            return (MIXFKO);
+        len = 0;
+    }
+    else
+        len = strlen(baseTimes);
     for (i=0;i<len;i+=3)
     {
         minutes[0] = baseTimes[i];
@@ -969,6 +7646,19 @@ Error define_base_dump(char* baseDir, char* baseTimeFormat, char* baseTimes)
     else
         strcpy(BaseCtrTimeStampFormat, baseTimeFormat);
 
+    /* Compile dump times into the bitmap of the minutes of the day (each minute for all hours) */
+    /* The bitmap is left empty for periodic schedules */
+    BaseDumpPeriod = period;
+    memset(BaseDumpMap, 0, sizeof(BaseDumpMap));
+    for (i=0;i<len;i+=3)
+    {
+        minutes[0] = baseTimes[i];
+        minutes[1] = baseTimes[i+1];
+        s = atoi(minutes);
+        for (h = 0; h < 24; h++)
+            SETDUMPSLOT(BaseDumpMap, h * 60 + s);
+    }
+
     strcpy(BaseDumpTimes, baseTimes);
     strcpy(BaseCtrDir, Dir);
 
@@ -1007,76 +7697,334 @@ Error define_base_dump(char* baseDir, char* baseTimeFormat, char* baseTimes)
  * Remember also that aggregated PEG counters are set to zero at every aggregation interval  */
 Error define_aggr_dump(char* aggrDir, char* aggrTimeFormat, char* aggrTimes)
 {
-    /* Local variables */
-    ExtendedString Dir;
-    char           minutes[3] = { '\0','\0','\0' },
-                   hours[3] = { '\0','\0','\0' };
-    short          s, count = 0;
-    int            i,len;
+    /* Local variables */
+    ExtendedString Dir;
+    char           minutes[3] = { '\0','\0','\0' },
+                   hours[3] = { '\0','\0','\0' };
+    short          s, count = 0;
+    int            i,len;
+
+    if (BaseCtrActive==true)    /* Base Counters already started, returns MIXFKO */
+        return (MIXFKO);
+
+    if (aggrTimes==NULL)
+        return (MIXFKO);
+
+    len = strlen(aggrTimes);
+    /* First check third parameter and evaluate if it is correct */
+    for (i=0;i<len;i+=5)
+    {
+        count++;
+
+        hours[0] = aggrTimes[i];
+        if (aggrTimes[i+1] == '\0')
+            return (MIXFKO);
+        hours[1] = aggrTimes[i+1];
+        hours[2] = '\0';
+
+        if (aggrTimes[i+2] == '\0')
+            return (MIXFKO);
+
+        minutes[0] = aggrTimes[i+2];
+        if (aggrTimes[i+3] == '\0')
+            return (MIXFKO);
+        minutes[1] = aggrTimes[i+3];
+        minutes[2] = '\0';
+        if ((aggrTimes[i+4] != '\0') && (aggrTimes[i+4] != ','))
+            return (MIXFKO);
+
+        s = atoi(hours);
+        if ((s < 0) || (s > 23))
+            return (MIXFKO);
+
+        s = atoi(minutes);
+        if ((s < 0) || (s > 59))
+            return (MIXFKO);
+    }   /* for (i=0;i<len;i+=5) */
+
+    if (count > MAXAGGRDUMPTIMES)
+        return (MIXFOVFL);
+
+    /* Third parameter is correct - Now check the first one */
+    if ((aggrDir == NULL) || (aggrDir[0] == '\0') ) /* Aggr Directory has not been specified. Use current directory */
+        strcpy(Dir, "./");
+    else
+    {   /* Aggr directory specified. First check if the file name is valid */
+        if (check_file_name_validity(aggrDir) != MIXFOK)
+            return (MIXFKO);
+        strcpy(Dir, aggrDir);
+        s = strlen(Dir);
+        if ((s != 0) && (Dir[s-1] != '/'))
+            strcat(Dir, "/");
+    }
+
+    /* Now, Dir contains a valid base dir and aggrTimes a valid sequence of dump times */
+    /* Evaluate current time stamp format provided as second parameter (if any) */
+    if ((aggrTimeFormat == NULL) || (aggrTimeFormat[0] == '\0'))
+        strcpy (AggrCtrTimeStampFormat,"%d%m%Y");
+    else
+        strcpy(AggrCtrTimeStampFormat, aggrTimeFormat);
+
+    /* Compile dump times into the bitmap of the minutes of the day */
+    memset(AggrDumpMap, 0, sizeof(AggrDumpMap));
+    for (i=0;i<len;i+=5)
+    {
+        hours[0] = aggrTimes[i];
+        hours[1] = aggrTimes[i+1];
+        minutes[0] = aggrTimes[i+2];
+        minutes[1] = aggrTimes[i+3];
+        SETDUMPSLOT(AggrDumpMap, atoi(hours) * 60 + atoi(minutes));
+    }
+
+    strcpy(AggrDumpTimes, aggrTimes);
+    strcpy(AggrCtrDir, Dir);
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This function defines how counters are updated by incr_peg_xxx_ctr() and
+ * update_roller_xxx_ctr() functions. The only parameter can be:
+ *     CTRPLAINMODE:  counters are updated through plain (non atomic) operations.
+ *                    This is the default mode and is the fastest one, but it is
+ *                    suitable only when counters are updated by a single thread
+ *     CTRATOMICMODE: counters are updated through relaxed atomic operations (Peg
+ *                    counters through atomic add, Roller counters through a
+ *                    compare-and-swap loop that applies saturation), so that they
+ *                    can be safely updated by several concurrent threads. At dump
+ *                    time, each Peg counter is read and reset through a single
+ *                    atomic exchange, so that no increment is lost
+ *     CTRSHARDEDMODE: each thread updating counters gets its own private, cache line
+ *                    aligned block of cells, lazily allocated at its first update,
+ *                    so that increments never require atomic operations nor
+ *                    contend on shared cache lines. Thread blocks are folded into
+ *                    the shared counters by check_and_dump_ctr() and by retrieve
+ *                    functions. In this mode incr_peg_xxx_ctr() and
+ *                    update_roller_xxx_ctr() do not return MIXFOVFL (wrap and
+ *                    saturation are applied when thread blocks are folded)
+ * The mode is applied when counters are started, therefore this function shall be
+ * called before start_counters(). It is reset to CTRPLAINMODE by stop_counters().
+ * This function returns:
+ *     - MIXFKO: if the mode is not valid or counters collection has been already
+ *               started through start_counters()
+ *     - MIXFOK: if everything is correct
+ */
+Error define_ctr_update_mode(uint8_t ctrMode)
+{
+    if (BaseCtrActive==true)    /* Base Counters already started, returns MIXFKO */
+        return (MIXFKO);
+
+    if ((ctrMode != CTRPLAINMODE) && (ctrMode != CTRATOMICMODE) && (ctrMode != CTRSHARDEDMODE))
+        return (MIXFKO);
+
+    CtrUpdateMode = ctrMode;
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This function defines where counters values are stored. Parameters are:
+ *     storage:  either CTRHEAPSTORAGE, CTRSHMSTORAGE or CTRFILESTORAGE
+ *               CTRHEAPSTORAGE: values are stored in the private memory of the
+ *                               process (this is the default)
+ *               CTRSHMSTORAGE:  values are stored in a POSIX shared memory
+ *                               segment, created by start_counters() and removed
+ *                               by stop_counters(), so that external processes can
+ *                               map it read-only and read live counters without
+ *                               any copy (see CtrShmHeader and CtrShmDesc in mixf.h)
+ *               CTRFILESTORAGE: values are stored in a state file mapped in
+ *                               memory, with the same layout, which survives
+ *                               crashes and restarts: if counters are defined in
+ *                               the same way, start_counters() resumes all values
+ *                               from it, otherwise it is reinitialized
+ *     name:     CTRSHMSTORAGE: name of the shared memory segment, as required by
+ *                              shm_open() (i.e. starting with '/' and without other '/')
+ *               CTRFILESTORAGE: name of the state file (without any '/'), created
+ *                              within the base dump directory
+ *               ignored for CTRHEAPSTORAGE
+ * The storage is applied when counters are started, therefore this function shall be
+ * called before start_counters(). It is reset to CTRHEAPSTORAGE by stop_counters().
+ * This function returns:
+ *     - MIXFKO: if storage or name are not valid or counters collection has been
+ *               already started through start_counters()
+ *     - MIXFOK: if everything is correct
+ */
+Error define_ctr_storage(uint8_t storage, char *name)
+{
+    if (BaseCtrActive==true)    /* Base Counters already started, returns MIXFKO */
+        return (MIXFKO);
+
+    CloseCtrSegment();          /* Left by a previous start_counters() that failed */
+
+    if (storage == CTRHEAPSTORAGE)
+    {
+        CtrStorage = storage;
+        CtrStorageName[0] = '\0';
+        return (MIXFOK);
+    }
+
+    if ( ((storage != CTRSHMSTORAGE) && (storage != CTRFILESTORAGE)) || (name == NULL) ||
+         (strlen(name) > MEDIUMSTRINGMAXLEN) )
+        return (MIXFKO);
+    if ( (storage == CTRSHMSTORAGE) && ((name[0] != '/') || (name[1] == '\0') || (strchr(name + 1, '/') != NULL)) )
+        return (MIXFKO);
+    if ( (storage == CTRFILESTORAGE) && ((name[0] == '\0') || (strchr(name, '/') != NULL)) )
+        return (MIXFKO);
+
+    CtrStorage = storage;
+    strcpy(CtrStorageName, name);
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This function defines the format of base and aggregated dump files. The only
+ * parameter can be:
+ *     CTRCSVDUMP:  one CSV file for Scalar Counters and one for each Vector Counter,
+ *                  with a text row per dump slot (this is the default)
+ *     CTRCSVTAGGED: a single CSV file for all counters (counters_<stamp>.csv or
+ *                  counters_aggr_<stamp>.csv), in which each row is tagged (third
+ *                  column) with "scalar" or "vector_<ctrId>", so that the number of
+ *                  files and the time to open and rotate them do not depend on the
+ *                  number of Vector Counters
+ *     CTRBINDUMP:  a single binary file for all counters (counters_<stamp>.bin or
+ *                  counters_aggr_<stamp>.bin), made of little-endian blocks: a schema
+ *                  block describing all counters, written whenever the file is opened,
+ *                  then a row block per dump slot (a gap block for missed slots). By
+ *                  default values are fixed width (4 bytes, 8 bytes for CTR64BIT
+ *                  counters); one of the following encodings can be OR-ed:
+ *                  CTRVARINTENC: values are stored as LEB128 varints
+ *                  CTRDELTAENC:  values are stored as zig-zag LEB128 varints of the
+ *                                difference from the previous row of the same file
+ * Binary files can be converted back to the CSV files through the mixf-ctrdump tool.
+ * The format is applied when counters are started, therefore this function shall be
+ * called before start_counters(). It is reset to CTRCSVDUMP by stop_counters().
+ * This function returns:
+ *     - MIXFKO: if the format is not valid or counters collection has been already
+ *               started through start_counters()
+ *     - MIXFOK: if everything is correct
+ */
+Error define_ctr_dump_format(uint8_t format)
+{
+    if (BaseCtrActive==true)    /* Base Counters already started, returns MIXFKO */
+        return (MIXFKO);
+
+    if ( (format != CTRCSVDUMP) && (format != CTRCSVTAGGED) && (format != CTRBINDUMP) &&
+         (format != (CTRBINDUMP | CTRVARINTENC)) && (format != (CTRBINDUMP | CTRDELTAENC)) )
+        return (MIXFKO);
+
+    CtrDumpFormat = format;
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This function defines whether base and aggregated dump files are flushed to disk
+ * through fdatasync(), so that dumped rows survive a crash of the system (not only of
+ * the process). The only parameter is the number of dumps after which files are synced:
+ * CTRNOSYNC (0, the default) never syncs them (the kernel writes them back on its own),
+ * CTRSYNCEACHDUMP (1) syncs them after each dump, any other value N every N dumps (base
+ * and aggr dumps are counted separately). Files with dumps not synced yet are synced
+ * anyway before they are closed, i.e. at rotation time and by stop_counters().
+ * The setting is reset to CTRNOSYNC by stop_counters().
+ * This function returns:
+ *     - MIXFKO: if counters collection has been already started through start_counters()
+ *     - MIXFOK: if everything is correct
+ */
+Error define_ctr_dump_sync(uint32_t dumps)
+{
+    if (BaseCtrActive==true)    /* Base Counters already started, returns MIXFKO */
+        return (MIXFKO);
 
+    CtrDumpSync = dumps;
+
+    return (MIXFOK);
+}
+
+
+/*
+ * This function defines how base and aggregated dump files are written. The only
+ * parameter can be:
+ *     CTRDIRECTWRITER: rows are written through write() by the thread performing the
+ *                      dump (this is the default)
+ *     CTRURINGWRITER:  rows are copied and submitted to an io_uring instance owned by the
+ *                      library, at most one io_uring_enter() per dump, without waiting for
+ *                      the disk; completions are reaped at the next check_and_dump_ctr()
+ *                      call. If io_uring is not available, CTRTHREADWRITER is used
+ *     CTRTHREADWRITER: rows are copied and queued to a writer thread owned by the library
+ * Asynchronous writers execute writes, syncs (see define_ctr_dump_sync()) and closes in
+ * the same order in which they are queued. The writer actually in use and its statistics
+ * are provided by query_ctr_dump_writer(). The writer is applied when counters are
+ * started, therefore this function shall be called before start_counters(). It is reset
+ * to CTRDIRECTWRITER by stop_counters(), which waits for all pending operations.
+ * This function returns:
+ *     - MIXFKO: if the writer is not valid or counters collection has been already
+ *               started through start_counters()
+ *     - MIXFOK: if everything is correct
+ */
+Error define_ctr_dump_writer(uint8_t writer)
+{
     if (BaseCtrActive==true)    /* Base Counters already started, returns MIXFKO */
         return (MIXFKO);
 
-    if (aggrTimes==NULL)
+    if ( (writer != CTRDIRECTWRITER) && (writer != CTRURINGWRITER) && (writer != CTRTHREADWRITER) )
         return (MIXFKO);
 
-    len = strlen(aggrTimes);
-    /* First check third parameter and evaluate if it is correct */
-    for (i=0;i<len;i+=5)
-    {
-        count++;
+    CtrDumpWriter = writer;
 
-        hours[0] = aggrTimes[i];
-        if (aggrTimes[i+1] == '\0')
-            return (MIXFKO);
-        hours[1] = aggrTimes[i+1];
-        hours[2] = '\0';
+    return (MIXFOK);
+}
 
-        if (aggrTimes[i+2] == '\0')
-            return (MIXFKO);
 
-        minutes[0] = aggrTimes[i+2];
-        if (aggrTimes[i+3] == '\0')
-            return (MIXFKO);
-        minutes[1] = aggrTimes[i+3];
-        minutes[2] = '\0';
-        if ((aggrTimes[i+4] != '\0') && (aggrTimes[i+4] != ','))
-            return (MIXFKO);
+/*
+ * This function provides the writer of dump files in use (see define_ctr_dump_writer())
+ * and its statistics: bytes and operations queued and not completed yet, bytes written
+ * and operations completed with an error (or partial writes) since start_counters().
+ * Completions already available are reaped first. With CTRDIRECTWRITER all statistics
+ * are 0. It returns MIXFKO if the parameter is NULL, MIXFOK otherwise.
+ */
+Error query_ctr_dump_writer(CtrWriterStats *stats)
+{
+    if (stats == NULL)
+        return (MIXFKO);
 
-        s = atoi(hours);
-        if ((s < 0) || (s > 23))
-            return (MIXFKO);
+    pthread_mutex_lock(&WriterMutex);
+    if (CtrWriterActive == CTRURINGWRITER)
+        ReapCtrUring();
+    stats->writer = CtrWriterActive;
+    stats->inFlightBytes = WriterInFlightBytes;
+    stats->inFlightOps = WriterInFlightOps;
+    stats->writtenBytes = WriterWrittenBytes;
+    stats->errors = WriterErrors;
+    pthread_mutex_unlock(&WriterMutex);
 
-        s = atoi(minutes);
-        if ((s < 0) || (s > 59))
-            return (MIXFKO);
-    }   /* for (i=0;i<len;i+=5) */
+    return (MIXFOK);
+}
 
-    if (count > MAXAGGRDUMPTIMES)
-        return (MIXFOVFL);
 
-    /* Third parameter is correct - Now check the first one */
-    if ((aggrDir == NULL) || (aggrDir[0] == '\0') ) /* Aggr Directory has not been specified. Use current directory */
-        strcpy(Dir, "./");
-    else
-    {   /* Aggr directory specified. First check if the file name is valid */
-        if (check_file_name_validity(aggrDir) != MIXFOK)
-            return (MIXFKO);
-        strcpy(Dir, aggrDir);
-        s = strlen(Dir);
-        if ((s != 0) && (Dir[s-1] != '/'))
-            strcat(Dir, "/");
-    }
+/*
+ * This function defines how many dumped intervals of Scalar and Vector Counters are kept
+ * in memory, base ones (first parameter) and aggregated ones (second parameter), up to
+ * MAXCTRHISTORY each (0 if no interval shall be kept). Rings are allocated by
+ * start_counters() and read through query_ctr_history(). This function shall be called
+ * before start_counters(); the setting is reset by stop_counters().
+ * It returns MIXFKO if a parameter is out of range or counters have already been
+ * started, MIXFOK otherwise.
+ */
+Error define_ctr_history(uint16_t baseIntervals, uint16_t aggrIntervals)
+{
+    if (BaseCtrActive==true)    /* Base Counters already started, returns MIXFKO */
+        return (MIXFKO);
 
-    /* Now, Dir contains a valid base dir and aggrTimes a valid sequence of dump times */
-    /* Evaluate current time stamp format provided as second parameter (if any) */
-    if ((aggrTimeFormat == NULL) || (aggrTimeFormat[0] == '\0'))
-        strcpy (AggrCtrTimeStampFormat,"%d%m%Y");
-    else
-        strcpy(AggrCtrTimeStampFormat, aggrTimeFormat);
+    if ((baseIntervals > MAXCTRHISTORY) || (aggrIntervals > MAXCTRHISTORY))
+        return (MIXFKO);
 
-    strcpy(AggrDumpTimes, aggrTimes);
-    strcpy(AggrCtrDir, Dir);
+    CtrHistoryDepth[0] = baseIntervals;
+    CtrHistoryDepth[1] = aggrIntervals;
 
     return (MIXFOK);
 }
@@ -1085,9 +8033,10 @@ Error define_aggr_dump(char* aggrDir, char* aggrTimeFormat, char* aggrTimes)
 /*
  * Open all counters files (base and aggregated, if defined) and start counting events
  * This function may return:
- *  - MIXFNOACCESS: if any of the base or aggregated files cannot be opened
- *  - MIXFKO:       if counter collection has alredy been started before through start_counters()
- *                  or define_base_dump() has not been called
+ *  - MIXFNOACCESS: if any of the base or aggregated files (or the counters shared
+ *                  memory segment or state file, see define_ctr_storage()) cannot be opened
+ *  - MIXFKO:       if counter collection has alredy been started before through start_counters(),
+ *                  define_base_dump() has not been called or dump buffers cannot be allocated
  *  - MIXFOK:       if everything is OK
  */
 Error start_counters(void)
@@ -1095,67 +8044,215 @@ Error start_counters(void)
     /* Local variables */
     LongString  DumpFile;
     ShortString TimeStamp;
-    struct stat FileStat;
-    int         i,j;
-    bool        nameTooLong = false;
+    Error       result;
+    size_t      rowLen, histoLen;
+    int         i;
+    bool        nameTooLong = false,
+                empty;
 
     if ( (BaseCtrActive==true) || (BaseCtrDir[0]=='\0') )   /* Either counters already started or define_base_dump() not called */
         return (MIXFKO);
 
-    /* Retrieve current time stamp according to defined format */
-    retrieve_time_date(TimeStamp, BaseCtrTimeStampFormat);
+    /* Evaluate the layout of shard cells (used in CTRSHARDEDMODE, and for binary dump rows) */
+    numShardCells = numScalarCtr;
+    for (i = 0; i < numVectorCtr; i++)
+    {
+        VectorShardOffset[i] = numShardCells;
+        numShardCells += vectorHot[i].NumInstances;
+    }
+    numShardSpan = numShardCells + (uint32_t)numSummaryCtr * SUMMARYCELLS;
+    for (i = 0; i < numDistinctCtr; i++)
+    {   /* Registers of Distinct Counters follow Summary Counters cells, eight per cell */
+        DistinctShardOffset[i] = numShardSpan;
+        if (distinctCtr[i].Precision != 0)
+            numShardSpan += (1U << distinctCtr[i].Precision) / 8;
+    }
+    for (i = 0; i < numHistoCtr; i++)
+    {   /* Blocks of Histogram Counters follow, with the same layout as shared ones */
+        HistoShardOffset[i] = numShardSpan;
+        if (histoCtr[i].Bits != 0)
+            numShardSpan += HISTOHDR + histoCtr[i].NumBuckets;
+    }
+    pthread_mutex_lock(&ShardMutex);
+    ShardGeneration++;
+    pthread_mutex_unlock(&ShardMutex);
+    pthread_once(&ShardKeyOnce, CreateShardKey);
 
-    /* Open first the single scalar counter base file */
-    /* File is open in append mode, in case that it is initially empty */
-    /* it prints first an header row containing all scalar counters name */
-    nameTooLong = (snprintf(DumpFile, sizeof(DumpFile), "%sscalar_%s.csv", BaseCtrDir, TimeStamp) >= sizeof(DumpFile));
-    pthread_mutex_lock(&BaseMutex);
-    if (nameTooLong || (BaseCtr_fd=fopen(DumpFile,"a")) == NULL)
+    /* Allocate row buffers, large enough for the time stamp and the longest row of values */
+    rowLen = numScalarCtr;
+    for (i = 0; i < numVectorCtr; i++)
+        if (vectorHot[i].NumInstances > rowLen)
+            rowLen = vectorHot[i].NumInstances;
+    rowLen = (SHORTSTRINGMAXLEN + 1) + rowLen * (MAXCTRDIGITS + 1);
+    if (CtrDumpFormat & CTRBINDUMP)     /* A binary row holds all counters, varints take 10 bytes at most */
+        rowLen = 24 + (size_t)numShardCells * 10;
+    if (CtrDumpFormat & CTRCSVTAGGED)   /* All rows of a slot, each with time stamp and tag (at most "vector_1023,") */
+        rowLen = (size_t)(numVectorCtr + 1) * (SHORTSTRINGMAXLEN + 1 + 12) + (size_t)numShardCells * (MAXCTRDIGITS + 1);
+    if (numHistoCtr > 0)                /* Rows of Histogram Counters, or their single binary block, use row buffers too */
     {
-        pthread_mutex_unlock(&BaseMutex);
-        return (MIXFNOACCESS);
+        histoLen = (CtrDumpFormat & CTRBINDUMP) ? 24 + (size_t)numHistoCtr * HISTOSTATS * 10 :
+                                                  (SHORTSTRINGMAXLEN + 1 + 12) + HISTOSTATS * (MAXCTRDIGITS + 1);
+        if (histoLen > rowLen)
+            rowLen = histoLen;
     }
-    if (stat(DumpFile, &FileStat) != 0)
+    if (numRateCtr > 0)                 /* Likewise the row of rates, or its binary block */
     {
-        pthread_mutex_unlock(&BaseMutex);
-        return (MIXFNOACCESS);
+        histoLen = (CtrDumpFormat & CTRBINDUMP) ? 24 + (size_t)numRateCtr * RATEVALUES * 8 :
+                                                  (SHORTSTRINGMAXLEN + 1 + 12) + (size_t)numRateCtr * RATEVALUES * (RATEDIGITS + 1);
+        if (histoLen > rowLen)
+            rowLen = histoLen;
+    }
+    if (numSummaryCtr > 0)              /* Likewise rows of Summary Counters, or their single binary block */
+    {
+        histoLen = (CtrDumpFormat & CTRBINDUMP) ? 24 + (size_t)numSummaryCtr * SUMMARYCELLS * 10 :
+                                                  (SHORTSTRINGMAXLEN + 1 + 12) + SUMMARYCELLS * (MAXCTRDIGITS + 1);
+        if (histoLen > rowLen)
+            rowLen = histoLen;
+    }
+    if (numDistinctCtr > 0)             /* Likewise the row of Distinct Counters, or its binary block */
+    {
+        histoLen = (CtrDumpFormat & CTRBINDUMP) ? 24 + (size_t)numDistinctCtr * 10 :
+                                                  (SHORTSTRINGMAXLEN + 1 + 12) + (size_t)numDistinctCtr * (MAXCTRDIGITS + 1);
+        if (histoLen > rowLen)
+            rowLen = histoLen;
+    }
+    for (i = 0; i < numTopkCtr; i++)    /* Likewise rows of the top keys of each Top-K Counter, or its binary block */
+    {
+        histoLen = (CtrDumpFormat & CTRBINDUMP) ? 28 + (size_t)topkCtr[i].TopK * (CTRTOPKKEYLEN + 2 + 2 * 10) :
+                                                  (size_t)topkCtr[i].TopK * TOPKMAXROW;
+        if (histoLen > rowLen)
+            rowLen = histoLen;
     }
-    if (FileStat.st_size == 0)
+    free(BaseRowBuf);
+    free(AggrRowBuf);
+    free(BasePrevVal);
+    free(AggrPrevVal);
+    BaseRowBuf = (char *)malloc(rowLen);
+    AggrRowBuf = (char *)malloc(rowLen);
+    BasePrevVal = AggrPrevVal = NULL;
+    if (CtrDumpFormat & CTRDELTAENC)
     {
-        fprintf(BaseCtr_fd, "Date,Time,");
-        for (j = 0; j < (numScalarCtr - 1); j++)
-            fprintf(BaseCtr_fd, "%s,", scalarCtr[j].Name);
-        fprintf(BaseCtr_fd, "%s\n", scalarCtr[numScalarCtr - 1].Name);
+        BasePrevVal = (uint64_t *)calloc(numShardCells + 1, sizeof(uint64_t));
+        AggrPrevVal = (uint64_t *)calloc(numShardCells + 1, sizeof(uint64_t));
+    }
+    if ( (BaseRowBuf == NULL) || (AggrRowBuf == NULL) ||
+         ((CtrDumpFormat & CTRDELTAENC) && ((BasePrevVal == NULL) || (AggrPrevVal == NULL))) )
+    {
+        free(BaseRowBuf);
+        free(AggrRowBuf);
+        free(BasePrevVal);
+        free(AggrPrevVal);
+        BaseRowBuf = AggrRowBuf = NULL;
+        BasePrevVal = AggrPrevVal = NULL;
+        return (MIXFKO);
     }
 
-    /* Now open all the vector counters base files */
-    /* As above, files are opened in append mode and if initially empty */
-    /* it prints first an header row containing all scalar counters name */
-    for (i = 0; i<numVectorCtr; i++)
+    /* Dumps fetch values in rows of history rings, allocated even if no history is kept */
+    if (AllocCtrHistory() != MIXFOK)
+        return (MIXFKO);
+
+    /* Rows of Sparse Counters are encoded in buffers of their own, written when nearly full */
+    free(BaseSparseBuf);
+    free(AggrSparseBuf);
+    BaseSparseBuf = AggrSparseBuf = NULL;
+    if (numSparseCtr > 0)
+    {
+        BaseSparseBuf = (char *)malloc(SPARSEBUFSIZE);
+        AggrSparseBuf = (char *)malloc(SPARSEBUFSIZE);
+        if ((BaseSparseBuf == NULL) || (AggrSparseBuf == NULL))
+        {
+            free(BaseSparseBuf);
+            free(AggrSparseBuf);
+            BaseSparseBuf = AggrSparseBuf = NULL;
+            return (MIXFKO);
+        }
+    }
+
+    /* Buckets of Histogram Counters are moved at dump time to buffers large enough for any of them */
+    free(BaseHistoBuf);
+    free(AggrHistoBuf);
+    BaseHistoBuf = AggrHistoBuf = NULL;
+    if (numHistoCtr > 0)
+    {
+        BaseHistoBuf = (uint64_t *)malloc((size_t)HISTOBUCKETS(MAXHISTOBITS) * sizeof(uint64_t));
+        AggrHistoBuf = (uint64_t *)malloc((size_t)HISTOBUCKETS(MAXHISTOBITS) * sizeof(uint64_t));
+        if ((BaseHistoBuf == NULL) || (AggrHistoBuf == NULL))
+        {
+            free(BaseHistoBuf);
+            free(AggrHistoBuf);
+            BaseHistoBuf = AggrHistoBuf = NULL;
+            return (MIXFKO);
+        }
+    }
+
+    /* Create the segment of counters, if any (values are moved there once everything is open) */
+    if ( (CtrStorage != CTRHEAPSTORAGE) && ((result = OpenCtrSegment()) != MIXFOK) )
+        return (result);
+
+    /* Start the writer of dump files (any writer left by a failed start is stopped first) */
+    StopCtrWriter();
+    StartCtrWriter();
+
+    /* Retrieve current time stamp according to defined format */
+    retrieve_time_date(TimeStamp, BaseCtrTimeStampFormat);
+
+    pthread_mutex_lock(&BaseMutex);
+    if (CtrDumpFormat & CTRBINDUMP)
+    {   /* A single binary file for all base counters */
+        if ((result = OpenBinDumpFile(&BaseCtr_fd, BaseCtrDir, "", TimeStamp, (BaseDumpPeriod != 0), BasePrevVal)) != MIXFOK)
+        {
+            pthread_mutex_unlock(&BaseMutex);
+            return (result);
+        }
+    }
+    else if (CtrDumpFormat & CTRCSVTAGGED)
+    {   /* A single CSV file for all base counters */
+        if ((result = OpenTaggedDumpFile(&BaseCtr_fd, BaseCtrDir, "", TimeStamp)) != MIXFOK)
+        {
+            pthread_mutex_unlock(&BaseMutex);
+            return (result);
+        }
+    }
+    else
     {
-        nameTooLong = (snprintf(DumpFile, sizeof(DumpFile), "%svector_%d_%s.csv", BaseCtrDir, i, TimeStamp) >= sizeof(DumpFile));
-        if (nameTooLong || (vectorCtr[i].BaseCtr_fd = fopen(DumpFile, "a")) == NULL)
-        {   /* Not able to open the i-th vector base file, close all files already open and exit with MIXFNOACCESS */
-            for (j = i - 1; j >= 0; j--)
-                fclose(vectorCtr[j].BaseCtr_fd);
-            fclose(BaseCtr_fd);
+        /* Open first the single scalar counter base file */
+        /* File is open in append mode, in case that it is initially empty */
+        /* it prints first an header row containing all scalar counters name */
+        nameTooLong = (snprintf(DumpFile, sizeof(DumpFile), "%sscalar_%s.csv", BaseCtrDir, TimeStamp) >= sizeof(DumpFile));
+        if (nameTooLong || (BaseCtr_fd = OpenCtrFile(DumpFile, &empty)) < 0)
+        {
             pthread_mutex_unlock(&BaseMutex);
             return (MIXFNOACCESS);
-        }   /* if ((vectorCtr[i].AggrCtr_fd ... */
-        if (stat(DumpFile, &FileStat) != 0)
+        }
+        if (empty)
+            WriteCtrHeader(BaseCtr_fd, "Date,Time,", scalarCtr[0].Name, sizeof(ScalarCtrInfo), numScalarCtr);
+
+        /* Now open all the vector counters base files */
+        /* As above, files are opened in append mode and if initially empty */
+        /* it prints first an header row containing all scalar counters name */
+        for (i = 0; i<numVectorCtr; i++)
+        {
+            nameTooLong = (snprintf(DumpFile, sizeof(DumpFile), "%svector_%d_%s.csv", BaseCtrDir, i, TimeStamp) >= sizeof(DumpFile));
+            if (nameTooLong || (vectorCtr[i].BaseCtr_fd = OpenCtrFile(DumpFile, &empty)) < 0)
+            {   /* Not able to open the i-th vector base file, close all files already open and exit with MIXFNOACCESS */
+                CloseCtrFiles(false);
+                pthread_mutex_unlock(&BaseMutex);
+                return (MIXFNOACCESS);
+            }   /* if ((vectorCtr[i].BaseCtr_fd ... */
+            if (empty)
+                WriteVectorCtrHeader(vectorCtr[i].BaseCtr_fd, i, false);
+        }   /* for (i = 0; i<numVectorCtr; i++) */
+
+        /* Finally open Sparse, Histogram, Summary, Top-K and Distinct Counters base files, and rates file, in the same way */
+        if ((OpenSparseCtrFiles(false, TimeStamp) != MIXFOK) || (OpenHistoCtrFiles(false, TimeStamp) != MIXFOK) ||
+            (OpenSummaryCtrFiles(false, TimeStamp) != MIXFOK) || (OpenRateCtrFile(false, TimeStamp) != MIXFOK) ||
+            (OpenTopkCtrFiles(false, TimeStamp) != MIXFOK) || (OpenDistinctCtrFile(false, TimeStamp) != MIXFOK))
         {
+            CloseCtrFiles(false);
             pthread_mutex_unlock(&BaseMutex);
             return (MIXFNOACCESS);
         }
-        if (FileStat.st_size == 0)
-        {
-            fprintf(vectorCtr[i].BaseCtr_fd, "Vector Counter: %s - Instances: %s\nDate,Time,", vectorCtr[i].Name, vectorCtr[i].InstName);
-            for (j = 0; j < (vectorCtr[i].NumInstances - 1); j++)
-                fprintf(vectorCtr[i].BaseCtr_fd, "%s,", vectorCtr[i].InstIdName[j]);
-            fprintf(vectorCtr[i].BaseCtr_fd, "%s\n", vectorCtr[i].InstIdName[j]);
-        }   /* if (FileStat.st_size == 0) */
-    }   /* for (i = 0; i<numVectorCtr; i++) */
-    fflush (NULL);
+    }   /* if (CtrDumpFormat & CTRBINDUMP) */
     /* All base files are open - clear base mutex */
     pthread_mutex_unlock(&BaseMutex);
 
@@ -1163,83 +8260,151 @@ Error start_counters(void)
     if (AggrCtrDir[0] == '\0')
     {   /* Aggregation not initialized - Store the BaseDumpOpenDate for file rotation, set BaseCtrActive and exit */
         retrieve_time_date(BaseDumpOpenDate, "%d%m%Y");
+        BaseLastDumpTime = time(NULL);
+        BaseNextDumpTime = NextSlotTime(BaseDumpMap, BaseDumpPeriod,
+                                        BaseLastDumpTime - BaseLastDumpTime % (BaseDumpPeriod ? BaseDumpPeriod : 60));
+        AggrNextDumpTime = NODUMPTIME;
+        AttachCtrSegment();
+        StartRateCtrs();
+        StartCtrAlarms();
+        SubmitCtrWriter();
         BaseCtrActive = true;
-        BaseNextDump = NULL;
         return (MIXFOK);
     }
 
     /* Aggregation has been initialized through define_aggr_dump() */
-    /* Now Open the single scalar counter Aggr file */
-    /* File is open in append mode, in case that it is initially empty */
-    /* it prints first an header row containing all scalar counters name */
-    nameTooLong = (snprintf(DumpFile, sizeof(DumpFile), "%sscalar_aggr_%s.csv", AggrCtrDir, TimeStamp) >= sizeof(DumpFile));
     pthread_mutex_lock(&AggrMutex);
-    if (nameTooLong || (AggrCtr_fd = fopen(DumpFile, "a")) == NULL)
-    {   /* Something went wrong - close all previously opened files */
-        for (j = 0; j < numScalarCtr; j++)
-            fclose(vectorCtr[j].BaseCtr_fd);
-        fclose(BaseCtr_fd);
-        pthread_mutex_unlock(&AggrMutex);
-        return (MIXFNOACCESS);
-    }
-    if (stat(DumpFile, &FileStat) != 0)
-    {
-        pthread_mutex_unlock(&AggrMutex);
-        return (MIXFNOACCESS);
+    if (CtrDumpFormat & CTRBINDUMP)
+    {   /* A single binary file for all aggr counters */
+        if ((result = OpenBinDumpFile(&AggrCtr_fd, AggrCtrDir, "aggr_", TimeStamp, false, AggrPrevVal)) != MIXFOK)
+        {
+            CloseCtrFiles(false);
+            pthread_mutex_unlock(&AggrMutex);
+            return (result);
+        }
     }
-    if (FileStat.st_size == 0)
-    {
-        fprintf(AggrCtr_fd, "Date,Time,");
-        for (j = 0; j < (numScalarCtr - 1); j++)
-            fprintf(AggrCtr_fd, "%s,", scalarCtr[j].Name);
-        fprintf(AggrCtr_fd, "%s\n", scalarCtr[numScalarCtr - 1].Name);
+    else if (CtrDumpFormat & CTRCSVTAGGED)
+    {   /* A single CSV file for all aggr counters */
+        if ((result = OpenTaggedDumpFile(&AggrCtr_fd, AggrCtrDir, "aggr_", TimeStamp)) != MIXFOK)
+        {
+            CloseCtrFiles(false);
+            pthread_mutex_unlock(&AggrMutex);
+            return (result);
+        }
     }
-
-    /* Now open all the vector counters Aggr files */
-    /* As above, files are opened in append mode and if initially empty */
-    /* it prints first an header row containing all scalar counters name */
-    for (i = 0; i < numVectorCtr; i++)
+    else
     {
-        nameTooLong = (snprintf(DumpFile, sizeof(DumpFile), "%svector_%d_aggr_%s.csv", AggrCtrDir, i, TimeStamp) >= sizeof(DumpFile));
-        if (nameTooLong || (vectorCtr[i].AggrCtr_fd = fopen(DumpFile, "a")) == NULL)
-        {   /* Not able to open the i-th vector Aggr file, close all files already open and exit with MIXFNOACCESS */
-            for (j = i - 1; j >= 0; j--)
-                fclose(vectorCtr[j].AggrCtr_fd);
-            for (j = 0; j < numScalarCtr; j++)
-                fclose(vectorCtr[j].BaseCtr_fd);
-            fclose(AggrCtr_fd);
-            fclose(BaseCtr_fd);
+        /* Now Open the single scalar counter Aggr file */
+        /* File is open in append mode, in case that it is initially empty */
+        /* it prints first an header row containing all scalar counters name */
+        nameTooLong = (snprintf(DumpFile, sizeof(DumpFile), "%sscalar_aggr_%s.csv", AggrCtrDir, TimeStamp) >= sizeof(DumpFile));
+        if (nameTooLong || (AggrCtr_fd = OpenCtrFile(DumpFile, &empty)) < 0)
+        {   /* Something went wrong - close all previously opened files */
+            CloseCtrFiles(false);
             pthread_mutex_unlock(&AggrMutex);
             return (MIXFNOACCESS);
-        }   /* if ((vectorCtr[i].AggrCtr_fd ... */
-        if (stat(DumpFile, &FileStat) != 0)
+        }
+        if (empty)
+            WriteCtrHeader(AggrCtr_fd, "Date,Time,", scalarCtr[0].Name, sizeof(ScalarCtrInfo), numScalarCtr);
+
+        /* Now open all the vector counters Aggr files */
+        /* As above, files are opened in append mode and if initially empty */
+        /* it prints first an header row containing all scalar counters name */
+        for (i = 0; i < numVectorCtr; i++)
+        {
+            nameTooLong = (snprintf(DumpFile, sizeof(DumpFile), "%svector_%d_aggr_%s.csv", AggrCtrDir, i, TimeStamp) >= sizeof(DumpFile));
+            if (nameTooLong || (vectorCtr[i].AggrCtr_fd = OpenCtrFile(DumpFile, &empty)) < 0)
+            {   /* Not able to open the i-th vector Aggr file, close all files already open and exit with MIXFNOACCESS */
+                CloseCtrFiles(true);
+                CloseCtrFiles(false);
+                pthread_mutex_unlock(&AggrMutex);
+                return (MIXFNOACCESS);
+            }   /* if ((vectorCtr[i].AggrCtr_fd ... */
+            if (empty)
+                WriteVectorCtrHeader(vectorCtr[i].AggrCtr_fd, i, false);
+        }   /* for (i = 0; i<numVectorCtr; i++) */
+
+        /* Finally open Sparse, Histogram, Summary, Top-K and Distinct Counters Aggr files, and rates file, in the same way */
+        if ((OpenSparseCtrFiles(true, TimeStamp) != MIXFOK) || (OpenHistoCtrFiles(true, TimeStamp) != MIXFOK) ||
+            (OpenSummaryCtrFiles(true, TimeStamp) != MIXFOK) || (OpenRateCtrFile(true, TimeStamp) != MIXFOK) ||
+            (OpenTopkCtrFiles(true, TimeStamp) != MIXFOK) || (OpenDistinctCtrFile(true, TimeStamp) != MIXFOK))
         {
+            CloseCtrFiles(true);
+            CloseCtrFiles(false);
             pthread_mutex_unlock(&AggrMutex);
             return (MIXFNOACCESS);
         }
-        if (FileStat.st_size == 0)
-        {
-            fprintf(vectorCtr[i].AggrCtr_fd, "Vector Counter: %s - Instances: %s\nDate,Time,", vectorCtr[i].Name, vectorCtr[i].InstName);
-            for (j = 0; j < (vectorCtr[i].NumInstances - 1); j++)
-                fprintf(vectorCtr[i].AggrCtr_fd, "%s,", vectorCtr[i].InstIdName[j]);
-            fprintf(vectorCtr[i].AggrCtr_fd, "%s\n", vectorCtr[i].InstIdName[j]);
-        }   /* if (FileStat.st_size == 0) */
-    }   /* for (i = 0; i<numVectorCtr; i++) */
-    fflush (NULL);
+    }   /* if (CtrDumpFormat & CTRBINDUMP) */
     /* All Aggr files are open - clear Aggr mutex */
     pthread_mutex_unlock(&AggrMutex);
 
     /* Store the DumpOpenDate for file rotation and set flags */
     retrieve_time_date(BaseDumpOpenDate, "%d%m%Y");
     strcpy(AggrDumpOpenDate, BaseDumpOpenDate);
+    /* The first dump slots are looked up from the current minute (or period) included */
+    BaseLastDumpTime = AggrLastDumpTime = time(NULL);
+    BaseNextDumpTime = NextSlotTime(BaseDumpMap, BaseDumpPeriod,
+                                    BaseLastDumpTime - BaseLastDumpTime % (BaseDumpPeriod ? BaseDumpPeriod : 60));
+    AggrNextDumpTime = NextSlotTime(AggrDumpMap, 0, AggrLastDumpTime - AggrLastDumpTime % 60);
+    AttachCtrSegment();
+    StartRateCtrs();
+    StartCtrAlarms();
+    SubmitCtrWriter();
     BaseCtrActive = AggrCtrActive = true;
-    BaseNextDump = AggrNextDump = NULL;
 
     return (MIXFOK);
 
 }
 
 
+/*
+ * Same as start_counters(), but counters are also dumped by a thread owned by the
+ * library, so that the application does not need to call check_and_dump_ctr() (if
+ * called, it has no effect). The thread sleeps on a timerfd armed for the exact next
+ * base/aggr dump time defined through define_base_dump()/define_aggr_dump(), therefore
+ * update functions never pay for dump scheduling or file I/O, and dumps are not missed
+ * if the application is busy. The thread is stopped by stop_counters().
+ * This function may return:
+ *  - MIXFNOACCESS: if any of the base or aggregated files (or the counters shared
+ *                  memory segment or state file, see define_ctr_storage()) cannot be opened
+ *  - MIXFKO:       if counter collection has alredy been started before, define_base_dump()
+ *                  has not been called or the thread cannot be created (in the latter case
+ *                  counters are not started)
+ *  - MIXFOK:       if everything is OK
+ */
+Error start_counters_async(void)
+{
+    Error   res;
+
+    if (BaseCtrActive == true)      /* Counters already started */
+        return (MIXFKO);
+
+    if ((DumpTimer_fd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC)) < 0)
+        return (MIXFKO);
+    if ((DumpStop_fd = eventfd(0, EFD_CLOEXEC)) < 0)
+    {
+        close(DumpTimer_fd);
+        DumpTimer_fd = -1;
+        return (MIXFKO);
+    }
+
+    if ((res = start_counters()) == MIXFOK)
+    {
+        DumpThreadActive = true;
+        if (pthread_create(&DumpThread, NULL, DumpThreadLoop, NULL) == 0)
+            return (MIXFOK);
+        DumpThreadActive = false;
+        stop_counters();
+        res = MIXFKO;
+    }
+
+    close(DumpTimer_fd);
+    close(DumpStop_fd);
+    DumpTimer_fd = DumpStop_fd = -1;
+    return (res);
+}
+
+
 /*
  * Stops collecting counters, dumps the last values collected up to that time,
  * closes all files and releases internal resources.
@@ -1252,70 +8417,100 @@ Error stop_counters(void)
     if (BaseCtrActive == false)     /* Counters not started */
         return (MIXFKO);
 
-    /* Set both locks for base and aggregated counters */
+    /* Stop the dump thread (if any) before taking locks, it may be dumping counters */
+    StopDumpThread();
+
+    /* Set both locks for base and aggregated counters (after the one of alarms, which */
+    /* may be notified by another thread without holding BaseMutex) */
+    pthread_mutex_lock(&AlarmMutex);
     pthread_mutex_lock(&BaseMutex);
     pthread_mutex_lock(&AggrMutex);
 
+    /* Release all thread shards (if any) and the shared memory segment (if any) */
+    ReleaseShards();
+    CloseCtrSegment();
+
     /* Now close all files, free all allocated memory structures and reset all data */
     for (i = 0; i < MAXSCALARCTRNUM; i++)
     {
         scalarCtr[i].Name[0] = '\0';
-        scalarCtr[i].Type = 0;
-        scalarCtr[i].BaseVal = 0;
-        scalarCtr[i].AggrVal = 0;
+        scalarType[i] = UNDEFCTR;
+        scalarBaseVal[0][i] = scalarBaseVal[1][i] = 0;
+        scalarAggrVal[0][i] = scalarAggrVal[1][i] = 0;
     }
 
-    if (BaseCtr_fd != NULL)
-    {
-        fclose(BaseCtr_fd);
-        BaseCtr_fd = NULL;
-    }
-    if (AggrCtr_fd != NULL)
-    {
-        fclose(AggrCtr_fd);
-        AggrCtr_fd = NULL;
-    }
+    CloseCtrFiles(false);
+    CloseCtrFiles(true);
+    StopCtrWriter();
+    ReleaseSparseCtrs();
+    ReleaseHistoCtrs();
+    ReleaseSummaryCtrs();
+    ReleaseRateCtrs();
+    ReleaseTopkCtrs();
+    ReleaseDistinctCtrs();
+    ReleaseCtrAlarms();
+    CtrAlarmHook = NULL;
 
     for (i = 0; i < MAXVECTORCTRNUM; i++)
     {
         vectorCtr[i].Name[0] = '\0';
         vectorCtr[i].InstName[0] = '\0';
-        vectorCtr[i].Type = 0;
-        vectorCtr[i].NumInstances = 0;
-        if (vectorCtr[i].BaseVal)
-            free(vectorCtr[i].BaseVal);
-        vectorCtr[i].BaseVal = NULL;
-        if (vectorCtr[i].AggrVal)
-            free(vectorCtr[i].AggrVal);
-        vectorCtr[i].AggrVal = NULL;
+        vectorHot[i].Type = UNDEFCTR;
+        vectorHot[i].NumInstances = 0;
+        if (vectorCtr[i].BaseMem)
+            free(vectorCtr[i].BaseMem);
+        if (vectorCtr[i].AggrMem)
+            free(vectorCtr[i].AggrMem);
+        vectorCtr[i].BaseMem = vectorCtr[i].AggrMem = NULL;
+        SetVectorValues(i, UNDEFCTR, 0, NULL, NULL);
         if (vectorCtr[i].InstIdName)
             free(vectorCtr[i].InstIdName);
         vectorCtr[i].InstIdName = NULL;
-        if (vectorCtr[i].BaseCtr_fd != NULL)
-        {
-            fclose(vectorCtr[i].BaseCtr_fd);
-            vectorCtr[i].BaseCtr_fd = NULL;
-        }
-        if (vectorCtr[i].AggrCtr_fd != NULL)
-        {
-            fclose(vectorCtr[i].AggrCtr_fd);
-            vectorCtr[i].AggrCtr_fd = NULL;
-        }
     }   /* for (i = 0; i < MAXVECTORCTRNUM; i++) */
 
     /* Finally, restore all default values for global variables */
-    numScalarCtr = numVectorCtr = 0;
+    numScalarCtr = numVectorCtr = numSparseCtr = numHistoCtr = numSummaryCtr = numRateCtr = numTopkCtr = numDistinctCtr = 0;
+    ResetCtrRegistry(CTRSCALAR);
+    ResetCtrRegistry(CTRVECTOR);
     cumVectorInst = 0;
     BaseCtrDir[0] = '\0';
     AggrCtrDir[0] = '\0';
     BaseDumpTimes[0] = '\0';
     AggrDumpTimes[0] = '\0';
-    BaseNextDump = AggrNextDump = NULL;
+    memset(BaseDumpMap, 0, sizeof(BaseDumpMap));
+    memset(AggrDumpMap, 0, sizeof(AggrDumpMap));
+    BaseDumpPeriod = 0;
+    BaseNextDumpTime = AggrNextDumpTime = NODUMPTIME;
+    BaseLastDumpTime = AggrLastDumpTime = 0;
+    CtrUpdateMode = CTRPLAINMODE;
+    CtrStorage = CTRHEAPSTORAGE;
+    CtrStorageName[0] = '\0';
     BaseCtrActive = AggrCtrActive = false;
+    BaseEpoch = AggrEpoch = 0;
+    free(BaseRowBuf);
+    free(AggrRowBuf);
+    BaseRowBuf = AggrRowBuf = NULL;
+    free(BaseSparseBuf);
+    free(AggrSparseBuf);
+    BaseSparseBuf = AggrSparseBuf = NULL;
+    free(BaseHistoBuf);
+    free(AggrHistoBuf);
+    BaseHistoBuf = AggrHistoBuf = NULL;
+    SetHistoPercentiles(4, DefaultHistoPct);
+    CtrDumpFormat = CTRCSVDUMP;
+    CtrDumpSync = CTRNOSYNC;
+    BaseUnsyncedDumps = AggrUnsyncedDumps = 0;
+    CtrDumpWriter = CTRDIRECTWRITER;
+    free(BasePrevVal);
+    free(AggrPrevVal);
+    BasePrevVal = AggrPrevVal = NULL;
+    ReleaseCtrHistory();
+    CtrHistoryDepth[0] = CtrHistoryDepth[1] = 0;
 
     /* Release Locks */
     pthread_mutex_unlock(&AggrMutex);
     pthread_mutex_unlock(&BaseMutex);
+    pthread_mutex_unlock(&AlarmMutex);
 
     return (MIXFOK);
 
@@ -1327,184 +8522,21 @@ Error stop_counters(void)
  * Base and Aggr Dump Times. If they coincide, it writes a row in the
  * corresponding scalar and vector files. In order for counters to be
  * regularly dumped to files, this function shall be called at regular
- * intervals during code execution.
+ * intervals during code execution. When no dump is due, it only compares the
+ * current time with the precomputed next dump time. Dump times missed since
+ * the previous call are written as rows with empty values (up to one day),
+ * while values accumulated so far are written in the row of the last elapsed
+ * dump time. Calling this function is not needed if counters have been started through
+ * start_counters_async(): in that case dumps are performed by a library thread
+ * and this function has no effect (it just returns MIXFOK).
  * It returns MIXFKO if counters have not been defined/started,
  * MIXFNOACCESS if it is not able to write counters to file, MIXFOK in any
  * other case.
  */
- Error check_and_dump_ctr(void)
+Error check_and_dump_ctr(void)
 {
-    /* Local variables */
-    ShortString CurrentDate, TimeStamp;
-    Error       result;
-    bool        DumpBase = false,
-                DumpAggr = false;
-    char        Time[5];
-    int         i,j;
-
-    /* Check if counters are actually running */
-    if ( (BaseCtrActive==false) || (BaseCtrDir[0]=='\0') )  /* Either counters not started yet or define_base_dump() not called */
-        return (MIXFKO);
-
-    /* First check if there is something to dump */
-    retrieve_time_date(TimeStamp,"%d/%m/%Y,%H:%M");
-
-    /* Check first Base counters                       */
-    /* Retrieve minutes (mm) from Timestamp (dd/mm/yyyy,hh:mm) */
-    Time[0] = TimeStamp[14];
-    Time[1] = TimeStamp[15];
-    Time[2] = '\0';
-    if (BaseNextDump)
-    {   /* BaseNextDump is not NULL, i.e. it points to the next
-           dump time (minutes) within BaseDumpTimes string */
-        if (strncmp(Time,BaseNextDump,2)==0)
-        {   /* Current value of minutes is equal to the next base dump time */
-            /* (i.e. it is time to dump base counters) */
-            DumpBase = true;
-            BaseNextDump += 3;
-            if ( (int)(BaseNextDump-BaseDumpTimes)>=strlen(BaseDumpTimes))
-                BaseNextDump = BaseDumpTimes;
-        }   /* if (strncmp(Time,BaseNextDump)==0) */
-    }   /* if (BaseNextDump) */
-    else
-    {   /* BaseNextDump is NULL, i.e. this is the first row of counters
-           in the base dump files */
-        if ( (BaseNextDump=strstr(BaseDumpTimes,Time)) )
-        {   /* Current value of minutes is contained in the list of base dump times */
-            /* (i.e. it is time to dump base counters) */
-            DumpBase = true;
-            BaseNextDump += 3;
-            if ( (int)(BaseNextDump-BaseDumpTimes)>=strlen(BaseDumpTimes))
-                BaseNextDump = BaseDumpTimes;
-        }   /* if ( BaseNextDump=strstr(BaseDumpTimes,Time) ) */
-    }   /* else if (BaseNextDump) */
-
-    /* If Aggregation has been defined, check also Aggregate Counters */
-    if (AggrCtrActive)
-    {   /* Retrieve hours and minutes (hhmm) from Timestamp (dd/mm/yyyy,hh:mm)*/
-        Time[0] = TimeStamp[11];
-        Time[1] = TimeStamp[12];
-        Time[2] = TimeStamp[14];
-        Time[3] = TimeStamp[15];
-        Time[4] = '\0';
-
-        if (AggrNextDump)
-        {   /* AggrNextDump is not NULL, i.e. it points to the next
-            dump time (hours/minutes) within AggrDumpTimes string */
-            if (strncmp(Time,AggrNextDump,4)==0)
-            {   /* Current value of hours/minutes is equal to the next aggr dump time */
-                /* (i.e. it is time to dump aggr counters) */
-                DumpAggr = true;
-                AggrNextDump += 5;
-                if ( (int)(AggrNextDump-AggrDumpTimes)>=strlen(AggrDumpTimes))
-                    AggrNextDump = AggrDumpTimes;
-            }   /* if (strncmp(Time,AggrNextDump)==0) */
-        }   /* if (AggrNextDump) */
-        else
-        {   /* AggrNextDump is NULL, i.e. this is the first row of counters
-            in the aggr dump files */
-            if ( (AggrNextDump=strstr(AggrDumpTimes,Time)) )
-            {   /* Current value of hours/minutes is contained in the list of aggr dump times */
-                /* (i.e. it is time to dump aggr counters) */
-                DumpAggr = true;
-                AggrNextDump += 5;
-                if ( (int)(AggrNextDump-AggrDumpTimes)>=strlen(AggrDumpTimes))
-                    AggrNextDump = AggrDumpTimes;
-            }   /* if ( AggrNextDump=strstr(AggrDumpTimes,Time) ) */
-        }   /* else if (AggrNextDump) */
-    }   /* if (AggrCtrActive) */
-
-    retrieve_time_date(CurrentDate, "%d%m%Y");
-
-    /* Dump Base counters if needed */
-    if (DumpBase)
-    {
-        /* Enter the critical section for base counters */
-        pthread_mutex_lock(&BaseMutex);
-
-        /* Check if base counters shall be rotated */
-        if ( strcmp(CurrentDate,BaseDumpOpenDate) )
-            if ( (result=CloseReopenBaseCounters()) != MIXFOK)
-            {
-                pthread_mutex_unlock(&BaseMutex);
-                return (result);
-            }
-
-        /* Dump Scalar Counters (PEG and ROLLER) */
-        fprintf(BaseCtr_fd,"%s,",TimeStamp);
-        for (i = 0; i < (numScalarCtr - 1); i++)
-            fprintf(BaseCtr_fd, "%u,", scalarCtr[i].BaseVal);
-        fprintf(BaseCtr_fd, "%u\n", scalarCtr[numScalarCtr - 1].BaseVal);
-
-        /* Dump Vector Counter (PEG and ROLLER) */
-        for (i = 0; i<numVectorCtr; i++)
-        {
-            fprintf(vectorCtr[i].BaseCtr_fd,"%s,",TimeStamp);
-            for (j = 0; j < (vectorCtr[i].NumInstances - 1); j++)
-                fprintf(vectorCtr[i].BaseCtr_fd, "%u,", vectorCtr[i].BaseVal[j]);
-            fprintf(vectorCtr[i].BaseCtr_fd, "%u\n", vectorCtr[i].BaseVal[j]);
-        }
-
-        /* Reset PEG Scalar Counters */
-        for (i = 0; i < numScalarCtr; i++)
-            if (scalarCtr[i].Type == PEGCTR)
-                scalarCtr[i].BaseVal = 0;
-
-        /* Reset PEG Vector Counters */
-        for (i = 0; i < numVectorCtr; i++)
-            if (vectorCtr[i].Type == PEGCTR)
-                for (j = 0; j < vectorCtr[i].NumInstances; j++)
-                    vectorCtr[i].BaseVal[j] = 0;
-
-        fflush (NULL);
-        /* Exit from the critical section for base counters */
-        pthread_mutex_unlock(&BaseMutex);
-    }   /* if (DumpBase) */
-
-        /* Dump Aggr counters if needed */
-    if (DumpAggr)
-    {
-        /* Enter the critical section for aggr counters */
-        pthread_mutex_lock(&AggrMutex);
-
-        /* Check if aggr counters shall be rotated */
-        if ( strcmp(CurrentDate,AggrDumpOpenDate) )
-            if ( (result=CloseReopenAggrCounters()) != MIXFOK)
-            {
-                pthread_mutex_unlock(&AggrMutex);
-                return (result);
-        }
-
-        /* Dump Scalar Counters (PEG and ROLLER) */
-        fprintf(AggrCtr_fd,"%s,",TimeStamp);
-        for (i = 0; i < (numScalarCtr - 1); i++)
-            fprintf(AggrCtr_fd, "%u,", scalarCtr[i].AggrVal);
-        fprintf(AggrCtr_fd, "%u\n", scalarCtr[numScalarCtr - 1].AggrVal);
-
-        /* Dump Vector Counter (PEG and ROLLER) */
-        for (i = 0; i<numVectorCtr; i++)
-        {
-            fprintf(vectorCtr[i].AggrCtr_fd,"%s,",TimeStamp);
-            for (j = 0; j < (vectorCtr[i].NumInstances - 1); j++)
-                fprintf(vectorCtr[i].AggrCtr_fd, "%u,", vectorCtr[i].AggrVal[j]);
-            fprintf(vectorCtr[i].AggrCtr_fd, "%u\n", vectorCtr[i].AggrVal[j]);
-        }
-
-        /* Reset PEG Scalar Counters */
-        for (i = 0; i < numScalarCtr; i++)
-            if (scalarCtr[i].Type == PEGCTR)
-                scalarCtr[i].AggrVal = 0;
-
-        /* Reset PEG Vector Counters */
-        for (i = 0; i < numVectorCtr; i++)
-            if (vectorCtr[i].Type == PEGCTR)
-                for (j = 0; j < vectorCtr[i].NumInstances; j++)
-                    vectorCtr[i].AggrVal[j] = 0;
-
-        fflush (NULL);
-        /* Exit from the critical section for base counters */
-        pthread_mutex_unlock(&AggrMutex);
-    }   /* if (DumpAggr) */
+    if (DumpThreadActive)   /* Dumps are handled by DumpThread */
+        return (MIXFOK);
 
-    return (MIXFOK);
+    return (CheckAndDumpCtr());
 }
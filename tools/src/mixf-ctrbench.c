@@ -0,0 +1,294 @@
+/**********************************************************************************
+ * -----------------------------------------                                      *
+ * C/C++ Mixed Functions Library (libmixf)                                        *
+ * -----------------------------------------                                      *
+ * Copyright 2019-2026 Roberto Mameli                                             *
+ *                                                                                *
+ * Licensed under the Apache License, Version 2.0 (the "License");                *
+ * you may not use this file except in compliance with the License.               *
+ * You may obtain a copy of the License at                                        *
+ *                                                                                *
+ *     http://www.apache.org/licenses/LICENSE-2.0                                 *
+ *                                                                                *
+ * Unless required by applicable law or agreed to in writing, software            *
+ * distributed under the License is distributed on an "AS IS" BASIS,              *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.       *
+ * See the License for the specific language governing permissions and            *
+ * limitations under the License.                                                 *
+ * ------------------------------------------------------------------------       *
+ *                                                                                *
+ * FILE:        mixf-ctrbench.c                                                   *
+ *                                                                                *
+ * DESCRIPTION: This tool measures the cost of Counters Handling functions on a   *
+ *              single thread, with 1024 Peg Scalar Counters and 64 Peg Vector    *
+ *              Counters of 1024 instances each (65536 instances overall):        *
+ *                  - increment throughput of incr_peg_scalar_ctr() and           *
+ *                    incr_peg_vector_ctr(), with counters chosen at random       *
+ *                    (ns per call)                                               *
+ *                  - latency of check_and_dump_ctr() when a base dump is due     *
+ *                    (minimum and average over the dumps performed)              *
+ *                  - dump rows written per second by check_and_dump_ctr(),       *
+ *                    compared with the same rows written through one fprintf()   *
+ *                    per value, as libmixf did before its row encoder (the       *
+ *                    reference rows go to fprintf_*.csv files)                   *
+ *              Increments are spread over the dumps, so that every dump writes   *
+ *              non-null values. Dump files are written into a scratch directory. *
+ *                                                                                *
+ * USAGE:       mixf-ctrbench [-d dir] [-n increments] [-k dumps] [-m]            *
+ *                  -d  directory of dump files (default /tmp/mixf-ctrbench)      *
+ *                  -n  increments of each kind (default 50000000)                *
+ *                  -k  number of base dumps (default 5)                          *
+ *                  -m  dump at every minute instead of every second, e.g. to     *
+ *                      compare with libraries without "every Ns" schedules       *
+ *                      (each dump waits for the next minute)                     *
+ *                                                                                *
+ * NOTE WELL:   The tool only uses functions available since the first release   *
+ *              of Counters Handling, so that the same source can be linked with  *
+ *              a library built from an older revision to compare results         *
+ *              (before/after). It is built with "make bench".                    *
+ **********************************************************************************/
+
+
+/**********************
+ * Linux system files *
+ **********************/
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+/******************
+ * libmixf header *
+ ******************/
+#include "mixf.h"
+
+
+#define BENCHSCALARS     1024           /* Number of Scalar Counters */
+#define BENCHVECTORS       64           /* Number of Vector Counters */
+#define BENCHINSTANCES   1024           /* Number of instances of each Vector Counter */
+#define BENCHROWS        (1 + BENCHVECTORS) /* Rows of each dump (Scalar Counters and each Vector Counter) */
+
+
+static FILE        *RefFile[BENCHROWS];                             /* Files of the fprintf() reference path */
+static uint32_t     RefVal[BENCHROWS][BENCHINSTANCES];              /* Values of the rows of the reference path */
+
+
+/* Gives back a monotonic time in seconds */
+static double Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((double)ts.tv_sec + (double)ts.tv_nsec * 1e-9);
+}
+
+
+/* Sleeps until the beginning of the next second (or minute), i.e. the next dump time */
+static void WaitDumpTime(bool minutes)
+{
+    struct timespec ts;
+    long            period = minutes ? 60 : 1;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec = period - 1 - ts.tv_sec % period;
+    ts.tv_nsec = 1000000000L - ts.tv_nsec + 20000000L; /* 20 ms after the boundary, since */
+                                                        /* time() may use a coarse clock */
+    if (ts.tv_nsec >= 1000000000L)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    nanosleep(&ts, NULL);
+}
+
+
+/* Linear congruential generator, enough to pick counters at random */
+static uint32_t NextRandom(uint32_t *x)
+{
+    *x = *x * 1664525u + 1013904223u;
+
+    return (*x >> 8);
+}
+
+
+/* Opens the files of the fprintf() reference path, gives back false in case of errors */
+static bool OpenRefFiles(const char *dir)
+{
+    char    path[320];
+    int     i;
+
+    for (i = 0; i < BENCHROWS; i++)
+    {
+        if (i == 0)
+            snprintf(path, sizeof(path), "%s/fprintf_scalar.csv", dir);
+        else
+            snprintf(path, sizeof(path), "%s/fprintf_vector_%d.csv", dir, i - 1);
+        if ((RefFile[i] = fopen(path, "a")) == NULL)
+            return (false);
+    }
+
+    return (true);
+}
+
+
+/* Fetches the current base values of all counters, i.e. the values of the next dump */
+static void FetchRefValues(void)
+{
+    uint32_t    aggr;
+    uint16_t    i, j;
+
+    for (j = 0; j < BENCHSCALARS; j++)
+        retrieve_peg_scalar_ctr(j, &RefVal[0][j], &aggr);
+    for (i = 0; i < BENCHVECTORS; i++)
+        for (j = 0; j < BENCHINSTANCES; j++)
+            retrieve_peg_vector_ctr(i, j, &RefVal[i + 1][j], &aggr);
+}
+
+
+/* Writes the rows of a dump with one fprintf() per value, then flushes them (as */
+/* check_and_dump_ctr() did before the row encoder) */
+static void WriteRefRows(void)
+{
+    char        stamp[32];
+    time_t      now = time(NULL);
+    struct tm   tm;
+    int         i, j, num;
+
+    strftime(stamp, sizeof(stamp), "%d/%m/%Y,%H:%M", localtime_r(&now, &tm));
+    for (i = 0; i < BENCHROWS; i++)
+    {
+        num = (i == 0) ? BENCHSCALARS : BENCHINSTANCES;
+        fprintf(RefFile[i], "%s,", stamp);
+        for (j = 0; j < num - 1; j++)
+            fprintf(RefFile[i], "%" PRIu32 ",", RefVal[i][j]);
+        fprintf(RefFile[i], "%" PRIu32 "\n", RefVal[i][num - 1]);
+    }
+    fflush(NULL);
+}
+
+
+int main (int argc, char *argv[])
+{
+    char        dir[256] = "/tmp/mixf-ctrbench",
+                times[200],
+                name[40];
+    long        numIncr = 50000000L,
+                i;
+    int         numDumps = 5,
+                opt,
+                d;
+    bool        minutes = false;
+    uint32_t    x = 1,
+                r;
+    uint16_t    inst;
+    double      t0,
+                scalarTime = 0.0,
+                vectorTime = 0.0,
+                dumpTime = 0.0,
+                dumpMin = 0.0,
+                refTime = 0.0;
+
+    while ((opt = getopt(argc, argv, "d:n:k:m")) != -1)
+        switch (opt)
+        {
+            case 'd':
+                snprintf(dir, sizeof(dir), "%s", optarg);
+                break;
+            case 'n':
+                numIncr = atol(optarg);
+                break;
+            case 'k':
+                numDumps = atoi(optarg);
+                break;
+            case 'm':
+                minutes = true;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-d dir] [-n increments] [-k dumps] [-m]\n", argv[0]);
+                return (1);
+        }
+    if ((numIncr <= 0) || (numDumps <= 0))
+    {
+        fprintf(stderr, "%s: increments and dumps shall be positive\n", argv[0]);
+        return (1);
+    }
+    mkdir(dir, 0755);
+    if (!OpenRefFiles(dir))
+    {
+        fprintf(stderr, "%s: cannot open files in dump directory %s\n", argv[0], dir);
+        return (1);
+    }
+
+    /* Define counters and start them, with a base dump at every second (or minute) */
+    define_scalar_ctr_num(BENCHSCALARS);
+    for (i = 0; i < BENCHSCALARS; i++)
+    {
+        sprintf(name, "Scalar%ld", i);
+        define_scalar_ctr((uint16_t)i, PEGCTR, 0, name);
+    }
+    define_vector_ctr_num(BENCHVECTORS);
+    for (i = 0; i < BENCHVECTORS; i++)
+    {
+        sprintf(name, "Vector%ld", i);
+        define_vector_ctr((uint16_t)i, BENCHINSTANCES, PEGCTR, 0, name, "Instance");
+    }
+    if (minutes)
+        for (i = 0, times[0] = '\0'; i < 60; i++)
+            sprintf(times + strlen(times), i ? ",%02ld" : "%02ld", i);
+    else
+        strcpy(times, "every 1s");
+    if ((define_base_dump(dir, NULL, times) != MIXFOK) || (start_counters() != MIXFOK))
+    {
+        fprintf(stderr, "%s: cannot start counters (dump directory %s)\n", argv[0], dir);
+        return (1);
+    }
+
+    /* The first dump after start may also have to write headers: wait for it */
+    WaitDumpTime(minutes);
+    check_and_dump_ctr();
+
+    for (d = 0; d < numDumps; d++)
+    {
+        t0 = Now();
+        for (i = d * numIncr / numDumps; i < (d + 1) * numIncr / numDumps; i++)
+            incr_peg_scalar_ctr(NextRandom(&x) % BENCHSCALARS);
+        scalarTime += Now() - t0;
+
+        t0 = Now();
+        for (i = d * numIncr / numDumps; i < (d + 1) * numIncr / numDumps; i++)
+        {
+            r = NextRandom(&x);
+            inst = r % BENCHINSTANCES;
+            incr_peg_vector_ctr(r / BENCHINSTANCES % BENCHVECTORS, &inst);
+        }
+        vectorTime += Now() - t0;
+
+        FetchRefValues();
+        t0 = Now();
+        WriteRefRows();
+        refTime += Now() - t0;
+
+        WaitDumpTime(minutes);
+        t0 = Now();
+        check_and_dump_ctr();
+        t0 = Now() - t0;
+        dumpTime += t0;
+        if ((d == 0) || (t0 < dumpMin))
+            dumpMin = t0;
+    }
+    stop_counters();
+
+    printf("scalar incr %.2f ns/op, vector incr %.2f ns/op, dump %.2f ms (min %.2f ms, %d dumps)\n",
+           scalarTime / numIncr * 1e9, vectorTime / numIncr * 1e9,
+           dumpTime / numDumps * 1e3, dumpMin * 1e3, numDumps);
+    printf("dump rows %.0f rows/s, fprintf() rows %.0f rows/s (%d rows, %d values per dump)\n",
+           BENCHROWS * numDumps / dumpTime, BENCHROWS * numDumps / refTime,
+           BENCHROWS, BENCHSCALARS + BENCHVECTORS * BENCHINSTANCES);
+
+    return (0);
+}
@@ -0,0 +1,879 @@
+/**********************************************************************************
+ * -----------------------------------------                                      *
+ * C/C++ Mixed Functions Library (libmixf)                                        *
+ * -----------------------------------------                                      *
+ * Copyright 2019-2026 Roberto Mameli                                             *
+ *                                                                                *
+ * Licensed under the Apache License, Version 2.0 (the "License");                *
+ * you may not use this file except in compliance with the License.               *
+ * You may obtain a copy of the License at                                        *
+ *                                                                                *
+ *     http://www.apache.org/licenses/LICENSE-2.0                                 *
+ *                                                                                *
+ * Unless required by applicable law or agreed to in writing, software            *
+ * distributed under the License is distributed on an "AS IS" BASIS,              *
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.       *
+ * See the License for the specific language governing permissions and            *
+ * limitations under the License.                                                 *
+ * ------------------------------------------------------------------------       *
+ *                                                                                *
+ * FILE:        mixf-ctrdump.c                                                    *
+ *                                                                                *
+ * DESCRIPTION: This tool converts binary counter dump files, written by libmixf  *
+ *              when define_ctr_dump_format(CTRBINDUMP) is used, back to the      *
+ *              CSV files written by default:                                     *
+ *                  counters_<stamp>.bin      -> scalar_<stamp>.csv               *
+ *                                               vector_<i>_<stamp>.csv           *
+ *                                               sparse_<i>_<stamp>.csv           *
+ *                                               histo_<i>_<stamp>.csv            *
+ *                                               summary_<i>_<stamp>.csv          *
+ *                                               rates_<stamp>.csv                *
+ *                                               topk_<i>_<stamp>.csv             *
+ *                                               distinct_<stamp>.csv             *
+ *                  counters_aggr_<stamp>.bin -> scalar_aggr_<stamp>.csv          *
+ *                                               vector_<i>_aggr_<stamp>.csv      *
+ *                                               sparse_<i>_aggr_<stamp>.csv      *
+ *                                               histo_<i>_aggr_<stamp>.csv       *
+ *                                               summary_<i>_aggr_<stamp>.csv     *
+ *                                               rates_aggr_<stamp>.csv           *
+ *                                               topk_<i>_aggr_<stamp>.csv        *
+ *                                               distinct_aggr_<stamp>.csv        *
+ *              CSV files are created in the output directory (the current one    *
+ *              by default) or appended to if they already exist; header rows     *
+ *              are written only into empty files, as libmixf does.               *
+ *                                                                                *
+ * USAGE:       mixf-ctrdump [-d outdir] file.bin [file.bin ...]                  *
+ *                                                                                *
+ * NOTE WELL:   The format of binary dump files is described in mixf.h and in     *
+ *              docs/libmixf.md (see define_ctr_dump_format()). The tool only     *
+ *              needs the libmixf header, it is not linked with the library.      *
+ **********************************************************************************/
+
+
+/**********************
+ * Linux system files *
+ **********************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/******************
+ * libmixf header *
+ ******************/
+#include "mixf.h"
+
+
+#define MAXSPARSETABLES     64          /* Max number of sparse counters (MAXSPARSECTRNUM in libmixf) */
+#define MAXHISTOTABLES      64          /* Max number of histogram counters (MAXHISTOCTRNUM in libmixf) */
+#define MAXHISTOVALUES      12          /* Max number of values of a histogram counter (HISTOSTATS in libmixf) */
+#define MAXSUMMARYTABLES   256          /* Max number of summary counters (MAXSUMMARYCTRNUM in libmixf) */
+#define MAXRATES            64          /* Max number of counter rates (MAXRATECTRNUM in libmixf) */
+#define RATECOLUMNS          6          /* Values of each rate: EWMAs and window averages over 1, 5 and 15 minutes */
+#define MAXTOPKTABLES       64          /* Max number of top-K counters (MAXTOPKCTRNUM in libmixf) */
+#define MAXDISTINCT         64          /* Max number of distinct counters (MAXDISTINCTCTRNUM in libmixf) */
+
+
+/* Description of a counter table (the scalar one, a vector one, a sparse, histogram, summary or top-K one, the rates or distinct one) within a schema block */
+typedef struct
+{
+    FILE       *fd;             /* Output CSV file (NULL for sparse, histogram, summary and top-K counters not defined) */
+    uint16_t    numValues;      /* Number of values in each row (0 for sparse and top-K counters) */
+    uint8_t    *type;           /* Type of each value (counter type, key type for top-K counters) */
+    bool        sparse;         /* Rows are written by sparse blocks (key and value) */
+    bool        topk;           /* Rows are written by top-K blocks (key, count and error) */
+    bool        stats;          /* Rows are written by histogram, summary, rate or distinct blocks, not by row blocks */
+} CtrTable;
+
+static CtrTable    *Tables = NULL;
+static int          numTables = 0;
+static int          SparseBase = 0;     /* Index of the table of the first sparse counter */
+static int          HistoBase = 0;      /* Index of the table of the first histogram counter */
+static int          SummaryBase = 0;    /* Index of the table of the first summary counter */
+static int          RateTable = -1;     /* Index of the table of rates (-1 if not described) */
+static int          TopkBase = 0;       /* Index of the table of the first top-K counter */
+static int          DistinctTable = -1; /* Index of the table of distinct counters (-1 if not described) */
+static uint64_t    *PrevVal = NULL;     /* Values of the previous row (CTRDELTAENC) */
+static int          numValues = 0;
+static bool         Seconds = false;
+
+
+/* Reads n bytes in little-endian order */
+static uint64_t GetLE(const uint8_t *p, int n)
+{
+    uint64_t    v = 0;
+
+    while (n-- > 0)
+        v = (v << 8) | p[n];
+
+    return (v);
+}
+
+
+/* Reads a LEB128 varint, returns NULL if it exceeds end */
+static const uint8_t *GetVarint(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+    int     shift;
+
+    for (*v = 0, shift = 0; (p < end) && (shift < 64); shift += 7)
+    {
+        *v |= (uint64_t)(*p & 0x7F) << shift;
+        if ((*p++ & 0x80) == 0)
+            return (p);
+    }
+
+    return (NULL);
+}
+
+
+/* Reads a string preceded by its length, returns NULL if it exceeds end */
+static const uint8_t *GetString(const uint8_t *p, const uint8_t *end, char *s)
+{
+    if ((p >= end) || (p + 1 + *p > end))
+        return (NULL);
+    memcpy(s, p + 1, *p);
+    s[*p] = '\0';
+
+    return (p + 1 + *p);
+}
+
+
+/* Closes all output files and releases the current schema */
+static void ReleaseSchema(void)
+{
+    int     i;
+
+    for (i = 0; i < numTables; i++)
+    {
+        if (Tables[i].fd != NULL)
+            fclose(Tables[i].fd);
+        free(Tables[i].type);
+    }
+    free(Tables);
+    free(PrevVal);
+    Tables = NULL;
+    PrevVal = NULL;
+    numTables = numValues = SparseBase = HistoBase = SummaryBase = TopkBase = 0;
+    RateTable = DistinctTable = -1;
+}
+
+
+/* Opens an output CSV file in append mode, returns true if it is empty */
+static FILE *OpenCsv(const char *dir, const char *name, bool *empty)
+{
+    char    path[4096];
+    FILE   *fd;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if ((fd = fopen(path, "a")) == NULL)
+    {
+        fprintf(stderr, "mixf-ctrdump: cannot open %s\n", path);
+        return (NULL);
+    }
+    fseek(fd, 0, SEEK_END);
+    *empty = (ftell(fd) == 0);
+
+    return (fd);
+}
+
+
+/* Parses a schema block, opens all output files and writes header rows (if empty) */
+static int ParseSchema(const uint8_t *p, const uint8_t *end, const char *dir, const char *stamp)
+{
+    char        name[256], inst[256], file[600], pct[MAXRATES * RATECOLUMNS * 264];
+    uint16_t    numScalar, numVector, numSparse = 0, numHisto = 0, numPct = 0, numSummary = 0, numRates = 0, numTopk = 0,
+                numDistinct = 0, n;
+    bool        empty;
+    int         i, j;
+
+    ReleaseSchema();
+    if ((end - p < 16) || memcmp(p, CTRDUMPMAGIC, sizeof(CTRDUMPMAGIC)) || (GetLE(p + 8, 2) != CTRDUMPVERSION))
+        return (-1);
+    Seconds = (GetLE(p + 10, 2) & CTRSCHEMASECONDS) != 0;
+    numScalar = GetLE(p + 12, 2);
+    numVector = GetLE(p + 14, 2);
+    p += 16;
+
+    numTables = 1 + numVector;
+    if ((Tables = (CtrTable *)calloc(numTables + MAXSPARSETABLES + MAXHISTOTABLES + MAXSUMMARYTABLES + 1 + MAXTOPKTABLES + 1,
+                                 sizeof(CtrTable))) == NULL)
+        return (-1);
+
+    /* Scalar Counters table */
+    snprintf(file, sizeof(file), "scalar_%s.csv", stamp);
+    if ((Tables[0].fd = OpenCsv(dir, file, &empty)) == NULL)
+        return (-1);
+    Tables[0].numValues = numScalar;
+    Tables[0].type = (uint8_t *)malloc(numScalar + 1);
+    if (empty)
+        fprintf(Tables[0].fd, "Date,Time,");
+    for (i = 0; i < numScalar; i++)
+    {
+        if (p >= end)
+            return (-1);
+        Tables[0].type[i] = *p;
+        if ((p = GetString(p + 1, end, name)) == NULL)
+            return (-1);
+        if (empty)
+            fprintf(Tables[0].fd, (i < numScalar - 1) ? "%s," : "%s\n", name);
+    }
+    numValues = numScalar;
+
+    /* Vector Counters tables */
+    for (i = 0; i < numVector; i++)
+    {
+        if (p >= end)
+            return (-1);
+        n = *p;
+        if (((p = GetString(p + 1, end, name)) == NULL) || ((p = GetString(p, end, inst)) == NULL) || (end - p < 2))
+            return (-1);
+        Tables[1 + i].numValues = GetLE(p, 2);
+        p += 2;
+        Tables[1 + i].type = (uint8_t *)malloc(Tables[1 + i].numValues + 1);
+        memset(Tables[1 + i].type, n, Tables[1 + i].numValues + 1);
+        numValues += Tables[1 + i].numValues;
+
+        snprintf(file, sizeof(file), "vector_%d_%s.csv", i, stamp);
+        if ((Tables[1 + i].fd = OpenCsv(dir, file, &empty)) == NULL)
+            return (-1);
+        if (empty)
+            fprintf(Tables[1 + i].fd, "Vector Counter: %s - Instances: %s\nDate,Time,", name, inst);
+        for (j = 0; j < Tables[1 + i].numValues; j++)
+        {
+            if ((p = GetString(p, end, inst)) == NULL)
+                return (-1);
+            if (empty)
+                fprintf(Tables[1 + i].fd, (j < Tables[1 + i].numValues - 1) ? "%s," : "%s\n", inst);
+        }
+    }
+
+    /* Sparse counters tables (only if described at the end of the schema) */
+    SparseBase = numTables;
+    if (end - p >= 2)
+    {
+        numSparse = GetLE(p, 2);
+        p += 2;
+    }
+    if (numSparse > MAXSPARSETABLES)
+        return (-1);
+    for (i = 0; i < numSparse; i++, numTables++)
+    {
+        if (p >= end)
+            return (-1);
+        n = *p;
+        if (((p = GetString(p + 1, end, name)) == NULL) || ((p = GetString(p, end, inst)) == NULL))
+            return (-1);
+        Tables[numTables].sparse = true;
+        Tables[numTables].type = (uint8_t *)malloc(1);
+        Tables[numTables].type[0] = n;
+        if (n == 0xFF)      /* Not defined, no file */
+            continue;
+
+        snprintf(file, sizeof(file), "sparse_%d_%s.csv", i, stamp);
+        if ((Tables[numTables].fd = OpenCsv(dir, file, &empty)) == NULL)
+            return (-1);
+        if (empty)
+            fprintf(Tables[numTables].fd, "Sparse Counter: %s - Keys: %s\nDate,Time,%s,%s\n", name, inst, inst, name);
+    }
+
+    /* Histogram counters tables (only if described after sparse ones) */
+    HistoBase = numTables;
+    if (end - p >= 3)
+    {
+        numHisto = GetLE(p, 2);
+        numPct = p[2];
+        p += 3;
+    }
+    if ((numHisto > MAXHISTOTABLES) || (4 + numPct > MAXHISTOVALUES))
+        return (-1);
+    for (i = 0, n = 0; i < numPct; i++)
+    {   /* Column names of percentiles */
+        if ((p = GetString(p, end, inst)) == NULL)
+            return (-1);
+        n += snprintf(pct + n, sizeof(pct) - n, ",%s", inst);
+    }
+    for (i = 0; i < numHisto; i++, numTables++)
+    {
+        if (p >= end)
+            return (-1);
+        n = *p;
+        if ((p = GetString(p + 1, end, name)) == NULL)
+            return (-1);
+        Tables[numTables].stats = true;
+        Tables[numTables].numValues = 4 + numPct;
+        if (n == 0)         /* Not defined, no file */
+            continue;
+
+        snprintf(file, sizeof(file), "histo_%d_%s.csv", i, stamp);
+        if ((Tables[numTables].fd = OpenCsv(dir, file, &empty)) == NULL)
+            return (-1);
+        if (empty)
+            fprintf(Tables[numTables].fd, "Histogram Counter: %s\nDate,Time,count,sum,min,max%s\n", name, pct);
+    }
+
+    /* Summary counters tables (only if described after histogram ones) */
+    SummaryBase = numTables;
+    if (end - p >= 2)
+    {
+        numSummary = GetLE(p, 2);
+        p += 2;
+    }
+    if (numSummary > MAXSUMMARYTABLES)
+        return (-1);
+    for (i = 0; i < numSummary; i++, numTables++)
+    {
+        if (p >= end)
+            return (-1);
+        n = *p;
+        if ((p = GetString(p + 1, end, name)) == NULL)
+            return (-1);
+        Tables[numTables].stats = true;
+        Tables[numTables].numValues = 4;
+        if (n == 0)         /* Not defined, no file */
+            continue;
+
+        snprintf(file, sizeof(file), "summary_%d_%s.csv", i, stamp);
+        if ((Tables[numTables].fd = OpenCsv(dir, file, &empty)) == NULL)
+            return (-1);
+        if (empty)
+            fprintf(Tables[numTables].fd, "Summary Counter: %s\nDate,Time,count,sum,min,max\n", name);
+    }
+
+    /* Table of rates (only if described after summary counters), with the columns of all defined rates */
+    if (end - p >= 2)
+    {
+        numRates = GetLE(p, 2);
+        p += 2;
+    }
+    if (numRates > MAXRATES)
+        return (-1);
+    if (numRates > 0)
+    {
+        for (i = 0, n = 0; i < numRates; i++)
+        {
+            if (p >= end)
+                return (-1);
+            j = *p;
+            if ((p = GetString(p + 1, end, name)) == NULL)
+                return (-1);
+            if (j != 0)     /* Not defined, no columns */
+                n += snprintf(pct + n, sizeof(pct) - n, ",%s ewma1m,%s ewma5m,%s ewma15m,%s avg1m,%s avg5m,%s avg15m",
+                              name, name, name, name, name, name);
+            Tables[numTables].numValues += (j != 0) ? RATECOLUMNS : 0;
+        }
+        RateTable = numTables++;
+        Tables[RateTable].stats = true;
+        snprintf(file, sizeof(file), "rates_%s.csv", stamp);
+        if ((Tables[RateTable].fd = OpenCsv(dir, file, &empty)) == NULL)
+            return (-1);
+        if (empty)
+            fprintf(Tables[RateTable].fd, "Counter Rates\nDate,Time%s\n", numRates ? pct : "");
+    }
+
+    /* Top-K counters tables (only if described after rates) */
+    TopkBase = numTables;
+    if (end - p >= 2)
+    {
+        numTopk = GetLE(p, 2);
+        p += 2;
+    }
+    if (numTopk > MAXTOPKTABLES)
+        return (-1);
+    for (i = 0; i < numTopk; i++, numTables++)
+    {
+        if (end - p < 3)
+            return (-1);
+        n = *p;
+        if (((p = GetString(p + 3, end, name)) == NULL) || ((p = GetString(p, end, inst)) == NULL))
+            return (-1);
+        Tables[numTables].topk = true;
+        Tables[numTables].type = (uint8_t *)malloc(1);
+        Tables[numTables].type[0] = n;
+        if (n == 0xFF)      /* Not defined, no file */
+            continue;
+
+        snprintf(file, sizeof(file), "topk_%d_%s.csv", i, stamp);
+        if ((Tables[numTables].fd = OpenCsv(dir, file, &empty)) == NULL)
+            return (-1);
+        if (empty)
+            fprintf(Tables[numTables].fd, "Top-K Counter: %s - Keys: %s\nDate,Time,%s,%s,error\n", name, inst, inst, name);
+    }
+
+    /* Table of distinct counters (only if described after top-K counters), with a column for each defined counter */
+    if (end - p >= 2)
+    {
+        numDistinct = GetLE(p, 2);
+        p += 2;
+    }
+    if (numDistinct > MAXDISTINCT)
+        return (-1);
+    if (numDistinct > 0)
+    {
+        pct[0] = '\0';
+        for (i = 0, n = 0; i < numDistinct; i++)
+        {
+            if (p >= end)
+                return (-1);
+            j = *p;
+            if ((p = GetString(p + 1, end, name)) == NULL)
+                return (-1);
+            if (j != 0)     /* Not defined, no column */
+                n += snprintf(pct + n, sizeof(pct) - n, ",%s", name);
+            Tables[numTables].numValues += (j != 0) ? 1 : 0;
+        }
+        DistinctTable = numTables++;
+        Tables[DistinctTable].stats = true;
+        snprintf(file, sizeof(file), "distinct_%s.csv", stamp);
+        if ((Tables[DistinctTable].fd = OpenCsv(dir, file, &empty)) == NULL)
+            return (-1);
+        if (empty)
+            fprintf(Tables[DistinctTable].fd, "Distinct Counters\nDate,Time%s\n", pct);
+    }
+
+    /* Differences (CTRDELTAENC) never span schema blocks */
+    if ((PrevVal = (uint64_t *)calloc(numValues + 1, sizeof(uint64_t))) == NULL)
+        return (-1);
+
+    return (0);
+}
+
+
+/* Formats the time stamp of a block as local time of the writer (slot + offset from UTC) */
+static int FormatStamp(const uint8_t *p, char *ts, size_t size)
+{
+    struct tm   tm;
+    time_t      t;
+
+    t = (time_t)(int64_t)GetLE(p, 8) + (time_t)(int32_t)GetLE(p + 8, 4);
+    gmtime_r(&t, &tm);
+
+    return ((int)strftime(ts, size, Seconds ? "%d/%m/%Y,%H:%M:%S" : "%d/%m/%Y,%H:%M", &tm));
+}
+
+
+/* Parses a row or gap block and appends a row to each output file */
+static int ParseRow(const uint8_t *p, const uint8_t *end, uint16_t type, uint16_t encoding)
+{
+    char        ts[64];
+    uint64_t    v, *prev;
+    int         i, j, len;
+
+    if ((Tables == NULL) || (end - p < 16))
+        return (-1);
+
+    len = FormatStamp(p, ts, sizeof(ts));
+    p += 16;
+
+    prev = PrevVal;
+    for (i = 0; i < numTables; i++)
+    {
+        if (Tables[i].sparse)
+        {   /* Sparse counters only get gap rows (empty key and value) */
+            if ((type == CTRBLKGAP) && (Tables[i].fd != NULL))
+                fprintf(Tables[i].fd, "%.*s,,\n", len, ts);
+            continue;
+        }
+        if (Tables[i].topk)
+        {   /* Top-K counters only get gap rows (empty key, count and error) */
+            if ((type == CTRBLKGAP) && (Tables[i].fd != NULL))
+                fprintf(Tables[i].fd, "%.*s,,,\n", len, ts);
+            continue;
+        }
+        if (Tables[i].stats)
+        {   /* Histogram, summary and distinct counters and rates only get gap rows (empty values) */
+            if ((type == CTRBLKGAP) && (Tables[i].fd != NULL))
+            {
+                fwrite(ts, 1, len, Tables[i].fd);
+                for (j = 0; j < Tables[i].numValues; j++)
+                    fputc(',', Tables[i].fd);
+                fputc('\n', Tables[i].fd);
+            }
+            continue;
+        }
+        fwrite(ts, 1, len, Tables[i].fd);
+        for (j = 0; j < Tables[i].numValues; j++, prev++)
+        {
+            if (type == CTRBLKGAP)
+            {
+                fputc(',', Tables[i].fd);
+                continue;
+            }
+            if (encoding & CTRDELTAENC)
+            {
+                if ((p = GetVarint(p, end, &v)) == NULL)
+                    return (-1);
+                v = *prev + ((v >> 1) ^ (0 - (v & 1)));
+                *prev = v;
+            }
+            else if (encoding & CTRVARINTENC)
+            {
+                if ((p = GetVarint(p, end, &v)) == NULL)
+                    return (-1);
+            }
+            else
+            {
+                if (end - p < CTRDUMPWIDTH(Tables[i].type[j]))
+                    return (-1);
+                v = GetLE(p, CTRDUMPWIDTH(Tables[i].type[j]));
+                p += CTRDUMPWIDTH(Tables[i].type[j]);
+            }
+            fprintf(Tables[i].fd, ",%llu", (unsigned long long)v);
+        }
+        fputc('\n', Tables[i].fd);
+    }
+
+    return (0);
+}
+
+
+/* Parses a sparse block and appends a row for each key (then the overflow cell, if any) */
+static int ParseSparse(const uint8_t *p, const uint8_t *end, uint16_t encoding)
+{
+    char        ts[64];
+    CtrTable   *t;
+    uint64_t    key, v;
+    uint16_t    id, flags;
+    int         len, width;
+
+    if ((Tables == NULL) || (end - p < 20))
+        return (-1);
+
+    len = FormatStamp(p, ts, sizeof(ts));
+    id = GetLE(p + 16, 2);
+    flags = GetLE(p + 18, 2);
+    p += 20;
+    if ((SparseBase + id >= numTables) || ((t = &Tables[SparseBase + id])->fd == NULL))
+        return (-1);
+    width = CTRDUMPWIDTH(t->type[0]);
+
+    /* Pairs of key and value, the overflow value (if any) being the last one alone */
+    while (p < end)
+    {
+        if (encoding & (CTRVARINTENC | CTRDELTAENC))
+        {
+            if ((p = GetVarint(p, end, &key)) == NULL)
+                return (-1);
+            if ((p == end) && (flags & CTRSPARSEOVFL))
+            {
+                fprintf(t->fd, "%.*s,overflow,%llu\n", len, ts, (unsigned long long)key);
+                break;
+            }
+            if ((p = GetVarint(p, end, &v)) == NULL)
+                return (-1);
+        }
+        else
+        {
+            if ((end - p == width) && (flags & CTRSPARSEOVFL))
+            {
+                fprintf(t->fd, "%.*s,overflow,%llu\n", len, ts, (unsigned long long)GetLE(p, width));
+                break;
+            }
+            if (end - p < 8 + width)
+                return (-1);
+            key = GetLE(p, 8);
+            v = GetLE(p + 8, width);
+            p += 8 + width;
+        }
+        fprintf(t->fd, "%.*s,%llu,%llu\n", len, ts, (unsigned long long)key, (unsigned long long)v);
+    }
+
+    return (0);
+}
+
+
+/* Parses a top-K block and appends a row for each key (string or integer), with its count and error */
+static int ParseTopk(const uint8_t *p, const uint8_t *end, uint16_t encoding)
+{
+    char        ts[64], key[256];
+    CtrTable   *t;
+    uint64_t    k = 0, v[2];
+    uint16_t    id, num;
+    int         i, j, len;
+
+    if ((Tables == NULL) || (end - p < 20))
+        return (-1);
+
+    len = FormatStamp(p, ts, sizeof(ts));
+    id = GetLE(p + 16, 2);
+    num = GetLE(p + 18, 2);
+    p += 20;
+    if ((TopkBase + id >= numTables) || ((t = &Tables[TopkBase + id])->fd == NULL) || !t->topk)
+        return (-1);
+
+    for (i = 0; i < num; i++)
+    {
+        if (t->type[0] == CTRTOPKSTRKEY)
+        {
+            if ((p = GetString(p, end, key)) == NULL)
+                return (-1);
+        }
+        else if (encoding & (CTRVARINTENC | CTRDELTAENC))
+        {
+            if ((p = GetVarint(p, end, &k)) == NULL)
+                return (-1);
+        }
+        else
+        {
+            if (end - p < 8)
+                return (-1);
+            k = GetLE(p, 8);
+            p += 8;
+        }
+        for (j = 0; j < 2; j++)
+        {
+            if (encoding & (CTRVARINTENC | CTRDELTAENC))
+            {
+                if ((p = GetVarint(p, end, &v[j])) == NULL)
+                    return (-1);
+            }
+            else
+            {
+                if (end - p < 8)
+                    return (-1);
+                v[j] = GetLE(p, 8);
+                p += 8;
+            }
+        }
+        if (t->type[0] == CTRTOPKSTRKEY)
+            fprintf(t->fd, "%.*s,%s,%llu,%llu\n", len, ts, key, (unsigned long long)v[0], (unsigned long long)v[1]);
+        else
+            fprintf(t->fd, "%.*s,%llu,%llu,%llu\n", len, ts, (unsigned long long)k, (unsigned long long)v[0],
+                    (unsigned long long)v[1]);
+    }
+
+    return (0);
+}
+
+
+/* Parses a rate block and appends a row to the rates file (doubles, never encoded) */
+static int ParseRates(const uint8_t *p, const uint8_t *end)
+{
+    char        ts[64];
+    CtrTable   *t;
+    uint64_t    bits;
+    double      v;
+    int         j, len;
+
+    if ((Tables == NULL) || (RateTable < 0) || (end - p < 16))
+        return (-1);
+    t = &Tables[RateTable];
+    if (end - p < 16 + 8 * (long)t->numValues)
+        return (-1);
+
+    len = FormatStamp(p, ts, sizeof(ts));
+    p += 16;
+    fwrite(ts, 1, len, t->fd);
+    for (j = 0; j < t->numValues; j++, p += 8)
+    {
+        bits = GetLE(p, 8);
+        memcpy(&v, &bits, sizeof(v));
+        fprintf(t->fd, ",%.3f", v);
+    }
+    fputc('\n', t->fd);
+
+    return (0);
+}
+
+
+/* Parses a distinct block and appends a row to the distinct counters file */
+static int ParseDistinct(const uint8_t *p, const uint8_t *end, uint16_t encoding)
+{
+    char        ts[64];
+    CtrTable   *t;
+    uint64_t    v;
+    int         j, len;
+
+    if ((Tables == NULL) || (DistinctTable < 0) || (end - p < 16))
+        return (-1);
+    t = &Tables[DistinctTable];
+
+    len = FormatStamp(p, ts, sizeof(ts));
+    p += 16;
+    fwrite(ts, 1, len, t->fd);
+    for (j = 0; j < t->numValues; j++)
+    {
+        if (encoding & (CTRVARINTENC | CTRDELTAENC))
+        {
+            if ((p = GetVarint(p, end, &v)) == NULL)
+                return (-1);
+        }
+        else
+        {
+            if (end - p < 8)
+                return (-1);
+            v = GetLE(p, 8);
+            p += 8;
+        }
+        fprintf(t->fd, ",%llu", (unsigned long long)v);
+    }
+    fputc('\n', t->fd);
+
+    return (0);
+}
+
+
+/* Parses a histogram or summary block and appends a row to the file of each counter of tables [first, last) */
+static int ParseStats(const uint8_t *p, const uint8_t *end, uint16_t encoding, int first, int last)
+{
+    char        ts[64];
+    uint64_t    v[MAXHISTOVALUES];
+    int         i, j, len;
+
+    if ((Tables == NULL) || (end - p < 16))
+        return (-1);
+
+    len = FormatStamp(p, ts, sizeof(ts));
+    p += 16;
+
+    /* Values of all defined counters, in ID order */
+    for (i = first; i < last; i++)
+    {
+        if (Tables[i].fd == NULL)
+            continue;
+        for (j = 0; j < Tables[i].numValues; j++)
+        {
+            if (encoding & (CTRVARINTENC | CTRDELTAENC))
+            {
+                if ((p = GetVarint(p, end, &v[j])) == NULL)
+                    return (-1);
+            }
+            else
+            {
+                if (end - p < 8)
+                    return (-1);
+                v[j] = GetLE(p, 8);
+                p += 8;
+            }
+        }
+        /* Min, max and percentiles are empty if no value has been recorded or observed */
+        fprintf(Tables[i].fd, "%.*s,%llu,%llu", len, ts, (unsigned long long)v[0], (unsigned long long)v[1]);
+        for (j = 2; j < Tables[i].numValues; j++)
+            if (v[0] != 0)
+                fprintf(Tables[i].fd, ",%llu", (unsigned long long)v[j]);
+            else
+                fputc(',', Tables[i].fd);
+        fputc('\n', Tables[i].fd);
+    }
+
+    return (0);
+}
+
+
+/* Converts a binary dump file */
+static int ConvertFile(const char *path, const char *dir)
+{
+    char            stamp[512];
+    const char     *base, *dot;
+    const uint8_t  *p, *end;
+    uint8_t        *buf;
+    uint32_t        size;
+    long            len;
+    FILE           *fd;
+    int             res = 0;
+
+    /* The stamp (with the aggr_ prefix, if any) is taken from the file name */
+    base = (strrchr(path, '/') != NULL) ? strrchr(path, '/') + 1 : path;
+    dot = strrchr(base, '.');
+    if ((strncmp(base, "counters_", 9) != 0) || (dot == NULL) || (dot <= base + 9) || strcmp(dot, ".bin"))
+    {
+        fprintf(stderr, "mixf-ctrdump: %s is not named counters_<stamp>.bin\n", path);
+        return (-1);
+    }
+    snprintf(stamp, sizeof(stamp), "%.*s", (int)(dot - base - 9), base + 9);
+
+    if ((fd = fopen(path, "rb")) == NULL)
+    {
+        fprintf(stderr, "mixf-ctrdump: cannot open %s\n", path);
+        return (-1);
+    }
+    fseek(fd, 0, SEEK_END);
+    len = ftell(fd);
+    rewind(fd);
+    if ((buf = (uint8_t *)malloc(len + 1)) == NULL || (fread(buf, 1, len, fd) != (size_t)len))
+    {
+        fprintf(stderr, "mixf-ctrdump: cannot read %s\n", path);
+        fclose(fd);
+        free(buf);
+        return (-1);
+    }
+    fclose(fd);
+
+    /* Each block: size (4 bytes, header included), type (2 bytes), encoding (2 bytes) */
+    for (p = buf, end = buf + len; (p < end) && (res == 0); p += size)
+    {
+        if ((end - p < 8) || ((size = GetLE(p, 4)) < 8) || (size > end - p))
+        {
+            res = -1;
+            break;
+        }
+        switch (GetLE(p + 4, 2))
+        {
+            case CTRBLKSCHEMA:
+                res = ParseSchema(p + 8, p + size, dir, stamp);
+                break;
+            case CTRBLKROW:
+            case CTRBLKGAP:
+                res = ParseRow(p + 8, p + size, GetLE(p + 4, 2), GetLE(p + 6, 2));
+                break;
+            case CTRBLKSPARSE:
+                res = ParseSparse(p + 8, p + size, GetLE(p + 6, 2));
+                break;
+            case CTRBLKHISTO:
+                res = ParseStats(p + 8, p + size, GetLE(p + 6, 2), HistoBase, SummaryBase);
+                break;
+            case CTRBLKSUMMARY:
+                res = ParseStats(p + 8, p + size, GetLE(p + 6, 2), SummaryBase, (RateTable < 0) ? TopkBase : RateTable);
+                break;
+            case CTRBLKRATE:
+                res = ParseRates(p + 8, p + size);
+                break;
+            case CTRBLKTOPK:
+                res = ParseTopk(p + 8, p + size, GetLE(p + 6, 2));
+                break;
+            case CTRBLKDISTINCT:
+                res = ParseDistinct(p + 8, p + size, GetLE(p + 6, 2));
+                break;
+            default:        /* Unknown blocks are skipped */
+                break;
+        }
+    }
+    if (res != 0)
+        fprintf(stderr, "mixf-ctrdump: %s is corrupted or truncated at offset %ld\n", path, (long)(p - buf));
+
+    ReleaseSchema();
+    free(buf);
+
+    return (res);
+}
+
+
+/* Main function */
+int main (int argc, char *argv[])
+{
+    const char *dir = ".";
+    int         opt, res = 0;
+
+    while ((opt = getopt(argc, argv, "d:h")) != -1)
+    {
+        if (opt == 'd')
+            dir = optarg;
+        else
+        {
+            fprintf(stderr, "Usage: %s [-d outdir] file.bin [file.bin ...]\n", argv[0]);
+            return (opt == 'h' ? 0 : 1);
+        }
+    }
+    if (optind >= argc)
+    {
+        fprintf(stderr, "Usage: %s [-d outdir] file.bin [file.bin ...]\n", argv[0]);
+        return (1);
+    }
+
+    for (; optind < argc; optind++)
+        if (ConvertFile(argv[optind], dir) != 0)
+            res = 1;
+
+    return (res);
+}